@@ -1,6 +1,64 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
 class Asset {
 public:
+	inline Asset() : mLastUsedFrame(0), mReferences(0), mRevision(0) {}
 	virtual ~Asset() {}
+
+	/// Records that the asset was drawn with in a frame. AssetManager evicts the assets that were used the longest ago first, and reloads evicted assets once they are used.
+	/// Materials, MeshRenderers and texture descriptor writes mark their assets used. Called from render and loader threads.
+	inline void MarkUsed(uint64_t frame) { mLastUsedFrame = frame; }
+	inline uint64_t LastUsedFrame() const { return mLastUsedFrame; }
+	/// Number of AssetHandles to the asset. Assets with handles are never evicted.
+	inline uint32_t ReferenceCount() const { return mReferences; }
+	/// Incremented by AssetManager when the asset's contents are swapped for reloaded or placeholder contents. Objects that cache data
+	/// derived from one asset (i.e. MeshRenderer's bounds) compare it to the value they cached it at, instead of refreshing on every reload.
+	inline uint64_t Revision() const { return mRevision; }
+
+protected:
+	friend class AssetManager;
+	template<class T> friend class AssetHandle;
+
+	/// Exchanges contents with an asset of the same type that was loaded from the same source, so that pointers to this asset see the reloaded contents.
+	/// Called by AssetManager between frames. The other asset is destroyed once the GPU is done with the frames that used it. Returns false if the asset can't be reloaded.
+	inline virtual bool Swap(Asset* other) { return false; }
+	/// Replaces the asset's contents with placeholder contents that are safe to draw with until AssetManager reloads it, and returns the old contents.
+	/// AssetManager destroys them once the frames in flight are done with them. Returns nullptr if the asset can't be evicted.
+	inline virtual Asset* Evict() { return nullptr; }
+	/// Bytes of device memory the asset holds
+	inline virtual uint64_t ResidentSize() const { return 0; }
+	/// Bytes of device memory that destroying the asset gives back to the heaps, which is less than ResidentSize() for contents that share pooled memory
+	inline virtual uint64_t HeapSize() const { return ResidentSize(); }
+
+private:
+	std::atomic<uint64_t> mLastUsedFrame;
+	std::atomic<uint32_t> mReferences;
+	std::atomic<uint64_t> mRevision;
+};
+
+/// Reference counted pointer to an Asset, which keeps AssetManager from evicting the asset while any handle to it exists.
+/// Hold one to keep using an asset that isn't drawn every frame (i.e. meshes that are only read by compute or copied into other buffers).
+template<class T>
+class AssetHandle {
+public:
+	inline AssetHandle() : mAsset(nullptr) {}
+	inline AssetHandle(T* asset) : mAsset(asset) { if (mAsset) mAsset->mReferences++; }
+	inline AssetHandle(const AssetHandle& h) : mAsset(h.mAsset) { if (mAsset) mAsset->mReferences++; }
+	inline AssetHandle(AssetHandle&& h) : mAsset(h.mAsset) { h.mAsset = nullptr; }
+	inline ~AssetHandle() { if (mAsset) mAsset->mReferences--; }
+
+	inline AssetHandle& operator=(AssetHandle h) { std::swap(mAsset, h.mAsset); return *this; }
+
+	inline T* get() const { return mAsset; }
+	inline T* operator->() const { return mAsset; }
+	inline T& operator*() const { return *mAsset; }
+	inline operator T*() const { return mAsset; }
+	inline explicit operator bool() const { return mAsset; }
+
+private:
+	T* mAsset;
 };
\ No newline at end of file
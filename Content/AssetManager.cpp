@@ -3,47 +3,336 @@
 #include <Content/Mesh.hpp>
 #include <Content/Texture.hpp>
 #include <Content/Shader.hpp>
+#include <Core/Instance.hpp>
+#include <Util/Profiler.hpp>
+
+#ifndef WINDOWS
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
-AssetManager::AssetManager(Device* device) : mDevice(device) {}
+AssetManager::AssetManager(Device* device) : mDevice(device) {
+	uint32_t white = 0xFFFFFFFF;
+	mWhiteTexture = new Texture("White", mDevice, &white, sizeof(uint32_t), 1, 1, 1, VK_FORMAT_R8G8B8A8_UNORM, 1);
+	mCubeMesh = Mesh::CreateCube("Cube", mDevice, .5f);
+	mMemoryBudget = 0;
+	mEvictionFrames = ASSET_EVICTION_FRAMES;
+	mTextureStreamBytesPerFrame = TEXTURE_STREAM_BYTES_PER_FRAME;
+
+	#ifndef WINDOWS
+	mWatchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (mWatchFd < 0) printf_color(COLOR_YELLOW, "Failed to initialize inotify, assets won't be reloaded when they change\n");
+	#endif
+}
 AssetManager::~AssetManager() {
+	// loads reference this AssetManager, so they must finish first
+	vector<shared_future<Asset*>> loading;
+	mMutex.lock();
+	for (auto& l : mLoading)
+		loading.push_back(l.second);
+	mMutex.unlock();
+	for (auto& l : loading)
+		l.wait();
+
+	for (auto& r : mReloading) {
+		try {
+			delete r.second.get();
+		} catch (...) {}
+	}
+	for (auto& r : mRetired)
+		delete r.first;
+	#ifndef WINDOWS
+	if (mWatchFd >= 0) close(mWatchFd);
+	#endif
+
 	for (auto& asset : mAssets)
 		delete asset.second;
+	safe_delete(mWhiteTexture);
+	safe_delete(mCubeMesh);
 }
 
-Shader* AssetManager::LoadShader(const string& filename) {
+void AssetManager::Track(const string& key, const vector<string>& files, const function<Asset*()>& create) {
+	if (files.empty()) return;
+	AssetSource& source = mSources[key];
+	source.mCreate = create;
+	source.mEvictedFrame = 0;
+
+	#ifndef WINDOWS
+	if (mWatchFd < 0) return;
+	for (const string& file : files) {
+		// editors often replace files instead of writing them, so the directory is watched rather than the file
+		fs::path path = fs::absolute(file);
+		string directory = path.parent_path().string();
+		int wd = inotify_add_watch(mWatchFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (wd < 0) {
+			printf_color(COLOR_YELLOW, "Failed to watch %s\n", directory.c_str());
+			continue;
+		}
+		mWatchDirectories[wd] = directory;
+		mWatchedFiles[path.string()].push_back(key);
+	}
+	#endif
+}
+
+Asset* AssetManager::Load(const string& key, const vector<string>& files, const function<Asset*()>& create) {
+	unique_lock lock(mMutex);
+	auto it = mAssets.find(key);
+	if (it != mAssets.end()) return it->second;
+
+	auto loading = mLoading.find(key);
+	if (loading != mLoading.end()) {
+		// another thread is loading the asset
+		shared_future<Asset*> future = loading->second;
+		lock.unlock();
+		return future.get();
+	}
+
+	promise<Asset*> result;
+	mLoading.emplace(key, result.get_future().share());
+	lock.unlock();
+
+	Asset* asset;
+	try {
+		asset = create();
+	} catch (...) {
+		// threads waiting on the load get the exception, and the next Load tries again
+		result.set_exception(current_exception());
+		lock.lock();
+		mLoading.erase(key);
+		throw;
+	}
+
+	lock.lock();
+	mAssets.emplace(key, asset);
+	mLoading.erase(key);
+	Track(key, files, create);
+	lock.unlock();
+
+	result.set_value(asset);
+	return asset;
+}
+shared_future<Asset*> AssetManager::LoadAsync(const string& key, const vector<string>& files, function<Asset*()>&& create) {
+	lock_guard lock(mMutex);
+	auto it = mAssets.find(key);
+	if (it != mAssets.end()) {
+		promise<Asset*> result;
+		result.set_value(it->second);
+		return result.get_future().share();
+	}
+
+	auto loading = mLoading.find(key);
+	if (loading != mLoading.end()) return loading->second;
+
+	// mMutex is held until the load is in mLoading, so the job can't finish before then
+	shared_future<Asset*> future = mDevice->Instance()->ThreadPool()->Enqueue([this, key, files, create]() {
+		Asset* asset;
+		try {
+			asset = create();
+		} catch (...) {
+			// the future holds the exception, and the next load tries again
+			lock_guard lock(mMutex);
+			mLoading.erase(key);
+			throw;
+		}
+		lock_guard lock(mMutex);
+		mAssets.emplace(key, asset);
+		mLoading.erase(key);
+		Track(key, files, create);
+		return asset;
+	}).share();
+	mLoading.emplace(key, future);
+	return future;
+}
+
+uint32_t AssetManager::LoadingCount() {
+	lock_guard lock(mMutex);
+	return (uint32_t)mLoading.size();
+}
+
+void AssetManager::Update() {
+	uint64_t frame = mDevice->Instance()->FrameCount();
+	unordered_set<string> changed;
+	unordered_set<string> used;
+
 	mMutex.lock();
-	Asset*& asset = mAssets[filename];
-	if (!asset) asset = new Shader(filename, mDevice, filename);
+	#ifndef WINDOWS
+	if (mWatchFd >= 0) {
+		alignas(inotify_event) char buffer[4096];
+		ssize_t size;
+		while ((size = read(mWatchFd, buffer, sizeof(buffer))) > 0)
+			for (char* p = buffer; p < buffer + size; p += sizeof(inotify_event) + ((inotify_event*)p)->len) {
+				const inotify_event* e = (const inotify_event*)p;
+				if (!e->len) continue;
+				auto directory = mWatchDirectories.find(e->wd);
+				if (directory == mWatchDirectories.end()) continue;
+				auto keys = mWatchedFiles.find((fs::path(directory->second) / e->name).string());
+				if (keys != mWatchedFiles.end())
+					changed.insert(keys->second.begin(), keys->second.end());
+			}
+	}
+	#endif
+	// evicted assets are reloaded once they are used again, or something takes a handle to them
+	for (auto& s : mSources) {
+		if (!s.second.mEvictedFrame || mReloading.count(s.first)) continue;
+		Asset* asset = mAssets.at(s.first);
+		if (asset->LastUsedFrame() > s.second.mEvictedFrame || asset->ReferenceCount())
+			used.insert(s.first);
+	}
 	mMutex.unlock();
-	return (Shader*)asset;
-}
-Texture* AssetManager::LoadTexture(const string& filename, bool srgb) {
+
+	// assets are reloaded from scratch, the same way they were loaded. Assets that were cooked load from the cooked file.
+	auto StartReload = [&](const string& key) {
+		mMutex.lock();
+		function<Asset*()> create = mSources.at(key).mCreate;
+		mMutex.unlock();
+		mReloading.emplace(key, mDevice->Instance()->ThreadPool()->Enqueue(move(create)));
+	};
+	for (const string& key : changed) {
+		if (mReloading.count(key)) {
+			mReloadAgain.insert(key);
+			continue;
+		}
+		printf_color(COLOR_CYAN, "Reloading %s\n", key.c_str());
+		StartReload(key);
+	}
+	for (const string& key : used)
+		if (!mReloading.count(key)) StartReload(key);
+
+	// swap in finished reloads. The old contents are destroyed once the frames that could be using them are done.
+	bool shaderSwapped = false;
+	for (auto it = mReloading.begin(); it != mReloading.end();) {
+		if (it->second.wait_for(chrono::seconds(0)) != future_status::ready) {
+			it++;
+			continue;
+		}
+		string key = it->first;
+		Asset* reloaded = nullptr;
+		try {
+			reloaded = it->second.get();
+		} catch (...) {}
+		it = mReloading.erase(it);
+
+		lock_guard lock(mMutex);
+		AssetSource& source = mSources.at(key);
+		if (!reloaded) {
+			fprintf_color(COLOR_RED, stderr, "Failed to reload %s\n", key.c_str());
+			// don't retry an evicted asset until its file changes
+			if (source.mEvictedFrame) source.mEvictedFrame = ~0ull;
+			continue;
+		}
+		Asset* asset = mAssets.at(key);
+		if (asset->Swap(reloaded)) {
+			if (!source.mEvictedFrame) printf_color(COLOR_GREEN, "Reloaded %s\n", key.c_str());
+			source.mEvictedFrame = 0;
+			asset->mRevision++;
+			if (dynamic_cast<Shader*>(asset)) shaderSwapped = true;
+		} else
+			printf_color(COLOR_YELLOW, "%s can't be reloaded\n", key.c_str());
+		mRetired.push_back(make_pair(reloaded, frame));
+	}
+	for (auto it = mReloadAgain.begin(); it != mReloadAgain.end();) {
+		if (mReloading.count(*it))
+			it++;
+		else {
+			StartReload(*it);
+			it = mReloadAgain.erase(it);
+		}
+	}
+
+	Evict(frame);
+	if (shaderSwapped) mDevice->ShadersReloaded();
+
+	// textures replace their own views as levels arrive, materials notice through Texture::ViewRevision()
 	mMutex.lock();
-	Asset*& asset = mAssets[filename];
-	if (!asset) asset = new Texture(filename, mDevice, filename, srgb);
+	uint64_t streamBudget = mTextureStreamBytesPerFrame;
+	for (auto& a : mAssets)
+		if (Texture* texture = dynamic_cast<Texture*>(a.second))
+			streamBudget -= min(texture->StreamMipLevels(streamBudget), streamBudget);
 	mMutex.unlock();
-	return (Texture*)asset;
+
+	while (mRetired.size() && mRetired.front().second + mDevice->MaxFramesInFlight() < frame) {
+		delete mRetired.front().first;
+		mRetired.pop_front();
+	}
+	// meshes return their ranges when they are destroyed, and emptied blocks are only released by Recycle
+	if (mDevice->MeshPool()) mDevice->MeshPool()->Recycle();
+}
+bool AssetManager::Evict(uint64_t frame) {
+	lock_guard lock(mMutex);
+
+	// bytes over the budget, from the assets' own sizes when there is an explicit budget, otherwise from the device local heaps
+	uint64_t resident = 0;
+	vector<pair<Asset*, AssetSource*>> candidates;
+	for (auto& s : mSources) {
+		Asset* asset = mAssets.at(s.first);
+		if (s.second.mEvictedFrame) continue;
+		uint64_t size = asset->ResidentSize();
+		resident += size;
+		// assets can only be evicted once no frame in flight uses them, and nothing holds a handle to them
+		if (size && !asset->ReferenceCount() && asset->LastUsedFrame() + max<uint64_t>(mEvictionFrames, mDevice->MaxFramesInFlight()) < frame)
+			candidates.push_back(make_pair(asset, &s.second));
+	}
+	uint64_t excess = 0;
+	if (mMemoryBudget)
+		excess = resident > mMemoryBudget ? resident - mMemoryBudget : 0;
+	else {
+		for (uint32_t i = 0; i < mDevice->MemoryHeapCount(); i++) {
+			const DeviceMemoryBudget& budget = mDevice->MemoryBudget(i);
+			if (budget.mUsage > budget.mBudget) excess = max(excess, budget.mUsage - budget.mBudget);
+		}
+		// memory that retired contents and the MeshPool will release is still in the heaps for a few frames
+		uint64_t pending = mDevice->MeshPool() ? mDevice->MeshPool()->PendingReleaseSize() : 0;
+		for (auto& r : mRetired)
+			pending += r.first->HeapSize();
+		excess -= min(excess, pending);
+	}
+	if (!excess || candidates.empty()) return false;
+
+	sort(candidates.begin(), candidates.end(), [](const pair<Asset*, AssetSource*>& a, const pair<Asset*, AssetSource*>& b) {
+		return a.first->LastUsedFrame() < b.first->LastUsedFrame();
+	});
+	// the heaps only shrink by what the old contents actually release, pooled meshes release nothing while their block is shared
+	auto Size = [&](Asset* a) { return mMemoryBudget ? a->ResidentSize() : a->HeapSize(); };
+	bool evicted = false;
+	for (uint32_t i = 0; i < candidates.size() && excess; i++) {
+		uint64_t size = Size(candidates[i].first);
+		if (!size) continue;
+		Asset* contents = candidates[i].first->Evict();
+		if (!contents) continue;
+		candidates[i].first->mRevision++;
+		// descriptors written before the eviction may still be in use by the frames in flight
+		mRetired.push_back(make_pair(contents, frame));
+		candidates[i].second->mEvictedFrame = frame;
+		excess -= min(excess, size - min(size, Size(candidates[i].first)));
+		evicted = true;
+	}
+	return evicted;
+}
+
+Shader* AssetManager::LoadShader(const string& filename) {
+	return (Shader*)Load(filename, { filename }, [=]() { return new Shader(filename, mDevice, filename); });
+}
+Texture* AssetManager::LoadTexture(const string& filename, bool srgb) {
+	return (Texture*)Load(filename, { filename }, [=]() { return new Texture(filename, mDevice, filename, srgb); });
 }
 Texture* AssetManager::LoadCubemap(const string& posx, const string& negx, const string& posy, const string& negy, const string& posz, const string& negz, bool srgb) {
-	mMutex.lock();
-	Asset*& asset = mAssets[negx + posx + negy + posy + negz + posz];
-	if (!asset) asset = new Texture(negx + " Cube", mDevice, posx, negx, posy, negy, posz, negz, srgb);
-	mMutex.unlock();
-	return (Texture*)asset;
+	return (Texture*)Load(negx + posx + negy + posy + negz + posz, { posx, negx, posy, negy, posz, negz }, [=]() { return new Texture(negx + " Cube", mDevice, posx, negx, posy, negy, posz, negz, srgb); });
 }
-Mesh* AssetManager::LoadMesh(const string& filename, float scale) {
-	mMutex.lock();
-	Asset*& asset = mAssets[filename];
-	if (!asset) asset = new Mesh(filename, mDevice, filename, scale);
-	mMutex.unlock();
-	return (Mesh*)asset;
+Mesh* AssetManager::LoadMesh(const string& filename, float scale, bool quantize) {
+	return (Mesh*)Load(quantize ? filename + " Quantized" : filename, { filename }, [=]() { return new Mesh(filename, mDevice, filename, scale, quantize); });
 }
 Font* AssetManager::LoadFont(const string& filename, uint32_t pixelHeight) {
-	mMutex.lock();
-	Asset*& asset = mAssets[filename + to_string(pixelHeight)];
-	if (!asset) asset = new Font(filename, mDevice, filename, (float)pixelHeight, 1.f / pixelHeight);
-	mMutex.unlock();
-	return (Font*)asset;
+	return (Font*)Load(filename + to_string(pixelHeight), {}, [=]() { return new Font(filename, mDevice, filename, (float)pixelHeight, 1.f / pixelHeight); });
+}
+
+AssetFuture<Shader> AssetManager::LoadShaderAsync(const string& filename) {
+	return AssetFuture<Shader>(LoadAsync(filename, { filename }, [=]() { return new Shader(filename, mDevice, filename); }), nullptr);
+}
+AssetFuture<Texture> AssetManager::LoadTextureAsync(const string& filename, bool srgb) {
+	return AssetFuture<Texture>(LoadAsync(filename, { filename }, [=]() { return new Texture(filename, mDevice, filename, srgb); }), mWhiteTexture);
+}
+AssetFuture<Mesh> AssetManager::LoadMeshAsync(const string& filename, float scale, bool quantize) {
+	return AssetFuture<Mesh>(LoadAsync(quantize ? filename + " Quantized" : filename, { filename }, [=]() { return new Mesh(filename, mDevice, filename, scale, quantize); }), mCubeMesh);
 }
\ No newline at end of file
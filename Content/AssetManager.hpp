@@ -1,5 +1,10 @@
 #pragma once
 
+#include <functional>
+#include <deque>
+#include <future>
+#include <unordered_set>
+
 #include <Core/Device.hpp>
 #include <Util/Util.hpp>
 #include <Content/Asset.hpp>
@@ -9,7 +14,31 @@ class Mesh;
 class Shader;
 class Texture;
 class Instance;
+class ThreadPool;
+
+/// Reference to an asset that may still be loading on the Instance's ThreadPool
+template<class T>
+class AssetFuture {
+public:
+	inline AssetFuture() : mPlaceholder(nullptr) {}
+	inline AssetFuture(const std::shared_future<Asset*>& future, T* placeholder) : mFuture(future), mPlaceholder(placeholder) {}
+
+	inline bool Ready() const { return mFuture.valid() && mFuture.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+	/// Blocks until the asset is loaded
+	inline T* Get() const { return (T*)mFuture.get(); }
+	/// Returns the asset if it is loaded, otherwise the placeholder
+	inline T* Current() const { return Ready() ? Get() : mPlaceholder; }
+
+private:
+	std::shared_future<Asset*> mFuture;
+	T* mPlaceholder;
+};
+
+#define ASSET_EVICTION_FRAMES 600
+#define TEXTURE_STREAM_BYTES_PER_FRAME (16 * 1024 * 1024)
 
+/// Loads assets once and keeps them resident, evicting the least recently used textures and meshes when they exceed the memory budget.
+/// Evicted assets keep their pointers with placeholder contents, and are reloaded from their cooked files once they are used again.
 class AssetManager {
 public:
 	ENGINE_EXPORT ~AssetManager();
@@ -17,14 +46,85 @@ public:
 	ENGINE_EXPORT Shader*	LoadShader	(const std::string& filename);
 	ENGINE_EXPORT Texture*	LoadTexture	(const std::string& filename, bool srgb = true);
 	ENGINE_EXPORT Texture*  LoadCubemap (const std::string& posx, const std::string& negx, const std::string& posy, const std::string& negy, const std::string& posz, const std::string& negz, bool srgb = true);
-	ENGINE_EXPORT Mesh*		LoadMesh	(const std::string& filename, float scale = 1.f);
+	/// Loads a mesh, quantize stores static meshes as QuantizedVertex (see Mesh::Cook)
+	ENGINE_EXPORT Mesh*		LoadMesh	(const std::string& filename, float scale = 1.f, bool quantize = false);
 	ENGINE_EXPORT Font*		LoadFont	(const std::string& filename, uint32_t pixelHeight);
 
+	/// Loads an asset on the Instance's ThreadPool and returns immediately. Requests for an asset that is already loading share the same load.
+	ENGINE_EXPORT AssetFuture<Shader>	LoadShaderAsync	(const std::string& filename);
+	/// Loads an asset on the Instance's ThreadPool and returns immediately. WhiteTexture() is used until it finishes.
+	ENGINE_EXPORT AssetFuture<Texture>	LoadTextureAsync(const std::string& filename, bool srgb = true);
+	/// Loads an asset on the Instance's ThreadPool and returns immediately. CubeMesh() is used until it finishes.
+	ENGINE_EXPORT AssetFuture<Mesh>		LoadMeshAsync	(const std::string& filename, float scale = 1.f, bool quantize = false);
+
+	/// 1x1 white texture, the placeholder for textures that are still loading
+	inline Texture* WhiteTexture() const { return mWhiteTexture; }
+	/// Unit cube, the placeholder for meshes that are still loading
+	inline Mesh* CubeMesh() const { return mCubeMesh; }
+
+	/// Number of assets that are currently loading
+	ENGINE_EXPORT uint32_t LoadingCount();
+
+	/// Re-imports assets whose source files changed and evicted assets that were used again on the Instance's ThreadPool, and swaps finished reloads into
+	/// the existing assets so pointers to them stay valid. Then evicts textures and meshes if they are over budget, and streams in the mip levels
+	/// that textures were requested at (see Texture::RequestMipLevel). Called once per frame between frames.
+	/// Files are only watched on Linux, with inotify.
+	ENGINE_EXPORT void Update();
+
+	/// Bytes of device memory that loaded textures and meshes can use before the least recently used ones are evicted.
+	/// 0 evicts assets when the device local heaps are over the Device's MemoryBudget instead.
+	inline void MemoryBudget(uint64_t b) { mMemoryBudget = b; }
+	inline uint64_t MemoryBudget() const { return mMemoryBudget; }
+	/// Number of frames an asset has to go unused before it can be evicted
+	inline void EvictionFrames(uint32_t f) { mEvictionFrames = f; }
+	inline uint32_t EvictionFrames() const { return mEvictionFrames; }
+	/// Bytes of texture mip levels that are streamed in per frame
+	inline void TextureStreamBytesPerFrame(uint64_t b) { mTextureStreamBytesPerFrame = b; }
+	inline uint64_t TextureStreamBytesPerFrame() const { return mTextureStreamBytesPerFrame; }
+
 private:
 	friend class Stratum;
 	ENGINE_EXPORT AssetManager(Device* device);
 
 	Device* mDevice;
+	Texture* mWhiteTexture;
+	Mesh* mCubeMesh;
 	std::unordered_map<std::string, Asset*> mAssets;
+	// assets that are loading, by key
+	std::unordered_map<std::string, std::shared_future<Asset*>> mLoading;
 	std::mutex mMutex;
+
+	struct AssetSource {
+		std::function<Asset*()> mCreate;
+		// frame the asset was evicted in, 0 if it is resident
+		uint64_t mEvictedFrame;
+	};
+	// how to load each asset that was loaded from files again, by key
+	std::unordered_map<std::string, AssetSource> mSources;
+	// keys of the assets loaded from each watched file, by absolute path
+	std::unordered_map<std::string, std::vector<std::string>> mWatchedFiles;
+	// reloads in progress, by key
+	std::unordered_map<std::string, std::future<Asset*>> mReloading;
+	// assets whose files changed again while they were reloading
+	std::unordered_set<std::string> mReloadAgain;
+	// replaced contents of reloaded assets, and the frame they were replaced in
+	std::deque<std::pair<Asset*, uint64_t>> mRetired;
+	uint64_t mMemoryBudget;
+	uint32_t mEvictionFrames;
+	uint64_t mTextureStreamBytesPerFrame;
+	#ifndef WINDOWS
+	int mWatchFd;
+	// watched directory of each inotify watch descriptor
+	std::unordered_map<int, std::string> mWatchDirectories;
+	#endif
+
+	/// Returns the asset with key, creating it on the calling thread if it isn't loaded or loading. mMutex is not held while the asset is created.
+	/// The asset is reloaded when one of files changes.
+	ENGINE_EXPORT Asset* Load(const std::string& key, const std::vector<std::string>& files, const std::function<Asset*()>& create);
+	/// Returns a future of the asset with key, creating it on the ThreadPool if it isn't loaded or loading
+	ENGINE_EXPORT std::shared_future<Asset*> LoadAsync(const std::string& key, const std::vector<std::string>& files, std::function<Asset*()>&& create);
+	/// Remembers how to load the asset with key, and watches files for changes to reload it. Called with mMutex held.
+	ENGINE_EXPORT void Track(const std::string& key, const std::vector<std::string>& files, const std::function<Asset*()>& create);
+	/// Evicts the least recently used assets that are over budget and haven't been used for EvictionFrames(). Returns true if any were evicted.
+	ENGINE_EXPORT bool Evict(uint64_t frame);
 };
\ No newline at end of file
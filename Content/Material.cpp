@@ -1,4 +1,5 @@
 #include <Content/Material.hpp>
+#include <Content/Mesh.hpp>
 #include <Shaders/include/shadercompat.h>
 #include <Scene/Camera.hpp>
 #include <Scene/Scene.hpp>
@@ -8,10 +9,18 @@
 using namespace std;
 
 Material::Material(const string& name, ::Shader* shader)
-	: mName(name), mShader(shader), mDevice(shader->Device()), mCullMode(VK_CULL_MODE_FLAG_BITS_MAX_ENUM), mBlendMode(BLEND_MODE_MAX_ENUM), mRenderQueue(~0), mPassMask(PASS_MASK_MAX_ENUM) {}
+	: mName(name), mShader(shader), mDevice(shader->Device()), mCullMode(VK_CULL_MODE_FLAG_BITS_MAX_ENUM), mBlendMode(BLEND_MODE_MAX_ENUM), mRenderQueue(~0), mPassMask(PASS_MASK_MAX_ENUM), mBindless(false), mBindlessDirty(true), mShaderReloadCount(mDevice->ShaderReloadCount()), mTexturesUsedFrame(~0ull), mTextureViewRevision(0) {
+	// materials whose shaders support it are bindless by default, so renderers that only differ in textures batch together
+	Bindless(true);
+}
 Material::Material(const string& name, shared_ptr<::Shader> shader)
-	: mName(name), mShader(shader), mDevice(shader->Device()), mCullMode(VK_CULL_MODE_FLAG_BITS_MAX_ENUM), mBlendMode(BLEND_MODE_MAX_ENUM), mRenderQueue(~0), mPassMask(PASS_MASK_MAX_ENUM) {}
+	: mName(name), mShader(shader), mDevice(shader->Device()), mCullMode(VK_CULL_MODE_FLAG_BITS_MAX_ENUM), mBlendMode(BLEND_MODE_MAX_ENUM), mRenderQueue(~0), mPassMask(PASS_MASK_MAX_ENUM), mBindless(false), mBindlessDirty(true), mShaderReloadCount(mDevice->ShaderReloadCount()), mTexturesUsedFrame(~0ull), mTextureViewRevision(0) {
+	Bindless(true);
+}
 Material::~Material() {
+	if (mDevice->BindlessTable())
+		for (auto& kp : mBindlessSlots)
+			mDevice->BindlessTable()->FreeMaterial(kp.second);
 	for (auto& kp : mVariantData) {
 		for (uint32_t i = 0; i < mDevice->MaxFramesInFlight(); i++)
 			safe_delete(kp.second->mDescriptorSets[i]);
@@ -27,6 +36,7 @@ void Material::EnableKeyword(const string& kw) {
 	for (auto& d : mVariantData) {
 		memset(d.second->mDirty, true, sizeof(bool) * mDevice->MaxFramesInFlight());
 		d.second->mShaderVariant = nullptr;
+		d.second->mPushConstantsDirty = true;
 	}
 }
 void Material::DisableKeyword(const string& kw) {
@@ -35,6 +45,7 @@ void Material::DisableKeyword(const string& kw) {
 	for (auto& d : mVariantData) {
 		memset(d.second->mDirty, true, sizeof(bool) * mDevice->MaxFramesInFlight());
 		d.second->mShaderVariant = nullptr;
+		d.second->mPushConstantsDirty = true;
 	}
 }
 
@@ -81,15 +92,20 @@ void Material::SetParameter(const string& name, const MaterialParameter& param)
 	MaterialParameter& p = mParameters[name];
 	if (p != param) {
 		p = param;
+		mBindlessDirty = true;
 		if (param.index() < 4) // push constants dont make descriptors dirty
 			for (auto& d : mVariantData)
 				memset(d.second->mDirty, true, sizeof(bool) * mDevice->MaxFramesInFlight());
+		else
+			for (auto& d : mVariantData)
+				d.second->mPushConstantsDirty = true;
 	}
 }
 void Material::SetParameter(const string& name, uint32_t index, shared_ptr<Texture> param) {
 	auto& p = mArrayParameters[name][index];
 	if (p.index() != 0 || get<shared_ptr<Texture>>(p) != param) {
 		p = param;
+		mBindlessDirty = true;
 		for (auto& d : mVariantData)
 			memset(d.second->mDirty, true, sizeof(bool) * mDevice->MaxFramesInFlight());
 	}
@@ -98,14 +114,106 @@ void Material::SetParameter(const string& name, uint32_t index, Texture* param)
 	auto& p = mArrayParameters[name][index];
 	if (p.index() != 1 || get<Texture*>(p) != param) {
 		p = param;
+		mBindlessDirty = true;
 		for (auto& d : mVariantData)
 			memset(d.second->mDirty, true, sizeof(bool) * mDevice->MaxFramesInFlight());
 	}
 }
 
-Material::VariantData* Material::GetData(PassType pass) {
-	if (mVariantData.count(pass) == 0) {
-		GraphicsShader* shader = Shader()->GetGraphics(pass, mShaderKeywords);
+void Material::Bindless(bool b) {
+	BindlessTable* table = mDevice->BindlessTable();
+	if (b == mBindless || !table || !Shader()->HasKeyword("BINDLESS")) return;
+	mBindless = b;
+	if (mBindless) {
+		EnableKeyword("BINDLESS");
+		mBindlessDirty = true;
+	} else {
+		DisableKeyword("BINDLESS");
+		for (auto& kp : mBindlessSlots)
+			table->FreeMaterial(kp.second);
+		mBindlessSlots.clear();
+	}
+}
+MaterialData Material::GetMaterialData(uint32_t textureIndex) {
+	BindlessTable* table = mDevice->BindlessTable();
+
+	MaterialData data = {};
+	data.Color = 1;
+	data.TextureST = float4(1, 1, 0, 0);
+	data.Emission = 0;
+	data.Metallic = 0;
+	data.Roughness = 1;
+	data.BumpStrength = 1;
+
+	auto GetValue = [&](const string& name, auto& value) {
+		auto it = mParameters.find(name);
+		if (it == mParameters.end()) return;
+		if (auto v = get_if<remove_reference_t<decltype(value)>>(&it->second)) value = *v;
+	};
+	GetValue("Color", data.Color);
+	GetValue("TextureST", data.TextureST);
+	GetValue("Emission", data.Emission);
+	GetValue("Metallic", data.Metallic);
+	GetValue("Roughness", data.Roughness);
+	GetValue("BumpStrength", data.BumpStrength);
+
+	auto GetTexture = [&](const string& name) {
+		auto it = mArrayParameters.find(name);
+		if (it == mArrayParameters.end() || !it->second.count(textureIndex)) return (uint32_t)BINDLESS_DEFAULT_TEXTURE;
+		auto& p = it->second.at(textureIndex);
+		return table->TextureIndex(p.index() == 0 ? get<shared_ptr<Texture>>(p).get() : get<Texture*>(p));
+	};
+	data.MainTexture = GetTexture("MainTextures");
+	data.NormalTexture = GetTexture("NormalTextures");
+	data.MaskTexture = GetTexture("MaskTextures");
+	return data;
+}
+uint32_t Material::BindlessIndex(uint32_t textureIndex) {
+	MarkTexturesUsed();
+	BindlessTable* table = mDevice->BindlessTable();
+	if (mBindlessDirty) {
+		for (auto& kp : mBindlessSlots)
+			table->SetMaterial(kp.second, GetMaterialData(kp.first));
+		mBindlessDirty = false;
+	}
+	auto it = mBindlessSlots.find(textureIndex);
+	if (it == mBindlessSlots.end()) {
+		it = mBindlessSlots.emplace(textureIndex, table->AllocateMaterial()).first;
+		table->SetMaterial(it->second, GetMaterialData(textureIndex));
+	}
+	return table->MaterialOffset() + it->second;
+}
+bool Material::CanBatch(Material* other, PassType pass) {
+	if (other == this) return true;
+	return mBindless && other->mBindless &&
+		GetShader(pass) == other->GetShader(pass) &&
+		mCullMode == other->mCullMode && mBlendMode == other->mBlendMode;
+}
+
+Material::VariantData* Material::GetData(PassType pass, const VertexInput* input) {
+	if (mShaderReloadCount != mDevice->ShaderReloadCount()) {
+		// the shader may have been reloaded in place, which destroys the old variants. Reloaded textures are noticed by MarkTexturesUsed
+		mShaderReloadCount = mDevice->ShaderReloadCount();
+		for (auto& d : mVariantData) {
+			memset(d.second->mDirty, true, sizeof(bool) * mDevice->MaxFramesInFlight());
+			d.second->mShaderVariant = nullptr;
+			d.second->mPushConstantsDirty = true;
+		}
+		mBindlessDirty = true;
+	}
+
+	// the vertex format's keyword only applies to this lookup, the material may be shared by meshes of other formats
+	bool quantized = input == &QuantizedVertex::VertexInput && Shader()->HasKeyword("QUANTIZED_VERTEX");
+	auto key = make_pair(pass, quantized);
+	auto keywords = [&]() {
+		if (!quantized) return mShaderKeywords;
+		set<string> k = mShaderKeywords;
+		k.insert("QUANTIZED_VERTEX");
+		return k;
+	};
+
+	if (mVariantData.count(key) == 0) {
+		GraphicsShader* shader = Shader()->GetGraphics(pass, keywords());
 		if (!shader) return nullptr;
 
 		VariantData* data = new VariantData();
@@ -114,19 +222,67 @@ Material::VariantData* Material::GetData(PassType pass) {
 		memset(data->mDescriptorSets, 0, sizeof(DescriptorSet*) * mDevice->MaxFramesInFlight());
 		memset(data->mDirty, true, sizeof(bool) * mDevice->MaxFramesInFlight());
 		data->mShaderVariant  = shader;
-		mVariantData.emplace(pass, data);
+		data->mPushConstantsDirty = true;
+		mVariantData.emplace(key, data);
 		return data;
 	}
 
-	auto& data = mVariantData.at(pass);
-	if (!data->mShaderVariant) data->mShaderVariant = Shader()->GetGraphics(pass, mShaderKeywords);
+	auto& data = mVariantData.at(key);
+	if (!data->mShaderVariant) data->mShaderVariant = Shader()->GetGraphics(pass, keywords());
 	return data;
 }
-GraphicsShader* Material::GetShader(PassType pass) {
-	return GetData(pass)->mShaderVariant;
+void Material::ForEachTexture(const function<void(Texture*)>& f) {
+	for (auto& m : mParameters)
+		if (m.second.index() == 0)
+			f(get<shared_ptr<Texture>>(m.second).get());
+		else if (m.second.index() == 2)
+			f(get<Texture*>(m.second));
+	for (auto& m : mArrayParameters)
+		for (auto& p : m.second)
+			f(p.second.index() == 0 ? get<shared_ptr<Texture>>(p.second).get() : get<Texture*>(p.second));
+}
+void Material::MarkTexturesUsed() {
+	uint64_t frame = mDevice->Instance()->FrameCount();
+	if (mTexturesUsedFrame == frame) return;
+	mTexturesUsedFrame = frame;
+	uint64_t revision = 0;
+	ForEachTexture([&](Texture* t) {
+		if (!t) return;
+		t->MarkUsed(frame);
+		revision += t->ViewRevision();
+	});
+	// streaming textures replace their views as more mip levels are uploaded
+	if (revision != mTextureViewRevision) {
+		mTextureViewRevision = revision;
+		for (auto& d : mVariantData)
+			memset(d.second->mDirty, true, sizeof(bool) * mDevice->MaxFramesInFlight());
+		mBindlessDirty = true;
+	}
+}
+void Material::RequestMipLevels(float uvPerPixel) {
+	if (!(uvPerPixel > 0)) return;
+	float scale = 1;
+	auto it = mParameters.find("TextureST");
+	if (it != mParameters.end())
+		if (auto st = get_if<float4>(&it->second)) scale = max(fabsf(st->x), fabsf(st->y));
+	ForEachTexture([&](Texture* t) {
+		if (t) t->RequestMipLevel(log2f(uvPerPixel * scale * max(t->Width(), t->Height())));
+	});
+}
+GraphicsShader* Material::GetShader(PassType pass, const VertexInput* input) {
+	VariantData* data = GetData(pass, input);
+	return data ? data->mShaderVariant : nullptr;
+}
+void Material::PrewarmPipeline(PassType pass, RenderPass* renderPass, const VertexInput* input, VkPrimitiveTopology topology, VkCullModeFlags cullMode) {
+	GraphicsShader* shader = GetShader(pass, input);
+	if (!shader) return;
+	// resolve states the same way CommandBuffer::BindMaterial does
+	if (cullMode == VK_CULL_MODE_FLAG_BITS_MAX_ENUM) cullMode = mCullMode;
+	shader->PrewarmPipeline(renderPass, input, topology, cullMode, mBlendMode);
 }
 
 void Material::SetDescriptorParameters(CommandBuffer* commandBuffer, Camera* camera, VariantData* data) {
+	MarkTexturesUsed();
 	GraphicsShader* shader = data->mShaderVariant;
 	if (shader->mDescriptorSetLayouts.size() > PER_MATERIAL && shader->mDescriptorBindings.size()) {
 		uint32_t frameContextIndex = commandBuffer->Device()->FrameContextIndex();
@@ -204,87 +360,53 @@ void Material::SetDescriptorParameters(CommandBuffer* commandBuffer, Camera* cam
 		PROFILER_END;
 	}
 
-	if (camera && shader->mDescriptorSetLayouts.size() > PER_CAMERA && shader->mDescriptorBindings.count("Camera")) {
-		auto binding = shader->mDescriptorBindings.at("Camera");
-		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->mPipelineLayout, PER_CAMERA, 1, *camera->DescriptorSet(binding.second.stageFlags), 0, nullptr);
+	const auto* cameraBinding = shader->DescriptorBinding(SHADER_NAME_ID("Camera"));
+	if (camera && shader->mDescriptorSetLayouts.size() > PER_CAMERA && cameraBinding)
+		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->mPipelineLayout, PER_CAMERA, 1, *camera->DescriptorSet(cameraBinding->second.stageFlags), 0, nullptr);
+
+	BindlessTable* table = commandBuffer->Device()->BindlessTable();
+	if (table && shader->mDescriptorSetLayouts.size() > PER_BINDLESS && shader->mDescriptorSetLayouts[PER_BINDLESS] == table->Layout()) {
+		VkDescriptorSet ds = table->DescriptorSet();
+		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->mPipelineLayout, PER_BINDLESS, 1, &ds, 0, nullptr);
 	}
 }
-void Material::SetPushConstantParameters(CommandBuffer* commandBuffer, Camera* camera, VariantData* data) {
-	PROFILER_BEGIN("Push Constants");
-	// set push constant parameters
+void Material::CompilePushConstants(VariantData* data) {
+	// lay out the push constant parameters for the variant, so that drawing only copies the block
 	GraphicsShader* shader = data->mShaderVariant;
+	data->mPushConstantData.resize(shader->mPushConstantSize);
+	memset(data->mPushConstantData.data(), 0, data->mPushConstantData.size());
+
 	for (auto& m : mParameters) {
 		if (m.second.index() < 4) continue;
 		if (shader->mPushConstants.count(m.first) == 0) continue;
 		auto& range = shader->mPushConstants.at(m.first);
 
-		union pvalue {
-			float4 fvalue;
-			uint4 uvalue;
-			int4 ivalue;
-			float4x4 f4x4value;
-		};
-		pvalue value = { uint4(0) };
-
+		const void* value = nullptr;
+		uint32_t size = 0;
 		switch (m.second.index()) {
-		case 4:
-			if (range.size != sizeof(float)) continue;
-			value.fvalue = float4(get<float>(m.second), 0, 0, 0);
-			break;
-		case 5:
-			if (range.size != sizeof(float2)) continue;
-			value.fvalue = float4(get<float2>(m.second), 0, 0);
-			break;
-		case 6:
-			if (range.size != sizeof(float3)) continue;
-			value.fvalue = float4(get<float3>(m.second), 0);
-			break;
-		case 7:
-			if (range.size != sizeof(float4)) continue;
-			value.fvalue = get<float4>(m.second);
-			break;
-
-		case 8:
-			if (range.size != sizeof(uint32_t)) continue;
-			value.uvalue = uint4(get<uint32_t>(m.second), 0, 0, 0);
-			break;
-		case 9:
-			if (range.size != sizeof(uint2)) continue;
-			value.uvalue = uint4(get<uint2>(m.second), 0, 0);
-			break;
-		case 10:
-			if (range.size != sizeof(uint3)) continue;
-			value.uvalue = uint4(get<uint3>(m.second), 0);
-			break;
-		case 11:
-			if (range.size != sizeof(uint4)) continue;
-			value.uvalue = get<uint4>(m.second);
-			break;
-
-		case 12:
-			if (range.size != sizeof(int32_t)) continue;
-			value.ivalue = int4(get<int32_t>(m.second), 0, 0, 0);
-			break;
-		case 13:
-			if (range.size != sizeof(int2)) continue;
-			value.ivalue = int4(get<int2>(m.second), 0, 0);
-			break;
-		case 14:
-			if (range.size != sizeof(int3)) continue;
-			value.ivalue = int4(get<int3>(m.second), 0);
-			break;
-		case 15:
-			if (range.size != sizeof(int4)) continue;
-			value.ivalue = get<int4>(m.second);
-			break;
-
-		case 16:
-			if (range.size != sizeof(float4x4)) continue;
-			value.f4x4value = get<float4x4>(m.second);
-			break;
+		case 4:  value = &get<float>(m.second);    size = sizeof(float);    break;
+		case 5:  value = &get<float2>(m.second);   size = sizeof(float2);   break;
+		case 6:  value = &get<float3>(m.second);   size = sizeof(float3);   break;
+		case 7:  value = &get<float4>(m.second);   size = sizeof(float4);   break;
+		case 8:  value = &get<uint32_t>(m.second); size = sizeof(uint32_t); break;
+		case 9:  value = &get<uint2>(m.second);    size = sizeof(uint2);    break;
+		case 10: value = &get<uint3>(m.second);    size = sizeof(uint3);    break;
+		case 11: value = &get<uint4>(m.second);    size = sizeof(uint4);    break;
+		case 12: value = &get<int32_t>(m.second);  size = sizeof(int32_t);  break;
+		case 13: value = &get<int2>(m.second);     size = sizeof(int2);     break;
+		case 14: value = &get<int3>(m.second);     size = sizeof(int3);     break;
+		case 15: value = &get<int4>(m.second);     size = sizeof(int4);     break;
+		case 16: value = &get<float4x4>(m.second); size = sizeof(float4x4); break;
 		}
-
-		vkCmdPushConstants(*commandBuffer, shader->mPipelineLayout, range.stageFlags, range.offset, range.size, &value);
+		if (range.size != size || range.offset + size > data->mPushConstantData.size()) continue;
+		memcpy(data->mPushConstantData.data() + range.offset, value, size);
 	}
+	data->mPushConstantsDirty = false;
+}
+void Material::SetPushConstantParameters(CommandBuffer* commandBuffer, Camera* camera, VariantData* data) {
+	PROFILER_BEGIN("Push Constants");
+	if (data->mPushConstantsDirty) CompilePushConstants(data);
+	if (data->mPushConstantData.size())
+		commandBuffer->PushConstants(data->mShaderVariant, data->mPushConstantData.data());
 	PROFILER_END;
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <map>
+
 #include <Content/Shader.hpp>
 #include <Content/Texture.hpp>
 #include <Core/CommandBuffer.hpp>
@@ -37,7 +39,12 @@ public:
 	ENGINE_EXPORT ~Material();
 
 	inline ::Shader* Shader() const { return mShader.index() == 0 ? std::get<::Shader*>(mShader) : std::get<std::shared_ptr<::Shader>>(mShader).get(); };
-	ENGINE_EXPORT GraphicsShader* GetShader(PassType pass);
+	/// Returns the variant that draws geometry with the vertex input in pass. Quantized vertices select the QUANTIZED_VERTEX variant without changing
+	/// the material's keywords, so renderers of different vertex formats can share a material.
+	ENGINE_EXPORT GraphicsShader* GetShader(PassType pass, const VertexInput* input = nullptr);
+	/// Queues compilation of the pipeline that drawing with this material in pass would use, see GraphicsShader::PrewarmPipeline
+	ENGINE_EXPORT void PrewarmPipeline(PassType pass, RenderPass* renderPass, const VertexInput* input,
+		VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VkCullModeFlags cullMode = VK_CULL_MODE_FLAG_BITS_MAX_ENUM);
 
 	inline void PassMask(PassType p) { mPassMask = p; }
 	inline PassType PassMask() { return mPassMask == PASS_MASK_MAX_ENUM ? Shader()->PassMask() : mPassMask; }
@@ -64,18 +71,40 @@ public:
 	ENGINE_EXPORT void EnableKeyword(const std::string& kw);
 	ENGINE_EXPORT void DisableKeyword(const std::string& kw);
 
+	/// Stores the material's parameters in the device's BindlessTable and enables the BINDLESS keyword, so that materials using the same shader can be drawn
+	/// in one batch. Has no effect if the device has no BindlessTable or the shader has no BINDLESS keyword. Materials are bindless by default when both exist.
+	ENGINE_EXPORT void Bindless(bool b);
+	inline bool Bindless() const { return mBindless; }
+	/// Index of the material's MaterialData in the bindless material buffer for the current frame, using the textures at textureIndex of the texture arrays
+	ENGINE_EXPORT uint32_t BindlessIndex(uint32_t textureIndex = 0);
+	/// True if renderers using this material and renderers using other can be drawn in the same batch.
+	/// Bindless materials share the descriptor set of the batch's first material, aside from the bindless textures.
+	ENGINE_EXPORT bool CanBatch(Material* other, PassType pass);
+
+	/// Requests the mip levels of the material's textures that are sampled where one pixel covers uvPerPixel in uv space, before TextureST is applied.
+	/// Renderers call it with their screen-space uv density, so streaming textures only load the levels they are seen at.
+	ENGINE_EXPORT void RequestMipLevels(float uvPerPixel);
+
 private:
 	struct VariantData {
 		GraphicsShader* mShaderVariant;
 		DescriptorSet** mDescriptorSets;
 		bool* mDirty;
+		// push constant parameters, laid out for mShaderVariant
+		std::vector<uint8_t> mPushConstantData;
+		bool mPushConstantsDirty;
 	};
 
 	friend class CommandBuffer;
 	ENGINE_EXPORT void SetDescriptorParameters(CommandBuffer* commandBuffer, Camera* camera, VariantData* data);
 	ENGINE_EXPORT void SetPushConstantParameters(CommandBuffer* commandBuffer, Camera* camera, VariantData* data);
+	ENGINE_EXPORT void CompilePushConstants(VariantData* data);
 
-	ENGINE_EXPORT VariantData* GetData(PassType pass);
+	ENGINE_EXPORT VariantData* GetData(PassType pass, const VertexInput* input);
+	/// Marks the material's textures used in the current frame, once per frame. Descriptors are written again if a texture's view changed.
+	ENGINE_EXPORT void MarkTexturesUsed();
+	/// Calls f with each texture parameter, which may be nullptr
+	ENGINE_EXPORT void ForEachTexture(const std::function<void(Texture*)>& f);
 
 	Device* mDevice;
 
@@ -97,5 +126,18 @@ private:
 	std::unordered_map<std::string, MaterialParameter> mParameters;
 	std::unordered_map<std::string, std::unordered_map<uint32_t, std::variant<std::shared_ptr<Texture>, Texture*>>> mArrayParameters;
 
-	std::unordered_map<PassType, VariantData*> mVariantData;
+	// (pass, quantized vertices) -> variant
+	std::map<std::pair<PassType, bool>, VariantData*> mVariantData;
+
+	bool mBindless;
+	bool mBindlessDirty;
+	// Device::ShaderReloadCount() when the variant data was last invalidated
+	uint64_t mShaderReloadCount;
+	uint64_t mTexturesUsedFrame;
+	// sum of the textures' ViewRevision() when the descriptors were last written
+	uint64_t mTextureViewRevision;
+	// texture index -> slot in the bindless material buffer
+	std::unordered_map<uint32_t, uint32_t> mBindlessSlots;
+
+	ENGINE_EXPORT MaterialData GetMaterialData(uint32_t textureIndex);
 };
\ No newline at end of file
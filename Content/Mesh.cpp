@@ -5,6 +5,8 @@
 #include <shared_mutex>
 
 #include <Core/Device.hpp>
+#include <Util/MappedFile.hpp>
+#include <Util/MeshOptimizer.hpp>
 #include <Util/Util.hpp>
 
 #include <assimp/scene.h>
@@ -51,6 +53,41 @@ const ::VertexInput StdVertex::VertexInput {
 		}
 	}
 };
+const ::VertexInput QuantizedVertex::VertexInput {
+	{
+		{
+			0, // binding
+			sizeof(QuantizedVertex), // stride
+			VK_VERTEX_INPUT_RATE_VERTEX // inputRate
+		}
+	},
+	{
+		{
+			0, // location
+			0, // binding
+			VK_FORMAT_R16G16B16A16_UNORM, // format
+			offsetof(QuantizedVertex, position) // offset
+		},
+		{
+			1, // location
+			0, // binding
+			VK_FORMAT_R16G16_SNORM, // format
+			offsetof(QuantizedVertex, normal) // offset
+		},
+		{
+			2, // location
+			0, // binding
+			VK_FORMAT_R16G16_SNORM, // format
+			offsetof(QuantizedVertex, tangent) // offset
+		},
+		{
+			3, // location
+			0, // binding
+			VK_FORMAT_R16G16_SFLOAT, // format
+			offsetof(QuantizedVertex, uv) // offset
+		}
+	}
+};
 
 const ::VertexInput Float3VertexInput{
 	{
@@ -155,22 +192,213 @@ inline Bone* AddBone(AnimationRig& rig, aiNode* node, const aiScene* scene, aiNo
 	return bone;
 }
 
-Mesh::Mesh(const string& name) : mName(name), mVertexInput(nullptr), mBvh(nullptr), mIndexCount(0), mVertexCount(0), mBaseVertex(0), mVertexSize(0), mBaseIndex(0), mIndexType(VK_INDEX_TYPE_UINT16) {}
-Mesh::Mesh(const string& name, ::Device* device, const string& filename, float scale)
-	: mName(name), mVertexInput(nullptr), mBvh(nullptr), mBaseVertex(0), mBaseIndex(0), mTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST) {
+Mesh::Mesh(const string& name) : mName(name), mPooled(false), mUVDensity(1), mVertexInput(nullptr), mVertexTransform(float4x4(1)), mBvh(nullptr), mIndexCount(0), mVertexCount(0), mBaseVertex(0), mVertexSize(0), mBaseIndex(0), mIndexType(VK_INDEX_TYPE_UINT16) {}
+// relative to the executable's directory
+#define MESH_COOK_DIRECTORY "Cache"
+#define MESH_COOK_MAGIC 0x48534D53 // 'SMSH'
+#define MESH_COOK_VERSION 4
+#define MESH_COOK_ALIGNMENT 16
+// meshes with fewer triangles are drawn whole, and keep one cache and overdraw order over all their triangles
+#define MESH_CLUSTER_MIN_TRIANGLES (MESH_CLUSTER_SIZE * 16)
+
+// Header of a .stmesh file. Each section follows it at the offset stored here, aligned to MESH_COOK_ALIGNMENT.
+// Shape keys are stored as a name length, the name, and the vertices of the key, each part aligned.
+struct CookedMeshHeader {
+	uint32_t mMagic;
+	uint32_t mVersion;
+	// size and write time of the file the mesh was imported from, used to detect stale cooked files
+	uint64_t mSourceSize;
+	int64_t mSourceTime;
+	float mScale;
 
+	uint32_t mVertexCount;
+	uint32_t mVertexSize;
+	uint32_t mQuantized; // 1 if the vertices are QuantizedVertex, 0 if they are StdVertex
+	uint32_t mIndexCount;
+	uint32_t mIndexType;
+	uint32_t mShapeKeyCount;
+	uint32_t mBvhNodeCount;
+	uint32_t mBvhTriangleCount;
+	uint32_t mBvhVertexCount;
+	uint32_t mClusterCount;
+	float3 mBoundsMin;
+	float3 mBoundsMax;
+	// square root of the mesh's area in uv space over its area in object space, see Mesh::UVDensity()
+	float mUVDensity;
+
+	uint64_t mVertexOffset;
+	uint64_t mIndexOffset;
+	uint64_t mWeightOffset; // 0 if the mesh has no weights
+	uint64_t mShapeKeyOffset;
+	uint64_t mBvhNodeOffset;
+	uint64_t mBvhTriangleOffset;
+	uint64_t mBvhVertexOffset;
+	uint64_t mClusterOffset;
+	uint64_t mSize;
+};
+
+inline uint64_t AppendSection(vector<uint8_t>& dest, const void* data, size_t size) {
+	uint64_t offset = AlignUp(dest.size(), MESH_COOK_ALIGNMENT);
+	dest.resize(offset + size);
+	if (size) memcpy(dest.data() + offset, data, size);
+	return offset;
+}
+inline void SourceStamp(const string& filename, uint64_t& size, int64_t& time) {
+	error_code err;
+	size = (uint64_t)fs::file_size(filename, err);
+	if (err) size = 0;
+	time = (int64_t)fs::last_write_time(filename, err).time_since_epoch().count();
+	if (err) time = 0;
+}
+inline string CookedMeshFile(const string& filename, float scale, bool quantize) {
+	char hash[17];
+	snprintf(hash, 17, "%016llx", (unsigned long long)std::hash<string>()(fs::absolute(filename).string() + "_" + to_string(scale) + (quantize ? "_q" : "")));
+	return (ExecutableDirectory() / MESH_COOK_DIRECTORY / (fs::path(filename).stem().string() + "_" + hash + ".stmesh")).string();
+}
+
+inline int16_t ToSnorm16(float v) { return (int16_t)roundf(clamp(v, -1.f, 1.f) * 32767.f); }
+inline uint16_t ToUnorm16(float v) { return (uint16_t)roundf(clamp(v, 0.f, 1.f) * 65535.f); }
+// Maps a unit vector onto the octahedron and unfolds it into [-1, 1]^2, DecodeOctahedral in util.hlsli reverses it
+inline void EncodeOctahedral(const float3& n, int16_t* dest) {
+	float l = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	if (l == 0) {
+		dest[0] = dest[1] = 0;
+		return;
+	}
+	float2 e(n.x / l, n.y / l);
+	if (n.z < 0) e = float2((1 - fabsf(e.y)) * (e.x >= 0 ? 1.f : -1.f), (1 - fabsf(e.x)) * (e.y >= 0 ? 1.f : -1.f));
+	dest[0] = ToSnorm16(e.x);
+	dest[1] = ToSnorm16(e.y);
+}
+inline QuantizedVertex QuantizeVertex(const StdVertex& v, const float3& mn, const float3& extent) {
+	QuantizedVertex q;
+	for (uint32_t i = 0; i < 3; i++)
+		q.position[i] = extent[i] > 0 ? ToUnorm16((v.position[i] - mn[i]) / extent[i]) : 0;
+	q.position[3] = v.tangent.w < 0 ? 0 : 0xFFFF;
+	EncodeOctahedral(v.normal, q.normal);
+	EncodeOctahedral(v.tangent.xyz, q.tangent);
+	q.uv[0] = FloatToHalf(v.uv.x);
+	q.uv[1] = FloatToHalf(v.uv.y);
+	return q;
+}
+
+// Splits the BVH's triangle order at the largest subtrees with at most MESH_CLUSTER_SIZE triangles, merging neighbouring subtrees that fit in one cluster.
+// The clusters are index ranges into the BVH's triangles.
+inline void BuildClusters(const TriangleBvh2& bvh, vector<MeshCluster>& clusters) {
+	const vector<TriangleBvh2::Node>& nodes = bvh.Nodes();
+	if (nodes.empty()) return;
+	vector<uint32_t> todo;
+	todo.push_back(0);
+	while (todo.size()) {
+		uint32_t ni = todo.back();
+		todo.pop_back();
+		const TriangleBvh2::Node& node = nodes[ni];
+		if (node.mRightOffset == 0 || node.mCount <= MESH_CLUSTER_SIZE) {
+			if (clusters.size() && clusters.back().mIndexCount + 3 * node.mCount <= 3 * MESH_CLUSTER_SIZE)
+				clusters.back().mIndexCount += 3 * node.mCount;
+			else {
+				MeshCluster cluster = {};
+				cluster.mIndexOffset = 3 * node.mStartIndex;
+				cluster.mIndexCount = 3 * node.mCount;
+				clusters.push_back(cluster);
+			}
+			continue;
+		}
+		// the first child's triangles come first, so it is visited first to keep the clusters contiguous
+		todo.push_back(ni + node.mRightOffset);
+		todo.push_back(ni + 1);
+	}
+}
+// Optimizes the triangle order of one cluster, with its vertices numbered locally so the work doesn't scale with the size of the mesh.
+// localIndex has an entry for every vertex, which is ~0u outside of this function.
+inline void OptimizeCluster(uint32_t* indices, uint32_t indexCount, const vector<StdVertex>& vertices, vector<uint32_t>& localIndex) {
+	vector<uint32_t> globalIndex;
+	vector<uint32_t> local(indexCount);
+	for (uint32_t i = 0; i < indexCount; i++) {
+		uint32_t& l = localIndex[indices[i]];
+		if (l == ~0u) {
+			l = (uint32_t)globalIndex.size();
+			globalIndex.push_back(indices[i]);
+		}
+		local[i] = l;
+	}
+	MeshOptimizer::OptimizeVertexCache(local.data(), indexCount, (uint32_t)globalIndex.size());
+	for (uint32_t i = 0; i < indexCount; i++)
+		indices[i] = globalIndex[local[i]];
+	for (uint32_t v : globalIndex)
+		localIndex[v] = ~0u;
+}
+inline void ComputeClusterBounds(MeshCluster& cluster, const uint32_t* indices, const vector<StdVertex>& vertices) {
+	AABB box(vertices[indices[0]].position, vertices[indices[0]].position);
+	for (uint32_t i = 1; i < cluster.mIndexCount; i++)
+		box.Encapsulate(vertices[indices[i]].position);
+	cluster.mCenter = box.Center();
+	cluster.mRadius = 0;
+	for (uint32_t i = 0; i < cluster.mIndexCount; i++)
+		cluster.mRadius = max(cluster.mRadius, length(vertices[indices[i]].position - cluster.mCenter));
+
+	vector<float3> normals;
+	float3 axis = 0;
+	for (uint32_t i = 0; i < cluster.mIndexCount; i += 3) {
+		const StdVertex& v0 = vertices[indices[i]];
+		const StdVertex& v1 = vertices[indices[i + 1]];
+		const StdVertex& v2 = vertices[indices[i + 2]];
+		float3 n = cross(v1.position - v0.position, v2.position - v0.position);
+		float l = length(n);
+		if (l == 0) continue;
+		n /= l;
+		// orient the face normal with the vertex normals, so the cone faces outward whichever winding the model uses
+		if (dot(n, v0.normal + v1.normal + v2.normal) < 0) n = -n;
+		normals.push_back(n);
+		axis += n;
+	}
+
+	// a cutoff of 1 never culls
+	cluster.mConeAxis = float3(0, 0, 1);
+	cluster.mConeCutoff = 1;
+	float l = length(axis);
+	if (l == 0) return;
+	axis /= l;
+	float minDot = 1;
+	for (const float3& n : normals)
+		minDot = min(minDot, dot(n, axis));
+	cluster.mConeAxis = axis;
+	// every normal is within acos(minDot) of the axis, so the cluster faces away wherever the view direction is within 90 - acos(minDot) of the axis
+	if (minDot > 0) cluster.mConeCutoff = sqrtf(1 - minDot * minDot);
+}
+
+// square root of the area in uv space over the area in object space, of a triangle list
+inline float ComputeUVDensity(const vector<StdVertex>& vertices, const vector<uint32_t>& indices) {
+	double area = 0;
+	double uvArea = 0;
+	for (uint32_t i = 0; i + 2 < indices.size(); i += 3) {
+		const StdVertex& v0 = vertices[indices[i]];
+		const StdVertex& v1 = vertices[indices[i + 1]];
+		const StdVertex& v2 = vertices[indices[i + 2]];
+		area += length(cross(v1.position - v0.position, v2.position - v0.position));
+		float2 e0 = v1.uv - v0.uv;
+		float2 e1 = v2.uv - v0.uv;
+		uvArea += fabsf(e0.x * e1.y - e0.y * e1.x);
+	}
+	return area > 0 && uvArea > 0 ? (float)sqrt(uvArea / area) : 1.f;
+}
+
+// Imports a model with assimp and serializes it in the .stmesh format
+inline bool ImportMesh(const string& filename, float scale, bool quantize, vector<uint8_t>& dest) {
 	const aiScene* scene = aiImportFile(filename.c_str(), aiProcessPreset_TargetRealtime_MaxQuality | aiProcess_FlipUVs | aiProcess_MakeLeftHanded);
 	if (!scene) {
 		fprintf_color(COLOR_RED, stderr, "Failed to open %s: %s\n", filename.c_str(), aiGetErrorString());
-		throw;
+		return false;
 	}
 	vector<StdVertex> vertices;
-	vector<uint16_t> indices16;
-	vector<uint32_t> indices32;
+	vector<uint32_t> indices;
 	float3 mn, mx;
 
 	vector<AIWeight> weights;
+	vector<VertexWeight> vertexWeights;
 	unordered_map<string, aiBone*> uniqueBones;
+	// anim meshes and the first vertex of the mesh they belong to
+	vector<pair<const aiAnimMesh*, uint32_t>> animMeshes;
 
 	uint32_t vertexCount = 0;
 	for (uint32_t m = 0; m < scene->mNumMeshes; m++)
@@ -198,7 +426,7 @@ Mesh::Mesh(const string& name, ::Device* device, const string& filename, float s
 			if (mesh->HasTextureCoords(0)) vertex.uv = { (float)mesh->mTextureCoords[0][i].x, (float)mesh->mTextureCoords[0][i].y };
 			vertex.position *= scale;
 
-			if (i == 0) {
+			if (vertices.empty()) {
 				mn = vertex.position;
 				mx = vertex.position;
 			} else {
@@ -210,28 +438,16 @@ Mesh::Mesh(const string& name, ::Device* device, const string& filename, float s
 			weights.push_back(AIWeight());
 		}
 
-		if (use32bit)
-			for (uint32_t i = 0; i < mesh->mNumFaces; i++) {
-				const aiFace& f = mesh->mFaces[i];
-				if (f.mNumIndices == 0) continue;
-				indices32.push_back(f.mIndices[0]);
-				if (f.mNumIndices == 2) indices32.push_back(f.mIndices[1]);
-				for (uint32_t j = 2; j < f.mNumIndices; j++) {
-					indices32.push_back(f.mIndices[j - 1]);
-					indices32.push_back(f.mIndices[j]);
-				}
-			} else {
-				for (uint32_t i = 0; i < mesh->mNumFaces; i++) {
-					const aiFace& f = mesh->mFaces[i];
-					if (f.mNumIndices == 0) continue;
-					indices16.push_back(f.mIndices[0]);
-					if (f.mNumIndices == 2) indices16.push_back(f.mIndices[1]);
-					for (uint32_t j = 2; j < f.mNumIndices; j++) {
-						indices16.push_back(f.mIndices[j - 1]);
-						indices16.push_back(f.mIndices[j]);
-					}
-				}
+		for (uint32_t i = 0; i < mesh->mNumFaces; i++) {
+			const aiFace& f = mesh->mFaces[i];
+			if (f.mNumIndices == 0) continue;
+			indices.push_back(baseIndex + f.mIndices[0]);
+			if (f.mNumIndices == 2) indices.push_back(baseIndex + f.mIndices[1]);
+			for (uint32_t j = 2; j < f.mNumIndices; j++) {
+				indices.push_back(baseIndex + f.mIndices[j - 1]);
+				indices.push_back(baseIndex + f.mIndices[j]);
 			}
+		}
 
 		if (mesh->HasBones())
 			for (uint16_t c = 0; c < mesh->mNumBones; c++) {
@@ -244,6 +460,10 @@ Mesh::Mesh(const string& name, ::Device* device, const string& filename, float s
 				if (uniqueBones.count(bone->mName.C_Str()) == 0)
 					uniqueBones.emplace(bone->mName.C_Str(), bone);
 			}
+
+		for (uint32_t k = 0; k < mesh->mNumAnimMeshes; k++)
+			if (mesh->mAnimMeshes[k]->HasPositions())
+				animMeshes.push_back(make_pair(mesh->mAnimMeshes[k], baseIndex));
 	}
 
 	if (uniqueBones.size()) {
@@ -310,7 +530,7 @@ Mesh::Mesh(const string& name, ::Device* device, const string& filename, float s
 			//mAnimations.emplace(anim->mName.C_Str(), new Animation(anim, bonesByName, scale));
 		}
 
-		vector<VertexWeight> vertexWeights(vertices.size());
+		vertexWeights.resize(vertices.size());
 		for (uint32_t i = 0; i < vertices.size(); i++) {
 			weights[i].NormalizeWeights();
 			for (unsigned int j = 0; j < 4; j++) {
@@ -320,44 +540,292 @@ Mesh::Mesh(const string& name, ::Device* device, const string& filename, float s
 				}
 			}
 		}
-
-		mWeightBuffer = make_shared<Buffer>(mName + " Weights", device, vertexWeights.size() * sizeof(VertexWeight), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 	}
-	
-	if (use32bit) {
-		mIndexCount = (uint32_t)indices32.size();
-		mIndexType = VK_INDEX_TYPE_UINT32;
-	} else {
-		mIndexCount = (uint32_t)indices16.size();
-		mIndexType = VK_INDEX_TYPE_UINT16;
+
+	// shape keys replace the vertices of the meshes that have them, other meshes keep their vertices
+	vector<pair<string, vector<StdVertex>>> shapeKeys;
+	for (const auto& a : animMeshes) {
+		string keyName = a.first->mName.C_Str();
+		auto key = find_if(shapeKeys.begin(), shapeKeys.end(), [&](const auto& k) { return k.first == keyName; });
+		if (key == shapeKeys.end()) {
+			shapeKeys.push_back(make_pair(keyName, vertices));
+			key = shapeKeys.end() - 1;
+		}
+		for (uint32_t i = 0; i < a.first->mNumVertices; i++) {
+			StdVertex& vertex = key->second[a.second + i];
+			vertex.position = float3((float)a.first->mVertices[i].x, (float)a.first->mVertices[i].y, (float)a.first->mVertices[i].z) * scale;
+			if (a.first->HasNormals()) vertex.normal = { (float)a.first->mNormals[i].x, (float)a.first->mNormals[i].y, (float)a.first->mNormals[i].z };
+			if (a.first->HasTangentsAndBitangents()) vertex.tangent = float4((float)a.first->mTangents[i].x, (float)a.first->mTangents[i].y, (float)a.first->mTangents[i].z, vertex.tangent.w);
+		}
 	}
 
 	aiReleaseImport(scene);
 
-	mVertexCount = (uint32_t)vertices.size();
-	mBounds = AABB(mn, mx);
-	mVertexSize = sizeof(StdVertex);
-	mVertexInput = &StdVertex::VertexInput;
+	TriangleBvh2 bvh;
+	bvh.Build(vertices.data(), 0, (uint32_t)vertices.size(), sizeof(StdVertex), indices.data(), (uint32_t)indices.size(), VK_INDEX_TYPE_UINT32);
 
-	mBvh = new TriangleBvh2();
-	if (use32bit)
-		mBvh->Build(vertices.data(), 0, vertexCount, sizeof(StdVertex), indices32.data(), indices32.size(), VK_INDEX_TYPE_UINT32);
-	else
-		mBvh->Build(vertices.data(), 0, vertexCount, sizeof(StdVertex), indices16.data(), indices16.size(), VK_INDEX_TYPE_UINT16);
+	// large meshes are drawn in clusters taken from the BVH, which already puts nearby triangles next to each other.
+	// The cache order is optimized within each cluster, smaller meshes get the cache and overdraw order over all their triangles.
+	vector<MeshCluster> clusters;
+	if (indices.size() / 3 >= MESH_CLUSTER_MIN_TRIANGLES) {
+		BuildClusters(bvh, clusters);
+		for (uint32_t i = 0; i < bvh.Triangles().size(); i++)
+			memcpy(indices.data() + 3 * i, &bvh.Triangles()[i], sizeof(uint3));
+		vector<uint32_t> localIndex(vertices.size(), ~0u);
+		for (const MeshCluster& c : clusters)
+			OptimizeCluster(indices.data() + c.mIndexOffset, c.mIndexCount, vertices, localIndex);
+	} else if (indices.size()) {
+		MeshOptimizer::OptimizeVertexCache(indices.data(), indices.size(), (uint32_t)vertices.size());
+		MeshOptimizer::OptimizeOverdraw(indices.data(), indices.size(), &vertices[0].position, sizeof(StdVertex), (uint32_t)vertices.size());
+	}
 
-	if (!uniqueBones.size())
-		mWeightBuffer = nullptr;
-	mVertexBuffer = make_shared<Buffer>(name + " Vertex Buffer", device, vertices.data(), sizeof(StdVertex) * vertices.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	// reorder vertices for fetch locality, along with everything that refers to them
+	vector<uint3> bvhTriangles = bvh.Triangles();
+	vector<float3> bvhVertices = bvh.Vertices();
+	if (indices.size()) {
+		vector<uint32_t> remap;
+		MeshOptimizer::OptimizeVertexFetch(indices.data(), indices.size(), (uint32_t)vertices.size(), remap);
+		MeshOptimizer::RemapVertices(vertices.data(), sizeof(StdVertex), remap);
+		if (vertexWeights.size()) MeshOptimizer::RemapVertices(vertexWeights.data(), sizeof(VertexWeight), remap);
+		for (auto& k : shapeKeys) MeshOptimizer::RemapVertices(k.second.data(), sizeof(StdVertex), remap);
+		MeshOptimizer::RemapVertices(bvhVertices.data(), sizeof(float3), remap);
+		for (uint3& t : bvhTriangles)
+			t = uint3(remap[t.x], remap[t.y], remap[t.z]);
+	}
+	for (MeshCluster& c : clusters)
+		ComputeClusterBounds(c, indices.data() + c.mIndexOffset, vertices);
+
+	// skinning and shape keys operate on StdVertex buffers, so only static meshes are quantized
+	bool quantized = quantize && vertexWeights.empty() && shapeKeys.empty();
+	vector<QuantizedVertex> quantizedVertices;
+	if (quantized) {
+		quantizedVertices.resize(vertices.size());
+		for (uint32_t i = 0; i < vertices.size(); i++)
+			quantizedVertices[i] = QuantizeVertex(vertices[i], mn, mx - mn);
+	}
+
+	CookedMeshHeader header = {};
+	header.mMagic = MESH_COOK_MAGIC;
+	header.mVersion = MESH_COOK_VERSION;
+	SourceStamp(filename, header.mSourceSize, header.mSourceTime);
+	header.mScale = scale;
+	header.mVertexCount = (uint32_t)vertices.size();
+	header.mVertexSize = quantized ? sizeof(QuantizedVertex) : sizeof(StdVertex);
+	header.mQuantized = quantized ? 1 : 0;
+	header.mIndexCount = (uint32_t)indices.size();
+	header.mIndexType = use32bit ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16;
+	header.mShapeKeyCount = (uint32_t)shapeKeys.size();
+	header.mBvhNodeCount = (uint32_t)bvh.Nodes().size();
+	header.mBvhTriangleCount = (uint32_t)bvhTriangles.size();
+	header.mBvhVertexCount = (uint32_t)bvhVertices.size();
+	header.mClusterCount = (uint32_t)clusters.size();
+	header.mBoundsMin = mn;
+	header.mBoundsMax = mx;
+	header.mUVDensity = ComputeUVDensity(vertices, indices);
+
+	dest.clear();
+	AppendSection(dest, &header, sizeof(CookedMeshHeader));
+	if (quantized)
+		header.mVertexOffset = AppendSection(dest, quantizedVertices.data(), sizeof(QuantizedVertex) * quantizedVertices.size());
+	else
+		header.mVertexOffset = AppendSection(dest, vertices.data(), sizeof(StdVertex) * vertices.size());
 	if (use32bit)
-		mIndexBuffer = make_shared<Buffer>(name + " Index Buffer", device, indices32.data(), sizeof(uint32_t) * indices32.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+		header.mIndexOffset = AppendSection(dest, indices.data(), sizeof(uint32_t) * indices.size());
+	else {
+		vector<uint16_t> indices16(indices.begin(), indices.end());
+		header.mIndexOffset = AppendSection(dest, indices16.data(), sizeof(uint16_t) * indices16.size());
+	}
+	header.mWeightOffset = vertexWeights.size() ? AppendSection(dest, vertexWeights.data(), sizeof(VertexWeight) * vertexWeights.size()) : 0;
+	header.mShapeKeyOffset = AlignUp(dest.size(), MESH_COOK_ALIGNMENT);
+	for (const auto& k : shapeKeys) {
+		uint32_t nameLength = (uint32_t)k.first.length();
+		AppendSection(dest, &nameLength, sizeof(uint32_t));
+		AppendSection(dest, k.first.data(), nameLength);
+		AppendSection(dest, k.second.data(), sizeof(StdVertex) * k.second.size());
+	}
+	header.mBvhNodeOffset = AppendSection(dest, bvh.Nodes().data(), sizeof(TriangleBvh2::Node) * bvh.Nodes().size());
+	header.mBvhTriangleOffset = AppendSection(dest, bvhTriangles.data(), sizeof(uint3) * bvhTriangles.size());
+	header.mBvhVertexOffset = AppendSection(dest, bvhVertices.data(), sizeof(float3) * bvhVertices.size());
+	header.mClusterOffset = AppendSection(dest, clusters.data(), sizeof(MeshCluster) * clusters.size());
+	header.mSize = dest.size();
+	memcpy(dest.data(), &header, sizeof(CookedMeshHeader));
+
+	printf("Imported %s / %d verts %d tris / %.2fx%.2fx%.2f\n", filename.c_str(), (int)vertices.size(), (int)header.mIndexCount / 3, mx.x - mn.x, mx.y - mn.y, mx.z - mn.z);
+	return true;
+}
+inline bool WriteCookedMesh(const string& cookedFile, const vector<uint8_t>& data) {
+	fs::path path(cookedFile);
+	if (path.has_parent_path()) {
+		error_code err;
+		fs::create_directories(path.parent_path(), err);
+	}
+	// write to a temporary file first, so a partially written file is never loaded
+	string tmp = cookedFile + ".tmp";
+	ofstream file(tmp, ios::binary);
+	if (!file.is_open()) return false;
+	file.write((const char*)data.data(), data.size());
+	file.close();
+	if (file.fail()) return false;
+	error_code err;
+	fs::rename(tmp, cookedFile, err);
+	return !err;
+}
+
+bool Mesh::Cook(const string& filename, const string& cookedFile, float scale, bool quantize) {
+	vector<uint8_t> data;
+	if (!ImportMesh(filename, scale, quantize, data)) return false;
+	if (!WriteCookedMesh(cookedFile, data)) {
+		fprintf_color(COLOR_RED, stderr, "Failed to write %s\n", cookedFile.c_str());
+		return false;
+	}
+	return true;
+}
+
+Mesh::Mesh(const string& name, ::Device* device, const string& filename, float scale, bool quantize)
+	: mName(name), mPooled(false), mUVDensity(1), mVertexInput(nullptr), mVertexTransform(float4x4(1)), mBvh(nullptr), mBaseVertex(0), mBaseIndex(0), mTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST) {
+
+	// .stmesh files are loaded as they are, other files are imported once and loaded from the cooked copy after that
+	if (fs::path(filename).extension() == ".stmesh") {
+		MappedFile file;
+		if (!file.Open(filename) || !LoadCooked(device, file.Data(), file.Size())) {
+			fprintf_color(COLOR_RED, stderr, "Failed to load %s\n", filename.c_str());
+			throw;
+		}
+		return;
+	}
+
+	string cookedFile = CookedMeshFile(filename, scale, quantize);
+	MappedFile file;
+	if (file.Open(cookedFile) && file.Size() >= sizeof(CookedMeshHeader)) {
+		const CookedMeshHeader* header = (const CookedMeshHeader*)file.Data();
+		uint64_t sourceSize;
+		int64_t sourceTime;
+		SourceStamp(filename, sourceSize, sourceTime);
+		if (header->mSourceSize == sourceSize && header->mSourceTime == sourceTime && header->mScale == scale && LoadCooked(device, file.Data(), file.Size()))
+			return;
+	}
+	file.Close();
+
+	vector<uint8_t> data;
+	if (!ImportMesh(filename, scale, quantize, data)) throw;
+	if (!WriteCookedMesh(cookedFile, data))
+		printf_color(COLOR_YELLOW, "Failed to write %s\n", cookedFile.c_str());
+	LoadCooked(device, data.data(), data.size());
+}
+// true if count elements of stride bytes starting at offset lie within size bytes
+inline bool SectionFits(uint64_t offset, uint64_t count, uint64_t stride, uint64_t size) {
+	return offset <= size && count * stride <= size - offset;
+}
+
+// true if every index, BVH node, BVH triangle and cluster refers to elements that exist, so that drawing and ray queries stay in bounds
+inline bool ValidCookedRanges(const CookedMeshHeader* header, const uint8_t* data) {
+	for (uint32_t i = 0; i < header->mIndexCount; i++) {
+		uint32_t index = header->mIndexType == VK_INDEX_TYPE_UINT32 ? ((const uint32_t*)(data + header->mIndexOffset))[i] : ((const uint16_t*)(data + header->mIndexOffset))[i];
+		if (index >= header->mVertexCount) return false;
+	}
+	const uint3* triangles = (const uint3*)(data + header->mBvhTriangleOffset);
+	for (uint32_t i = 0; i < header->mBvhTriangleCount; i++)
+		if (triangles[i].x >= header->mBvhVertexCount || triangles[i].y >= header->mBvhVertexCount || triangles[i].z >= header->mBvhVertexCount) return false;
+	const TriangleBvh2::Node* nodes = (const TriangleBvh2::Node*)(data + header->mBvhNodeOffset);
+	for (uint32_t i = 0; i < header->mBvhNodeCount; i++) {
+		if (nodes[i].mRightOffset == 0) {
+			if ((uint64_t)nodes[i].mStartIndex + nodes[i].mCount > header->mBvhTriangleCount) return false;
+		} else if ((uint64_t)i + nodes[i].mRightOffset >= header->mBvhNodeCount) return false;
+	}
+	const MeshCluster* clusters = (const MeshCluster*)(data + header->mClusterOffset);
+	for (uint32_t i = 0; i < header->mClusterCount; i++)
+		if ((uint64_t)clusters[i].mIndexOffset + clusters[i].mIndexCount > header->mIndexCount) return false;
+	return true;
+}
+
+bool Mesh::LoadCooked(::Device* device, const uint8_t* data, size_t size) {
+	if (size < sizeof(CookedMeshHeader)) return false;
+	const CookedMeshHeader* header = (const CookedMeshHeader*)data;
+	if (header->mMagic != MESH_COOK_MAGIC || header->mVersion != MESH_COOK_VERSION || header->mSize != size ||
+		header->mVertexSize != (header->mQuantized ? sizeof(QuantizedVertex) : sizeof(StdVertex))) return false;
+
+	// a truncated or corrupt file is imported again instead of being read out of bounds
+	if (header->mIndexType != VK_INDEX_TYPE_UINT16 && header->mIndexType != VK_INDEX_TYPE_UINT32) return false;
+	uint32_t indexStride = header->mIndexType == VK_INDEX_TYPE_UINT32 ? sizeof(uint32_t) : sizeof(uint16_t);
+	if (!SectionFits(header->mVertexOffset, header->mVertexCount, header->mVertexSize, size) ||
+		!SectionFits(header->mIndexOffset, header->mIndexCount, indexStride, size) ||
+		(header->mWeightOffset && !SectionFits(header->mWeightOffset, header->mVertexCount, sizeof(VertexWeight), size)) ||
+		!SectionFits(header->mBvhNodeOffset, header->mBvhNodeCount, sizeof(TriangleBvh2::Node), size) ||
+		!SectionFits(header->mBvhTriangleOffset, header->mBvhTriangleCount, sizeof(uint3), size) ||
+		!SectionFits(header->mBvhVertexOffset, header->mBvhVertexCount, sizeof(float3), size) ||
+		!SectionFits(header->mClusterOffset, header->mClusterCount, sizeof(MeshCluster), size)) return false;
+	uint64_t keyOffset = header->mShapeKeyOffset;
+	for (uint32_t i = 0; i < header->mShapeKeyCount; i++) {
+		keyOffset = AlignUp(keyOffset, MESH_COOK_ALIGNMENT);
+		if (!SectionFits(keyOffset, 1, sizeof(uint32_t), size)) return false;
+		uint32_t nameLength = *(const uint32_t*)(data + keyOffset);
+		keyOffset = AlignUp(keyOffset + sizeof(uint32_t), MESH_COOK_ALIGNMENT);
+		if (!SectionFits(keyOffset, nameLength, 1, size)) return false;
+		keyOffset = AlignUp(keyOffset + nameLength, MESH_COOK_ALIGNMENT);
+		if (!SectionFits(keyOffset, header->mVertexCount, header->mVertexSize, size)) return false;
+		keyOffset += (uint64_t)header->mVertexSize * header->mVertexCount;
+	}
+	if (!ValidCookedRanges(header, data)) return false;
+
+	mVertexCount = header->mVertexCount;
+	mVertexSize = header->mVertexSize;
+	mIndexCount = header->mIndexCount;
+	mIndexType = (VkIndexType)header->mIndexType;
+	mBounds = AABB(header->mBoundsMin, header->mBoundsMax);
+	if (header->mQuantized) {
+		mVertexInput = &QuantizedVertex::VertexInput;
+		mVertexTransform = float4x4::Translate(header->mBoundsMin) * float4x4::Scale(header->mBoundsMax - header->mBoundsMin);
+	} else {
+		mVertexInput = &StdVertex::VertexInput;
+		mVertexTransform = float4x4(1);
+	}
+
+	mBvh = new TriangleBvh2();
+	mBvh->Load(
+		(const TriangleBvh2::Node*)(data + header->mBvhNodeOffset), header->mBvhNodeCount,
+		(const uint3*)(data + header->mBvhTriangleOffset), header->mBvhTriangleCount,
+		(const float3*)(data + header->mBvhVertexOffset), header->mBvhVertexCount);
+	const MeshCluster* clusters = (const MeshCluster*)(data + header->mClusterOffset);
+	mClusters.assign(clusters, clusters + header->mClusterCount);
+
+	mUVDensity = header->mUVDensity > 0 ? header->mUVDensity : 1.f;
+
+	// the buffers copy straight from the file into the StagingRing
+	uint32_t indexSize = mIndexType == VK_INDEX_TYPE_UINT32 ? sizeof(uint32_t) : sizeof(uint16_t);
+	mPooled = header->mWeightOffset == 0 && header->mShapeKeyCount == 0;
+	if (mPooled) {
+		// static meshes share vertex and index buffers with other meshes of the same format
+		MeshPool::Allocation a = device->MeshPool()->Allocate(mVertexInput, (uint32_t)mVertexSize, data + header->mVertexOffset, mVertexCount,
+			mIndexType, data + header->mIndexOffset, mIndexCount);
+		mVertexBuffer = a.mVertexBuffer;
+		mIndexBuffer = a.mIndexBuffer;
+		mBaseVertex = a.mBaseVertex;
+		mBaseIndex = a.mBaseIndex;
+	} else {
+		mVertexBuffer = make_shared<Buffer>(mName + " Vertex Buffer", device, data + header->mVertexOffset, mVertexSize * mVertexCount, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+		mIndexBuffer = make_shared<Buffer>(mName + " Index Buffer", device, data + header->mIndexOffset, indexSize * mIndexCount, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	}
+	if (header->mWeightOffset)
+		mWeightBuffer = make_shared<Buffer>(mName + " Weights", device, data + header->mWeightOffset, sizeof(VertexWeight) * mVertexCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
 	else
-		mIndexBuffer = make_shared<Buffer>(name + " Index Buffer", device, indices16.data(), sizeof(uint16_t) * indices16.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+		mWeightBuffer = nullptr;
+
+	uint64_t offset = header->mShapeKeyOffset;
+	for (uint32_t i = 0; i < header->mShapeKeyCount; i++) {
+		offset = AlignUp(offset, MESH_COOK_ALIGNMENT);
+		uint32_t nameLength = *(const uint32_t*)(data + offset);
+		offset = AlignUp(offset + sizeof(uint32_t), MESH_COOK_ALIGNMENT);
+		string keyName((const char*)(data + offset), nameLength);
+		offset = AlignUp(offset + nameLength, MESH_COOK_ALIGNMENT);
+		mShapeKeys.emplace(keyName, make_shared<Buffer>(mName + keyName, device, data + offset, mVertexSize * mVertexCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT));
+		offset += mVertexSize * mVertexCount;
+	}
 
-	printf("Loaded %s / %d verts %d tris / %.2fx%.2fx%.2f\n", filename.c_str(), (int)vertices.size(), (int)(use32bit ? indices32.size() : indices16.size()) / 3, mx.x - mn.x, mx.y - mn.y, mx.z - mn.z);
+	return true;
 }
 Mesh::Mesh(const string& name, ::Device* device, const AABB& bounds, TriangleBvh2* bvh, shared_ptr<Buffer> vertexBuffer, shared_ptr<Buffer> indexBuffer,
 	uint32_t baseVertex, uint32_t vertexCount, uint32_t baseIndex, uint32_t indexCount, const ::VertexInput* vertexInput, VkIndexType indexType, VkPrimitiveTopology topology)
-	: mName(name), mVertexInput(vertexInput), mBvh(bvh), mBaseIndex(baseIndex), mIndexCount(indexCount), mIndexType(indexType), mBaseVertex(baseVertex), mVertexCount(vertexCount), mBounds(bounds), mTopology(topology) {
+	: mName(name), mPooled(false), mUVDensity(1), mVertexInput(vertexInput), mVertexTransform(float4x4(1)), mBvh(bvh), mBaseIndex(baseIndex), mIndexCount(indexCount), mIndexType(indexType), mBaseVertex(baseVertex), mVertexCount(vertexCount), mBounds(bounds), mTopology(topology) {
 	
 	mVertexBuffer = vertexBuffer;
 	mIndexBuffer = indexBuffer;
@@ -368,7 +836,7 @@ Mesh::Mesh(const string& name, ::Device* device, const AABB& bounds, TriangleBvh
 }
 Mesh::Mesh(const string& name, ::Device* device, const AABB& bounds, TriangleBvh2* bvh, shared_ptr<Buffer> vertexBuffer, shared_ptr<Buffer> indexBuffer, shared_ptr<Buffer> weightBuffer,
 	uint32_t baseVertex, uint32_t vertexCount, uint32_t baseIndex, uint32_t indexCount, const ::VertexInput* vertexInput, VkIndexType indexType, VkPrimitiveTopology topology)
-	: mName(name), mVertexInput(vertexInput), mBvh(bvh), mBaseIndex(baseIndex), mIndexCount(indexCount), mIndexType(indexType), mBaseVertex(baseVertex), mVertexCount(vertexCount), mBounds(bounds), mTopology(topology) {
+	: mName(name), mPooled(false), mUVDensity(1), mVertexInput(vertexInput), mVertexTransform(float4x4(1)), mBvh(bvh), mBaseIndex(baseIndex), mIndexCount(indexCount), mIndexType(indexType), mBaseVertex(baseVertex), mVertexCount(vertexCount), mBounds(bounds), mTopology(topology) {
 
 	mVertexBuffer = vertexBuffer;
 	mIndexBuffer = indexBuffer;
@@ -378,7 +846,7 @@ Mesh::Mesh(const string& name, ::Device* device, const AABB& bounds, TriangleBvh
 		mVertexSize = max(mVertexSize, a.offset + FormatSize(a.format));
 }
 Mesh::Mesh(const string& name, ::Device* device, const void* vertices, const void* indices, uint32_t vertexCount, uint32_t vertexSize, uint32_t indexCount, const ::VertexInput* vertexInput, VkIndexType indexType, VkPrimitiveTopology topology)
-	: mName(name), mVertexInput(vertexInput), mBvh(nullptr), mIndexCount(indexCount), mIndexType(indexType), mVertexCount(vertexCount), mVertexSize(vertexSize), mBaseVertex(0), mBaseIndex(0), mTopology(topology) {
+	: mName(name), mPooled(false), mUVDensity(1), mVertexInput(vertexInput), mVertexTransform(float4x4(1)), mBvh(nullptr), mIndexCount(indexCount), mIndexType(indexType), mVertexCount(vertexCount), mVertexSize(vertexSize), mBaseVertex(0), mBaseIndex(0), mTopology(topology) {
 	
 	float3 mn, mx;
 	for (uint32_t i = 0; i < indexCount; i++) {
@@ -409,7 +877,7 @@ Mesh::Mesh(const string& name, ::Device* device, const void* vertices, const voi
 	mIndexBuffer  = make_shared<Buffer>(name + " Index Buffer", device, indices, indexSize * indexCount, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
 }
 Mesh::Mesh(const string& name, ::Device* device, const void* vertices, const VertexWeight* weights, const vector<pair<string, const void*>>&  shapeKeys, const void* indices, uint32_t vertexCount, uint32_t vertexSize, uint32_t indexCount, const ::VertexInput* vertexInput, VkIndexType indexType, VkPrimitiveTopology topology)
-	: mName(name), mVertexInput(vertexInput), mBvh(nullptr), mIndexCount(indexCount), mIndexType(indexType), mVertexCount(vertexCount), mVertexSize(vertexSize), mBaseVertex(0), mBaseIndex(0), mTopology(topology) {
+	: mName(name), mPooled(false), mUVDensity(1), mVertexInput(vertexInput), mVertexTransform(float4x4(1)), mBvh(nullptr), mIndexCount(indexCount), mIndexType(indexType), mVertexCount(vertexCount), mVertexSize(vertexSize), mBaseVertex(0), mBaseIndex(0), mTopology(topology) {
 
 	float3 mn, mx;
 	for (uint32_t i = 0; i < indexCount; i++) {
@@ -511,7 +979,73 @@ bool Mesh::Intersect(const Ray& ray, float* t, bool any) {
 }
 
 Mesh::~Mesh() {
+	if (mPooled && mVertexBuffer) {
+		MeshPool::Allocation a = {};
+		a.mVertexBuffer = mVertexBuffer;
+		a.mIndexBuffer = mIndexBuffer;
+		a.mBaseVertex = mBaseVertex;
+		a.mVertexCount = mVertexCount;
+		a.mBaseIndex = mBaseIndex;
+		a.mIndexCount = mIndexCount;
+		mVertexBuffer->Device()->MeshPool()->Free(a);
+	}
 	for (auto kp : mAnimations)
 		safe_delete(kp.second);
 	safe_delete(mBvh);
+}
+bool Mesh::Swap(Asset* other) {
+	Mesh* m = dynamic_cast<Mesh*>(other);
+	if (!m) return false;
+	swap(mPooled, m->mPooled);
+	swap(mBvh, m->mBvh);
+	swap(mVertexInput, m->mVertexInput);
+	swap(mVertexTransform, m->mVertexTransform);
+	swap(mBaseVertex, m->mBaseVertex);
+	swap(mVertexCount, m->mVertexCount);
+	swap(mVertexSize, m->mVertexSize);
+	swap(mBaseIndex, m->mBaseIndex);
+	swap(mIndexCount, m->mIndexCount);
+	swap(mIndexType, m->mIndexType);
+	swap(mTopology, m->mTopology);
+	swap(mAnimations, m->mAnimations);
+	swap(mBounds, m->mBounds);
+	swap(mUVDensity, m->mUVDensity);
+	swap(mClusters, m->mClusters);
+	swap(mWeightBuffer, m->mWeightBuffer);
+	swap(mIndexBuffer, m->mIndexBuffer);
+	swap(mVertexBuffer, m->mVertexBuffer);
+	swap(mShapeKeys, m->mShapeKeys);
+	return true;
+}
+Asset* Mesh::Evict() {
+	Mesh* empty = new Mesh(mName);
+	empty->mBounds = mBounds;
+	empty->mUVDensity = mUVDensity;
+	empty->mTopology = mTopology;
+	Swap(empty);
+	return empty;
+}
+uint64_t Mesh::ResidentSize() const {
+	uint64_t size = 0;
+	if (mPooled) {
+		// only the mesh's ranges of the shared buffers
+		if (mVertexBuffer) size += mVertexSize * mVertexCount;
+		if (mIndexBuffer) size += (mIndexType == VK_INDEX_TYPE_UINT32 ? sizeof(uint32_t) : sizeof(uint16_t)) * mIndexCount;
+	} else {
+		if (mVertexBuffer) size += mVertexBuffer->Size();
+		if (mIndexBuffer) size += mIndexBuffer->Size();
+	}
+	if (mWeightBuffer) size += mWeightBuffer->Size();
+	for (auto& kp : mShapeKeys)
+		size += kp.second->Size();
+	return size;
+}
+uint64_t Mesh::HeapSize() const {
+	if (!mPooled) return ResidentSize();
+	// freeing the ranges only releases the pool's block if nothing else is in it
+	uint64_t size = mVertexBuffer ? mVertexBuffer->Device()->MeshPool()->ReleasableSize(mVertexBuffer.get()) : 0;
+	if (mWeightBuffer) size += mWeightBuffer->Size();
+	for (auto& kp : mShapeKeys)
+		size += kp.second->Size();
+	return size;
 }
\ No newline at end of file
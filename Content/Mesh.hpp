@@ -23,8 +23,34 @@ struct StdVertex {
 
 	ENGINE_EXPORT static const ::VertexInput VertexInput;
 };
+/// Compact vertex that Mesh::Cook writes when asked to quantize. Positions are unorm16 within the mesh bounds, and Mesh::VertexTransform() maps them
+/// back to object space. Normals and tangents are octahedral snorm16, the tangent's sign is stored in position[3], and uvs are half floats.
+/// Shaders decode it with the QUANTIZED_VERTEX keyword.
+struct QuantizedVertex {
+	uint16_t position[4];
+	int16_t normal[2];
+	int16_t tangent[2];
+	uint16_t uv[2];
+
+	ENGINE_EXPORT static const ::VertexInput VertexInput;
+};
 #pragma pack(pop)
 
+// Maximum number of triangles in a MeshCluster
+#define MESH_CLUSTER_SIZE 128
+
+/// A group of up to MESH_CLUSTER_SIZE nearby triangles, which are contiguous in the index buffer and culled together.
+/// The cluster faces away from every point p where dot(mCenter - p, mConeAxis) >= mConeCutoff * length(mCenter - p) + mRadius.
+struct MeshCluster {
+	float3 mCenter;
+	float mRadius;
+	float3 mConeAxis;
+	float mConeCutoff;
+	// relative to the mesh's BaseIndex
+	uint32_t mIndexOffset;
+	uint32_t mIndexCount;
+};
+
 class Bone : public virtual Object {
 public:
 	uint32_t mBoneIndex;
@@ -63,6 +89,12 @@ public:
 		const ::VertexInput* vertexInput, VkIndexType indexType, VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
 	ENGINE_EXPORT ~Mesh() override;
 
+	/// Imports a model file with assimp and writes it to a .stmesh file, which loads without assimp or any per-vertex processing.
+	/// Meshes that are loaded from other formats are cooked into Cache/ on first import automatically.
+	/// Triangles are grouped into MeshClusters along the BVH and reordered for the vertex cache and overdraw within each cluster,
+	/// and vertices are reordered for fetch locality. If quantize is true, meshes without bone weights or shape keys are stored as QuantizedVertex.
+	ENGINE_EXPORT static bool Cook(const std::string& filename, const std::string& cookedFile, float scale = 1.f, bool quantize = false);
+
 	// Creates a cube, using float3 vertices
 	ENGINE_EXPORT static Mesh* CreateCube(const std::string& name, Device* device, float radius = 1.f);
 	// Creates a plane facing the positive z axis, using StdVertex vertices
@@ -81,21 +113,40 @@ public:
 	inline uint32_t IndexCount() const { return mIndexCount; }
 	inline VkIndexType IndexType() const { return mIndexType; }
 
+	/// Clusters of the index buffer for culling, empty unless the mesh was cooked
+	inline const std::vector<MeshCluster>& Clusters() const { return mClusters; }
+
 	inline TriangleBvh2* BVH() const { return mBvh; }
 	ENGINE_EXPORT bool Intersect(const Ray& ray, float* t, bool any);
 
 	inline const ::VertexInput* VertexInput() const { return mVertexInput; }
+	/// Transform from vertex positions to object space, the identity unless the vertices are QuantizedVertex
+	inline const float4x4& VertexTransform() const { return mVertexTransform; }
 
 	inline AABB Bounds() const { return mBounds; }
 	inline void Bounds(const AABB& b) { mBounds = b; }
 
+	/// Square root of the mesh's area in uv space over its area in object space, so the uv distance of one object space unit.
+	/// Renderers request texture mip levels with it. 1 unless the mesh was cooked.
+	inline float UVDensity() const { return mUVDensity; }
+
 private:
 	friend class AssetManager;
-	ENGINE_EXPORT Mesh(const std::string& name, ::Device* device, const std::string& filename, float scale = 1.f);
+	ENGINE_EXPORT Mesh(const std::string& name, ::Device* device, const std::string& filename, float scale = 1.f, bool quantize = false);
+	/// Creates the buffers and BVH from the contents of a .stmesh file, returns false if the data isn't a valid .stmesh file
+	ENGINE_EXPORT bool LoadCooked(::Device* device, const uint8_t* data, size_t size);
+	ENGINE_EXPORT bool Swap(Asset* other) override;
+	/// Releases the buffers and BVH but keeps the bounds, so renderers are still culled and mark the mesh used while it has nothing to draw
+	ENGINE_EXPORT Asset* Evict() override;
+	ENGINE_EXPORT uint64_t ResidentSize() const override;
+	ENGINE_EXPORT uint64_t HeapSize() const override;
 
 	TriangleBvh2* mBvh;
 
+	// the vertices and indices are a range of the Device's MeshPool
+	bool mPooled;
 	const ::VertexInput* mVertexInput;
+	float4x4 mVertexTransform;
 	uint32_t mBaseVertex;
 	uint32_t mVertexCount;
 	VkDeviceSize mVertexSize;
@@ -107,6 +158,8 @@ private:
 	std::unordered_map<std::string, Animation*> mAnimations;
 
 	AABB mBounds;
+	float mUVDensity;
+	std::vector<MeshCluster> mClusters;
 	std::shared_ptr<Buffer> mWeightBuffer;
 	std::shared_ptr<Buffer> mIndexBuffer;
 
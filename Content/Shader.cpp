@@ -1,12 +1,20 @@
 #include <Content/Shader.hpp>
 #include <Stratum/ShaderCompiler.hpp>
 
+#include <algorithm>
 #include <string>
 
 using namespace std;
 
+uint32_t ShaderNameID(uint64_t nameHash) {
+	static unordered_map<uint64_t, uint32_t> ids;
+	static mutex idMutex;
+	lock_guard lock(idMutex);
+	return ids.emplace(nameHash, (uint32_t)ids.size()).first->second;
+}
+
 bool PipelineInstance::operator==(const PipelineInstance& rhs) const {
-	return rhs.mRenderPass == mRenderPass &&
+	return rhs.mRenderPassID == mRenderPassID &&
 		((!rhs.mVertexInput && !mVertexInput) || (rhs.mVertexInput && mVertexInput && *rhs.mVertexInput == *mVertexInput)) &&
 		mTopology == rhs.mTopology &&
 		mCullMode == rhs.mCullMode &&
@@ -132,7 +140,13 @@ Shader::Shader(const string& name, ::Device* device, const string& filename)
 
 		// create DescriptorSetLayouts
 		var->mDescriptorSetLayouts.resize(bindings.size());
-		for (uint32_t b = 0; b < bindings.size(); b++) {			
+		for (uint32_t b = 0; b < bindings.size(); b++) {
+			// the bindless set is shared by every shader
+			if (b == PER_BINDLESS && bindings[b].size() && mDevice->BindlessTable()) {
+				var->mDescriptorSetLayouts[b] = mDevice->BindlessTable()->Layout();
+				continue;
+			}
+
 			VkDescriptorSetLayoutBindingFlagsCreateInfoEXT extendedInfo = {};
 			extendedInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
 			extendedInfo.bindingCount = (uint32_t)bindingFlags[b].size();
@@ -147,6 +161,20 @@ Shader::Shader(const string& name, ::Device* device, const string& filename)
 			mDevice->SetObjectName(var->mDescriptorSetLayouts[b], mName + " DescriptorSetLayout", VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT);
 		}
 
+		// index bindings and push constants by name ID
+		var->mDescriptorBindingIDs.clear();
+		var->mPushConstantIDs.clear();
+		for (const auto& b : var->mDescriptorBindings) {
+			uint32_t id = ShaderNameID(b.first);
+			if (id >= var->mDescriptorBindingIDs.size()) var->mDescriptorBindingIDs.resize(id + 1, make_pair(~0u, VkDescriptorSetLayoutBinding {}));
+			var->mDescriptorBindingIDs[id] = b.second;
+		}
+		for (const auto& p : var->mPushConstants) {
+			uint32_t id = ShaderNameID(p.first);
+			if (id >= var->mPushConstantIDs.size()) var->mPushConstantIDs.resize(id + 1, VkPushConstantRange {});
+			var->mPushConstantIDs[id] = p.second;
+		}
+
 		// Create PipelineLayout
 		vector<VkPushConstantRange> constants;
 		unordered_map<VkShaderStageFlags, uint2> ranges;
@@ -165,6 +193,30 @@ Shader::Shader(const string& name, ::Device* device, const string& filename)
 			constants.back().size = r.second.y - r.second.x;
 		}
 
+		// split the push constant block into pieces that are covered by the same ranges, so that the whole block can be pushed at once
+		vector<uint32_t> bounds;
+		for (const auto& r : constants) {
+			bounds.push_back(r.offset);
+			bounds.push_back(r.offset + r.size);
+		}
+		sort(bounds.begin(), bounds.end());
+		bounds.erase(unique(bounds.begin(), bounds.end()), bounds.end());
+		var->mPushConstantRanges.clear();
+		var->mPushConstantSize = bounds.size() ? bounds.back() : 0;
+		for (uint32_t i = 1; i < bounds.size(); i++) {
+			VkPushConstantRange piece = {};
+			piece.offset = bounds[i - 1];
+			piece.size = bounds[i] - bounds[i - 1];
+			for (const auto& r : constants)
+				if (r.offset <= piece.offset && r.offset + r.size >= piece.offset + piece.size)
+					piece.stageFlags |= r.stageFlags;
+			if (!piece.stageFlags) continue;
+			if (var->mPushConstantRanges.size() && var->mPushConstantRanges.back().stageFlags == piece.stageFlags && var->mPushConstantRanges.back().offset + var->mPushConstantRanges.back().size == piece.offset)
+				var->mPushConstantRanges.back().size += piece.size;
+			else
+				var->mPushConstantRanges.push_back(piece);
+		}
+
 		VkPipelineLayoutCreateInfo layout = {};
 		layout.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 		layout.setLayoutCount = (uint32_t)var->mDescriptorSetLayouts.size();
@@ -216,16 +268,41 @@ Shader::Shader(const string& name, ::Device* device, const string& filename)
 	mBlendMode = compiled.mBlendMode;
 	mDepthStencilState = compiled.mDepthStencilState;
 }
+bool Shader::Swap(Asset* other) {
+	Shader* s = dynamic_cast<Shader*>(other);
+	if (!s) return false;
+	swap(mKeywords, s->mKeywords);
+	swap(mPassMask, s->mPassMask);
+	swap(mColorMask, s->mColorMask);
+	swap(mRenderQueue, s->mRenderQueue);
+	swap(mBlendMode, s->mBlendMode);
+	swap(mViewportState, s->mViewportState);
+	swap(mRasterizationState, s->mRasterizationState);
+	swap(mDepthStencilState, s->mDepthStencilState);
+	swap(mDynamicState, s->mDynamicState);
+	swap(mDynamicStates, s->mDynamicStates);
+	swap(mComputeVariants, s->mComputeVariants);
+	swap(mGraphicsVariants, s->mGraphicsVariants);
+	swap(mStaticSamplers, s->mStaticSamplers);
+	// pipelines are created from the states of the variant's shader
+	for (auto& g : mGraphicsVariants)
+		for (auto& v : g.second) v.second->mShader = this;
+	for (auto& g : s->mGraphicsVariants)
+		for (auto& v : g.second) v.second->mShader = s;
+	return true;
+}
 Shader::~Shader() {
 	for (auto& g : mStaticSamplers)
 		safe_delete(g);
 
 	for (auto& g : mGraphicsVariants) {
 		for (auto& v : g.second) {
+			v.second->WaitPipelines();
 			for (auto& s : v.second->mPipelines)
 				vkDestroyPipeline(*mDevice, s.second, nullptr);
 			for (auto& s : v.second->mDescriptorSetLayouts)
-				vkDestroyDescriptorSetLayout(*mDevice, s, nullptr);
+				if (!mDevice->BindlessTable() || s != mDevice->BindlessTable()->Layout())
+					vkDestroyDescriptorSetLayout(*mDevice, s, nullptr);
 			vkDestroyPipelineLayout(*mDevice, v.second->mPipelineLayout, nullptr);
 			for (auto& s : v.second->mStages)
 				vkDestroyShaderModule(*mDevice, s.module, nullptr);
@@ -235,7 +312,8 @@ Shader::~Shader() {
 	for (auto& s : mComputeVariants) {
 		for (auto& v : s.second) {
 			for (auto& l : v.second->mDescriptorSetLayouts)
-				vkDestroyDescriptorSetLayout(*mDevice, l, nullptr);
+				if (!mDevice->BindlessTable() || l != mDevice->BindlessTable()->Layout())
+					vkDestroyDescriptorSetLayout(*mDevice, l, nullptr);
 			vkDestroyPipeline(*mDevice, v.second->mPipeline, nullptr);
 			vkDestroyPipelineLayout(*mDevice, v.second->mPipelineLayout, nullptr);
 			vkDestroyShaderModule(*mDevice, v.second->mStage.module, nullptr);
@@ -244,141 +322,239 @@ Shader::~Shader() {
 	}
 }
 
+VkPipeline GraphicsShader::CreatePipeline(VkRenderPass renderPass, uint32_t colorAttachmentCount, VkSampleCountFlagBits samples, const VertexInput* vertexInput, VkPrimitiveTopology topology, VkCullModeFlags cull, BlendMode blend, VkPolygonMode poly) {
+	VkPipelineColorBlendAttachmentState bs = {};
+	bs.colorWriteMask = mShader->mColorMask;
+	switch (blend) {
+	case BLEND_MODE_OPAQUE:
+		bs.blendEnable = VK_FALSE;
+		bs.colorBlendOp = VK_BLEND_OP_ADD;
+		bs.alphaBlendOp = VK_BLEND_OP_ADD;
+		bs.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+		bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+		break;
+	case BLEND_MODE_ALPHA:
+		bs.blendEnable = VK_TRUE;
+		bs.colorBlendOp = VK_BLEND_OP_ADD;
+		bs.alphaBlendOp = VK_BLEND_OP_ADD;
+		bs.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+		bs.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+		bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+		bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+		break;
+	case BLEND_MODE_ADDITIVE:
+		bs.blendEnable = VK_TRUE;
+		bs.colorBlendOp = VK_BLEND_OP_ADD;
+		bs.alphaBlendOp = VK_BLEND_OP_ADD;
+		bs.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		break;
+	case BLEND_MODE_MULTIPLY:
+		bs.blendEnable = VK_TRUE;
+		bs.colorBlendOp = VK_BLEND_OP_MULTIPLY_EXT;
+		bs.alphaBlendOp = VK_BLEND_OP_MULTIPLY_EXT;
+		bs.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		break;
+	}
+	vector<VkPipelineColorBlendAttachmentState> blendAttachmentStates(colorAttachmentCount);
+	for (uint32_t i = 0; i < blendAttachmentStates.size(); i++) blendAttachmentStates[i] = bs;
+
+	VkPipelineRasterizationStateCreateInfo rasterState = mShader->mRasterizationState;
+	rasterState.cullMode = cull;
+	rasterState.polygonMode = poly;
+
+	VkPipelineColorBlendStateCreateInfo blendState = {};
+	blendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	blendState.attachmentCount = (uint32_t)blendAttachmentStates.size();
+	blendState.pAttachments = blendAttachmentStates.data();
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = {};
+	inputAssemblyState.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssemblyState.topology = topology;
+	inputAssemblyState.primitiveRestartEnable = VK_FALSE;
+
+	VkPipelineVertexInputStateCreateInfo vinput = {};
+	vinput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	if (vertexInput) {
+		vinput.vertexBindingDescriptionCount = (uint32_t)vertexInput->mBindings.size();
+		vinput.pVertexBindingDescriptions = vertexInput->mBindings.data();
+		vinput.vertexAttributeDescriptionCount = (uint32_t)vertexInput->mAttributes.size();
+		vinput.pVertexAttributeDescriptions = vertexInput->mAttributes.data();
+	} else {
+		vinput.vertexBindingDescriptionCount = 0;
+		vinput.pVertexBindingDescriptions = nullptr;
+		vinput.vertexAttributeDescriptionCount = 0;
+		vinput.pVertexAttributeDescriptions = nullptr;
+	}
+
+	VkPipelineMultisampleStateCreateInfo multisampleState = {};
+	multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampleState.sampleShadingEnable = VK_FALSE;
+	multisampleState.rasterizationSamples = samples;
+
+	VkGraphicsPipelineCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	info.stageCount = 2;
+	info.pStages = mStages;
+	info.pInputAssemblyState = &inputAssemblyState;
+	info.pVertexInputState = &vinput;
+	info.pTessellationState = nullptr;
+	info.pViewportState = &mShader->mViewportState;
+	info.pRasterizationState = &rasterState;
+	info.pMultisampleState = &multisampleState;
+	info.pDepthStencilState = &mShader->mDepthStencilState;
+	info.pColorBlendState = &blendState;
+	info.pDynamicState = &mShader->mDynamicState;
+	info.layout = mPipelineLayout;
+	info.basePipelineIndex = -1;
+	info.basePipelineHandle = VK_NULL_HANDLE;
+	info.renderPass = renderPass;
+
+	#pragma region print
+	const char* cullstr = "";
+	if (cull == VK_CULL_MODE_NONE) cullstr = "VK_CULL_MODE_NONE";
+	if (cull & VK_CULL_MODE_BACK_BIT) cullstr = "VK_CULL_MODE_BACK";
+	if (cull & VK_CULL_MODE_FRONT_BIT) cullstr = "VK_CULL_MODE_FRONT";
+	if (cull == VK_CULL_MODE_FRONT_AND_BACK) cullstr = "VK_CULL_MODE_FRONT_AND_BACK";
+
+	const char* blendstr = "";
+	switch (blend) {
+	case BLEND_MODE_OPAQUE: blendstr = "Opaque"; break;
+	case BLEND_MODE_ALPHA:  blendstr = "Alpha"; break;
+	case BLEND_MODE_ADDITIVE: blendstr = "Additive"; break;
+	case BLEND_MODE_MULTIPLY: blendstr = "Multiply"; break;
+	}
+
+	string kw = "";
+	for (const auto& p : mShader->mGraphicsVariants)
+		for (const auto& k : p.second)
+			if (k.second == this) {
+				kw = k.first;
+				break;
+			}
+	printf_color(COLOR_CYAN, "%s [%s]: Generating graphics pipeline %s %s %s\n", mShader->mName.c_str(), kw.c_str(), blendstr, cullstr, TopologyToString(topology));
+	#pragma endregion
+
+	VkPipeline p;
+	if (vkCreateGraphicsPipelines(*mShader->mDevice, mShader->mDevice->PipelineCache(), 1, &info, nullptr, &p) != VK_SUCCESS) {
+		fprintf_color(COLOR_RED, stderr, "%s [%s]: Failed to create graphics pipeline\n", mShader->mName.c_str(), kw.c_str());
+		return VK_NULL_HANDLE;
+	}
+	mShader->mDevice->SetObjectName(p, mShader->mName + " Variant", VK_OBJECT_TYPE_PIPELINE);
+	return p;
+}
 VkPipeline GraphicsShader::GetPipeline(RenderPass* renderPass, const VertexInput* vertexInput, VkPrimitiveTopology topology, VkCullModeFlags cullMode, BlendMode blendMode, VkPolygonMode polyMode) {
+	return GetPipeline(renderPass, vertexInput, topology, cullMode, blendMode, polyMode, !mShader->mDevice->AsyncPipelineCompilation());
+}
+VkPipeline GraphicsShader::GetPipeline(RenderPass* renderPass, const VertexInput* vertexInput, VkPrimitiveTopology topology, VkCullModeFlags cullMode, BlendMode blendMode, VkPolygonMode polyMode, bool wait) {
 	BlendMode blend = blendMode == BLEND_MODE_MAX_ENUM ? mShader->mBlendMode : blendMode;
 	VkCullModeFlags cull = cullMode == VK_CULL_MODE_FLAG_BITS_MAX_ENUM ? mShader->mRasterizationState.cullMode : cullMode;
 	VkPolygonMode poly = polyMode == VK_POLYGON_MODE_MAX_ENUM ? mShader->mRasterizationState.polygonMode : polyMode;
-	PipelineInstance instance(*renderPass, vertexInput, topology, cull, blendMode, poly);
-
-	if (mPipelines.count(instance))
-		return mPipelines.at(instance);
-	else {
-		VkPipelineColorBlendAttachmentState bs = {};
-		bs.colorWriteMask = mShader->mColorMask;
-		switch (blend) {
-		case BLEND_MODE_OPAQUE:
-			bs.blendEnable = VK_FALSE;
-			bs.colorBlendOp = VK_BLEND_OP_ADD;
-			bs.alphaBlendOp = VK_BLEND_OP_ADD;
-			bs.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
-			bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-			break;
-		case BLEND_MODE_ALPHA:
-			bs.blendEnable = VK_TRUE;
-			bs.colorBlendOp = VK_BLEND_OP_ADD;
-			bs.alphaBlendOp = VK_BLEND_OP_ADD;
-			bs.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-			bs.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-			bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-			bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-			break;
-		case BLEND_MODE_ADDITIVE:
-			bs.blendEnable = VK_TRUE;
-			bs.colorBlendOp = VK_BLEND_OP_ADD;
-			bs.alphaBlendOp = VK_BLEND_OP_ADD;
-			bs.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-			break;
-		case BLEND_MODE_MULTIPLY:
-			bs.blendEnable = VK_TRUE;
-			bs.colorBlendOp = VK_BLEND_OP_MULTIPLY_EXT;
-			bs.alphaBlendOp = VK_BLEND_OP_MULTIPLY_EXT;
-			bs.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-			break;
-		}
-		vector<VkPipelineColorBlendAttachmentState> blendAttachmentStates(renderPass->ColorAttachmentCount());
-		for (uint32_t i = 0; i < blendAttachmentStates.size(); i++) blendAttachmentStates[i] = bs;
-
-		VkPipelineRasterizationStateCreateInfo rasterState = mShader->mRasterizationState;
-		if (cullMode != VK_CULL_MODE_FLAG_BITS_MAX_ENUM) rasterState.cullMode = cullMode;
-		if (polyMode != VK_POLYGON_MODE_MAX_ENUM) rasterState.polygonMode = polyMode;
-
-		VkPipelineColorBlendStateCreateInfo blendState = {};
-		blendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-		blendState.attachmentCount = (uint32_t)blendAttachmentStates.size();
-		blendState.pAttachments = blendAttachmentStates.data();
-
-		VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = {};
-		inputAssemblyState.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-		inputAssemblyState.topology = topology;
-		inputAssemblyState.primitiveRestartEnable = VK_FALSE;
-
-		VkPipelineVertexInputStateCreateInfo vinput = {};
-		vinput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-		if (vertexInput) {
-			vinput.vertexBindingDescriptionCount = (uint32_t)vertexInput->mBindings.size();
-			vinput.pVertexBindingDescriptions = vertexInput->mBindings.data();
-			vinput.vertexAttributeDescriptionCount = (uint32_t)vertexInput->mAttributes.size();
-			vinput.pVertexAttributeDescriptions = vertexInput->mAttributes.data();
-		} else {
-			vinput.vertexBindingDescriptionCount = 0;
-			vinput.pVertexBindingDescriptions = nullptr;
-			vinput.vertexAttributeDescriptionCount = 0;
-			vinput.pVertexAttributeDescriptions = nullptr;
+	PipelineInstance instance(renderPass->ID(), vertexInput, topology, cull, blendMode, poly);
+
+	lock_guard lock(mPipelineMutex);
+	auto it = mPipelines.find(instance);
+	if (it != mPipelines.end()) return it->second;
+
+	::Device* device = mShader->mDevice;
+	auto pending = mPendingPipelines.find(instance);
+	if (pending == mPendingPipelines.end()) {
+		{
+			lock_guard pendingLock(device->mPendingPipelineMutex);
+			device->mRenderPassShaders[renderPass->ID()].insert(this);
 		}
 
-		VkPipelineMultisampleStateCreateInfo multisampleState = {};
-		multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-		multisampleState.sampleShadingEnable = VK_FALSE;
-		multisampleState.rasterizationSamples = renderPass->RasterizationSamples();
-
-		VkGraphicsPipelineCreateInfo info = {};
-		info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-		info.stageCount = 2;
-		info.pStages = mStages;
-		info.pInputAssemblyState = &inputAssemblyState;
-		info.pVertexInputState = &vinput;
-		info.pTessellationState = nullptr;
-		info.pViewportState = &mShader->mViewportState;
-		info.pRasterizationState = &rasterState;
-		info.pMultisampleState = &multisampleState;
-		info.pDepthStencilState = &mShader->mDepthStencilState;
-		info.pColorBlendState = &blendState;
-		info.pDynamicState = &mShader->mDynamicState;
-		info.layout = mPipelineLayout;
-		info.basePipelineIndex = -1;
-		info.basePipelineHandle = VK_NULL_HANDLE;
-		info.renderPass = *renderPass;
-
-		#pragma region print
-		const char* cullstr = "";
-		if (cullMode == VK_CULL_MODE_NONE) cullstr = "VK_CULL_MODE_NONE";
-		if (cullMode & VK_CULL_MODE_BACK_BIT) cullstr = "VK_CULL_MODE_BACK";
-		if (cullMode & VK_CULL_MODE_FRONT_BIT) cullstr = "VK_CULL_MODE_FRONT";
-		if (cullMode == VK_CULL_MODE_FRONT_AND_BACK) cullstr = "VK_CULL_MODE_FRONT_AND_BACK";
-
-		const char* blendstr = "";
-		switch (blend) {
-		case BLEND_MODE_OPAQUE: blendstr = "Opaque"; break;
-		case BLEND_MODE_ALPHA:  blendstr = "Alpha"; break;
-		case BLEND_MODE_ADDITIVE: blendstr = "Additive"; break;
-		case BLEND_MODE_MULTIPLY: blendstr = "Multiply"; break;
+		if (wait) {
+			VkPipeline p = CreatePipeline(*renderPass, renderPass->ColorAttachmentCount(), renderPass->RasterizationSamples(), vertexInput, topology, cull, blend, poly);
+			mPipelines.emplace(instance, p);
+			return p;
 		}
 
-		string kw = "";
-		for (const auto& p : mShader->mGraphicsVariants)
-			for (const auto& k : p.second)
-				if (k.second == this) {
-					kw = k.first;
-					break;
-				}
-		printf_color(COLOR_CYAN, "%s [%s]: Generating graphics pipeline %s %s %s\n", mShader->mName.c_str(), kw.c_str(), blendstr, cullstr, TopologyToString(topology));
-		#pragma endregion
-
-		VkPipeline p;
-		vkCreateGraphicsPipelines(*mShader->mDevice, mShader->mDevice->PipelineCache(), 1, &info, nullptr, &p);
-		mShader->mDevice->SetObjectName(p, mShader->mName + " Variant", VK_OBJECT_TYPE_PIPELINE);
-		mPipelines.emplace(instance, p);
+		// copy everything the job needs, the vertex input may be gone by the time it runs.
+		// The render pass cancels the job if it is destroyed first, and the last job using the VkRenderPass destroys it
+		VkRenderPass vkRenderPass = *renderPass;
+		uint32_t colorAttachmentCount = renderPass->ColorAttachmentCount();
+		VkSampleCountFlagBits samples = renderPass->RasterizationSamples();
+		optional<VertexInput> input;
+		if (vertexInput) input = *vertexInput;
+
+		device->mPendingPipelineCount++;
+		{
+			lock_guard pendingLock(device->mPendingPipelineMutex);
+			device->mPendingRenderPasses.emplace(vkRenderPass, ::Device::PendingRenderPass{ 0, false }).first->second.mPipelineCount++;
+		}
+		pending = mPendingPipelines.emplace(instance, device->Instance()->ThreadPool()->Enqueue([=]() {
+			bool cancelled;
+			{
+				lock_guard pendingLock(device->mPendingPipelineMutex);
+				cancelled = device->mPendingRenderPasses.at(vkRenderPass).mCancelled;
+			}
+			VkPipeline p = cancelled ? VK_NULL_HANDLE : CreatePipeline(vkRenderPass, colorAttachmentCount, samples, input ? &*input : nullptr, topology, cull, blend, poly);
+			device->mPendingPipelineCount--;
+
+			lock_guard pendingLock(device->mPendingPipelineMutex);
+			auto it = device->mPendingRenderPasses.find(vkRenderPass);
+			if (it->second.mCancelled && p != VK_NULL_HANDLE) {
+				// the render pass was destroyed while compiling, nothing can draw with the pipeline
+				vkDestroyPipeline(*device, p, nullptr);
+				p = VK_NULL_HANDLE;
+			}
+			if (--it->second.mPipelineCount == 0) {
+				if (it->second.mCancelled) vkDestroyRenderPass(*device, vkRenderPass, nullptr);
+				device->mPendingRenderPasses.erase(it);
+			}
+			return p;
+		})).first;
+	}
 
-		return p;
+	if (!wait && pending->second.wait_for(chrono::seconds(0)) != future_status::ready) return VK_NULL_HANDLE;
+	VkPipeline p = pending->second.get();
+	mPendingPipelines.erase(pending);
+	mPipelines.emplace(instance, p);
+	return p;
+}
+void GraphicsShader::PrewarmPipeline(RenderPass* renderPass, const VertexInput* vertexInput, VkPrimitiveTopology topology, VkCullModeFlags cullMode, BlendMode blendMode, VkPolygonMode polyMode) {
+	GetPipeline(renderPass, vertexInput, topology, cullMode, blendMode, polyMode, false);
+}
+void GraphicsShader::WaitPipelines() {
+	lock_guard lock(mPipelineMutex);
+	for (auto& p : mPendingPipelines) {
+		VkPipeline pipeline = p.second.get();
+		// cancelled pipelines have no result
+		if (pipeline != VK_NULL_HANDLE) mPipelines.emplace(p.first, pipeline);
 	}
+	mPendingPipelines.clear();
+}
+void GraphicsShader::ReleaseRenderPass(uint64_t renderPassID) {
+	lock_guard lock(mPipelineMutex);
+	for (auto it = mPipelines.begin(); it != mPipelines.end();)
+		if (it->first.mRenderPassID == renderPassID) {
+			vkDestroyPipeline(*mShader->mDevice, it->second, nullptr);
+			it = mPipelines.erase(it);
+		} else
+			it++;
+	// jobs that haven't finished see that the render pass is cancelled and return VK_NULL_HANDLE.
+	// They reference the shader, so their futures stay until WaitPipelines
+	for (auto it = mPendingPipelines.begin(); it != mPendingPipelines.end();)
+		if (it->first.mRenderPassID == renderPassID && it->second.wait_for(chrono::seconds(0)) == future_status::ready) {
+			VkPipeline p = it->second.get();
+			if (p != VK_NULL_HANDLE) vkDestroyPipeline(*mShader->mDevice, p, nullptr);
+			it = mPendingPipelines.erase(it);
+		} else
+			it++;
+}
+GraphicsShader::~GraphicsShader() {
+	if (!mShader) return;
+	lock_guard lock(mShader->mDevice->mPendingPipelineMutex);
+	for (auto& s : mShader->mDevice->mRenderPassShaders)
+		s.second.erase(this);
 }
 
 GraphicsShader* Shader::GetGraphics(PassType pass, const set<string>& keywords) const {
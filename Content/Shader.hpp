@@ -8,15 +8,15 @@
 class Shader;
 
 struct PipelineInstance {
-	VkRenderPass mRenderPass;
+	uint64_t mRenderPassID;
 	const VertexInput* mVertexInput;
 	VkPrimitiveTopology mTopology;
 	VkCullModeFlags mCullMode;
 	BlendMode mBlendMode;
 	VkPolygonMode mPolygonMode;
 
-	inline PipelineInstance(VkRenderPass renderPass, const VertexInput* vertexInput, VkPrimitiveTopology topology, VkCullModeFlags cullMode, BlendMode blendMode, VkPolygonMode polyMode)
-		: mRenderPass(renderPass), mVertexInput(vertexInput), mTopology(topology), mCullMode(cullMode), mBlendMode(blendMode), mPolygonMode(polyMode) {};
+	inline PipelineInstance(uint64_t renderPassID, const VertexInput* vertexInput, VkPrimitiveTopology topology, VkCullModeFlags cullMode, BlendMode blendMode, VkPolygonMode polyMode)
+		: mRenderPassID(renderPassID), mVertexInput(vertexInput), mTopology(topology), mCullMode(cullMode), mBlendMode(blendMode), mPolygonMode(polyMode) {};
 
 	ENGINE_EXPORT bool operator==(const PipelineInstance& rhs) const;
 };
@@ -26,7 +26,7 @@ namespace std {
 	struct hash<PipelineInstance> {
 		inline std::size_t operator()(const  PipelineInstance& p) const {
 			std::size_t h = 0;
-			hash_combine(h, p.mRenderPass);
+			hash_combine(h, p.mRenderPassID);
 			if (p.mVertexInput) hash_combine(h, *p.mVertexInput);
 			hash_combine(h, p.mTopology);
 			hash_combine(h, p.mCullMode);
@@ -37,14 +37,45 @@ namespace std {
 	};
 }
 
+/// FNV-1a hash of a descriptor binding or push constant name, evaluated at compile time for string literals
+constexpr uint64_t ShaderNameHash(const char* name) {
+	uint64_t h = 0xcbf29ce484222325ull;
+	while (*name) {
+		h ^= (uint8_t)*name++;
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+/// Returns the small integer ID of a descriptor binding or push constant name. Names are assigned IDs the first time they are seen.
+ENGINE_EXPORT uint32_t ShaderNameID(uint64_t nameHash);
+inline uint32_t ShaderNameID(const std::string& name) { return ShaderNameID(ShaderNameHash(name.c_str())); }
+/// ID of a string literal name, hashed at compile time and looked up once per call site
+#define SHADER_NAME_ID(name) ([]() { static const uint32_t id = ShaderNameID(std::integral_constant<uint64_t, ShaderNameHash(name)>::value); return id; }())
+
 class ShaderVariant {
 public:
 	VkPipelineLayout mPipelineLayout;
 	std::vector<VkDescriptorSetLayout> mDescriptorSetLayouts;
 	std::unordered_map<std::string, std::pair<uint32_t, VkDescriptorSetLayoutBinding>> mDescriptorBindings; // descriptorset, binding
 	std::unordered_map<std::string, VkPushConstantRange> mPushConstants;
-
-	inline ShaderVariant() : mPipelineLayout(VK_NULL_HANDLE) {}
+	/// mDescriptorBindings and mPushConstants indexed by ShaderNameID, with empty entries for names the variant doesn't use
+	std::vector<std::pair<uint32_t, VkDescriptorSetLayoutBinding>> mDescriptorBindingIDs;
+	std::vector<VkPushConstantRange> mPushConstantIDs;
+	/// Non-overlapping pieces of the push constant block, each with the stages of every range that covers it
+	std::vector<VkPushConstantRange> mPushConstantRanges;
+	/// Size of the push constant block, in bytes
+	uint32_t mPushConstantSize;
+
+	inline ShaderVariant() : mPipelineLayout(VK_NULL_HANDLE), mPushConstantSize(0) {}
+
+	/// Returns the descriptor set and binding of a ShaderNameID, or nullptr if the variant doesn't have it
+	inline const std::pair<uint32_t, VkDescriptorSetLayoutBinding>* DescriptorBinding(uint32_t id) const {
+		return id < mDescriptorBindingIDs.size() && mDescriptorBindingIDs[id].first != ~0u ? &mDescriptorBindingIDs[id] : nullptr;
+	}
+	/// Returns the push constant range of a ShaderNameID, or nullptr if the variant doesn't have it
+	inline const VkPushConstantRange* PushConstant(uint32_t id) const {
+		return id < mPushConstantIDs.size() && mPushConstantIDs[id].size ? &mPushConstantIDs[id] : nullptr;
+	}
 	inline virtual ~ShaderVariant() {}
 };
 class ComputeShader : public ShaderVariant {
@@ -64,11 +95,34 @@ public:
 	Shader* mShader;
 
 	inline GraphicsShader() : ShaderVariant() { mShader = nullptr; mStages[0] = {}; mStages[1] = {}; }
+	ENGINE_EXPORT ~GraphicsShader() override;
+	/// Returns the pipeline for a combination of states. When the Device compiles pipelines asynchronously, the first call queues the
+	/// pipeline on the Instance's ThreadPool and VK_NULL_HANDLE is returned until it is done, so draws using it should be skipped.
 	ENGINE_EXPORT VkPipeline GetPipeline(RenderPass* renderPass, const VertexInput* vertexInput,
 		VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
 		VkCullModeFlags cullMode = VK_CULL_MODE_FLAG_BITS_MAX_ENUM,
 		BlendMode blendMode = BLEND_MODE_MAX_ENUM,
 		VkPolygonMode polyMode = VK_POLYGON_MODE_MAX_ENUM);
+	/// Same as GetPipeline, but blocks until the pipeline is compiled if wait is true, and never blocks otherwise
+	ENGINE_EXPORT VkPipeline GetPipeline(RenderPass* renderPass, const VertexInput* vertexInput,
+		VkPrimitiveTopology topology, VkCullModeFlags cullMode, BlendMode blendMode, VkPolygonMode polyMode, bool wait);
+	/// Queues a pipeline for compilation in the background, so that it is ready by the time it is drawn with
+	ENGINE_EXPORT void PrewarmPipeline(RenderPass* renderPass, const VertexInput* vertexInput,
+		VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+		VkCullModeFlags cullMode = VK_CULL_MODE_FLAG_BITS_MAX_ENUM,
+		BlendMode blendMode = BLEND_MODE_MAX_ENUM,
+		VkPolygonMode polyMode = VK_POLYGON_MODE_MAX_ENUM);
+	/// Blocks until every queued pipeline is compiled
+	ENGINE_EXPORT void WaitPipelines();
+	/// Destroys the pipelines created for a render pass, and the results of its queued pipelines that are done. Called by Device when the render pass is destroyed.
+	ENGINE_EXPORT void ReleaseRenderPass(uint64_t renderPassID);
+
+private:
+	std::unordered_map<PipelineInstance, std::future<VkPipeline>> mPendingPipelines;
+	std::mutex mPipelineMutex;
+
+	ENGINE_EXPORT VkPipeline CreatePipeline(VkRenderPass renderPass, uint32_t colorAttachmentCount, VkSampleCountFlagBits samples, const VertexInput* vertexInput,
+		VkPrimitiveTopology topology, VkCullModeFlags cull, BlendMode blend, VkPolygonMode poly);
 };
 
 class Shader : public Asset {
@@ -85,11 +139,13 @@ public:
 	inline ::Device* Device() const { return mDevice; }
 	inline PassType PassMask() const { return mPassMask; }
 	inline uint32_t RenderQueue() const { return mRenderQueue; }
+	inline bool HasKeyword(const std::string& kw) const { return mKeywords.count(kw); }
 
 private:
 	friend class GraphicsShader;
 	friend class AssetManager;
 	ENGINE_EXPORT Shader(const std::string& name, ::Device* device, const std::string& filename);
+	ENGINE_EXPORT bool Swap(Asset* other) override;
 
 	::Device* mDevice;
 
@@ -4,11 +4,25 @@
 
 #include <Core/Buffer.hpp>
 #include <Core/CommandBuffer.hpp>
+#include <Core/Instance.hpp>
+#include <Util/MappedFile.hpp>
+#include <Util/MipGenerator.hpp>
 #include <Util/Util.hpp>
+#include <Stratum/TextureCooker.hpp>
 #include <ThirdParty/stb_image.h>
 
 using namespace std;
 
+struct Texture::MipStream {
+	// KTX2 files stay mapped while they stream, decoded images keep the mip chain MipGenerator made
+	MappedFile mFile;
+	vector<uint8_t> mPixels;
+	const uint8_t* mData;
+	vector<VkDeviceSize> mLevelOffsets;
+	vector<VkDeviceSize> mLevelSizes;
+	VkDeviceSize mAlignment;
+};
+
 uint8_t* load(const string& filename, bool srgb, uint32_t& pixelSize, int32_t& x, int32_t& y, int32_t& channels, VkFormat& format) {
 	uint8_t* pixels = nullptr;
 	pixelSize = 0;
@@ -52,7 +66,12 @@ uint8_t* load(const string& filename, bool srgb, uint32_t& pixelSize, int32_t& x
 	return pixels;
 }
 
-Texture::Texture(const string& name, Device* device, const string& filename, bool srgb) : mName(name), mDevice(device), mMemory({}) {
+Texture::Texture(const string& name, Device* device, const string& filename, bool srgb) : mName(name), mDevice(device), mMemory({}), mUploadToken(0), mStream(nullptr), mResidentLevel(0), mRequestedLevel(~0u), mViewRevision(0), mSrgb(false), mRequestedFrame(0) {
+	if (fs::path(filename).extension() == ".ktx2") {
+		LoadKtx2(filename);
+		return;
+	}
+
 	int32_t x, y, channels;
 	uint32_t size;
 	uint8_t* pixels = load(filename, srgb, size, x, y, channels, mFormat);
@@ -67,36 +86,159 @@ Texture::Texture(const string& name, Device* device, const string& filename, boo
 	mUsage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
 	mMemoryProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
 
-	CreateImage();
-	CreateImageView(VK_IMAGE_ASPECT_COLOR_BIT);
+	if (max(mWidth, mHeight) > TEXTURE_STREAM_TAIL_SIZE && MipGenerator::Supported(mFormat)) {
+		// the mip chain is generated on the CPU so that levels can be streamed in as they are requested. The levels up to TEXTURE_STREAM_TAIL_SIZE
+		// are box filtered from a point sampled copy of the image and uploaded right away, and the Kaiser filtered chain is generated on the ThreadPool.
+		VkDeviceSize pixelSize = FormatSize(mFormat);
+		uint32_t tailLevel = StreamTailLevel();
+		// each pixel of the tail averages 4x4 samples
+		uint32_t sampleLevel = tailLevel - min(tailLevel, 2u);
+		uint32_t sampleWidth = max(mWidth >> sampleLevel, 1u);
+		uint32_t sampleHeight = max(mHeight >> sampleLevel, 1u);
+		vector<uint8_t> samples((size_t)sampleWidth * sampleHeight * pixelSize);
+		for (uint32_t y = 0; y < sampleHeight; y++) {
+			uint32_t sy = min((y << sampleLevel) + (1u << sampleLevel) / 2, mHeight - 1);
+			for (uint32_t x = 0; x < sampleWidth; x++) {
+				uint32_t sx = min((x << sampleLevel) + (1u << sampleLevel) / 2, mWidth - 1);
+				memcpy(samples.data() + ((size_t)y * sampleWidth + x) * pixelSize, pixels + ((size_t)sy * mWidth + sx) * pixelSize, pixelSize);
+			}
+		}
+		mStream = make_unique<MipStream>();
+		vector<VkDeviceSize> sampleOffsets;
+		MipGenerator::Generate(samples.data(), mFormat, sampleWidth, sampleHeight, 1, 1, mMipLevels - sampleLevel, MIP_FILTER_BOX, nullptr, mStream->mPixels, sampleOffsets);
+		mStream->mData = mStream->mPixels.data();
+		mStream->mLevelOffsets.resize(mMipLevels);
+		mStream->mLevelSizes.resize(mMipLevels);
+		for (uint32_t i = sampleLevel; i < mMipLevels; i++) {
+			uint32_t s = i - sampleLevel;
+			mStream->mLevelOffsets[i] = sampleOffsets[s];
+			mStream->mLevelSizes[i] = (s + 1 < sampleOffsets.size() ? sampleOffsets[s + 1] : mStream->mPixels.size()) - sampleOffsets[s];
+		}
+		mStream->mAlignment = pixelSize * 4;
+		CreateStreamedImage();
+		mStream.reset();
+
+		mFilename = filename;
+		mSrgb = srgb;
+		shared_ptr<uint8_t> image(pixels, stbi_image_free);
+		VkFormat format = mFormat;
+		uint32_t width = mWidth, height = mHeight, mipLevels = mMipLevels;
+		ThreadPool* threadPool = mDevice->Instance()->ThreadPool();
+		mPendingStream = threadPool->Enqueue([=]() { return GenerateStream(image, filename, srgb, format, width, height, mipLevels, threadPool); });
+		return;
+	}
 
-	VkBufferImageCopy copyRegion = {};
-	copyRegion.bufferOffset = 0;
-	copyRegion.bufferRowLength = 0;
-	copyRegion.bufferImageHeight = 0;
-	copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	copyRegion.imageSubresource.mipLevel = 0;
-	copyRegion.imageSubresource.baseArrayLayer = 0;
-	copyRegion.imageSubresource.layerCount = 1;
-	copyRegion.imageOffset = { 0, 0, 0 };
-	copyRegion.imageExtent = { mWidth, mHeight, 1 };
+	CreateImage(pixels, mWidth * mHeight * size * channels);
 
-	VkDeviceSize dataSize = mWidth * mHeight * size * channels;
+	stbi_image_free(pixels);
 
-	Buffer uploadBuffer(name + " Copy", mDevice, pixels, dataSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	//printf("Loaded %s: %dx%d %s\n", filename.c_str(), mWidth, mHeight, FormatToString(mFormat));
+}
+unique_ptr<Texture::MipStream> Texture::GenerateStream(shared_ptr<uint8_t> pixels, const string& filename, bool srgb,
+	VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, ThreadPool* threadPool) {
+	if (!pixels) {
+		int32_t x, y, channels;
+		uint32_t size;
+		VkFormat fileFormat;
+		pixels = shared_ptr<uint8_t>(load(filename, srgb, size, x, y, channels, fileFormat), stbi_image_free);
+		// the file changed, the AssetManager reloads the texture
+		if ((uint32_t)x != width || (uint32_t)y != height || fileFormat != format) return nullptr;
+	}
+	unique_ptr<MipStream> stream = make_unique<MipStream>();
+	MipGenerator::Generate(pixels.get(), format, width, height, 1, 1, mipLevels, MIP_FILTER_KAISER, threadPool, stream->mPixels, stream->mLevelOffsets);
+	stream->mData = stream->mPixels.data();
+	stream->mLevelSizes.resize(mipLevels);
+	for (uint32_t i = 0; i < mipLevels; i++)
+		stream->mLevelSizes[i] = (i + 1 < mipLevels ? stream->mLevelOffsets[i + 1] : stream->mPixels.size()) - stream->mLevelOffsets[i];
+	stream->mAlignment = FormatSize(format) * 4;
+	return stream;
+}
+
+void Texture::LoadKtx2(const string& filename) {
+	// the file stays mapped if the texture streams, and is unmapped if loading throws
+	mStream = make_unique<MipStream>();
+	MappedFile& file = mStream->mFile;
+	if (!file.Open(filename) || file.Size() < sizeof(Ktx2Header)) {
+		fprintf_color(COLOR_RED_BOLD, stderr, "Failed to load image: %s\n", filename.c_str());
+		throw;
+	}
 
-	auto commandBuffer = mDevice->GetCommandBuffer();
-	TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer.get());
-	vkCmdCopyBufferToImage(*commandBuffer, uploadBuffer, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
-	GenerateMipMaps(commandBuffer.get());
-	mDevice->Execute(commandBuffer, false)->Wait();
+	const Ktx2Header* header = (const Ktx2Header*)file.Data();
+	const uint8_t identifier[12] = KTX2_IDENTIFIER;
+	if (memcmp(header->mIdentifier, identifier, sizeof(identifier)) || header->mSupercompressionScheme != 0 || header->mLayerCount > 1 ||
+		(header->mFaceCount != 1 && header->mFaceCount != 6) || file.Size() < sizeof(Ktx2Header) + sizeof(Ktx2Level) * max(header->mLevelCount, 1u)) {
+		fprintf_color(COLOR_RED_BOLD, stderr, "Unsupported KTX2 file: %s\n", filename.c_str());
+		throw;
+	}
+	const Ktx2Level* levels = (const Ktx2Level*)(file.Data() + sizeof(Ktx2Header));
+
+	mFormat = (VkFormat)header->mVkFormat;
+	// compressed formats are only available if the device enables them (e.g. textureCompressionBC)
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(mDevice->PhysicalDevice(), mFormat, &properties);
+	VkFormatFeatureFlags requiredFeatures = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+	if (mFormat == VK_FORMAT_UNDEFINED || (properties.optimalTilingFeatures & requiredFeatures) != requiredFeatures) {
+		fprintf_color(COLOR_RED_BOLD, stderr, "Unsupported KTX2 format %s: %s\n", FormatToString(mFormat), filename.c_str());
+		throw;
+	}
+	mWidth = header->mPixelWidth;
+	mHeight = max(header->mPixelHeight, 1u);
+	mDepth = max(header->mPixelDepth, 1u);
+	mArrayLayers = header->mFaceCount;
+	mMipLevels = max(header->mLevelCount, 1u);
+	mSampleCount = VK_SAMPLE_COUNT_1_BIT;
+	mTiling = VK_IMAGE_TILING_OPTIMAL;
+	mUsage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	mMemoryProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
 
-	stbi_image_free(pixels);
+	// the level data is contiguous apart from alignment padding, so it is staged with one copy straight from the mapped file
+	uint64_t begin = levels[0].mByteOffset;
+	uint64_t end = levels[0].mByteOffset + levels[0].mByteLength;
+	for (uint32_t i = 1; i < mMipLevels; i++) {
+		begin = min(begin, levels[i].mByteOffset);
+		end = max(end, levels[i].mByteOffset + levels[i].mByteLength);
+	}
+	if (end > file.Size()) {
+		fprintf_color(COLOR_RED_BOLD, stderr, "Truncated KTX2 file: %s\n", filename.c_str());
+		throw;
+	}
 
-	//printf("Loaded %s: %dx%d %s\n", filename.c_str(), mWidth, mHeight, FormatToString(mFormat));
+	// level offsets are aligned to the block size in the file, and must stay aligned in the staging buffer
+	VkDeviceSize alignment = max<VkDeviceSize>(BlockCompressedSize(mFormat) ? BlockCompressedSize(mFormat) : FormatSize(mFormat), 4);
+
+	mStream->mData = file.Data();
+	mStream->mLevelOffsets.resize(mMipLevels);
+	mStream->mLevelSizes.resize(mMipLevels);
+	for (uint32_t i = 0; i < mMipLevels; i++) {
+		mStream->mLevelOffsets[i] = levels[i].mByteOffset;
+		mStream->mLevelSizes[i] = levels[i].mByteLength;
+	}
+	mStream->mAlignment = alignment;
+	if (CreateStreamedImage()) return;
+
+	CreateImage();
+	CreateImageView(VK_IMAGE_ASPECT_COLOR_BIT);
+
+	vector<VkBufferImageCopy> regions(mMipLevels);
+	for (uint32_t i = 0; i < mMipLevels; i++) {
+		regions[i] = {};
+		regions[i].bufferOffset = levels[i].mByteOffset - begin;
+		regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		regions[i].imageSubresource.mipLevel = i;
+		regions[i].imageSubresource.baseArrayLayer = 0;
+		regions[i].imageSubresource.layerCount = mArrayLayers;
+		regions[i].imageExtent = { max(mWidth >> i, 1u), max(mHeight >> i, 1u), max(mDepth >> i, 1u) };
+	}
+
+	mUploadToken = mDevice->StagingRing()->Upload(file.Data() + begin, end - begin, alignment, [&](CommandBuffer* commandBuffer, VkBuffer staging, VkDeviceSize offset) {
+		for (VkBufferImageCopy& region : regions)
+			region.bufferOffset += offset;
+		CopyToImage(commandBuffer, staging, regions.data(), (uint32_t)regions.size(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	});
+	mStream.reset();
 }
 Texture::Texture(const string& name, Device* device, const string& px, const string& nx, const string& py, const string& ny, const string& pz, const string& nz, bool srgb)
-	: mName(name), mDevice(device), mMemory({}) {
+	: mName(name), mDevice(device), mMemory({}), mUploadToken(0), mStream(nullptr), mResidentLevel(0), mRequestedLevel(~0u), mViewRevision(0), mSrgb(false), mRequestedFrame(0) {
 	int32_t x, y, channels;
 	uint32_t size;
 	
@@ -119,33 +261,13 @@ Texture::Texture(const string& name, Device* device, const string& px, const str
 	mUsage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
 	mMemoryProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
 
-	CreateImage();
-	CreateImageView(VK_IMAGE_ASPECT_COLOR_BIT);
-
-	VkBufferImageCopy copyRegion = {};
-	copyRegion.bufferOffset = 0;
-	copyRegion.bufferRowLength = 0;
-	copyRegion.bufferImageHeight = 0;
-	copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	copyRegion.imageSubresource.mipLevel = 0;
-	copyRegion.imageSubresource.baseArrayLayer = 0;
-	copyRegion.imageSubresource.layerCount = mArrayLayers;
-	copyRegion.imageOffset = { 0, 0, 0 };
-	copyRegion.imageExtent = { mWidth, mHeight, 1 };
-
 	VkDeviceSize dataSize = mWidth * mHeight * size * channels;
 
-	auto commandBuffer = mDevice->GetCommandBuffer();
-	TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer.get());
-	
-	Buffer uploadBuffer(name + " Copy", mDevice, dataSize * mArrayLayers, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	vector<uint8_t> faces(dataSize * mArrayLayers);
 	for (uint32_t j = 0; j < mArrayLayers; j++)
-		memcpy((uint8_t*)uploadBuffer.MappedData() + j * dataSize, pixels[j], dataSize);
-
-	vkCmdCopyBufferToImage(*commandBuffer, uploadBuffer, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+		memcpy(faces.data() + j * dataSize, pixels[j], dataSize);
 
-	GenerateMipMaps(commandBuffer.get());
-	mDevice->Execute(commandBuffer, false)->Wait();
+	CreateImage(faces.data(), faces.size());
 
 	for (uint32_t i = 0; i < 6; i++)
 		stbi_image_free(pixels[i]);
@@ -154,38 +276,14 @@ Texture::Texture(const string& name, Device* device, const string& px, const str
 }
 
 Texture::Texture(const string& name, Device* device, void* pixels, VkDeviceSize imageSize, uint32_t width, uint32_t height, uint32_t depth, VkFormat format, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties)
-	: mName(name), mDevice(device), mWidth(width), mHeight(height), mDepth(depth), mArrayLayers(1), mMipLevels(mipLevels), mFormat(format), mSampleCount(numSamples), mTiling(tiling), mUsage(usage), mMemoryProperties(properties), mMemory({}) {
+	: mName(name), mDevice(device), mWidth(width), mHeight(height), mDepth(depth), mArrayLayers(1), mMipLevels(mipLevels), mFormat(format), mSampleCount(numSamples), mTiling(tiling), mUsage(usage), mMemoryProperties(properties), mMemory({}), mUploadToken(0), mStream(nullptr), mResidentLevel(0), mRequestedLevel(~0u), mViewRevision(0), mSrgb(false), mRequestedFrame(0) {
 	
-	if (mipLevels == 0) mMipLevels = (uint32_t)std::floor(std::log2(std::max(mWidth, mHeight))) + 1;
+	if (mipLevels == 0) mMipLevels = (uint32_t)std::floor(std::log2(std::max(std::max(mWidth, mHeight), mDepth))) + 1;
 	if (mMipLevels > 1) mUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 
 	if (pixels && imageSize) {
 		mUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-		CreateImage();
-		CreateImageView(VK_IMAGE_ASPECT_COLOR_BIT);
-
-		VkBufferImageCopy copyRegion = {};
-		copyRegion.bufferOffset = 0;
-		copyRegion.bufferRowLength = 0;
-		copyRegion.bufferImageHeight = 0;
-		copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		copyRegion.imageSubresource.mipLevel = 0;
-		copyRegion.imageSubresource.baseArrayLayer = 0;
-		copyRegion.imageSubresource.layerCount = 1;
-		copyRegion.imageOffset = { 0, 0, 0 };
-		copyRegion.imageExtent = { mWidth, mHeight, mDepth };
-
-		Buffer uploadBuffer(name + " Copy", mDevice, pixels, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-		auto commandBuffer = mDevice->GetCommandBuffer();
-		TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer.get());
-		vkCmdCopyBufferToImage(*commandBuffer, uploadBuffer, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
-
-		if (mMipLevels > 1)
-			GenerateMipMaps(commandBuffer.get());
-		else
-			TransitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, ((mUsage & VK_IMAGE_USAGE_STORAGE_BIT) != 0) ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, commandBuffer.get());
-		mDevice->Execute(commandBuffer, false)->Wait();
+		CreateImage(pixels, imageSize);
 	} else {
 		CreateImage();
 		CreateImageView(VK_IMAGE_ASPECT_COLOR_BIT);
@@ -193,7 +291,7 @@ Texture::Texture(const string& name, Device* device, void* pixels, VkDeviceSize
 }
 
 Texture::Texture(const string& name, Device* device, uint32_t width, uint32_t height, uint32_t depth, VkFormat format, VkSampleCountFlagBits numSamples, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties)
-	: mName(name), mDevice(device), mWidth(width), mHeight(height), mDepth(depth), mArrayLayers(1), mMipLevels(1), mFormat(format), mSampleCount(numSamples), mTiling(tiling), mUsage(usage), mMemoryProperties(properties), mMemory({}) {
+	: mName(name), mDevice(device), mWidth(width), mHeight(height), mDepth(depth), mArrayLayers(1), mMipLevels(1), mFormat(format), mSampleCount(numSamples), mTiling(tiling), mUsage(usage), mMemoryProperties(properties), mMemory({}), mUploadToken(0), mStream(nullptr), mResidentLevel(0), mRequestedLevel(~0u), mViewRevision(0), mSrgb(false), mRequestedFrame(0) {
 
 	CreateImage();
 
@@ -216,10 +314,282 @@ Texture::Texture(const string& name, Device* device, uint32_t width, uint32_t he
 }
 
 Texture::~Texture() {
+	if (mUploadToken) mDevice->StagingRing()->Wait(mUploadToken);
+	mDevice->StagingRing()->Discard((uint64_t)mImage);
+	mDevice->InvalidateDescriptorSets((uint64_t)mView);
+	if (mDevice->BindlessTable()) mDevice->BindlessTable()->RemoveTexture(this);
+	for (auto& v : mRetiredViews) {
+		mDevice->InvalidateDescriptorSets((uint64_t)v.first);
+		vkDestroyImageView(*mDevice, v.first, nullptr);
+	}
+	mStream.reset();
 	vkDestroyImage(*mDevice, mImage, nullptr);
 	vkDestroyImageView(*mDevice, mView, nullptr);
 	mDevice->FreeMemory(mMemory);
 }
+bool Texture::Swap(Asset* other) {
+	Texture* t = dynamic_cast<Texture*>(other);
+	if (!t) return false;
+	// the bindless table keys textures by pointer, so this texture's slot would keep the old view
+	if (mDevice->BindlessTable()) mDevice->BindlessTable()->RemoveTexture(this);
+	swap(mMemory, t->mMemory);
+	swap(mUploadToken, t->mUploadToken);
+	swap(mWidth, t->mWidth);
+	swap(mHeight, t->mHeight);
+	swap(mDepth, t->mDepth);
+	swap(mMipLevels, t->mMipLevels);
+	swap(mArrayLayers, t->mArrayLayers);
+	swap(mFormat, t->mFormat);
+	swap(mSampleCount, t->mSampleCount);
+	swap(mTiling, t->mTiling);
+	swap(mUsage, t->mUsage);
+	swap(mMemoryProperties, t->mMemoryProperties);
+	swap(mAllocationInfo, t->mAllocationInfo);
+	swap(mImage, t->mImage);
+	swap(mView, t->mView);
+	// the retired views belong to the old image
+	swap(mStream, t->mStream);
+	swap(mPendingStream, t->mPendingStream);
+	swap(mFilename, t->mFilename);
+	swap(mSrgb, t->mSrgb);
+	swap(mResidentLevel, t->mResidentLevel);
+	swap(mRetiredViews, t->mRetiredViews);
+	mViewRevision++;
+	return true;
+}
+Asset* Texture::Evict() {
+	if (mArrayLayers > 1) return nullptr;
+	// the smallest image with the same VkImageViewType, so descriptors that expect it stay valid
+	uint32_t width = min(mWidth, 2u);
+	uint32_t height = min(mHeight, 2u);
+	uint32_t depth = min(mDepth, 2u);
+	vector<uint32_t> white(width * height * depth, 0xFFFFFFFF);
+	Texture* placeholder = new Texture(mName, mDevice, white.data(), white.size() * sizeof(uint32_t), width, height, depth, VK_FORMAT_R8G8B8A8_UNORM, 1);
+	Swap(placeholder);
+	return placeholder;
+}
+
+bool Texture::CreateStreamedImage() {
+	if (mArrayLayers > 1 || mDepth > 1 || mMipLevels < 2 || max(mWidth, mHeight) <= TEXTURE_STREAM_TAIL_SIZE) return false;
+	mResidentLevel = StreamTailLevel();
+	CreateImage();
+	CreateImageView(VK_IMAGE_ASPECT_COLOR_BIT);
+	UploadMipLevels(mResidentLevel, mMipLevels - 1, true);
+	return true;
+}
+void Texture::UploadMipLevels(uint32_t first, uint32_t last, bool newImage) {
+	VkDeviceSize begin = mStream->mLevelOffsets[first];
+	VkDeviceSize end = 0;
+	for (uint32_t i = first; i <= last; i++) {
+		begin = min(begin, mStream->mLevelOffsets[i]);
+		end = max(end, mStream->mLevelOffsets[i] + mStream->mLevelSizes[i]);
+	}
+
+	vector<VkBufferImageCopy> regions(last - first + 1);
+	for (uint32_t i = first; i <= last; i++) {
+		VkBufferImageCopy& region = regions[i - first];
+		region = {};
+		region.bufferOffset = mStream->mLevelOffsets[i] - begin;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = i;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = mArrayLayers;
+		region.imageExtent = { max(mWidth >> i, 1u), max(mHeight >> i, 1u), max(mDepth >> i, 1u) };
+	}
+
+	if (newImage) {
+		mUploadToken = mDevice->StagingRing()->Upload(mStream->mData + begin, end - begin, mStream->mAlignment, [&](CommandBuffer* commandBuffer, VkBuffer staging, VkDeviceSize offset) {
+			for (VkBufferImageCopy& region : regions)
+				region.bufferOffset += offset;
+			CopyToImage(commandBuffer, staging, regions.data(), (uint32_t)regions.size(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		});
+		return;
+	}
+
+	// the resident levels may be in use by the graphics queue, so the copy is recorded there.
+	// The new levels aren't in any view yet, so their old contents are discarded.
+	mDevice->StagingRing()->Acquire((uint64_t)mImage, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+	mUploadToken = mDevice->StagingRing()->Upload(mStream->mData + begin, end - begin, mStream->mAlignment, nullptr, [&](CommandBuffer* commandBuffer, VkBuffer staging, VkDeviceSize offset) {
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.image = mImage;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = first;
+		barrier.subresourceRange.levelCount = last - first + 1;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = mArrayLayers;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(*commandBuffer,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			0, nullptr,
+			0, nullptr,
+			1, &barrier);
+
+		for (VkBufferImageCopy& region : regions)
+			region.bufferOffset += offset;
+		vkCmdCopyBufferToImage(*commandBuffer, staging, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(*commandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+			0, nullptr,
+			0, nullptr,
+			1, &barrier);
+	});
+}
+void Texture::RequestMipLevel(float level) {
+	uint32_t l = level > 0 ? (uint32_t)min(level, (float)(mMipLevels - 1)) : 0;
+	uint32_t current = mRequestedLevel;
+	while (l < current && !mRequestedLevel.compare_exchange_weak(current, l));
+}
+uint64_t Texture::StreamMipLevels(uint64_t budget) {
+	uint64_t frame = mDevice->Instance()->FrameCount();
+	while (mRetiredViews.size() && mRetiredViews.front().second + mDevice->MaxFramesInFlight() <= frame) {
+		mDevice->InvalidateDescriptorSets((uint64_t)mRetiredViews.front().first);
+		vkDestroyImageView(*mDevice, mRetiredViews.front().first, nullptr);
+		mRetiredViews.pop_front();
+	}
+
+	uint32_t requested = mRequestedLevel.exchange(~0u);
+	if (mPendingStream.valid() && mPendingStream.wait_for(chrono::seconds(0)) == future_status::ready) {
+		try {
+			mStream = mPendingStream.get();
+		} catch (...) {
+			fprintf_color(COLOR_RED, stderr, "Failed to generate the mip chain of %s\n", mName.c_str());
+		}
+	}
+
+	// levels are only streamed in for textures that are being drawn
+	uint32_t target = requested == ~0u ? 0 : requested;
+	if (target >= mResidentLevel || LastUsedFrame() + mDevice->MaxFramesInFlight() < frame) {
+		// decoded images don't keep their mip chain in memory once the levels they are drawn at are resident
+		if (mStream && mFilename.size() && mRequestedFrame + TEXTURE_STREAM_RELEASE_FRAMES < frame) mStream.reset();
+		return 0;
+	}
+	mRequestedFrame = frame;
+	if (!mStream) {
+		// the mip chain was released, generate it again
+		if (!mPendingStream.valid() && mFilename.size()) {
+			VkFormat format = mFormat;
+			uint32_t width = mWidth, height = mHeight, mipLevels = mMipLevels;
+			string filename = mFilename;
+			bool srgb = mSrgb;
+			ThreadPool* threadPool = mDevice->Instance()->ThreadPool();
+			mPendingStream = threadPool->Enqueue([=]() { return GenerateStream(nullptr, filename, srgb, format, width, height, mipLevels, threadPool); });
+		}
+		return 0;
+	}
+	if (!budget) return 0;
+
+	// the next level is uploaded even if it's over budget, so large textures still make progress
+	uint32_t first = mResidentLevel - 1;
+	uint64_t size = mStream->mLevelSizes[first];
+	while (first > target && size + mStream->mLevelSizes[first - 1] <= budget)
+		size += mStream->mLevelSizes[--first];
+	UploadMipLevels(first, mResidentLevel - 1, false);
+
+	// the upload is recorded before any later frame executes, so the new view can be used right away.
+	// The bindless table keys textures by pointer, so this texture's slot would keep the old view.
+	if (mDevice->BindlessTable()) mDevice->BindlessTable()->RemoveTexture(this);
+	mRetiredViews.push_back(make_pair(mView, frame));
+	mResidentLevel = first;
+	CreateImageView(VK_IMAGE_ASPECT_COLOR_BIT);
+	mViewRevision++;
+	if (mResidentLevel == 0) mStream.reset();
+	return size;
+}
+
+void Texture::CreateImage(const void* pixels, VkDeviceSize imageSize) {
+	bool generateMips = false;
+	if (mMipLevels > 1) {
+		// vkCmdBlitImage needs linear filtering and blit support in both directions, and only filters 3D textures per slice on some drivers
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties(mDevice->PhysicalDevice(), mFormat, &properties);
+		VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+		bool blit = mDepth == 1 && (properties.optimalTilingFeatures & blitFeatures) == blitFeatures;
+		if (!blit) {
+			if (MipGenerator::Supported(mFormat))
+				generateMips = true;
+			else {
+				printf_color(COLOR_YELLOW, "%s: Can't generate mipmaps for %s\n", mName.c_str(), FormatToString(mFormat));
+				mMipLevels = 1;
+			}
+		}
+	}
+
+	CreateImage();
+	CreateImageView(VK_IMAGE_ASPECT_COLOR_BIT);
+
+	VkImageLayout finalLayout = ((mUsage & VK_IMAGE_USAGE_STORAGE_BIT) != 0) ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	if (!generateMips) {
+		VkBufferImageCopy copyRegion = {};
+		copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		copyRegion.imageSubresource.mipLevel = 0;
+		copyRegion.imageSubresource.baseArrayLayer = 0;
+		copyRegion.imageSubresource.layerCount = mArrayLayers;
+		copyRegion.imageOffset = { 0, 0, 0 };
+		copyRegion.imageExtent = { mWidth, mHeight, mDepth };
+
+		mUploadToken = mDevice->StagingRing()->Upload(pixels, imageSize, FormatSize(mFormat) * 4, [&](CommandBuffer* commandBuffer, VkBuffer staging, VkDeviceSize offset) {
+			copyRegion.bufferOffset = offset;
+			CopyToImage(commandBuffer, staging, copyRegion, mMipLevels > 1 ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : finalLayout);
+		}, [&](CommandBuffer* commandBuffer, VkBuffer, VkDeviceSize) {
+			if (mMipLevels > 1) GenerateMipMaps(commandBuffer);
+		});
+		return;
+	}
+
+	// box filter 3D textures, the Kaiser filter's wider footprint costs too much with three axes
+	vector<uint8_t> levels;
+	vector<VkDeviceSize> levelOffsets;
+	MipGenerator::Generate(pixels, mFormat, mWidth, mHeight, mDepth, mArrayLayers, mMipLevels, mDepth > 1 ? MIP_FILTER_BOX : MIP_FILTER_KAISER,
+		mDevice->Instance()->ThreadPool(), levels, levelOffsets);
+
+	vector<VkBufferImageCopy> regions(mMipLevels);
+	for (uint32_t i = 0; i < mMipLevels; i++) {
+		regions[i] = {};
+		regions[i].bufferOffset = levelOffsets[i];
+		regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		regions[i].imageSubresource.mipLevel = i;
+		regions[i].imageSubresource.baseArrayLayer = 0;
+		regions[i].imageSubresource.layerCount = mArrayLayers;
+		regions[i].imageExtent = { max(mWidth >> i, 1u), max(mHeight >> i, 1u), max(mDepth >> i, 1u) };
+	}
+
+	mUploadToken = mDevice->StagingRing()->Upload(levels.data(), levels.size(), FormatSize(mFormat) * 4, [&](CommandBuffer* commandBuffer, VkBuffer staging, VkDeviceSize offset) {
+		for (VkBufferImageCopy& region : regions)
+			region.bufferOffset += offset;
+		CopyToImage(commandBuffer, staging, regions.data(), (uint32_t)regions.size(), finalLayout);
+	});
+}
+
+void Texture::CopyToImage(CommandBuffer* commandBuffer, VkBuffer staging, const VkBufferImageCopy* regions, uint32_t regionCount, VkImageLayout finalLayout) {
+	TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer);
+	vkCmdCopyBufferToImage(*commandBuffer, staging, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regionCount, regions);
+
+	// hand the image to the graphics queue in finalLayout, it's acquired by whatever uses it first. An image that stays in
+	// TRANSFER_DST_OPTIMAL is used by the upload's finish function, which generates mipmaps, so that batch acquires it
+	VkPipelineStageFlags srcStage, dstStage;
+	VkImageMemoryBarrier barrier = TransitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, finalLayout, srcStage, dstStage);
+	if (finalLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+		mDevice->StagingRing()->TransferOwnership(barrier, VK_PIPELINE_STAGE_TRANSFER_BIT);
+	else if (!mDevice->StagingRing()->TransferOwnership(barrier))
+		vkCmdPipelineBarrier(*commandBuffer,
+			srcStage, dstStage,
+			0,
+			0, nullptr,
+			0, nullptr,
+			1, &barrier);
+}
 
 void Texture::GenerateMipMaps(CommandBuffer* commandBuffer) {
 	VkImageMemoryBarrier barrier = {};
@@ -317,10 +687,20 @@ void Texture::CreateImage() {
 	ThrowIfFailed(vkCreateImage(*mDevice, &imageInfo, nullptr, &mImage), "vkCreateImage failed for " + mName);
 	mDevice->SetObjectName(mImage, mName, VK_OBJECT_TYPE_IMAGE);
 
-	VkMemoryRequirements memRequirements;
-	vkGetImageMemoryRequirements(*mDevice, mImage, &memRequirements);
-
-	mMemory = mDevice->AllocateMemory(memRequirements, mMemoryProperties, mName);
+	VkMemoryDedicatedRequirements dedicated = {};
+	dedicated.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+	VkMemoryRequirements2 memRequirements = {};
+	memRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+	memRequirements.pNext = &dedicated;
+	VkImageMemoryRequirementsInfo2 requirementsInfo = {};
+	requirementsInfo.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2;
+	requirementsInfo.image = mImage;
+	vkGetImageMemoryRequirements2(*mDevice, &requirementsInfo, &memRequirements);
+
+	if (dedicated.requiresDedicatedAllocation || dedicated.prefersDedicatedAllocation || memRequirements.memoryRequirements.size >= MEM_DEDICATED_ALLOC)
+		mMemory = mDevice->AllocateDedicatedMemory(memRequirements.memoryRequirements, mMemoryProperties, mName, mImage);
+	else
+		mMemory = mDevice->AllocateMemory(memRequirements.memoryRequirements, mMemoryProperties, mName);
 	vkBindImageMemory(*mDevice, mImage, mMemory.mDeviceMemory, mMemory.mOffset);
 }
 void Texture::CreateImageView(VkImageAspectFlags aspectFlags) {
@@ -329,8 +709,8 @@ void Texture::CreateImageView(VkImageAspectFlags aspectFlags) {
 	viewInfo.viewType = mArrayLayers == 6 ? VK_IMAGE_VIEW_TYPE_CUBE : (mDepth > 1 ? VK_IMAGE_VIEW_TYPE_3D : (mHeight > 1 ? VK_IMAGE_VIEW_TYPE_2D : VK_IMAGE_VIEW_TYPE_1D));
 	viewInfo.format = mFormat;
 	viewInfo.subresourceRange.aspectMask = aspectFlags;
-	viewInfo.subresourceRange.baseMipLevel = 0;
-	viewInfo.subresourceRange.levelCount = mMipLevels;
+	viewInfo.subresourceRange.baseMipLevel = mResidentLevel;
+	viewInfo.subresourceRange.levelCount = mMipLevels - mResidentLevel;
 	viewInfo.subresourceRange.baseArrayLayer = 0;
 	viewInfo.subresourceRange.layerCount = mArrayLayers;
 	viewInfo.image = mImage;
@@ -1,10 +1,18 @@
 #pragma once
 
+#include <deque>
+#include <future>
+
 #include <Content/Asset.hpp>
 #include <Core/Device.hpp>
 #include <Core/Sampler.hpp>
 #include <Util/Util.hpp>
 
+// Mip levels this many pixels wide and tall or smaller are uploaded when a texture is loaded, larger levels are streamed in
+#define TEXTURE_STREAM_TAIL_SIZE 128
+// Images decoded on the CPU release their mip chain once no levels that aren't resident were requested for this many frames
+#define TEXTURE_STREAM_RELEASE_FRAMES 300
+
 class Texture : public Asset {
 public:
 	const std::string mName;
@@ -28,9 +36,24 @@ public:
 	inline VkSampleCountFlagBits SampleCount() const { return mSampleCount; }
 	inline VkImageUsageFlags Usage() const { return mUsage; }
 
+	inline const DeviceMemoryAllocation& Memory() const { return mMemory; }
+	/// StagingRing token of the upload of the texture's initial contents, 0 if it has none
+	inline uint64_t UploadToken() const { return mUploadToken; }
+
 	inline VkImage Image() const { return mImage; }
+	/// View of the mip levels that have been uploaded, which starts at ResidentMipLevel() while the texture is streaming
 	inline VkImageView View() const { return mView; }
 
+	/// Most detailed mip level that has been uploaded. Textures loaded from files upload the levels up to TEXTURE_STREAM_TAIL_SIZE pixels first,
+	/// and the AssetManager streams in more detailed levels over later frames, as they are requested. Decoded images box filter the first levels
+	/// while the detailed levels are generated on the ThreadPool.
+	inline uint32_t ResidentMipLevel() const { return mResidentLevel; }
+	/// Incremented when View() is replaced by a view with more mip levels. Descriptors of the old view stay valid for MaxFramesInFlight() frames.
+	inline uint64_t ViewRevision() const { return mViewRevision; }
+	/// Requests that mip levels down to level be made resident, called with the screen-space mip level the texture is sampled at.
+	/// The most detailed level requested since the last StreamMipLevels() is streamed in. Textures that are used without requests stream in every level.
+	ENGINE_EXPORT void RequestMipLevel(float level);
+
 	ENGINE_EXPORT static void TransitionImageLayout(VkImage image, VkFormat format, uint32_t mipLevels, VkImageLayout oldLayout, VkImageLayout newLayout, CommandBuffer* commandBuffer);
 	ENGINE_EXPORT void TransitionImageLayout(VkImageLayout oldLayout, VkImageLayout newLayout, CommandBuffer* commandBuffer);
 	ENGINE_EXPORT VkImageMemoryBarrier TransitionImageLayout(VkImageLayout oldLayout, VkImageLayout newLayout, VkPipelineStageFlags& srcStage, VkPipelineStageFlags& dstStage);
@@ -42,10 +65,13 @@ public:
 private:
 	friend class AssetManager;
 	ENGINE_EXPORT Texture(const std::string& name, Device* device, const std::string& filename, bool srgb = true);
+	struct MipStream;
+
 	ENGINE_EXPORT Texture(const std::string& name, Device* device, const std::string& px, const std::string& nx, const std::string& py, const std::string& ny, const std::string& pz, const std::string& nz, bool srgb = true);
 
 	Device* mDevice;
 	DeviceMemoryAllocation mMemory;
+	uint64_t mUploadToken;
 	
 	uint32_t mWidth;
 	uint32_t mHeight;
@@ -64,6 +90,51 @@ private:
 	VkImage mImage;
 	VkImageView mView;
 
+	// source of the levels that aren't resident yet, nullptr once every level is or while it is generated
+	std::unique_ptr<MipStream> mStream;
+	uint32_t mResidentLevel;
+	std::atomic<uint32_t> mRequestedLevel;
+	uint64_t mViewRevision;
+	// mip chain of a decoded image that is being generated on the ThreadPool
+	std::future<std::unique_ptr<MipStream>> mPendingStream;
+	// image the mip chain is generated from again if it was released before every level was resident, empty for KTX2 files
+	std::string mFilename;
+	bool mSrgb;
+	// last frame levels that weren't resident were requested in
+	uint64_t mRequestedFrame;
+	// views that were replaced, and the frame they were replaced in
+	std::deque<std::pair<VkImageView, uint64_t>> mRetiredViews;
+
 	ENGINE_EXPORT void CreateImage();
 	ENGINE_EXPORT void CreateImageView(VkImageAspectFlags flags);
+	/// Creates the image and uploads level 0 of each layer from pixels. The remaining levels are blitted on the GPU,
+	/// or generated with MipGenerator when the format can't be blitted with linear filtering or the texture is 3D
+	ENGINE_EXPORT void CreateImage(const void* pixels, VkDeviceSize imageSize);
+	/// Records the upload of the texture's initial contents on the StagingRing's transfer CommandBuffer, leaving the image in finalLayout
+	/// once the graphics queue acquires it
+	ENGINE_EXPORT void CopyToImage(CommandBuffer* commandBuffer, VkBuffer staging, const VkBufferImageCopy* regions, uint32_t regionCount, VkImageLayout finalLayout);
+	inline void CopyToImage(CommandBuffer* commandBuffer, VkBuffer staging, const VkBufferImageCopy& region, VkImageLayout finalLayout) { CopyToImage(commandBuffer, staging, &region, 1, finalLayout); }
+	/// Loads a KTX2 file's mip levels as they are stored, without decoding or generating mipmaps
+	ENGINE_EXPORT void LoadKtx2(const std::string& filename);
+	/// Creates the image and uploads the levels up to TEXTURE_STREAM_TAIL_SIZE from mStream, returns false if the texture is too small to stream
+	ENGINE_EXPORT bool CreateStreamedImage();
+	/// Most detailed mip level that is at most TEXTURE_STREAM_TAIL_SIZE pixels wide and tall
+	inline uint32_t StreamTailLevel() const {
+		uint32_t level = 0;
+		while (level + 1 < mMipLevels && std::max(mWidth >> level, mHeight >> level) > TEXTURE_STREAM_TAIL_SIZE) level++;
+		return level;
+	}
+	/// Generates the Kaiser filtered mip chain of an image, decoding it from filename if pixels is null. Runs on the ThreadPool.
+	/// Returns nullptr if the file no longer matches the texture's format and size.
+	ENGINE_EXPORT static std::unique_ptr<MipStream> GenerateStream(std::shared_ptr<uint8_t> pixels, const std::string& filename, bool srgb,
+		VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, ThreadPool* threadPool);
+	/// Copies levels [first, last] from mStream into the image. Levels of a new image are written on the transfer queue, others on the graphics queue.
+	ENGINE_EXPORT void UploadMipLevels(uint32_t first, uint32_t last, bool newImage);
+	/// Uploads the next requested levels, at least one level and as many more as fit in budget bytes, and replaces the view.
+	/// Returns the number of bytes uploaded. Called by the AssetManager once per frame.
+	ENGINE_EXPORT uint64_t StreamMipLevels(uint64_t budget);
+	ENGINE_EXPORT bool Swap(Asset* other) override;
+	/// Replaces the image with a white image of the same type, cubemaps aren't evicted
+	ENGINE_EXPORT Asset* Evict() override;
+	inline uint64_t ResidentSize() const override { return mMemory.mSize; }
 };
\ No newline at end of file
@@ -0,0 +1,182 @@
+#include <Core/BindlessTable.hpp>
+#include <Core/Buffer.hpp>
+#include <Core/Device.hpp>
+#include <Core/Instance.hpp>
+#include <Content/Texture.hpp>
+
+using namespace std;
+
+BindlessTable::BindlessTable(Device* device) : mDevice(device), mMaterialBuffer(nullptr), mDefaultTexture(nullptr) {
+	mTextures.mCount = 0;
+	mTextures.mCapacity = BINDLESS_TEXTURE_COUNT;
+	mMaterials.mCount = 0;
+	mMaterials.mCapacity = BINDLESS_MATERIAL_COUNT;
+
+	VkDescriptorSetLayoutBinding bindings[2] = {};
+	bindings[0].binding = BINDLESS_TEXTURE_BINDING;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	bindings[0].descriptorCount = BINDLESS_TEXTURE_COUNT;
+	bindings[0].stageFlags = VK_SHADER_STAGE_ALL;
+	bindings[1].binding = MATERIAL_BUFFER_BINDING;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[1].descriptorCount = 1;
+	bindings[1].stageFlags = VK_SHADER_STAGE_ALL;
+
+	// the texture array is written while the set is in use, so only unused slots may change
+	VkDescriptorBindingFlagsEXT flags[2] = {
+		VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT,
+		0
+	};
+	VkDescriptorSetLayoutBindingFlagsCreateInfoEXT extendedInfo = {};
+	extendedInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+	extendedInfo.bindingCount = 2;
+	extendedInfo.pBindingFlags = flags;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = &extendedInfo;
+	layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+	layoutInfo.bindingCount = 2;
+	layoutInfo.pBindings = bindings;
+	ThrowIfFailed(vkCreateDescriptorSetLayout(*mDevice, &layoutInfo, nullptr, &mLayout), "vkCreateDescriptorSetLayout failed");
+	mDevice->SetObjectName(mLayout, "Bindless DescriptorSetLayout", VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT);
+
+	VkDescriptorPoolSize poolSizes[2] = {
+		{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, BINDLESS_TEXTURE_COUNT },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+	};
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+	poolInfo.poolSizeCount = 2;
+	poolInfo.pPoolSizes = poolSizes;
+	poolInfo.maxSets = 1;
+	ThrowIfFailed(vkCreateDescriptorPool(*mDevice, &poolInfo, nullptr, &mDescriptorPool), "vkCreateDescriptorPool failed");
+	mDevice->SetObjectName(mDescriptorPool, "Bindless DescriptorPool", VK_OBJECT_TYPE_DESCRIPTOR_POOL);
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = mDescriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &mLayout;
+	ThrowIfFailed(vkAllocateDescriptorSets(*mDevice, &allocInfo, &mDescriptorSet), "vkAllocateDescriptorSets failed");
+	mDevice->SetObjectName(mDescriptorSet, "Bindless DescriptorSet", VK_OBJECT_TYPE_DESCRIPTOR_SET);
+
+	// one copy of every material per frame context
+	mMaterialData.resize(BINDLESS_MATERIAL_COUNT);
+	mDirtyMaterials.resize(mDevice->MaxFramesInFlight());
+	mMaterialBuffer = new Buffer("Bindless Materials", mDevice, sizeof(MaterialData) * BINDLESS_MATERIAL_COUNT * mDevice->MaxFramesInFlight(),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	VkDescriptorBufferInfo bufferInfo = {};
+	bufferInfo.buffer = *mMaterialBuffer;
+	bufferInfo.offset = 0;
+	bufferInfo.range = mMaterialBuffer->Size();
+	VkWriteDescriptorSet write = {};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = mDescriptorSet;
+	write.dstBinding = MATERIAL_BUFFER_BINDING;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	write.descriptorCount = 1;
+	write.pBufferInfo = &bufferInfo;
+	vkUpdateDescriptorSets(*mDevice, 1, &write, 0, nullptr);
+
+	// the first texture added gets slot BINDLESS_DEFAULT_TEXTURE
+	uint32_t white = 0xFFFFFFFF;
+	mDefaultTexture = new Texture("Bindless Default", mDevice, &white, sizeof(uint32_t), 1, 1, 1, VK_FORMAT_R8G8B8A8_UNORM, 1);
+	TextureIndex(mDefaultTexture);
+}
+BindlessTable::~BindlessTable() {
+	safe_delete(mDefaultTexture);
+	safe_delete(mMaterialBuffer);
+	vkDestroyDescriptorPool(*mDevice, mDescriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(*mDevice, mLayout, nullptr);
+}
+
+uint32_t BindlessTable::Allocate(Slots& slots, const char* type) {
+	if (slots.mFree.size()) {
+		uint32_t slot = slots.mFree.back();
+		slots.mFree.pop_back();
+		return slot;
+	}
+	if (slots.mCount == slots.mCapacity) {
+		fprintf_color(COLOR_RED, stderr, "Bindless %s table is full (%u)\n", type, slots.mCapacity);
+		throw;
+	}
+	return slots.mCount++;
+}
+void BindlessTable::Retire(Slots& slots, uint32_t slot) {
+	slots.mRetired.push_back(make_pair(slot, mDevice->Instance()->FrameCount()));
+}
+void BindlessTable::Recycle(Slots& slots) {
+	uint64_t frame = mDevice->Instance()->FrameCount();
+	while (slots.mRetired.size() && slots.mRetired.front().second + mDevice->MaxFramesInFlight() <= frame) {
+		slots.mFree.push_back(slots.mRetired.front().first);
+		slots.mRetired.pop_front();
+	}
+}
+
+uint32_t BindlessTable::TextureIndex(Texture* texture) {
+	lock_guard lock(mMutex);
+	auto it = mTextures.mSlots.find(texture);
+	if (it != mTextures.mSlots.end()) return it->second;
+
+	uint32_t slot = Allocate(mTextures, "texture");
+	mTextures.mSlots.emplace(texture, slot);
+
+	mDevice->StagingRing()->Acquire((uint64_t)texture->Image(), VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	VkDescriptorImageInfo info = {};
+	info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	info.imageView = texture->View();
+	VkWriteDescriptorSet write = {};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = mDescriptorSet;
+	write.dstBinding = BINDLESS_TEXTURE_BINDING;
+	write.dstArrayElement = slot;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	write.descriptorCount = 1;
+	write.pImageInfo = &info;
+	vkUpdateDescriptorSets(*mDevice, 1, &write, 0, nullptr);
+	return slot;
+}
+void BindlessTable::RemoveTexture(Texture* texture) {
+	lock_guard lock(mMutex);
+	auto it = mTextures.mSlots.find(texture);
+	if (it == mTextures.mSlots.end()) return;
+	// the descriptor is left as is, partially bound descriptors may be invalid as long as they aren't used
+	Retire(mTextures, it->second);
+	mTextures.mSlots.erase(it);
+}
+
+uint32_t BindlessTable::AllocateMaterial() {
+	lock_guard lock(mMutex);
+	return Allocate(mMaterials, "material");
+}
+void BindlessTable::FreeMaterial(uint32_t index) {
+	lock_guard lock(mMutex);
+	Retire(mMaterials, index);
+}
+void BindlessTable::SetMaterial(uint32_t index, const MaterialData& data) {
+	lock_guard lock(mMutex);
+	mMaterialData[index] = data;
+	// the current frame's commands haven't been submitted yet while the scene updates, so its copy is written right away
+	uint32_t frameContext = mDevice->FrameContextIndex();
+	memcpy((MaterialData*)mMaterialBuffer->MappedData() + frameContext * BINDLESS_MATERIAL_COUNT + index, &data, sizeof(MaterialData));
+	for (uint32_t i = 0; i < mDirtyMaterials.size(); i++)
+		if (i != frameContext) mDirtyMaterials[i].insert(index);
+}
+uint32_t BindlessTable::MaterialOffset() const {
+	return mDevice->FrameContextIndex() * BINDLESS_MATERIAL_COUNT;
+}
+
+void BindlessTable::Update() {
+	lock_guard lock(mMutex);
+	uint32_t frameContext = mDevice->FrameContextIndex();
+	MaterialData* materials = (MaterialData*)mMaterialBuffer->MappedData() + frameContext * BINDLESS_MATERIAL_COUNT;
+	for (uint32_t i : mDirtyMaterials[frameContext])
+		materials[i] = mMaterialData[i];
+	mDirtyMaterials[frameContext].clear();
+
+	Recycle(mTextures);
+	Recycle(mMaterials);
+}
\ No newline at end of file
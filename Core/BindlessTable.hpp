@@ -0,0 +1,71 @@
+#pragma once
+
+#include <deque>
+#include <unordered_set>
+
+#include <Util/Util.hpp>
+#include <Shaders/include/shadercompat.h>
+
+class Buffer;
+class Device;
+class Texture;
+
+/// A global descriptor set that holds every Texture used by bindless materials in an array, and the MaterialData of every bindless
+/// Material in a storage buffer. Shaders declare it in descriptor set PER_BINDLESS and index it with the indices returned by TextureIndex()
+/// and Material::BindlessIndex(). Samplers stay in the material's descriptor set, since materials sharing a shader share its static samplers. The set is created with update-after-bind, so new entries are written while it is bound, and freed slots are only
+/// reused once the frames that could reference them are done. Material data is kept once per frame context, starting at MaterialOffset().
+/// Texture slot BINDLESS_DEFAULT_TEXTURE (0) always holds a 1x1 white texture, which materials use for the textures they don't have.
+class BindlessTable {
+public:
+	ENGINE_EXPORT BindlessTable(Device* device);
+	ENGINE_EXPORT ~BindlessTable();
+
+	/// Returns the slot of a texture in the table, adding the texture if necessary
+	ENGINE_EXPORT uint32_t TextureIndex(Texture* texture);
+	/// Called when a Texture is destroyed
+	ENGINE_EXPORT void RemoveTexture(Texture* texture);
+
+	ENGINE_EXPORT uint32_t AllocateMaterial();
+	ENGINE_EXPORT void FreeMaterial(uint32_t index);
+	/// Sets the data of a material. The current frame sees it immediately, the other frame contexts when they begin.
+	ENGINE_EXPORT void SetMaterial(uint32_t index, const MaterialData& data);
+	/// Index of the current frame context's first material in the material buffer
+	ENGINE_EXPORT uint32_t MaterialOffset() const;
+
+	/// Copies materials that changed since the frame context was last used, and recycles freed slots. Called once per frame.
+	ENGINE_EXPORT void Update();
+
+	inline VkDescriptorSetLayout Layout() const { return mLayout; }
+	inline VkDescriptorSet DescriptorSet() const { return mDescriptorSet; }
+
+private:
+	struct Slots {
+		std::unordered_map<void*, uint32_t> mSlots;
+		std::vector<uint32_t> mFree;
+		// slots that were freed, and the frame they were freed in
+		std::deque<std::pair<uint32_t, uint64_t>> mRetired;
+		uint32_t mCount;
+		uint32_t mCapacity;
+	};
+
+	Device* mDevice;
+	VkDescriptorSetLayout mLayout;
+	VkDescriptorPool mDescriptorPool;
+	VkDescriptorSet mDescriptorSet;
+
+	Slots mTextures;
+	// in slot BINDLESS_DEFAULT_TEXTURE
+	Texture* mDefaultTexture;
+	Slots mMaterials;
+
+	Buffer* mMaterialBuffer;
+	std::vector<MaterialData> mMaterialData;
+	// per frame context, materials that changed since the frame context was last used
+	std::vector<std::unordered_set<uint32_t>> mDirtyMaterials;
+
+	std::mutex mMutex;
+
+	ENGINE_EXPORT uint32_t Allocate(Slots& slots, const char* type);
+	ENGINE_EXPORT void Retire(Slots& slots, uint32_t slot);
+	ENGINE_EXPORT void Recycle(Slots& slots);
+};
\ No newline at end of file
@@ -1,66 +1,98 @@
 #include <Core/Buffer.hpp>
+#include <Core/CommandBuffer.hpp>
 #include <Util/Util.hpp>
 
 #include <cstring>
 
 using namespace std;
 
+inline uint64_t NextBufferID() {
+	static atomic<uint64_t> nextID = 1;
+	return nextID++;
+}
+
 Buffer::Buffer(const std::string& name, ::Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties)
-	: mName(name), mDevice(device), mSize(size), mUsageFlags(usage), mMemoryProperties(properties), mBuffer(VK_NULL_HANDLE), mView(VK_NULL_HANDLE), mViewFormat(VK_FORMAT_UNDEFINED), mMemory({}) {
+	: mName(name), mDevice(device), mSize(size), mUsageFlags(usage), mMemoryProperties(properties), mBuffer(VK_NULL_HANDLE), mID(NextBufferID()), mView(VK_NULL_HANDLE), mViewFormat(VK_FORMAT_UNDEFINED), mMemory({}), mUploadToken(0) {
 	Allocate();
 }
 Buffer::Buffer(const std::string& name, ::Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkFormat viewFormat, VkMemoryPropertyFlags properties)
-	: mName(name), mDevice(device), mSize(size), mUsageFlags(usage), mMemoryProperties(properties), mBuffer(VK_NULL_HANDLE), mView(VK_NULL_HANDLE), mViewFormat(viewFormat), mMemory({}) {
+	: mName(name), mDevice(device), mSize(size), mUsageFlags(usage), mMemoryProperties(properties), mBuffer(VK_NULL_HANDLE), mID(NextBufferID()), mView(VK_NULL_HANDLE), mViewFormat(viewFormat), mMemory({}), mUploadToken(0) {
 	Allocate();
 }
 Buffer::Buffer(const std::string& name, ::Device* device, const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties)
-	: mName(name), mDevice(device), mSize(size), mUsageFlags(usage), mMemoryProperties(properties), mBuffer(VK_NULL_HANDLE), mView(VK_NULL_HANDLE), mViewFormat(VK_FORMAT_UNDEFINED), mMemory({}) {
+	: mName(name), mDevice(device), mSize(size), mUsageFlags(usage), mMemoryProperties(properties), mBuffer(VK_NULL_HANDLE), mID(NextBufferID()), mView(VK_NULL_HANDLE), mViewFormat(VK_FORMAT_UNDEFINED), mMemory({}), mUploadToken(0) {
 	if ((properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == 0)
 		mUsageFlags |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 	Allocate();
-	Upload(data, size);
+	Upload(data, size, 0, true);
 }
 Buffer::Buffer(const std::string& name, ::Device* device, const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkFormat viewFormat, VkMemoryPropertyFlags properties)
-	: mName(name), mDevice(device), mSize(size), mUsageFlags(usage), mMemoryProperties(properties), mBuffer(VK_NULL_HANDLE), mView(VK_NULL_HANDLE), mViewFormat(viewFormat), mMemory({}) {
+	: mName(name), mDevice(device), mSize(size), mUsageFlags(usage), mMemoryProperties(properties), mBuffer(VK_NULL_HANDLE), mID(NextBufferID()), mView(VK_NULL_HANDLE), mViewFormat(viewFormat), mMemory({}), mUploadToken(0) {
 	if ((properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == 0)
 		mUsageFlags |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 	Allocate();
-	Upload(data, size);
+	Upload(data, size, 0, true);
 }
 Buffer::Buffer(const Buffer& src)
 	: mName(src.mName), mDevice(src.mDevice), mSize(0), mUsageFlags(src.mUsageFlags | VK_BUFFER_USAGE_TRANSFER_DST_BIT), mMemoryProperties(src.mMemoryProperties),
-	mBuffer(VK_NULL_HANDLE), mView(VK_NULL_HANDLE), mViewFormat(src.mViewFormat), mMemory({}) {
-	CopyFrom(src);
+	mBuffer(VK_NULL_HANDLE), mID(NextBufferID()), mView(VK_NULL_HANDLE), mViewFormat(src.mViewFormat), mMemory({}), mUploadToken(0) {
+	// callers expect src to be free to destroy once the copy is constructed
+	mDevice->StagingRing()->Wait(CopyFrom(src));
 }
 Buffer::~Buffer() {
+	{
+		lock_guard lock(mDevice->mMemoryMutex);
+		mDevice->mBuffers.erase(this);
+	}
+	// pending uploads must finish before the buffer is destroyed
+	if (mUploadToken) mDevice->StagingRing()->Wait(mUploadToken);
+	mDevice->StagingRing()->Discard((uint64_t)mBuffer);
+	mDevice->InvalidateDescriptorSets((uint64_t)mBuffer);
 	if (mView) vkDestroyBufferView(*mDevice, mView, nullptr);
 	if (mBuffer) vkDestroyBuffer(*mDevice, mBuffer, nullptr);
 	mDevice->FreeMemory(mMemory);
 }
 
-void Buffer::Upload(const void* data, VkDeviceSize size) {
-	if (!data) return;
+uint64_t Buffer::Upload(const void* data, VkDeviceSize size) {
+	return Upload(data, size, 0, false);
+}
+uint64_t Buffer::Upload(const void* data, VkDeviceSize size, VkDeviceSize offset) {
+	if (offset + size > mSize) throw runtime_error("Data size out of bounds");
+	return Upload(data, size, offset, false);
+}
+uint64_t Buffer::Upload(const void* data, VkDeviceSize size, VkDeviceSize dstOffset, bool newBuffer) {
+	if (!data) return 0;
 	if (size > mSize) throw runtime_error("Data size out of bounds");
 	if (mMemoryProperties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
-		memcpy(MappedData(), data, size);
-	} else {
-		if ((mUsageFlags & VK_BUFFER_USAGE_TRANSFER_DST_BIT) == 0) {
-			mUsageFlags |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-			
-			if (mView) vkDestroyBufferView(*mDevice, mView, nullptr);
-			if (mBuffer) vkDestroyBuffer(*mDevice, mBuffer, nullptr);
-			mDevice->FreeMemory(mMemory);
-			mSize = size;
-			Allocate();
-		}
-		Buffer uploadBuffer(mName + " upload", mDevice, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-		memcpy(uploadBuffer.MappedData(), data, size);
-		CopyFrom(uploadBuffer);
+		memcpy((uint8_t*)MappedData() + dstOffset, data, size);
+		return 0;
 	}
+
+	auto copy = [&](CommandBuffer* commandBuffer, VkBuffer staging, VkDeviceSize offset) {
+		VkBufferCopy copyRegion = {};
+		copyRegion.srcOffset = offset;
+		copyRegion.dstOffset = dstOffset;
+		copyRegion.size = size;
+		vkCmdCopyBuffer(*commandBuffer, staging, mBuffer, 1, &copyRegion);
+	};
+	if (newBuffer)
+		mUploadToken = mDevice->StagingRing()->Upload(data, size, 16, [&](CommandBuffer* commandBuffer, VkBuffer staging, VkDeviceSize offset) {
+			copy(commandBuffer, staging, offset);
+			mDevice->StagingRing()->TransferOwnership(mBuffer);
+		});
+	else {
+		// the buffer may be in use by the graphics queue, so it's written there
+		mDevice->StagingRing()->Acquire((uint64_t)mBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+		mUploadToken = mDevice->StagingRing()->Upload(data, size, 16, nullptr, copy);
+	}
+	return mUploadToken;
 }
 
-void Buffer::CopyFrom(const Buffer& other) {
+uint64_t Buffer::CopyFrom(const Buffer& other) {
 	if (mSize != other.mSize) {
+		mDevice->StagingRing()->Wait(mUploadToken);
+		mDevice->StagingRing()->Discard((uint64_t)mBuffer);
+		mDevice->InvalidateDescriptorSets((uint64_t)mBuffer);
 		if (mView) vkDestroyBufferView(*mDevice, mView, nullptr);
 		if (mBuffer) vkDestroyBuffer(*mDevice, mBuffer, nullptr);
 		mDevice->FreeMemory(mMemory);
@@ -68,28 +100,38 @@ void Buffer::CopyFrom(const Buffer& other) {
 		Allocate();
 	}
 
-	auto commandBuffer = mDevice->GetCommandBuffer();
-
-	VkBufferMemoryBarrier barrier = {};
-	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-	barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
-	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-	barrier.buffer = other;
-	barrier.size = mSize;
-	vkCmdPipelineBarrier(*commandBuffer,
-		VK_PIPELINE_STAGE_HOST_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
-		0,
-		0, nullptr,
-		1, &barrier,
-		0, nullptr);
+	// other belongs to the graphics queue, so the copy is recorded there
+	mDevice->StagingRing()->Acquire((uint64_t)other.mBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+	mDevice->StagingRing()->Acquire((uint64_t)mBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+	mUploadToken = mDevice->StagingRing()->Upload(nullptr, 0, 0, nullptr, [&](CommandBuffer* commandBuffer, VkBuffer, VkDeviceSize) {
+		// other may have been written earlier in the same batch
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = other;
+		barrier.size = mSize;
+		vkCmdPipelineBarrier(*commandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0,
+			0, nullptr,
+			1, &barrier,
+			0, nullptr);
 
-	VkBufferCopy copyRegion = {};
-	copyRegion.size = mSize;
-	vkCmdCopyBuffer(*commandBuffer, other.mBuffer, mBuffer, 1, &copyRegion);
-	mDevice->Execute(commandBuffer, false)->Wait();
+		VkBufferCopy copyRegion = {};
+		copyRegion.size = mSize;
+		vkCmdCopyBuffer(*commandBuffer, other.mBuffer, mBuffer, 1, &copyRegion);
+	});
+	return mUploadToken;
 }
 
 void Buffer::Allocate(){
+	// device-local buffers can be copied so that the defragmenter can relocate them
+	if ((mMemoryProperties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == 0)
+		mUsageFlags |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
 	VkBufferCreateInfo bufferInfo = {};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	bufferInfo.size = mSize;
@@ -98,9 +140,20 @@ void Buffer::Allocate(){
 	ThrowIfFailed(vkCreateBuffer(*mDevice, &bufferInfo, nullptr, &mBuffer), "vkCreateBuffer failed for " + mName);
 	mDevice->SetObjectName(mBuffer, mName, VK_OBJECT_TYPE_BUFFER);
 
-	VkMemoryRequirements memRequirements;
-	vkGetBufferMemoryRequirements(*mDevice, mBuffer, &memRequirements);
-	mMemory = mDevice->AllocateMemory(memRequirements, mMemoryProperties, mName);
+	VkMemoryDedicatedRequirements dedicated = {};
+	dedicated.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+	VkMemoryRequirements2 memRequirements = {};
+	memRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+	memRequirements.pNext = &dedicated;
+	VkBufferMemoryRequirementsInfo2 requirementsInfo = {};
+	requirementsInfo.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2;
+	requirementsInfo.buffer = mBuffer;
+	vkGetBufferMemoryRequirements2(*mDevice, &requirementsInfo, &memRequirements);
+
+	if (dedicated.requiresDedicatedAllocation || dedicated.prefersDedicatedAllocation || memRequirements.memoryRequirements.size >= MEM_DEDICATED_ALLOC)
+		mMemory = mDevice->AllocateDedicatedMemory(memRequirements.memoryRequirements, mMemoryProperties, mName, VK_NULL_HANDLE, mBuffer);
+	else
+		mMemory = mDevice->AllocateMemory(memRequirements.memoryRequirements, mMemoryProperties, mName);
 	vkBindBufferMemory(*mDevice, mBuffer, mMemory.mDeviceMemory, mMemory.mOffset);
 
 	if (mViewFormat != VK_FORMAT_UNDEFINED) {
@@ -113,4 +166,7 @@ void Buffer::Allocate(){
 		ThrowIfFailed(vkCreateBufferView(*mDevice, &viewInfo, nullptr, &mView), "vkCreateBufferView failed for " + mName);
 		mDevice->SetObjectName(mView, mName, VK_OBJECT_TYPE_BUFFER_VIEW);
 	}
+
+	lock_guard lock(mDevice->mMemoryMutex);
+	mDevice->mBuffers.insert(this);
 }
\ No newline at end of file
@@ -11,10 +11,17 @@ public:
 	ENGINE_EXPORT Buffer(const std::string& name, ::Device* device, const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkFormat viewFormat, VkMemoryPropertyFlags memoryFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 	ENGINE_EXPORT Buffer(const std::string& name, ::Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 	ENGINE_EXPORT Buffer(const std::string& name, ::Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkFormat viewFormat, VkMemoryPropertyFlags memoryFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	/// Copies src's contents, blocking until the copy is done so that src can be destroyed afterwards
 	ENGINE_EXPORT Buffer(const Buffer& src);
 	ENGINE_EXPORT ~Buffer();
 
-	ENGINE_EXPORT void Upload(const void* data, VkDeviceSize size);
+	/// Copies data into the buffer. Device-local buffers are uploaded through the Device's StagingRing without blocking;
+	/// returns the StagingRing token of the upload (0 for host-visible buffers)
+	ENGINE_EXPORT uint64_t Upload(const void* data, VkDeviceSize size);
+	/// Copies data into a range of the buffer, the rest of the buffer may be in use by the GPU
+	ENGINE_EXPORT uint64_t Upload(const void* data, VkDeviceSize size, VkDeviceSize offset);
+	/// StagingRing token of the most recent upload or copy into this buffer
+	inline uint64_t UploadToken() const { return mUploadToken; }
 
 	inline void* MappedData() const { return mMemory.mMapped; }
 
@@ -23,26 +30,34 @@ public:
 	inline VkMemoryPropertyFlags MemoryProperties() const { return mMemoryProperties; }
 	inline const DeviceMemoryAllocation& Memory() const { return mMemory; }
 
-	ENGINE_EXPORT void CopyFrom(const Buffer& other);
+	/// Records a copy from other into the Device's StagingRing. other must stay alive until the returned token completes.
+	ENGINE_EXPORT uint64_t CopyFrom(const Buffer& other);
 	Buffer& operator=(const Buffer& other) = delete;
 
 	inline const VkBufferView& View() const { return mView; }
 
 	inline ::Device* Device() const { return mDevice; }
+	/// Unique to this Buffer, unlike the VkBuffer handle which changes when the buffer is relocated and can be reused once it is destroyed
+	inline uint64_t ID() const { return mID; }
 	inline operator VkBuffer() const { return mBuffer; }
 
 private:
+	friend class ::Device;
 	::Device* mDevice;
 	VkBuffer mBuffer;
+	uint64_t mID;
 	DeviceMemoryAllocation mMemory;
 
 	VkBufferView mView;
 	VkFormat mViewFormat;
 
 	VkDeviceSize mSize;
+	uint64_t mUploadToken;
 
 	VkBufferUsageFlags mUsageFlags;
 	VkMemoryPropertyFlags mMemoryProperties;
 
 	ENGINE_EXPORT void Allocate();
+	/// Newly allocated buffers aren't in use by the graphics queue, so they can be written on the transfer queue
+	ENGINE_EXPORT uint64_t Upload(const void* data, VkDeviceSize size, VkDeviceSize offset, bool newBuffer);
 };
\ No newline at end of file
@@ -121,43 +121,57 @@ bool CommandBuffer::PushConstant(ShaderVariant* shader, const std::string& name,
 	vkCmdPushConstants(*this, shader->mPipelineLayout, range.stageFlags, range.offset, range.size, value);
 	return true;
 }
+bool CommandBuffer::PushConstant(ShaderVariant* shader, uint32_t nameID, const void* value) {
+	const VkPushConstantRange* range = shader->PushConstant(nameID);
+	if (!range) return false;
+	vkCmdPushConstants(*this, shader->mPipelineLayout, range->stageFlags, range->offset, range->size, value);
+	return true;
+}
+void CommandBuffer::PushConstants(ShaderVariant* shader, const void* data) {
+	for (const VkPushConstantRange& range : shader->mPushConstantRanges)
+		vkCmdPushConstants(*this, shader->mPipelineLayout, range.stageFlags, range.offset, range.size, (const uint8_t*)data + range.offset);
+}
 VkPipelineLayout CommandBuffer::BindShader(GraphicsShader* shader, PassType pass, const VertexInput* input, Camera* camera, VkPrimitiveTopology topology, VkCullModeFlags cullMode, BlendMode blendMode, VkPolygonMode polyMode) {
 	VkPipeline pipeline = shader->GetPipeline(mCurrentRenderPass, input, topology, cullMode, blendMode, polyMode);
+	if (pipeline == VK_NULL_HANDLE) return VK_NULL_HANDLE; // still compiling
 	if (mCurrentPipeline == pipeline) {
 		if (mCurrentCamera != camera && camera) {
 			mCurrentCamera = camera;
-			if (mCurrentRenderPass && camera && shader->mDescriptorBindings.count("Camera"))
-				vkCmdBindDescriptorSets(*this, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->mPipelineLayout, PER_CAMERA, 1, *camera->DescriptorSet(shader->mDescriptorBindings.at("Camera").second.stageFlags), 0, nullptr);
+			const auto* cameraBinding = shader->DescriptorBinding(SHADER_NAME_ID("Camera"));
+			if (mCurrentRenderPass && camera && cameraBinding)
+				vkCmdBindDescriptorSets(*this, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->mPipelineLayout, PER_CAMERA, 1, *camera->DescriptorSet(cameraBinding->second.stageFlags), 0, nullptr);
 			
 			uint32_t eye = 0;
-			PushConstant(shader, "StereoEye", &eye);
+			PushConstant(shader, SHADER_NAME_ID("StereoEye"), &eye);
 		}
 		return shader->mPipelineLayout;
 	}
 	mCurrentPipeline = pipeline;
 	vkCmdBindPipeline(*this, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 	if (camera) {
-		if (mCurrentRenderPass && shader->mDescriptorBindings.count("Camera"))
-			vkCmdBindDescriptorSets(*this, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->mPipelineLayout, PER_CAMERA, 1, *camera->DescriptorSet(shader->mDescriptorBindings.at("Camera").second.stageFlags), 0, nullptr);
+		const auto* cameraBinding = shader->DescriptorBinding(SHADER_NAME_ID("Camera"));
+		if (mCurrentRenderPass && cameraBinding)
+			vkCmdBindDescriptorSets(*this, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->mPipelineLayout, PER_CAMERA, 1, *camera->DescriptorSet(cameraBinding->second.stageFlags), 0, nullptr);
 		mCurrentCamera = camera;
 		uint32_t eye = 0;
-		PushConstant(shader, "StereoEye", &eye);
+		PushConstant(shader, SHADER_NAME_ID("StereoEye"), &eye);
 	}
 	mCurrentMaterial = nullptr;
 	return shader->mPipelineLayout;
 }
 VkPipelineLayout CommandBuffer::BindMaterial(Material* material, PassType pass, const VertexInput* input, Camera* camera, VkPrimitiveTopology topology, VkCullModeFlags cullMode, BlendMode blendMode, VkPolygonMode polyMode) {
-	GraphicsShader* shader = material->GetShader(pass);
+	GraphicsShader* shader = material->GetShader(pass, input);
 	if (!shader) return VK_NULL_HANDLE;
 
 	if (blendMode == BLEND_MODE_MAX_ENUM) blendMode = material->BlendMode();
 	if (cullMode == VK_CULL_MODE_FLAG_BITS_MAX_ENUM) cullMode = material->CullMode();
 
 	VkPipeline pipeline = shader->GetPipeline(mCurrentRenderPass, input, topology, cullMode, blendMode, polyMode);
+	if (pipeline == VK_NULL_HANDLE) return VK_NULL_HANDLE; // still compiling
 
 	if (pipeline != mCurrentPipeline && mCurrentCamera == camera && mCurrentMaterial == material) return shader->mPipelineLayout;
 
-	Material::VariantData* data = material->GetData(pass);
+	Material::VariantData* data = material->GetData(pass, input);
 
 	if (pipeline != mCurrentPipeline) {
 		vkCmdBindPipeline(*this, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
@@ -174,7 +188,7 @@ VkPipelineLayout CommandBuffer::BindMaterial(Material* material, PassType pass,
 	
 	material->SetPushConstantParameters(this, camera, data);
 	uint32_t eye = 0;
-	PushConstant(data->mShaderVariant, "StereoEye", &eye);
+	PushConstant(data->mShaderVariant, SHADER_NAME_ID("StereoEye"), &eye);
 
 	return shader->mPipelineLayout;
 }
@@ -183,6 +197,7 @@ void CommandBuffer::BindVertexBuffer(Buffer* buffer, uint32_t index, VkDeviceSiz
 	if (mCurrentVertexBuffers[index] == buffer) return;
 
 	VkBuffer buf = buffer == nullptr ? (VkBuffer)VK_NULL_HANDLE : (*buffer);
+	mDevice->StagingRing()->Acquire((uint64_t)buf, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
 	vkCmdBindVertexBuffers(mCommandBuffer, index, 1, &buf, &offset);
 
 	mCurrentVertexBuffers[index] = buffer;
@@ -190,6 +205,7 @@ void CommandBuffer::BindVertexBuffer(Buffer* buffer, uint32_t index, VkDeviceSiz
 void CommandBuffer::BindIndexBuffer(Buffer* buffer, VkDeviceSize offset, VkIndexType indexType) {
 	if (mCurrentIndexBuffer == buffer) return;
 	VkBuffer buf = buffer == nullptr ? (VkBuffer)VK_NULL_HANDLE : (*buffer);
+	mDevice->StagingRing()->Acquire((uint64_t)buf, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
 	vkCmdBindIndexBuffer(mCommandBuffer, buf, offset, indexType);
 	mCurrentIndexBuffer = buffer;
 }
\ No newline at end of file
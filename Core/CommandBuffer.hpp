@@ -57,6 +57,10 @@ public:
 	inline RenderPass* CurrentRenderPass() const { return mCurrentRenderPass; }
 
 	ENGINE_EXPORT bool PushConstant(ShaderVariant* shader, const std::string& name, const void* value);
+	/// Pushes a push constant by ShaderNameID, avoiding the string lookup on per-draw paths
+	ENGINE_EXPORT bool PushConstant(ShaderVariant* shader, uint32_t nameID, const void* value);
+	/// Pushes a whole push constant block laid out for shader, of size shader->mPushConstantSize
+	ENGINE_EXPORT void PushConstants(ShaderVariant* shader, const void* data);
 
 	/// Binds a shader
 	/// If camera is not nullptr, attempts to bind the camera's uniform buffer to a descriptor named 'Camera'
@@ -85,6 +89,7 @@ public:
 
 private:
 	friend class Device;
+	friend class StagingRing;
 	ENGINE_EXPORT CommandBuffer(::Device* device, VkCommandPool commandPool, const std::string& name = "Command Buffer");
 	::Device* mDevice;
 	VkCommandBuffer mCommandBuffer;
@@ -5,7 +5,10 @@
 
 using namespace std;
 
-DescriptorSet::DescriptorSet(const string& name, Device* device, VkDescriptorSetLayout layout) : mDevice(device), mLayout(layout) {
+// descriptors don't know which shader stages use them
+#define DESCRIPTOR_STAGES (VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
+
+DescriptorSet::DescriptorSet(const string& name, Device* device, VkDescriptorSetLayout layout) : mDevice(device), mLayout(layout), mDescriptorPool(device->mDescriptorPool) {
 	VkDescriptorSetAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = mDevice->mDescriptorPool;
@@ -16,7 +19,16 @@ DescriptorSet::DescriptorSet(const string& name, Device* device, VkDescriptorSet
 	mDevice->SetObjectName(mDescriptorSet, name, VK_OBJECT_TYPE_DESCRIPTOR_SET);
 	mDevice->mDescriptorSetCount++;
 }
+DescriptorSet::DescriptorSet(const string& name, Device* device, VkDescriptorSetLayout layout, VkDescriptorSet descriptorSet)
+	: mDevice(device), mLayout(layout), mDescriptorSet(descriptorSet), mDescriptorPool(VK_NULL_HANDLE) {
+	mDevice->SetObjectName(mDescriptorSet, name, VK_OBJECT_TYPE_DESCRIPTOR_SET);
+}
 DescriptorSet::~DescriptorSet() {
+	if (mCurrentBuffers.size()) {
+		lock_guard lock(mDevice->mMemoryMutex);
+		for (auto& kp : mCurrentBuffers)
+			if (--mDevice->mDescriptorBufferReferences.at(kp.second) == 0) mDevice->mDescriptorBufferReferences.erase(kp.second);
+	}
 	for (auto c : mCurrent) {
 		safe_delete(c.second.pImageInfo);
 		safe_delete(c.second.pBufferInfo);
@@ -34,8 +46,9 @@ DescriptorSet::~DescriptorSet() {
 		delete mImageInfoPool.front();
 		mImageInfoPool.pop();
 	}
+	if (!mDescriptorPool) return;
 	lock_guard lock(mDevice->mDescriptorPoolMutex);
-	ThrowIfFailed(vkFreeDescriptorSets(*mDevice, mDevice->mDescriptorPool, 1, &mDescriptorSet), "vkFreeDescriptorSets failed");
+	ThrowIfFailed(vkFreeDescriptorSets(*mDevice, mDescriptorPool, 1, &mDescriptorSet), "vkFreeDescriptorSets failed");
 	mDevice->mDescriptorSetCount--;
 }
 
@@ -49,6 +62,8 @@ void DescriptorSet::CreateStorageBufferDescriptor(Buffer* buffer, uint32_t index
 			c.pBufferInfo->range == range) return;
 	}
 
+	mDevice->StagingRing()->Acquire((uint64_t)(VkBuffer)*buffer, DESCRIPTOR_STAGES, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
 	VkDescriptorBufferInfo* info;
 	if (mBufferInfoPool.empty())
 		info = new VkDescriptorBufferInfo();
@@ -70,6 +85,7 @@ void DescriptorSet::CreateStorageBufferDescriptor(Buffer* buffer, uint32_t index
 	write.descriptorCount = 1;
 	mPending.push_back(write);
 	mPendingBuffers.push_back(info);
+	mPendingBufferIDs[idx] = buffer->ID();
 }
 void DescriptorSet::CreateStorageBufferDescriptor(Buffer* buffer, VkDeviceSize offset, VkDeviceSize range, uint32_t binding) {
 	uint64_t idx = (uint64_t)binding;
@@ -81,6 +97,8 @@ void DescriptorSet::CreateStorageBufferDescriptor(Buffer* buffer, VkDeviceSize o
 			c.pBufferInfo->range == range) return;
 	}
 
+	mDevice->StagingRing()->Acquire((uint64_t)(VkBuffer)*buffer, DESCRIPTOR_STAGES, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
 	VkDescriptorBufferInfo* info;
 	if (mBufferInfoPool.empty())
 		info = new VkDescriptorBufferInfo();
@@ -102,6 +120,7 @@ void DescriptorSet::CreateStorageBufferDescriptor(Buffer* buffer, VkDeviceSize o
 	write.descriptorCount = 1;
 	mPending.push_back(write);
 	mPendingBuffers.push_back(info);
+	mPendingBufferIDs[idx] = buffer->ID();
 }
 void DescriptorSet::CreateStorageTexelBufferDescriptor(Buffer* buffer, uint32_t binding) {
 	uint64_t idx = (uint64_t)binding;
@@ -110,6 +129,8 @@ void DescriptorSet::CreateStorageTexelBufferDescriptor(Buffer* buffer, uint32_t
 		if (c.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER && c.pTexelBufferView == &buffer->View()) return;
 	}
 
+	mDevice->StagingRing()->Acquire((uint64_t)(VkBuffer)*buffer, DESCRIPTOR_STAGES, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
 	VkWriteDescriptorSet write = {};
 	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 	write.dstSet = mDescriptorSet;
@@ -119,6 +140,7 @@ void DescriptorSet::CreateStorageTexelBufferDescriptor(Buffer* buffer, uint32_t
 	write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER;
 	write.descriptorCount = 1;
 	mPending.push_back(write);
+	mPendingBufferIDs[idx] = buffer->ID();
 }
 
 void DescriptorSet::CreateUniformBufferDescriptor(Buffer* buffer, VkDeviceSize offset, VkDeviceSize range, uint32_t binding) {
@@ -131,6 +153,8 @@ void DescriptorSet::CreateUniformBufferDescriptor(Buffer* buffer, VkDeviceSize o
 			c.pBufferInfo->range == range) return;
 	}
 
+	mDevice->StagingRing()->Acquire((uint64_t)(VkBuffer)*buffer, DESCRIPTOR_STAGES, VK_ACCESS_UNIFORM_READ_BIT);
+
 	VkDescriptorBufferInfo* info;
 	if (mBufferInfoPool.empty())
 		info = new VkDescriptorBufferInfo();
@@ -152,9 +176,12 @@ void DescriptorSet::CreateUniformBufferDescriptor(Buffer* buffer, VkDeviceSize o
 	write.descriptorCount = 1;
 	mPending.push_back(write);
 	mPendingBuffers.push_back(info);
+	mPendingBufferIDs[idx] = buffer->ID();
 }
 
 void DescriptorSet::CreateStorageTextureDescriptor(Texture* texture, uint32_t binding, VkImageLayout layout) {
+	// writing a texture's descriptor counts as using it, so AssetManager doesn't evict textures that are bound without a Material
+	texture->MarkUsed(mDevice->Instance()->FrameCount());
 	uint64_t idx = (uint64_t)binding;
 	if (mCurrent.count(idx)) {
 		const VkWriteDescriptorSet& c = mCurrent.at(idx);
@@ -163,6 +190,8 @@ void DescriptorSet::CreateStorageTextureDescriptor(Texture* texture, uint32_t bi
 			c.pImageInfo->imageView == texture->View()) return;
 	}
 
+	mDevice->StagingRing()->Acquire((uint64_t)texture->Image(), DESCRIPTOR_STAGES, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
 	VkDescriptorImageInfo* info;
 	if (mImageInfoPool.empty())
 		info = new VkDescriptorImageInfo();
@@ -186,6 +215,7 @@ void DescriptorSet::CreateStorageTextureDescriptor(Texture* texture, uint32_t bi
 	mPendingImages.push_back(info);
 }
 void DescriptorSet::CreateStorageTextureDescriptor(Texture* texture, uint32_t index, uint32_t binding, VkImageLayout layout) {
+	texture->MarkUsed(mDevice->Instance()->FrameCount());
 	uint64_t idx = (uint64_t)binding | ((uint64_t)index << 32);
 	if (mCurrent.count(idx)) {
 		const VkWriteDescriptorSet& c = mCurrent.at(idx);
@@ -194,6 +224,8 @@ void DescriptorSet::CreateStorageTextureDescriptor(Texture* texture, uint32_t in
 			c.pImageInfo->imageView == texture->View()) return;
 	}
 
+	mDevice->StagingRing()->Acquire((uint64_t)texture->Image(), DESCRIPTOR_STAGES, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
 	VkDescriptorImageInfo* info;
 	if (mImageInfoPool.empty())
 		info = new VkDescriptorImageInfo();
@@ -217,6 +249,7 @@ void DescriptorSet::CreateStorageTextureDescriptor(Texture* texture, uint32_t in
 	mPendingImages.push_back(info);
 }
 void DescriptorSet::CreateSampledTextureDescriptor(Texture* texture, uint32_t binding, VkImageLayout layout) {
+	texture->MarkUsed(mDevice->Instance()->FrameCount());
 	uint64_t idx = (uint64_t)binding;
 	if (mCurrent.count(idx)) {
 		const VkWriteDescriptorSet& c = mCurrent.at(idx);
@@ -225,6 +258,8 @@ void DescriptorSet::CreateSampledTextureDescriptor(Texture* texture, uint32_t bi
 			c.pImageInfo->imageView == texture->View()) return;
 	}
 
+	mDevice->StagingRing()->Acquire((uint64_t)texture->Image(), DESCRIPTOR_STAGES, VK_ACCESS_SHADER_READ_BIT);
+
 	VkDescriptorImageInfo* info;
 	if (mImageInfoPool.empty())
 		info = new VkDescriptorImageInfo();
@@ -248,6 +283,7 @@ void DescriptorSet::CreateSampledTextureDescriptor(Texture* texture, uint32_t bi
 	mPendingImages.push_back(info);
 }
 void DescriptorSet::CreateSampledTextureDescriptor(Texture* texture, uint32_t index, uint32_t binding, VkImageLayout layout) {
+	texture->MarkUsed(mDevice->Instance()->FrameCount());
 	uint64_t idx = (uint64_t)binding | ((uint64_t)index << 32);
 	if (mCurrent.count(idx)) {
 		const VkWriteDescriptorSet& c = mCurrent.at(idx);
@@ -256,6 +292,8 @@ void DescriptorSet::CreateSampledTextureDescriptor(Texture* texture, uint32_t in
 			c.pImageInfo->imageView == texture->View()) return;
 	}
 
+	mDevice->StagingRing()->Acquire((uint64_t)texture->Image(), DESCRIPTOR_STAGES, VK_ACCESS_SHADER_READ_BIT);
+
 	VkDescriptorImageInfo* info;
 	if (mImageInfoPool.empty())
 		info = new VkDescriptorImageInfo();
@@ -309,6 +347,32 @@ void DescriptorSet::CreateSamplerDescriptor(Sampler* sampler, uint32_t binding)
 	mPendingImages.push_back(info);
 }
 
+void DescriptorSet::Write(const DescriptorSetWrite& w) {
+	switch (w.mType) {
+	case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+		CreateStorageBufferDescriptor(w.mBuffer, w.mArrayIndex, w.mOffset, w.mRange, w.mBinding);
+		break;
+	case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+		CreateStorageTexelBufferDescriptor(w.mBuffer, w.mBinding);
+		break;
+	case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+		CreateUniformBufferDescriptor(w.mBuffer, w.mOffset, w.mRange, w.mBinding);
+		break;
+	case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+		CreateStorageTextureDescriptor(w.mTexture, w.mArrayIndex, w.mBinding, w.mImageLayout);
+		break;
+	case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+		CreateSampledTextureDescriptor(w.mTexture, w.mArrayIndex, w.mBinding, w.mImageLayout);
+		break;
+	case VK_DESCRIPTOR_TYPE_SAMPLER:
+		CreateSamplerDescriptor(w.mSampler, w.mBinding);
+		break;
+	default:
+		fprintf_color(COLOR_RED, stderr, "Unsupported descriptor type %d\n", w.mType);
+		break;
+	}
+}
+
 void DescriptorSet::FlushWrites() {
 	if (mPending.empty()) return;
 
@@ -335,6 +399,25 @@ void DescriptorSet::FlushWrites() {
 		}
 	}
 
+	{
+		// track which buffers the set references now, so that Device::Defragment doesn't move them
+		lock_guard lock(mDevice->mMemoryMutex);
+		for (const VkWriteDescriptorSet& i : mPending) {
+			uint64_t idx = (uint64_t)i.dstBinding | ((uint64_t)i.dstArrayElement << 32);
+			auto c = mCurrentBuffers.find(idx);
+			if (c != mCurrentBuffers.end()) {
+				if (--mDevice->mDescriptorBufferReferences.at(c->second) == 0) mDevice->mDescriptorBufferReferences.erase(c->second);
+				mCurrentBuffers.erase(c);
+			}
+			auto p = mPendingBufferIDs.find(idx);
+			if (p != mPendingBufferIDs.end()) {
+				mDevice->mDescriptorBufferReferences[p->second]++;
+				mCurrentBuffers.emplace(idx, p->second);
+			}
+		}
+		mPendingBufferIDs.clear();
+	}
+
 	for (VkDescriptorBufferInfo* d : mPendingBuffers) mBufferInfoPool.push(d);
 	for (VkDescriptorImageInfo* d : mPendingImages) mImageInfoPool.push(d);
 	
@@ -7,8 +7,29 @@ class Texture;
 class Buffer;
 class Sampler;
 
+/// One descriptor of a set requested with Device::GetCachedDescriptorSet
+struct DescriptorSetWrite {
+	VkDescriptorType mType;
+	uint32_t mBinding;
+	uint32_t mArrayIndex;
+	Buffer* mBuffer;
+	Texture* mTexture;
+	Sampler* mSampler;
+	VkDeviceSize mOffset;
+	VkDeviceSize mRange;
+	VkImageLayout mImageLayout;
+
+	inline DescriptorSetWrite(VkDescriptorType type, uint32_t binding, Buffer* buffer, VkDeviceSize offset, VkDeviceSize range, uint32_t arrayIndex = 0)
+		: mType(type), mBinding(binding), mArrayIndex(arrayIndex), mBuffer(buffer), mTexture(nullptr), mSampler(nullptr), mOffset(offset), mRange(range), mImageLayout(VK_IMAGE_LAYOUT_UNDEFINED) {}
+	inline DescriptorSetWrite(VkDescriptorType type, uint32_t binding, Texture* texture, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, uint32_t arrayIndex = 0)
+		: mType(type), mBinding(binding), mArrayIndex(arrayIndex), mBuffer(nullptr), mTexture(texture), mSampler(nullptr), mOffset(0), mRange(0), mImageLayout(layout) {}
+	inline DescriptorSetWrite(uint32_t binding, Sampler* sampler)
+		: mType(VK_DESCRIPTOR_TYPE_SAMPLER), mBinding(binding), mArrayIndex(0), mBuffer(nullptr), mTexture(nullptr), mSampler(sampler), mOffset(0), mRange(0), mImageLayout(VK_IMAGE_LAYOUT_UNDEFINED) {}
+};
+
 class DescriptorSet {
 public:
+	/// Allocates a descriptor set from the Device's shared descriptor pool
 	ENGINE_EXPORT DescriptorSet(const std::string& name, Device* device, VkDescriptorSetLayout layout);
 	ENGINE_EXPORT ~DescriptorSet();
 
@@ -25,6 +46,8 @@ public:
 	
 	ENGINE_EXPORT void CreateSamplerDescriptor(Sampler* sampler, uint32_t binding);
 
+	/// Queues a write described by a DescriptorSetWrite
+	ENGINE_EXPORT void Write(const DescriptorSetWrite& write);
 	ENGINE_EXPORT void FlushWrites();
 
 	inline VkDescriptorSetLayout Layout() const { return mLayout; }
@@ -32,7 +55,14 @@ public:
 	inline operator VkDescriptorSet() const { return mDescriptorSet; }
 
 private:
+	friend class Device;
+	// wraps a descriptor set allocated from a frame context's descriptor pool, which is freed when the pool is reset
+	ENGINE_EXPORT DescriptorSet(const std::string& name, Device* device, VkDescriptorSetLayout layout, VkDescriptorSet descriptorSet);
+
 	std::unordered_map<uint64_t, VkWriteDescriptorSet> mCurrent;
+	// Buffer::ID() of the buffers referenced by mCurrent and mPending, counted in Device::mDescriptorBufferReferences so they aren't relocated
+	std::unordered_map<uint64_t, uint64_t> mCurrentBuffers;
+	std::unordered_map<uint64_t, uint64_t> mPendingBufferIDs;
 
 	std::vector<VkWriteDescriptorSet> mPending;
 	std::queue<VkDescriptorBufferInfo*> mBufferInfoPool;
@@ -43,4 +73,6 @@ private:
 	Device* mDevice;
 	VkDescriptorSet mDescriptorSet;
 	VkDescriptorSetLayout mLayout;
+	// VK_NULL_HANDLE if the set isn't freed individually
+	VkDescriptorPool mDescriptorPool;
 };
\ No newline at end of file
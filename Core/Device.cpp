@@ -2,18 +2,38 @@
 #include <Core/Device.hpp>
 #include <Core/Instance.hpp>
 #include <Core/CommandBuffer.hpp>
+#include <Core/Sampler.hpp>
 #include <Core/Window.hpp>
+#include <Content/Shader.hpp>
+#include <Content/Texture.hpp>
 #include <Util/Profiler.hpp>
 #include <Util/Util.hpp>
 
 
 //#define PRINT_VK_ALLOCATIONS
 
-// 4kb blocks
-#define MEM_BLOCK_SIZE (4*1024)
-// 128mb min allocation
+// 512mb min allocation
 #define MEM_MIN_ALLOC (512*1024*1024)
 
+// TLSF second level subdivisions per power of two
+#define TLSF_SL_LOG2 5
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG2)
+#define TLSF_FL_COUNT 64
+// sizes smaller than this are binned linearly in the first free list
+#define TLSF_FL_SHIFT (TLSF_SL_LOG2 + 3)
+#define TLSF_SMALL_SIZE ((VkDeviceSize)1 << TLSF_FL_SHIFT)
+
+// pipeline caches are saved here relative to the executable's directory, one file per physical device and driver
+#define PIPELINE_CACHE_DIRECTORY "Cache"
+#define PIPELINE_CACHE_MAGIC 0x43505453 // 'STPC'
+
+// written in front of the driver's pipeline cache data, to detect truncated or corrupted files
+struct PipelineCacheFileHeader {
+	uint32_t mMagic;
+	uint32_t mDataSize;
+	uint64_t mDataHash;
+};
+
 using namespace std;
 
 /*static*/ bool Device::FindQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface, uint32_t& graphicsFamily, uint32_t& presentFamily) {
@@ -59,6 +79,14 @@ void Device::FrameContext::Reset() {
 	mFences.clear();
 	mSemaphores.clear();
 
+	for (auto& b : mRetiredBuffers) {
+		mDevice->InvalidateDescriptorSets((uint64_t)get<0>(b));
+		if (get<1>(b)) vkDestroyBufferView(*mDevice, get<1>(b), nullptr);
+		vkDestroyBuffer(*mDevice, get<0>(b), nullptr);
+		mDevice->FreeMemory(get<2>(b));
+	}
+	mRetiredBuffers.clear();
+
 	PROFILER_BEGIN("Clear old buffers");
 	for (auto it = mTempBuffers.begin(); it != mTempBuffers.end();) {
 		if (it->second == 1) {
@@ -73,26 +101,30 @@ void Device::FrameContext::Reset() {
 
 	for (Buffer* b : mTempBuffersInUse)
 		mTempBuffers.push_back(make_pair(b, 8));
-	for (DescriptorSet* ds : mTempDescriptorSetsInUse)
-		mTempDescriptorSets[ds->Layout()].push_back(make_pair(ds, 8));
-
 	mTempBuffersInUse.clear();
-	mTempDescriptorSetsInUse.clear();
+
+	// the GPU is done with this frame, so every descriptor set allocated for it can be freed at once
+	for (auto& kp : mDescriptorPools) {
+		for (DescriptorSet* ds : kp.second.mDescriptorSets)
+			delete ds;
+		kp.second.mDescriptorSets.clear();
+		for (uint32_t i = 0; i < kp.second.mPools.size() && i <= kp.second.mCurrent; i++)
+			vkResetDescriptorPool(*mDevice, kp.second.mPools[i], 0);
+		kp.second.mCurrent = 0;
+	}
 }
 Device::FrameContext::~FrameContext() {
 	Reset();
 	for (auto b : mTempBuffers)
 		safe_delete(b.first);
-	for (auto kp : mTempDescriptorSets)
-		while (kp.second.size()) {
-			auto front = kp.second.begin();
-			safe_delete(front->first);
-			kp.second.erase(front);
-		}
+	for (auto& kp : mDescriptorPools)
+		for (VkDescriptorPool p : kp.second.mPools)
+			vkDestroyDescriptorPool(*mDevice, p, nullptr);
 }
 
 Device::Device(::Instance* instance, VkPhysicalDevice physicalDevice, uint32_t physicalDeviceIndex, uint32_t graphicsQueueFamily, uint32_t presentQueueFamily, const set<string>& deviceExtensions, vector<const char*> validationLayers)
-	: mInstance(instance), mFrameContexts(nullptr), mGraphicsQueueFamily(graphicsQueueFamily), mPresentQueueFamily(presentQueueFamily), mFrameContextIndex(0), mDescriptorSetCount(0) {
+	: mInstance(instance), mFrameContexts(nullptr), mGraphicsQueueFamily(graphicsQueueFamily), mPresentQueueFamily(presentQueueFamily), mFrameContextIndex(0), mDescriptorSetCount(0),
+	mDefragmentThreshold(.5f), mDefragmentBytesPerFrame(32 * 1024 * 1024), mStagingRing(nullptr), mBindlessTable(nullptr), mMeshPool(nullptr), mAsyncPipelineCompilation(true), mPendingPipelineCount(0), mShaderReloadCount(0), mAliasedPerFrameContext(0) {
 
 	#ifdef ENABLE_DEBUG_LAYERS
 	SetDebugUtilsObjectNameEXT = (PFN_vkSetDebugUtilsObjectNameEXT)vkGetInstanceProcAddr(*instance, "vkSetDebugUtilsObjectNameEXT");
@@ -109,7 +141,23 @@ Device::Device(::Instance* instance, VkPhysicalDevice physicalDevice, uint32_t p
 		deviceExts.push_back(s.c_str());
 
 	#pragma region get queue info
-	set<uint32_t> uniqueQueueFamilies{ mGraphicsQueueFamily, mPresentQueueFamily };
+	// prefer a transfer-only queue family (usually a DMA engine), then any family without graphics
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(mPhysicalDevice, &queueFamilyCount, nullptr);
+	vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(mPhysicalDevice, &queueFamilyCount, queueFamilies.data());
+	mTransferQueueFamily = mGraphicsQueueFamily;
+	for (uint32_t i = 0; i < queueFamilyCount; i++) {
+		VkQueueFlags flags = queueFamilies[i].queueFlags;
+		if (queueFamilies[i].queueCount == 0 || (flags & VK_QUEUE_TRANSFER_BIT) == 0 || (flags & VK_QUEUE_GRAPHICS_BIT)) continue;
+		if ((flags & VK_QUEUE_COMPUTE_BIT) == 0) {
+			mTransferQueueFamily = i;
+			break;
+		}
+		if (mTransferQueueFamily == mGraphicsQueueFamily) mTransferQueueFamily = i;
+	}
+
+	set<uint32_t> uniqueQueueFamilies{ mGraphicsQueueFamily, mPresentQueueFamily, mTransferQueueFamily };
 	vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 	float queuePriority = 1.0f;
 	for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -131,11 +179,34 @@ Device::Device(::Instance* instance, VkPhysicalDevice physicalDevice, uint32_t p
 	deviceFeatures.sparseBinding = VK_TRUE;
 	deviceFeatures.shaderImageGatherExtended = VK_TRUE;
 
+	// the bindless table needs descriptors that can be written while the set is bound
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT supportedIndexing = {};
+	supportedIndexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	VkPhysicalDeviceFeatures2 supportedFeatures = {};
+	supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	supportedFeatures.pNext = &supportedIndexing;
+	vkGetPhysicalDeviceFeatures2(mPhysicalDevice, &supportedFeatures);
+	mBindlessSupported =
+		supportedIndexing.descriptorBindingSampledImageUpdateAfterBind &&
+		supportedIndexing.descriptorBindingStorageBufferUpdateAfterBind &&
+		supportedIndexing.descriptorBindingUpdateUnusedWhilePending &&
+		supportedIndexing.shaderSampledImageArrayNonUniformIndexing;
+	mMultiDrawIndirect = supportedFeatures.features.multiDrawIndirect;
+	deviceFeatures.multiDrawIndirect = supportedFeatures.features.multiDrawIndirect;
+	// block compressed KTX2 textures are sampled directly, Texture checks the format support before creating them
+	deviceFeatures.textureCompressionBC = supportedFeatures.features.textureCompressionBC;
+
 	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
 	indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
 	indexingFeatures.pNext = nullptr;
 	indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
 	indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+	if (mBindlessSupported) {
+		indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+		indexingFeatures.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+		indexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+		indexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+	}
 
 	VkDeviceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -157,49 +228,77 @@ Device::Device(::Instance* instance, VkPhysicalDevice physicalDevice, uint32_t p
 
 	vkGetDeviceQueue(mDevice, mGraphicsQueueFamily, 0, &mGraphicsQueue);
 	vkGetDeviceQueue(mDevice, mPresentQueueFamily, 0, &mPresentQueue);
+	vkGetDeviceQueue(mDevice, mTransferQueueFamily, 0, &mTransferQueue);
 	SetObjectName(mGraphicsQueue, name + " Graphics Queue", VK_OBJECT_TYPE_QUEUE);
 	SetObjectName(mPresentQueue, name + " Present Queue", VK_OBJECT_TYPE_QUEUE);
+	if (mTransferQueueFamily != mGraphicsQueueFamily) {
+		SetObjectName(mTransferQueue, name + " Transfer Queue", VK_OBJECT_TYPE_QUEUE);
+		printf_color(COLOR_YELLOW, "Using queue family %u for transfers\n", mTransferQueueFamily);
+	}
 	#pragma endregion
 
 	#pragma region PipelineCache and DesriptorPool
+	char uuid[2 * VK_UUID_SIZE + 1];
+	for (uint32_t i = 0; i < VK_UUID_SIZE; i++)
+		snprintf(uuid + 2 * i, 3, "%02x", properties.pipelineCacheUUID[i]);
+	mPipelineCacheFile = (ExecutableDirectory() / PIPELINE_CACHE_DIRECTORY / ("pipelines_" + to_string(properties.vendorID) + "_" + to_string(properties.deviceID) + "_" + to_string(properties.driverVersion) + "_" + uuid + ".bin")).string();
+
+	vector<uint8_t> cacheData;
+	LoadPipelineCache(properties, cacheData);
+
 	VkPipelineCacheCreateInfo cache = {};
 	cache.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-	vkCreatePipelineCache(mDevice, &cache, nullptr, &mPipelineCache);
+	cache.initialDataSize = cacheData.size();
+	cache.pInitialData = cacheData.data();
+	if (vkCreatePipelineCache(mDevice, &cache, nullptr, &mPipelineCache) != VK_SUCCESS) {
+		fprintf_color(COLOR_YELLOW, stderr, "Failed to create pipeline cache from %s, starting with an empty cache\n", mPipelineCacheFile.c_str());
+		cache.initialDataSize = 0;
+		cache.pInitialData = nullptr;
+		ThrowIfFailed(vkCreatePipelineCache(mDevice, &cache, nullptr, &mPipelineCache), "vkCreatePipelineCache failed");
+	} else if (cacheData.size())
+		printf_color(COLOR_YELLOW, "Loaded pipeline cache %s (%.2f KiB)\n", mPipelineCacheFile.c_str(), cacheData.size() / 1024.f);
+	SetObjectName(mPipelineCache, name + " PipelineCache", VK_OBJECT_TYPE_PIPELINE_CACHE);
 	
-	VkDescriptorPoolSize type_count[5] {
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,			min(4096u, mLimits.maxDescriptorSetUniformBuffers) },
-		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,	min(4096u, mLimits.maxDescriptorSetSampledImages) },
-		{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,				min(4096u, mLimits.maxDescriptorSetSampledImages) },
-		{ VK_DESCRIPTOR_TYPE_SAMPLER,					min(4096u, mLimits.maxDescriptorSetSamplers) },
-		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,			min(4096u, mLimits.maxDescriptorSetStorageBuffers) },
-	};
-
-	VkDescriptorPoolCreateInfo poolInfo = {};
-	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
-	poolInfo.poolSizeCount = 5;
-	poolInfo.pPoolSizes = type_count;
-	poolInfo.maxSets = 8192;
-
-	ThrowIfFailed(vkCreateDescriptorPool(mDevice, &poolInfo, nullptr, &mDescriptorPool), "vkCreateDescriptorPool failed");
-	SetObjectName(mDescriptorPool, name, VK_OBJECT_TYPE_DESCRIPTOR_POOL);
+	mDescriptorPool = CreateDescriptorPool(name, 8192, 4096, VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT);
 	#pragma endregion
+
+	vkGetPhysicalDeviceMemoryProperties(mPhysicalDevice, &mMemoryProperties);
+	mMemoryBudgetSupported = deviceExtensions.count(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+	mMemoryBudgets.resize(mMemoryProperties.memoryHeapCount);
+	memset(mMemoryBudgets.data(), 0, sizeof(DeviceMemoryBudget) * mMemoryBudgets.size());
+	mMemoryTypeStats.resize(mMemoryProperties.memoryTypeCount);
+	mMemoryHeapStats.resize(mMemoryProperties.memoryHeapCount);
+	memset(mMemoryTypeStats.data(), 0, sizeof(MemoryUsageStats) * mMemoryTypeStats.size());
+	memset(mMemoryHeapStats.data(), 0, sizeof(MemoryUsageStats) * mMemoryHeapStats.size());
+	UpdateMemoryBudget();
+
+	mStagingRing = new ::StagingRing(this);
+	mMeshPool = new ::MeshPool(this);
 }
 Device::~Device() {
 	Flush();
 	safe_delete_array(mFrameContexts);
+	// pooled buffers wait for their uploads when they're destroyed
+	safe_delete(mMeshPool);
+	safe_delete(mStagingRing);
+	safe_delete(mBindlessTable);
+	for (auto& kp : mDescriptorSetCache)
+		safe_delete(kp.second.mDescriptorSet);
+	mDescriptorSetCache.clear();
+	mDescriptorSetCacheHandles.clear();
 	vkDestroyDescriptorPool(mDevice, mDescriptorPool, nullptr);
+	SavePipelineCache();
 	vkDestroyPipelineCache(mDevice, mPipelineCache, nullptr);
 	for (auto& p : mCommandBuffers)
 		vkDestroyCommandPool(mDevice, p.first, nullptr);
 	
-	for (auto kp : mMemoryAllocations) {
-		for (uint32_t i = 0; i < kp.second.size(); i++) {
-			for (auto it = kp.second[i].mAllocations.begin(); it != kp.second[i].mAllocations.begin(); it++)
-				fprintf_color(COLOR_RED_BOLD, stderr, "Device memory leak detected. Tag: %s\n", it->mTag.c_str());
-			vkFreeMemory(mDevice, kp.second[i].mMemory, nullptr);
+	for (auto kp : mMemoryAllocations)
+		for (Allocation* a : kp.second) {
+			vkFreeMemory(mDevice, a->mMemory, nullptr);
+			safe_delete(a);
 		}
-	}
+	for (auto kp : mDedicatedAllocations)
+		vkFreeMemory(mDevice, kp.first, nullptr);
 
 	vkDestroyDevice(mDevice, nullptr);
 }
@@ -220,6 +319,7 @@ VkSampleCountFlagBits Device::GetMaxUsableSampleCount() {
 }
 
 void Device::Flush() {
+	if (mStagingRing) mStagingRing->Flush();
 	vkDeviceWaitIdle(mDevice);
 	lock_guard lock(mCommandPoolMutex);
 	for (auto& p : mCommandBuffers) {
@@ -248,16 +348,13 @@ void Device::PrintAllocations() {
 	VkDeviceSize available = 0;
 	VkDeviceSize total = 0;
 
-	VkPhysicalDeviceMemoryProperties memProperties;
-	vkGetPhysicalDeviceMemoryProperties(mPhysicalDevice, &memProperties);
-
-	for (int32_t i = 0; i < memProperties.memoryHeapCount; ++i)
-		total += memProperties.memoryHeaps[i].size;
+	for (uint32_t i = 0; i < mMemoryProperties.memoryHeapCount; ++i)
+		total += mMemoryProperties.memoryHeaps[i].size;
 
 	for (auto kp : mMemoryAllocations)
-		for (auto a : kp.second) {
-			used += a.mSize;
-			for (auto av : a.mAvailable) available += av.second;
+		for (Allocation* a : kp.second) {
+			used += a->mSize;
+			available += a->FreeSize();
 		}
 
 	if (used == 0) {
@@ -276,143 +373,259 @@ void Device::PrintAllocations() {
 		printf_color(COLOR_YELLOW, "Using %.3f MiB (%.1f%%) - %.1f%% wasted", used / (1024.f * 1024.f), percentTotal, percentWasted);
 }
 
-bool Device::Allocation::SubAllocate(const VkMemoryRequirements& requirements, DeviceMemoryAllocation& allocation, const string& tag) {
-if (mAvailable.empty()) return false;
+#pragma region TLSF
+inline uint32_t BitScanForward(uint64_t x) {
+	#ifdef WINDOWS
+	unsigned long i;
+	_BitScanForward64(&i, x);
+	return (uint32_t)i;
+	#else
+	return (uint32_t)__builtin_ctzll(x);
+	#endif
+}
+inline uint32_t BitScanReverse(uint64_t x) {
+	#ifdef WINDOWS
+	unsigned long i;
+	_BitScanReverse64(&i, x);
+	return (uint32_t)i;
+	#else
+	return 63 - (uint32_t)__builtin_clzll(x);
+	#endif
+}
+// first and second level indices of the free list that holds blocks of a given size
+inline void TlsfMapping(VkDeviceSize size, uint32_t& fl, uint32_t& sl) {
+	if (size < TLSF_SMALL_SIZE) {
+		fl = 0;
+		sl = (uint32_t)(size / (TLSF_SMALL_SIZE / TLSF_SL_COUNT));
+	} else {
+		uint32_t f = BitScanReverse(size);
+		sl = (uint32_t)(size >> (f - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+		fl = f - TLSF_FL_SHIFT + 1;
+	}
+}
+
+Device::Allocation::Allocation(VkDeviceMemory memory, VkDeviceSize size, VkDeviceSize granularity, void* mapped)
+	: mMapped(mapped), mMemory(memory), mSize(size), mGranularity(max(granularity, TLSF_SMALL_SIZE)), mFreeSize(0), mFreeBlockCount(0), mFirstLevelBitmap(0) {
+	memset(mSecondLevelBitmap, 0, sizeof(mSecondLevelBitmap));
+	memset(mFreeLists, 0, sizeof(mFreeLists));
+
+	mFirstBlock = new Block();
+	mFirstBlock->mOffset = 0;
+	mFirstBlock->mSize = AlignDown(size, mGranularity);
+	mFirstBlock->mFree = true;
+	mFirstBlock->mPrevPhysical = mFirstBlock->mNextPhysical = nullptr;
+	InsertFreeBlock(mFirstBlock);
+}
+Device::Allocation::~Allocation() {
+	Block* block = mFirstBlock;
+	while (block) {
+		if (!block->mFree)
+			fprintf_color(COLOR_RED_BOLD, stderr, "Device memory leak detected. Tag: %s\n", block->mTag.c_str());
+		Block* next = block->mNextPhysical;
+		delete block;
+		block = next;
+	}
+}
 
-	VkDeviceSize blockSize = 0;
-	VkDeviceSize memLocation = 0;
-	VkDeviceSize memSize = 0;
+void Device::Allocation::InsertFreeBlock(Block* block) {
+	uint32_t fl, sl;
+	TlsfMapping(block->mSize, fl, sl);
 
-	// find smallest block that can fit the allocation
-	auto block = mAvailable.end();
-	for (auto it = mAvailable.begin(); it != mAvailable.end(); it++) {
-		VkDeviceSize offset = it->first ? AlignUp(it->first, requirements.alignment) : 0;
-		VkDeviceSize blockEnd = AlignUp(offset + requirements.size, MEM_BLOCK_SIZE);
+	block->mFree = true;
+	block->mPrevFree = nullptr;
+	block->mNextFree = mFreeLists[fl][sl];
+	if (block->mNextFree) block->mNextFree->mPrevFree = block;
+	mFreeLists[fl][sl] = block;
 
-		if (blockEnd > it->first + it->second) continue;
+	mFirstLevelBitmap |= 1ull << fl;
+	mSecondLevelBitmap[fl] |= 1u << sl;
 
-		if (block == mAvailable.end() || it->second < block->second) {
-			memLocation = offset;
-			memSize = blockEnd - offset;
-			blockSize = blockEnd - it->first;
-			block = it;
+	mFreeSize += block->mSize;
+	mFreeBlockCount++;
+}
+void Device::Allocation::RemoveFreeBlock(Block* block) {
+	uint32_t fl, sl;
+	TlsfMapping(block->mSize, fl, sl);
+
+	if (block->mPrevFree) block->mPrevFree->mNextFree = block->mNextFree;
+	if (block->mNextFree) block->mNextFree->mPrevFree = block->mPrevFree;
+	if (mFreeLists[fl][sl] == block) {
+		mFreeLists[fl][sl] = block->mNextFree;
+		if (!mFreeLists[fl][sl]) {
+			mSecondLevelBitmap[fl] &= ~(1u << sl);
+			if (!mSecondLevelBitmap[fl]) mFirstLevelBitmap &= ~(1ull << fl);
 		}
 	}
-	if (block == mAvailable.end()) return false;
 
-	allocation.mDeviceMemory = mMemory;
-	allocation.mOffset = memLocation;
-	allocation.mSize = memSize;
-	allocation.mMapped = ((uint8_t*)mMapped) + memLocation;
-	allocation.mTag = tag;
+	block->mFree = false;
+	block->mPrevFree = block->mNextFree = nullptr;
 
-	if (block->second > blockSize) {
-		// still room left after this allocation, shift this block over
-		block->first += blockSize;
-		block->second -= blockSize;
-	} else
-		mAvailable.erase(block);
+	mFreeSize -= block->mSize;
+	mFreeBlockCount--;
+}
+Device::Allocation::Block* Device::Allocation::FindFreeBlock(VkDeviceSize size) {
+	// round up to the next size class, so that any block in the list is large enough
+	if (size >= TLSF_SMALL_SIZE)
+		size += ((VkDeviceSize)1 << (BitScanReverse(size) - TLSF_SL_LOG2)) - 1;
+	else
+		size = AlignUp(size, TLSF_SMALL_SIZE / TLSF_SL_COUNT);
+
+	uint32_t fl, sl;
+	TlsfMapping(size, fl, sl);
+	if (fl >= TLSF_FL_COUNT) return nullptr;
+
+	uint32_t slMap = mSecondLevelBitmap[fl] & (~0u << sl);
+	if (!slMap) {
+		// no block in this first level is large enough, use the smallest block from a larger first level
+		uint64_t flMap = fl + 1 < TLSF_FL_COUNT ? mFirstLevelBitmap & (~0ull << (fl + 1)) : 0;
+		if (!flMap) return nullptr;
+		fl = BitScanForward(flMap);
+		slMap = mSecondLevelBitmap[fl];
+	}
+	sl = BitScanForward(slMap);
+	return mFreeLists[fl][sl];
+}
+Device::Allocation::Block* Device::Allocation::Split(Block* block, VkDeviceSize size) {
+	Block* rest = new Block();
+	rest->mOffset = block->mOffset + size;
+	rest->mSize = block->mSize - size;
+	rest->mFree = false;
+	rest->mPrevPhysical = block;
+	rest->mNextPhysical = block->mNextPhysical;
+	rest->mPrevFree = rest->mNextFree = nullptr;
+	if (rest->mNextPhysical) rest->mNextPhysical->mPrevPhysical = rest;
+	block->mNextPhysical = rest;
+	block->mSize = size;
+	return rest;
+}
+
+bool Device::Allocation::SubAllocate(const VkMemoryRequirements& requirements, DeviceMemoryAllocation& allocation, const string& tag) {
+	VkDeviceSize alignment = max(requirements.alignment, mGranularity);
+	VkDeviceSize size = AlignUp(requirements.size, mGranularity);
+
+	// search with enough room to align the start of the block
+	Block* block = FindFreeBlock(size + alignment - mGranularity);
+	if (!block) return false;
+	RemoveFreeBlock(block);
+
+	VkDeviceSize offset = AlignUp(block->mOffset, alignment);
+	if (offset > block->mOffset) {
+		// return the space in front of the allocation to the free lists
+		Block* aligned = Split(block, offset - block->mOffset);
+		InsertFreeBlock(block);
+		block = aligned;
+	}
+	if (block->mSize > size)
+		InsertFreeBlock(Split(block, size));
 
-	mAllocations.push_back(allocation);
+	block->mTag = tag;
+	mAllocations.emplace(block->mOffset, block);
 
+	allocation.mDeviceMemory = mMemory;
+	allocation.mOffset = block->mOffset;
+	allocation.mSize = block->mSize;
+	allocation.mMapped = mMapped ? ((uint8_t*)mMapped) + block->mOffset : nullptr;
+	allocation.mTag = tag;
 	return true;
 }
 void Device::Allocation::Deallocate(const DeviceMemoryAllocation& allocation) {
 	if (allocation.mDeviceMemory != mMemory) return;
 
-	for (auto it = mAllocations.begin(); it != mAllocations.end(); it++)
-		if (it->mOffset == allocation.mOffset) {
-			mAllocations.erase(it);
-			break;
-		}
-
-	VkDeviceSize end = allocation.mOffset + allocation.mSize;
-
-	auto firstAfter = mAvailable.end();
-	auto startBlock = mAvailable.end();
-	auto endBlock = mAvailable.end();
-
-	for (auto it = mAvailable.begin(); it != mAvailable.end(); it++) {
-		if (it->first > allocation.mOffset && (firstAfter == mAvailable.end() || it->first < firstAfter->first)) firstAfter = it;
-
-		if (it->first == end)
-			endBlock = it;
-		if (it->first + it->second == allocation.mOffset)
-			startBlock = it;
+	auto it = mAllocations.find(allocation.mOffset);
+	if (it == mAllocations.end()) return;
+	Block* block = it->second;
+	mAllocations.erase(it);
+	block->mTag.clear();
+
+	// merge with free neighbours
+	if (block->mPrevPhysical && block->mPrevPhysical->mFree) {
+		Block* prev = block->mPrevPhysical;
+		RemoveFreeBlock(prev);
+		prev->mSize += block->mSize;
+		prev->mNextPhysical = block->mNextPhysical;
+		if (block->mNextPhysical) block->mNextPhysical->mPrevPhysical = prev;
+		delete block;
+		block = prev;
 	}
-
-	if (startBlock == endBlock && startBlock != mAvailable.end()) throw; // this should NOT happen
-
-	// merge blocks
-
-	if (startBlock == mAvailable.end() && endBlock == mAvailable.end())
-		// block isn't adjacent to any other blocks
-		mAvailable.insert(firstAfter, make_pair(allocation.mOffset, allocation.mSize));
-	else if (startBlock == mAvailable.end()) {
-		//  --------     |---- allocation ----|---- endBlock ----|
-		endBlock->first = allocation.mOffset;
-		endBlock->second += allocation.mSize;
-	} else if (endBlock == mAvailable.end()) {
-		//  |---- startBlock ----|---- allocation ----|     --------
-		startBlock->second += allocation.mSize;
-	} else {
-		//  |---- startBlock ----|---- allocation ----|---- endBlock ----|
-		startBlock->second += allocation.mSize + endBlock->second;
-		mAvailable.erase(endBlock);
+	if (block->mNextPhysical && block->mNextPhysical->mFree) {
+		Block* next = block->mNextPhysical;
+		RemoveFreeBlock(next);
+		block->mSize += next->mSize;
+		block->mNextPhysical = next->mNextPhysical;
+		if (next->mNextPhysical) next->mNextPhysical->mPrevPhysical = block;
+		delete next;
 	}
+
+	InsertFreeBlock(block);
+}
+void Device::Allocation::GetFragmentation(MemoryFragmentation& stats) const {
+	stats.mTotalSize += mSize;
+	stats.mFreeSize += mFreeSize;
+	stats.mFreeBlockCount += mFreeBlockCount;
+	stats.mAllocationCount += (uint32_t)mAllocations.size();
+	stats.mBlockCount++;
+
+	// the largest free block is in the highest non-empty free list
+	if (!mFirstLevelBitmap) return;
+	uint32_t fl = BitScanReverse(mFirstLevelBitmap);
+	uint32_t sl = BitScanReverse(mSecondLevelBitmap[fl]);
+	for (Block* b = mFreeLists[fl][sl]; b; b = b->mNextFree)
+		stats.mLargestFreeBlock = max(stats.mLargestFreeBlock, b->mSize);
+}
+#pragma endregion
+
+uint32_t Device::FindMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties) {
+	for (uint32_t i = 0; i < mMemoryProperties.memoryTypeCount; ++i)
+		if ((typeBits & (1 << i)) && ((mMemoryProperties.memoryTypes[i].propertyFlags & properties) == properties))
+			return i;
+	fprintf_color(COLOR_RED_BOLD, stderr, "Failed to find suitable memory type!");
+	throw;
 }
 
 DeviceMemoryAllocation Device::AllocateMemory(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, const string& tag) {
 	lock_guard lock(mMemoryMutex);
 
-	VkDeviceSize total = 0;
-	VkDeviceSize available = 0;
-
-	VkPhysicalDeviceMemoryProperties memProperties;
-	vkGetPhysicalDeviceMemoryProperties(mPhysicalDevice, &memProperties);
-
-	int32_t memoryType = -1;
-	for (int32_t i = 0; i < memProperties.memoryTypeCount; ++i) {
-		if ((requirements.memoryTypeBits & (1 << i)) && ((memProperties.memoryTypes[i].propertyFlags & properties) == properties)) {
-			memoryType = i;
-			break;
-		}
-	}
-	if (memoryType == -1) {
-		fprintf_color(COLOR_RED_BOLD, stderr, "Failed to find suitable memory type!");
-		throw;
-	}
+	uint32_t memoryType = FindMemoryType(requirements.memoryTypeBits, properties);
 
 	DeviceMemoryAllocation alloc = {};
 	alloc.mMemoryType = memoryType;
 
-	vector<Allocation>& allocations = mMemoryAllocations[memoryType];
+	vector<Allocation*>& allocations = mMemoryAllocations[memoryType];
 
-	for (uint32_t i = 0; i < allocations.size(); i++)
-		if (allocations[i].SubAllocate(requirements, alloc, tag))
+	for (Allocation* a : allocations)
+		if (a->SubAllocate(requirements, alloc, tag)) {
+			TrackMemory(memoryType, tag, 0, alloc.mSize);
 			return alloc;
+		}
 
 
 	// Failed to sub-allocate, make a new allocation
 
-	allocations.push_back({});
-	Allocation& allocation = allocations.back();
-	
 	VkMemoryAllocateInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
 	info.memoryTypeIndex = memoryType;
-	info.allocationSize = max((uint64_t)MEM_MIN_ALLOC, 2*AlignUp(requirements.size, MEM_BLOCK_SIZE));
-	ThrowIfFailed(vkAllocateMemory(mDevice, &info, nullptr, &allocation.mMemory), "vkAllocateMemory failed");
-	allocation.mSize = info.allocationSize;
-	allocation.mAvailable = { make_pair((VkDeviceSize)0, allocation.mSize) };
+	info.allocationSize = max((VkDeviceSize)MEM_MIN_ALLOC, 2 * AlignUp(requirements.size + requirements.alignment, mLimits.bufferImageGranularity));
+	DeviceMemoryBudget& budget = mMemoryBudgets[mMemoryProperties.memoryTypes[memoryType].heapIndex];
+	if (budget.mUsage + info.allocationSize > budget.mBudget)
+		fprintf_color(COLOR_YELLOW, stderr, "Warning: Allocating %.3f MiB exceeds the memory budget of heap %u\n", info.allocationSize / (1024.f * 1024.f), mMemoryProperties.memoryTypes[memoryType].heapIndex);
 
+	VkDeviceMemory memory;
+	ThrowIfFailed(vkAllocateMemory(mDevice, &info, nullptr, &memory), "vkAllocateMemory failed");
+	budget.mAllocated += info.allocationSize;
+	budget.mUsage += info.allocationSize;
+
+	void* mapped = nullptr;
 	if (properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
-		vkMapMemory(mDevice, allocation.mMemory, 0, allocation.mSize, 0, &allocation.mMapped);
+		vkMapMemory(mDevice, memory, 0, info.allocationSize, 0, &mapped);
+
+	Allocation* allocation = new Allocation(memory, info.allocationSize, mLimits.bufferImageGranularity, mapped);
+	allocations.push_back(allocation);
 
-	if (!allocation.SubAllocate(requirements, alloc, tag)) {
+	if (!allocation->SubAllocate(requirements, alloc, tag)) {
 		fprintf_color(COLOR_RED_BOLD, stderr, "Failed to allocate memory\n");
 		throw;
 	}
+	TrackMemory(memoryType, tag, info.allocationSize, alloc.mSize);
 
 	#ifdef PRINT_VK_ALLOCATIONS
 	if (info.allocationSize < 1024)
@@ -429,15 +642,71 @@ DeviceMemoryAllocation Device::AllocateMemory(const VkMemoryRequirements& requir
 
 	return alloc;
 }
+DeviceMemoryAllocation Device::AllocateDedicatedMemory(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, const string& tag, VkImage image, VkBuffer buffer) {
+	lock_guard lock(mMemoryMutex);
+
+	VkMemoryDedicatedAllocateInfo dedicatedInfo = {};
+	dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+	dedicatedInfo.image = image;
+	dedicatedInfo.buffer = buffer;
+
+	DeviceMemoryAllocation alloc = {};
+	alloc.mMemoryType = FindMemoryType(requirements.memoryTypeBits, properties);
+	alloc.mOffset = 0;
+	alloc.mSize = requirements.size;
+	alloc.mTag = tag;
+
+	VkMemoryAllocateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	info.pNext = &dedicatedInfo;
+	info.memoryTypeIndex = alloc.mMemoryType;
+	info.allocationSize = requirements.size;
+
+	DeviceMemoryBudget& budget = mMemoryBudgets[mMemoryProperties.memoryTypes[alloc.mMemoryType].heapIndex];
+	if (budget.mUsage + info.allocationSize > budget.mBudget)
+		fprintf_color(COLOR_YELLOW, stderr, "Warning: Allocating %.3f MiB for %s exceeds the memory budget of heap %u\n", info.allocationSize / (1024.f * 1024.f), tag.c_str(), mMemoryProperties.memoryTypes[alloc.mMemoryType].heapIndex);
+
+	ThrowIfFailed(vkAllocateMemory(mDevice, &info, nullptr, &alloc.mDeviceMemory), "vkAllocateMemory failed for " + tag);
+	budget.mAllocated += info.allocationSize;
+	budget.mUsage += info.allocationSize;
+
+	if (properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		vkMapMemory(mDevice, alloc.mDeviceMemory, 0, info.allocationSize, 0, &alloc.mMapped);
+
+	mDedicatedAllocations.emplace(alloc.mDeviceMemory, alloc.mSize);
+	TrackMemory(alloc.mMemoryType, tag, alloc.mSize, alloc.mSize);
+
+	#ifdef PRINT_VK_ALLOCATIONS
+	printf_color(COLOR_YELLOW, "Allocated %.3f MiB of type %u for %s (dedicated)\n", info.allocationSize / (1024.f * 1024.f), info.memoryTypeIndex, tag.c_str());
+	#endif
+
+	return alloc;
+}
 void Device::FreeMemory(const DeviceMemoryAllocation& allocation) {
 	lock_guard lock(mMemoryMutex);
 
-	vector<Allocation>& allocations = mMemoryAllocations[allocation.mMemoryType];
+	auto dedicated = mDedicatedAllocations.find(allocation.mDeviceMemory);
+	if (dedicated != mDedicatedAllocations.end()) {
+		vkFreeMemory(mDevice, allocation.mDeviceMemory, nullptr);
+		DeviceMemoryBudget& budget = mMemoryBudgets[mMemoryProperties.memoryTypes[allocation.mMemoryType].heapIndex];
+		budget.mAllocated -= dedicated->second;
+		budget.mUsage -= min(budget.mUsage, dedicated->second);
+		TrackMemory(allocation.mMemoryType, allocation.mTag, -(int64_t)dedicated->second, -(int64_t)dedicated->second);
+		mDedicatedAllocations.erase(dedicated);
+		return;
+	}
+
+	vector<Allocation*>& allocations = mMemoryAllocations[allocation.mMemoryType];
 	for (auto it = allocations.begin(); it != allocations.end();){
-		if (it->mMemory == allocation.mDeviceMemory) {
-			it->Deallocate(allocation);
-			if (it->mAvailable.size() == 1 && it->mAvailable.begin()->second == it->mSize) {
-				vkFreeMemory(mDevice, it->mMemory, nullptr);
+		if ((*it)->mMemory == allocation.mDeviceMemory) {
+			(*it)->Deallocate(allocation);
+			TrackMemory(allocation.mMemoryType, allocation.mTag, 0, -(int64_t)allocation.mSize);
+			if ((*it)->Empty()) {
+				vkFreeMemory(mDevice, (*it)->mMemory, nullptr);
+				TrackMemory(allocation.mMemoryType, "", -(int64_t)(*it)->mSize, 0);
+				DeviceMemoryBudget& budget = mMemoryBudgets[mMemoryProperties.memoryTypes[allocation.mMemoryType].heapIndex];
+				budget.mAllocated -= (*it)->mSize;
+				budget.mUsage -= min(budget.mUsage, (*it)->mSize);
 				#ifdef PRINT_VK_ALLOCATIONS
 				if (allocation.mSize < 1024)
 					printf_color(COLOR_YELLOW, "Freed %lu B of type %u\t- ", allocation.mSize, allocation.mMemoryType);
@@ -450,13 +719,317 @@ void Device::FreeMemory(const DeviceMemoryAllocation& allocation) {
 				PrintAllocations();
 				printf_color(COLOR_YELLOW, "\n");
 				#endif
+				delete *it;
 				it = allocations.erase(it);
 				continue;
 			}
+			break;
 		}
 		it++;
 	}
 }
+MemoryFragmentation Device::GetMemoryFragmentation(int32_t memoryType) {
+	lock_guard lock(mMemoryMutex);
+	MemoryFragmentation stats = {};
+	for (const auto& kp : mMemoryAllocations)
+		if (memoryType < 0 || kp.first == (uint32_t)memoryType)
+			for (Allocation* a : kp.second)
+				a->GetFragmentation(stats);
+	return stats;
+}
+
+void Device::TrackMemory(uint32_t memoryType, const string& tag, int64_t reserved, int64_t used) {
+	auto apply = [&](MemoryUsageStats& stats, int64_t reserved) {
+		stats.mReserved += reserved;
+		stats.mUsed += used;
+		if (used > 0) stats.mAllocationCount++;
+		if (used < 0) stats.mAllocationCount--;
+		stats.mPeakReserved = max(stats.mPeakReserved, stats.mReserved);
+		stats.mPeakUsed = max(stats.mPeakUsed, stats.mUsed);
+	};
+	apply(mMemoryTypeStats[memoryType], reserved);
+	apply(mMemoryHeapStats[mMemoryProperties.memoryTypes[memoryType].heapIndex], reserved);
+	if (used) apply(mMemoryTagStats[tag], used);
+}
+
+DeviceMemoryStats Device::GetMemoryStats() {
+	lock_guard lock(mMemoryMutex);
+	DeviceMemoryStats stats;
+	stats.mTypes = mMemoryTypeStats;
+	stats.mHeaps = mMemoryHeapStats;
+	stats.mTags = mMemoryTagStats;
+	stats.mAliasedPerFrameContext = mAliasedPerFrameContext;
+
+	for (uint32_t i = 0; i < mMemoryProperties.memoryTypeCount; i++) {
+		MemoryFragmentation f = {};
+		for (Allocation* a : mMemoryAllocations[i])
+			a->GetFragmentation(f);
+		MemoryUsageStats& heap = stats.mHeaps[mMemoryProperties.memoryTypes[i].heapIndex];
+		stats.mTypes[i].mLargestFreeBlock = f.mLargestFreeBlock;
+		stats.mTypes[i].mBlockCount = f.mBlockCount;
+		heap.mLargestFreeBlock = max(heap.mLargestFreeBlock, f.mLargestFreeBlock);
+		heap.mBlockCount += f.mBlockCount;
+	}
+	return stats;
+}
+
+bool Device::LoadPipelineCache(const VkPhysicalDeviceProperties& properties, vector<uint8_t>& data) {
+	data.clear();
+	if (!fs::exists(mPipelineCacheFile)) return false;
+
+	vector<uint8_t> file;
+	if (!ReadFile(mPipelineCacheFile, file)) return false;
+
+	// validate our header, then the driver's (VkPipelineCacheHeaderVersionOne)
+	PipelineCacheFileHeader header = {};
+	if (file.size() >= sizeof(PipelineCacheFileHeader)) memcpy(&header, file.data(), sizeof(PipelineCacheFileHeader));
+	if (header.mMagic != PIPELINE_CACHE_MAGIC || header.mDataSize < 16 + VK_UUID_SIZE || file.size() != sizeof(PipelineCacheFileHeader) + header.mDataSize) {
+		fprintf_color(COLOR_YELLOW, stderr, "Ignoring invalid pipeline cache %s\n", mPipelineCacheFile.c_str());
+		return false;
+	}
+	const uint8_t* cache = file.data() + sizeof(PipelineCacheFileHeader);
+	if (hash<string_view>()(string_view((const char*)cache, header.mDataSize)) != header.mDataHash) {
+		fprintf_color(COLOR_YELLOW, stderr, "Ignoring corrupted pipeline cache %s\n", mPipelineCacheFile.c_str());
+		return false;
+	}
+
+	uint32_t cacheHeader[4];
+	memcpy(cacheHeader, cache, sizeof(cacheHeader));
+	if (cacheHeader[0] < 16 + VK_UUID_SIZE || cacheHeader[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+		cacheHeader[2] != properties.vendorID || cacheHeader[3] != properties.deviceID ||
+		memcmp(cache + 16, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+		fprintf_color(COLOR_YELLOW, stderr, "Ignoring pipeline cache %s from a different device or driver\n", mPipelineCacheFile.c_str());
+		return false;
+	}
+
+	data.assign(cache, cache + header.mDataSize);
+	return true;
+}
+bool Device::SavePipelineCache() {
+	size_t size = 0;
+	if (vkGetPipelineCacheData(mDevice, mPipelineCache, &size, nullptr) != VK_SUCCESS || size == 0) return false;
+	vector<uint8_t> data(size);
+	if (vkGetPipelineCacheData(mDevice, mPipelineCache, &size, data.data()) != VK_SUCCESS) return false;
+	data.resize(size);
+
+	PipelineCacheFileHeader header = {};
+	header.mMagic = PIPELINE_CACHE_MAGIC;
+	header.mDataSize = (uint32_t)data.size();
+	header.mDataHash = hash<string_view>()(string_view((const char*)data.data(), data.size()));
+
+	error_code ec;
+	fs::create_directories(fs::path(mPipelineCacheFile).parent_path(), ec);
+
+	// write to a temporary file first so that a crash never leaves a partial cache behind
+	string tmp = mPipelineCacheFile + ".tmp";
+	FILE* file = fopen(tmp.c_str(), "wb");
+	if (!file) {
+		fprintf_color(COLOR_RED, stderr, "Failed to open %s\n", tmp.c_str());
+		return false;
+	}
+	bool success = fwrite(&header, sizeof(PipelineCacheFileHeader), 1, file) == 1 && fwrite(data.data(), 1, data.size(), file) == data.size();
+	success = fclose(file) == 0 && success;
+	if (success) {
+		fs::rename(tmp, mPipelineCacheFile, ec);
+		success = !ec;
+	}
+	if (!success) {
+		fprintf_color(COLOR_RED, stderr, "Failed to write pipeline cache %s\n", mPipelineCacheFile.c_str());
+		fs::remove(tmp, ec);
+	}
+	return success;
+}
+
+bool Device::WriteMemoryStats(const string& filename) {
+	DeviceMemoryStats stats = GetMemoryStats();
+
+	FILE* file = fopen(filename.c_str(), "w");
+	if (!file) {
+		fprintf_color(COLOR_RED, stderr, "Failed to open %s\n", filename.c_str());
+		return false;
+	}
+
+	auto writeStats = [&](const MemoryUsageStats& s) {
+		fprintf(file, "\"reserved\": %llu, \"used\": %llu, \"allocations\": %u, \"peakReserved\": %llu, \"peakUsed\": %llu",
+			(unsigned long long)s.mReserved, (unsigned long long)s.mUsed, s.mAllocationCount, (unsigned long long)s.mPeakReserved, (unsigned long long)s.mPeakUsed);
+	};
+
+	fprintf(file, "{\n\t\"heaps\": [\n");
+	for (uint32_t i = 0; i < stats.mHeaps.size(); i++) {
+		fprintf(file, "\t\t{ \"heap\": %u, \"size\": %llu, \"budget\": %llu, \"deviceLocal\": %s, ", i,
+			(unsigned long long)mMemoryProperties.memoryHeaps[i].size, (unsigned long long)mMemoryBudgets[i].mBudget,
+			(mMemoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? "true" : "false");
+		writeStats(stats.mHeaps[i]);
+		fprintf(file, ", \"largestFreeBlock\": %llu, \"blocks\": %u }%s\n", (unsigned long long)stats.mHeaps[i].mLargestFreeBlock, stats.mHeaps[i].mBlockCount, i + 1 < stats.mHeaps.size() ? "," : "");
+	}
+	fprintf(file, "\t],\n\t\"types\": [\n");
+	for (uint32_t i = 0; i < stats.mTypes.size(); i++) {
+		fprintf(file, "\t\t{ \"type\": %u, \"heap\": %u, \"flags\": %u, ", i, mMemoryProperties.memoryTypes[i].heapIndex, mMemoryProperties.memoryTypes[i].propertyFlags);
+		writeStats(stats.mTypes[i]);
+		fprintf(file, ", \"largestFreeBlock\": %llu, \"blocks\": %u }%s\n", (unsigned long long)stats.mTypes[i].mLargestFreeBlock, stats.mTypes[i].mBlockCount, i + 1 < stats.mTypes.size() ? "," : "");
+	}
+
+	vector<pair<string, MemoryUsageStats>> tags(stats.mTags.begin(), stats.mTags.end());
+	sort(tags.begin(), tags.end(), [](const auto& a, const auto& b) { return a.second.mUsed > b.second.mUsed; });
+	fprintf(file, "\t],\n\t\"aliasedPerFrameContext\": %llu,\n\t\"aliasedTotal\": %llu,\n", (unsigned long long)stats.mAliasedPerFrameContext,
+		(unsigned long long)(stats.mAliasedPerFrameContext * (MaxFramesInFlight() - 1)));
+	fprintf(file, "\t\"tags\": [\n");
+	for (uint32_t i = 0; i < tags.size(); i++) {
+		string tag;
+		for (char c : tags[i].first) {
+			if (c == '"' || c == '\\') tag += '\\';
+			if ((unsigned char)c >= 0x20) tag += c;
+		}
+		fprintf(file, "\t\t{ \"tag\": \"%s\", \"used\": %llu, \"allocations\": %u, \"peakUsed\": %llu }%s\n", tag.c_str(),
+			(unsigned long long)tags[i].second.mUsed, tags[i].second.mAllocationCount, (unsigned long long)tags[i].second.mPeakUsed, i + 1 < tags.size() ? "," : "");
+	}
+	fprintf(file, "\t]\n}\n");
+	fclose(file);
+	return true;
+}
+
+void Device::UpdateMemoryBudget() {
+	lock_guard lock(mMemoryMutex);
+	if (mMemoryBudgetSupported) {
+		VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {};
+		budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+		VkPhysicalDeviceMemoryProperties2 properties = {};
+		properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+		properties.pNext = &budget;
+		vkGetPhysicalDeviceMemoryProperties2(mPhysicalDevice, &properties);
+		for (uint32_t i = 0; i < mMemoryProperties.memoryHeapCount; i++) {
+			mMemoryBudgets[i].mBudget = budget.heapBudget[i];
+			mMemoryBudgets[i].mUsage = budget.heapUsage[i];
+		}
+	} else {
+		// without VK_EXT_memory_budget, assume we can use most of each heap
+		for (uint32_t i = 0; i < mMemoryProperties.memoryHeapCount; i++) {
+			mMemoryBudgets[i].mBudget = mMemoryProperties.memoryHeaps[i].size * 8 / 10;
+			mMemoryBudgets[i].mUsage = mMemoryBudgets[i].mAllocated;
+		}
+	}
+}
+
+bool Device::RelocateBuffer(Buffer* buffer, CommandBuffer* commandBuffer, VkDeviceMemory source) {
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = buffer->mSize;
+	bufferInfo.usage = buffer->mUsageFlags;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VkBuffer newBuffer;
+	ThrowIfFailed(vkCreateBuffer(mDevice, &bufferInfo, nullptr, &newBuffer), "vkCreateBuffer failed for " + buffer->mName);
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(mDevice, newBuffer, &memRequirements);
+
+	// only move into existing blocks, never allocate a new one
+	DeviceMemoryAllocation alloc = {};
+	alloc.mMemoryType = buffer->mMemory.mMemoryType;
+	bool found = false;
+	for (Allocation* a : mMemoryAllocations[alloc.mMemoryType])
+		if (a->mMemory != source && a->SubAllocate(memRequirements, alloc, buffer->mName)) {
+			found = true;
+			break;
+		}
+	if (!found) {
+		vkDestroyBuffer(mDevice, newBuffer, nullptr);
+		return false;
+	}
+	TrackMemory(alloc.mMemoryType, buffer->mName, 0, alloc.mSize);
+	vkBindBufferMemory(mDevice, newBuffer, alloc.mDeviceMemory, alloc.mOffset);
+	SetObjectName(newBuffer, buffer->mName, VK_OBJECT_TYPE_BUFFER);
+
+	VkBufferView newView = VK_NULL_HANDLE;
+	if (buffer->mViewFormat != VK_FORMAT_UNDEFINED) {
+		VkBufferViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_BUFFER_VIEW_CREATE_INFO;
+		viewInfo.buffer = newBuffer;
+		viewInfo.offset = 0;
+		viewInfo.range = buffer->mSize;
+		viewInfo.format = buffer->mViewFormat;
+		ThrowIfFailed(vkCreateBufferView(mDevice, &viewInfo, nullptr, &newView), "vkCreateBufferView failed for " + buffer->mName);
+		SetObjectName(newView, buffer->mName, VK_OBJECT_TYPE_BUFFER_VIEW);
+	}
+
+	// wait for all previous work on the buffer, then copy it
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	vkCmdPipelineBarrier(*commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	VkBufferCopy copyRegion = {};
+	copyRegion.size = buffer->mSize;
+	vkCmdCopyBuffer(*commandBuffer, buffer->mBuffer, newBuffer, 1, &copyRegion);
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+	vkCmdPipelineBarrier(*commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	// the old buffer may still be in use by frames in flight
+	CurrentFrameContext()->mRetiredBuffers.push_back(make_tuple(buffer->mBuffer, buffer->mView, buffer->mMemory));
+	buffer->mBuffer = newBuffer;
+	buffer->mView = newView;
+	buffer->mMemory = alloc;
+	return true;
+}
+
+void Device::Defragment(CommandBuffer* commandBuffer) {
+	if (mDefragmentBytesPerFrame == 0) return;
+	PROFILER_BEGIN("Defragment");
+	lock_guard lock(mMemoryMutex);
+
+	VkDeviceSize moved = 0;
+	for (auto& kp : mMemoryAllocations) {
+		if (kp.second.size() < 2) continue;
+		if (mMemoryProperties.memoryTypes[kp.first].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) continue;
+
+		MemoryFragmentation stats = {};
+		Allocation* source = nullptr;
+		for (Allocation* a : kp.second) {
+			a->GetFragmentation(stats);
+			if (!source || a->mSize - a->FreeSize() < source->mSize - source->FreeSize()) source = a;
+		}
+		if ((float)stats.mFreeSize / (float)stats.mTotalSize < mDefragmentThreshold) continue;
+		// the other blocks need to be able to hold everything in the source block
+		if (stats.mFreeSize - source->FreeSize() < source->mSize - source->FreeSize()) continue;
+
+		for (Buffer* b : mBuffers) {
+			if (b->mMemory.mDeviceMemory != source->mMemory) continue;
+			if ((b->mUsageFlags & VK_BUFFER_USAGE_TRANSFER_SRC_BIT) == 0 || (b->mUsageFlags & VK_BUFFER_USAGE_TRANSFER_DST_BIT) == 0) continue;
+			if (mDescriptorBufferReferences.count(b->mID)) continue;
+			// still owned by the transfer queue
+			if (mStagingRing->Pending((uint64_t)b->mBuffer)) continue;
+			if (moved + b->mMemory.mSize > mDefragmentBytesPerFrame) break;
+
+			VkDeviceSize size = b->mMemory.mSize;
+			if (RelocateBuffer(b, commandBuffer, source->mMemory)) moved += size;
+		}
+		if (moved >= mDefragmentBytesPerFrame) break;
+	}
+	PROFILER_END;
+}
+
+void Device::DestroyRenderPass(uint64_t renderPassID, VkRenderPass renderPass) {
+	unordered_set<GraphicsShader*> shaders;
+	{
+		lock_guard lock(mPendingPipelineMutex);
+		auto it = mPendingRenderPasses.find(renderPass);
+		if (it == mPendingRenderPasses.end())
+			vkDestroyRenderPass(mDevice, renderPass, nullptr);
+		else
+			it->second.mCancelled = true;
+
+		auto s = mRenderPassShaders.find(renderPassID);
+		if (s != mRenderPassShaders.end()) {
+			shaders = move(s->second);
+			mRenderPassShaders.erase(s);
+		}
+	}
+	// the shaders lock their pipelines before mPendingPipelineMutex
+	for (GraphicsShader* s : shaders)
+		s->ReleaseRenderPass(renderPassID);
+}
 
 shared_ptr<CommandBuffer> Device::GetCommandBuffer(const std::string& name) {
 	// get a commandpool for the current thread
@@ -496,6 +1069,9 @@ shared_ptr<CommandBuffer> Device::GetCommandBuffer(const std::string& name) {
 	return commandBuffer;
 }
 shared_ptr<Fence> Device::Execute(shared_ptr<CommandBuffer> commandBuffer, bool frameContext) {
+	// pending uploads must execute before anything that might use them
+	mStagingRing->Flush();
+
 	lock_guard lock(mCommandPoolMutex);
 	ThrowIfFailed(vkEndCommandBuffer(commandBuffer->mCommandBuffer), "vkEndCommandBuffer failed");
 
@@ -551,20 +1127,139 @@ Buffer* Device::GetTempBuffer(const std::string& name, VkDeviceSize size, VkBuff
 	frame->mTempBuffersInUse.push_back(b);
 	return b;
 }
+VkDescriptorPool Device::CreateDescriptorPool(const string& name, uint32_t maxSets, uint32_t descriptorCount, VkDescriptorPoolCreateFlags flags) {
+	VkDescriptorPoolSize type_count[7] {
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,			min(descriptorCount, mLimits.maxDescriptorSetUniformBuffers) },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,	min(descriptorCount, mLimits.maxDescriptorSetSampledImages) },
+		{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,				min(descriptorCount, mLimits.maxDescriptorSetSampledImages) },
+		{ VK_DESCRIPTOR_TYPE_SAMPLER,					min(descriptorCount, mLimits.maxDescriptorSetSamplers) },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,			min(descriptorCount, mLimits.maxDescriptorSetStorageBuffers) },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,				min(descriptorCount, mLimits.maxDescriptorSetStorageImages) },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,		min(descriptorCount, mLimits.maxDescriptorSetStorageImages) },
+	};
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = flags;
+	poolInfo.poolSizeCount = 7;
+	poolInfo.pPoolSizes = type_count;
+	poolInfo.maxSets = maxSets;
+
+	VkDescriptorPool pool;
+	ThrowIfFailed(vkCreateDescriptorPool(mDevice, &poolInfo, nullptr, &pool), "vkCreateDescriptorPool failed");
+	SetObjectName(pool, name, VK_OBJECT_TYPE_DESCRIPTOR_POOL);
+	return pool;
+}
+
 DescriptorSet* Device::GetTempDescriptorSet(const std::string& name, VkDescriptorSetLayout layout) {
-	lock_guard lock(mTmpDescriptorSetMutex);
-	FrameContext* frame = CurrentFrameContext();
+	FrameContext::DescriptorPools* pools;
+	{
+		lock_guard lock(mTmpDescriptorSetMutex);
+		pools = &CurrentFrameContext()->mDescriptorPools[this_thread::get_id()];
+	}
+	// only this thread allocates from its pools, so no lock is needed from here on
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &layout;
+
+	VkDescriptorSet descriptorSet;
+	while (true) {
+		bool created = false;
+		if (pools->mCurrent == pools->mPools.size()) {
+			pools->mPools.push_back(CreateDescriptorPool("Temp Descriptor Pool", TEMP_DESCRIPTOR_POOL_SIZE, TEMP_DESCRIPTOR_POOL_SIZE * 4, 0));
+			created = true;
+		}
+		allocInfo.descriptorPool = pools->mPools[pools->mCurrent];
+		VkResult result = vkAllocateDescriptorSets(mDevice, &allocInfo, &descriptorSet);
+		if (result == VK_SUCCESS) break;
+		if (created || (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL))
+			ThrowIfFailed(result, "vkAllocateDescriptorSets failed for " + name);
+		// this pool is full, move on to the next one
+		pools->mCurrent++;
+	}
+
+	DescriptorSet* ds = new DescriptorSet(name, this, layout, descriptorSet);
+	pools->mDescriptorSets.push_back(ds);
+	return ds;
+}
+DescriptorSet* Device::GetCachedDescriptorSet(const string& name, VkDescriptorSetLayout layout, const vector<DescriptorSetWrite>& writes) {
+	vector<uint64_t> key;
+	vector<uint64_t> handles;
+	key.reserve(1 + writes.size() * 5);
+	key.push_back((uint64_t)layout);
+	for (const DescriptorSetWrite& w : writes) {
+		key.push_back((uint64_t)w.mType | ((uint64_t)w.mBinding << 32));
+		key.push_back((uint64_t)w.mArrayIndex | ((uint64_t)w.mImageLayout << 32));
+		if (w.mBuffer) {
+			handles.push_back((uint64_t)(VkBuffer)*w.mBuffer);
+			key.push_back(handles.back());
+			key.push_back(w.mType == VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER ? (uint64_t)w.mBuffer->View() : w.mOffset);
+			key.push_back(w.mRange);
+		} else if (w.mTexture) {
+			// cached sets are bound again without writes, so their textures are marked used here
+			w.mTexture->MarkUsed(mInstance->FrameCount());
+			handles.push_back((uint64_t)w.mTexture->View());
+			key.push_back(handles.back());
+		} else if (w.mSampler) {
+			handles.push_back((uint64_t)(VkSampler)*w.mSampler);
+			key.push_back(handles.back());
+		}
+	}
 
-	auto& sets = frame->mTempDescriptorSets[layout];
+	size_t hash = 0;
+	for (uint64_t k : key) hash_combine(hash, k);
 
-	DescriptorSet* ds;
-	if (sets.size()) {
-		auto front = sets.begin();
-		ds = front->first;
-		sets.erase(front);
-	} else
-		ds = new DescriptorSet(name, this, layout);
+	lock_guard lock(mDescriptorSetCacheMutex);
+	auto range = mDescriptorSetCache.equal_range(hash);
+	for (auto it = range.first; it != range.second; it++)
+		if (it->second.mKey == key) {
+			it->second.mLastUsed = mInstance->FrameCount();
+			return it->second.mDescriptorSet;
+		}
+
+	DescriptorSet* ds = new DescriptorSet(name, this, layout);
+	for (const DescriptorSetWrite& w : writes)
+		ds->Write(w);
+	ds->FlushWrites();
+
+	for (uint64_t h : handles)
+		mDescriptorSetCacheHandles[h]++;
 
-	frame->mTempDescriptorSetsInUse.push_back(ds);
+	CachedDescriptorSet c = {};
+	c.mDescriptorSet = ds;
+	c.mKey = move(key);
+	c.mHandles = move(handles);
+	c.mLastUsed = mInstance->FrameCount();
+	mDescriptorSetCache.emplace(hash, move(c));
 	return ds;
+}
+void Device::InvalidateDescriptorSets(uint64_t handle) {
+	lock_guard lock(mDescriptorSetCacheMutex);
+	if (!mDescriptorSetCacheHandles.count(handle)) return;
+
+	// a resource can only be destroyed once the GPU is done with it, so are the sets that reference it
+	for (auto it = mDescriptorSetCache.begin(); it != mDescriptorSetCache.end();) {
+		if (find(it->second.mHandles.begin(), it->second.mHandles.end(), handle) != it->second.mHandles.end()) {
+			for (uint64_t h : it->second.mHandles)
+				if (--mDescriptorSetCacheHandles[h] == 0) mDescriptorSetCacheHandles.erase(h);
+			safe_delete(it->second.mDescriptorSet);
+			it = mDescriptorSetCache.erase(it);
+		} else
+			it++;
+	}
+}
+void Device::PurgeDescriptorSetCache() {
+	lock_guard lock(mDescriptorSetCacheMutex);
+	uint64_t frame = mInstance->FrameCount();
+	for (auto it = mDescriptorSetCache.begin(); it != mDescriptorSetCache.end();) {
+		if (it->second.mLastUsed + DESCRIPTOR_CACHE_LIFETIME < frame) {
+			for (uint64_t h : it->second.mHandles)
+				if (--mDescriptorSetCacheHandles[h] == 0) mDescriptorSetCacheHandles.erase(h);
+			safe_delete(it->second.mDescriptorSet);
+			it = mDescriptorSetCache.erase(it);
+		} else
+			it++;
+	}
 }
\ No newline at end of file
@@ -1,15 +1,28 @@
 #pragma once
 
+#include <atomic>
 #include <list>
+#include <unordered_set>
 #include <utility>
 
 #include <Core/DescriptorSet.hpp>
+#include <Core/BindlessTable.hpp>
 #include <Core/CommandBuffer.hpp>
 #include <Core/Instance.hpp>
+#include <Core/MeshPool.hpp>
+#include <Core/StagingRing.hpp>
 #include <Util/Util.hpp>
 
+// images and buffers at least this large are given their own VkDeviceMemory
+#define MEM_DEDICATED_ALLOC (64*1024*1024)
+// cached descriptor sets that go unused for this many frames are freed
+#define DESCRIPTOR_CACHE_LIFETIME 64
+// sets per temporary descriptor pool, each thread allocates more pools as needed
+#define TEMP_DESCRIPTOR_POOL_SIZE 256
+
 class CommandBuffer;
 class Fence;
+class GraphicsShader;
 class Window;
 
 struct DeviceMemoryAllocation {
@@ -21,21 +34,76 @@ struct DeviceMemoryAllocation {
 	std::string mTag;
 };
 
+struct MemoryFragmentation {
+	VkDeviceSize mTotalSize;
+	VkDeviceSize mFreeSize;
+	VkDeviceSize mLargestFreeBlock;
+	uint32_t mFreeBlockCount;
+	uint32_t mAllocationCount;
+	uint32_t mBlockCount;
+	/// 0 when all free memory is contiguous, approaching 1 as free memory is split into many small blocks
+	inline float Fragmentation() const { return mFreeSize ? 1.f - (float)mLargestFreeBlock / (float)mFreeSize : 0.f; }
+};
+
+struct DeviceMemoryBudget {
+	/// How much memory the process can use from this heap. Reported by VK_EXT_memory_budget when available, otherwise estimated from the heap size
+	VkDeviceSize mBudget;
+	/// How much memory the process is using from this heap. Reported by VK_EXT_memory_budget when available, otherwise equal to mAllocated
+	VkDeviceSize mUsage;
+	/// Bytes allocated with vkAllocateMemory from this heap by this Device
+	VkDeviceSize mAllocated;
+};
+
+struct MemoryUsageStats {
+	/// Bytes allocated from the driver with vkAllocateMemory. Equal to mUsed for tags.
+	VkDeviceSize mReserved;
+	/// Bytes sub-allocated to resources
+	VkDeviceSize mUsed;
+	uint32_t mAllocationCount;
+	VkDeviceSize mPeakReserved;
+	VkDeviceSize mPeakUsed;
+	/// Memory types and heaps only
+	VkDeviceSize mLargestFreeBlock;
+	uint32_t mBlockCount;
+};
+
+struct DeviceMemoryStats {
+	/// Indexed by memory type
+	std::vector<MemoryUsageStats> mTypes;
+	/// Indexed by memory heap
+	std::vector<MemoryUsageStats> mHeaps;
+	/// Keyed by DeviceMemoryAllocation::mTag
+	std::unordered_map<std::string, MemoryUsageStats> mTags;
+	/// Bytes of framebuffer attachments that each frame context after the first shares instead of allocating its own.
+	/// The total saving is this times MaxFramesInFlight() - 1
+	VkDeviceSize mAliasedPerFrameContext;
+};
+
 class Device {
 public:
 	struct FrameContext {
+		// descriptor pools used by one thread, reset when the frame is done
+		struct DescriptorPools {
+			std::vector<VkDescriptorPool> mPools;
+			// index of the pool that sets are allocated from
+			uint32_t mCurrent;
+			std::vector<DescriptorSet*> mDescriptorSets;
+		};
+
 		std::vector<std::shared_ptr<Semaphore>> mSemaphores; // semaphores that signal when this frame is done
 		std::vector<std::shared_ptr<Fence>> mFences; // fences that signal when this frame is done
 		
 		std::list<std::pair<Buffer*, uint32_t>> mTempBuffers;
-		std::unordered_map<VkDescriptorSetLayout, std::list<std::pair<DescriptorSet*, uint32_t>>> mTempDescriptorSets;
+		std::unordered_map<std::thread::id, DescriptorPools> mDescriptorPools;
 
 		std::vector<Buffer*> mTempBuffersInUse;
-		std::vector<DescriptorSet*> mTempDescriptorSetsInUse;
+
+		// buffers that were relocated by the defragmenter, destroyed when this frame is done
+		std::vector<std::tuple<VkBuffer, VkBufferView, DeviceMemoryAllocation>> mRetiredBuffers;
 
 		Device* mDevice;
 
-		inline FrameContext() : mFences({}), mSemaphores({}), mTempBuffers({}), mTempDescriptorSets({}), mTempBuffersInUse({}), mTempDescriptorSetsInUse({}) {};
+		inline FrameContext() : mFences({}), mSemaphores({}), mTempBuffers({}), mDescriptorPools({}), mTempBuffersInUse({}) {};
 		ENGINE_EXPORT ~FrameContext();
 		ENGINE_EXPORT void Reset();
 	};
@@ -45,10 +113,46 @@ public:
 	ENGINE_EXPORT ~Device();
 
 	ENGINE_EXPORT DeviceMemoryAllocation AllocateMemory(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, const std::string& tag);
+	/// Allocates a VkDeviceMemory block used only by the given image or buffer, for large resources or when the driver prefers it
+	ENGINE_EXPORT DeviceMemoryAllocation AllocateDedicatedMemory(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, const std::string& tag, VkImage image, VkBuffer buffer = VK_NULL_HANDLE);
 	ENGINE_EXPORT void FreeMemory(const DeviceMemoryAllocation& allocation);
+	/// Fragmentation of the memory blocks of a memory type, or of all memory types if memoryType is -1
+	ENGINE_EXPORT MemoryFragmentation GetMemoryFragmentation(int32_t memoryType = -1);
+	/// Snapshot of memory usage per memory type, heap and allocation tag, with high-water marks
+	ENGINE_EXPORT DeviceMemoryStats GetMemoryStats();
+	/// Writes GetMemoryStats() to a JSON file, with tags sorted by the memory they use
+	ENGINE_EXPORT bool WriteMemoryStats(const std::string& filename);
+	/// Adds to the bytes of framebuffer attachments that are shared by the frame contexts. Called by Framebuffer when its attachments are created and destroyed.
+	inline void TrackAliasedMemory(int64_t perFrameContext) { mAliasedPerFrameContext += perFrameContext; }
+	inline VkMemoryPropertyFlags MemoryTypeFlags(uint32_t memoryType) const { return mMemoryProperties.memoryTypes[memoryType].propertyFlags; }
+	inline uint32_t MemoryTypeHeap(uint32_t memoryType) const { return mMemoryProperties.memoryTypes[memoryType].heapIndex; }
+	inline VkDeviceSize MemoryHeapSize(uint32_t heap) const { return mMemoryProperties.memoryHeaps[heap].size; }
+
+	/// Queries the current memory usage and budget of each heap. Called once per frame.
+	ENGINE_EXPORT void UpdateMemoryBudget();
+	inline uint32_t MemoryHeapCount() const { return mMemoryProperties.memoryHeapCount; }
+	inline const DeviceMemoryBudget& MemoryBudget(uint32_t heap) const { return mMemoryBudgets[heap]; }
+	inline bool MemoryBudgetSupported() const { return mMemoryBudgetSupported; }
+
+	/// Relocates device-local Buffers out of the least-used memory block of each memory type, so that the block can be freed.
+	/// Runs when the fraction of free memory in a memory type's blocks exceeds DefragmentThreshold(), copying at most DefragmentBytesPerFrame() per call.
+	/// Buffers that are written into a DescriptorSet stay where they are, since the set would keep pointing at the old memory.
+	ENGINE_EXPORT void Defragment(CommandBuffer* commandBuffer);
+	inline float DefragmentThreshold() const { return mDefragmentThreshold; }
+	inline void DefragmentThreshold(float t) { mDefragmentThreshold = t; }
+	inline VkDeviceSize DefragmentBytesPerFrame() const { return mDefragmentBytesPerFrame; }
+	inline void DefragmentBytesPerFrame(VkDeviceSize b) { mDefragmentBytesPerFrame = b; }
 	
 	ENGINE_EXPORT Buffer* GetTempBuffer(const std::string& name, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties);
+	/// Allocates a descriptor set from the calling thread's descriptor pools for the current frame context.
+	/// The set is freed when the frame context is reset, so it is only valid for the current frame.
 	ENGINE_EXPORT DescriptorSet* GetTempDescriptorSet(const std::string& name, VkDescriptorSetLayout layout);
+	/// Returns a descriptor set with the given contents, which is only written the first time those contents are requested.
+	/// The returned set must not be modified. It stays valid for the current frame, and is freed when a resource it references is destroyed.
+	ENGINE_EXPORT DescriptorSet* GetCachedDescriptorSet(const std::string& name, VkDescriptorSetLayout layout, const std::vector<DescriptorSetWrite>& writes);
+	/// Frees the cached descriptor sets that reference a VkBuffer, VkImageView or VkSampler. Called when the handle is destroyed.
+	ENGINE_EXPORT void InvalidateDescriptorSets(uint64_t handle);
+	inline uint32_t CachedDescriptorSetCount() const { return (uint32_t)mDescriptorSetCache.size(); }
 
 	ENGINE_EXPORT std::shared_ptr<CommandBuffer> GetCommandBuffer(const std::string& name = "Command Buffer");
 	ENGINE_EXPORT std::shared_ptr<Fence> Execute(std::shared_ptr<CommandBuffer> commandBuffer, bool frameContext = true);
@@ -62,45 +166,139 @@ public:
 	inline uint32_t PhysicalDeviceIndex() const { return mPhysicalDeviceIndex; }
 	inline VkQueue GraphicsQueue() const { return mGraphicsQueue; };
 	inline VkQueue PresentQueue() const { return mPresentQueue; };
+	/// A queue from a dedicated transfer queue family if the device has one, otherwise the graphics queue
+	inline VkQueue TransferQueue() const { return mTransferQueue; };
 	inline uint32_t GraphicsQueueFamily() const { return mGraphicsQueueFamily; };
 	inline uint32_t PresentQueueFamily() const { return mPresentQueueFamily; };
+	inline uint32_t TransferQueueFamily() const { return mTransferQueueFamily; };
 	inline uint32_t DescriptorSetCount() const { return mDescriptorSetCount; };
 
 	inline uint32_t MaxFramesInFlight() const { return mInstance->MaxFramesInFlight(); }
 	inline uint32_t FrameContextIndex() const { return mFrameContextIndex; }
 	inline FrameContext* CurrentFrameContext() { return &mFrameContexts[mFrameContextIndex]; }
 
+	/// Shared upload ring used by Buffer and Texture uploads
+	inline ::StagingRing* StagingRing() const { return mStagingRing; }
+	/// Global table of bindless textures and materials, nullptr if the device can't update descriptors after binding
+	inline ::BindlessTable* BindlessTable() const { return mBindlessTable; }
+	/// Shared vertex and index buffers that static meshes are sub-allocated from
+	inline ::MeshPool* MeshPool() const { return mMeshPool; }
+	/// Incremented when AssetManager reloads shaders in place, which destroys their variants. Materials compare it to the value they
+	/// looked their variants up at. Other assets have their own Asset::Revision().
+	inline uint64_t ShaderReloadCount() const { return mShaderReloadCount; }
+	inline void ShadersReloaded() { mShaderReloadCount++; }
+
 	inline const VkPhysicalDeviceLimits& Limits() const { return mLimits; }
+	/// True if vkCmdDrawIndexedIndirect can take more than one draw
+	inline bool MultiDrawIndirect() const { return mMultiDrawIndirect; }
 	inline ::Instance* Instance() const { return mInstance; }
 	inline VkPipelineCache PipelineCache() const { return mPipelineCache; }
+	/// When enabled, GraphicsShader::GetPipeline compiles new pipelines on the Instance's ThreadPool instead of blocking
+	inline void AsyncPipelineCompilation(bool a) { mAsyncPipelineCompilation = a; }
+	inline bool AsyncPipelineCompilation() const { return mAsyncPipelineCompilation; }
+	/// Number of pipelines being compiled in the background
+	inline uint32_t PendingPipelineCount() const { return mPendingPipelineCount; }
+	/// Cancels the pipelines queued for a render pass and destroys the pipelines created for it. The VkRenderPass is destroyed right away,
+	/// or by the last background compile that is still using it. Called when a RenderPass is destroyed.
+	ENGINE_EXPORT void DestroyRenderPass(uint64_t renderPassID, VkRenderPass renderPass);
+	/// Writes the pipeline cache to disk, it is loaded again when a device with the same driver is created. Called when the Device is destroyed.
+	ENGINE_EXPORT bool SavePipelineCache();
 
 	inline operator VkDevice() const { return mDevice; }
 
 private:
-	struct Allocation {
+	/// A single VkDeviceMemory block, sub-allocated with a two-level segregated fit (TLSF) allocator.
+	/// Allocation and deallocation are O(1): free blocks are binned by size class, with bitmaps to find a non-empty bin.
+	class Allocation {
+	public:
 		void* mMapped;
 		VkDeviceMemory mMemory;
 		VkDeviceSize mSize;
-		// <offset, size>
-		std::list<std::pair<VkDeviceSize, VkDeviceSize>> mAvailable;
-		std::list<DeviceMemoryAllocation> mAllocations;
+
+		ENGINE_EXPORT Allocation(VkDeviceMemory memory, VkDeviceSize size, VkDeviceSize granularity, void* mapped);
+		ENGINE_EXPORT ~Allocation();
 
 		ENGINE_EXPORT bool SubAllocate(const VkMemoryRequirements& requirements, DeviceMemoryAllocation& allocation, const std::string& tag);
 		ENGINE_EXPORT void Deallocate(const DeviceMemoryAllocation& allocation);
+		ENGINE_EXPORT void GetFragmentation(MemoryFragmentation& stats) const;
+
+		inline bool Empty() const { return mAllocations.empty(); }
+		inline VkDeviceSize FreeSize() const { return mFreeSize; }
+
+	private:
+		struct Block {
+			VkDeviceSize mOffset;
+			VkDeviceSize mSize;
+			bool mFree;
+			// neighbouring blocks in memory
+			Block* mPrevPhysical;
+			Block* mNextPhysical;
+			// neighbouring blocks in the same free list
+			Block* mPrevFree;
+			Block* mNextFree;
+			std::string mTag;
+		};
+
+		Block* mFirstBlock;
+		VkDeviceSize mGranularity;
+		VkDeviceSize mFreeSize;
+		uint32_t mFreeBlockCount;
+		uint64_t mFirstLevelBitmap;
+		uint32_t mSecondLevelBitmap[64];
+		Block* mFreeLists[64][32];
+		// offset -> used block
+		std::unordered_map<VkDeviceSize, Block*> mAllocations;
+
+		ENGINE_EXPORT void InsertFreeBlock(Block* block);
+		ENGINE_EXPORT void RemoveFreeBlock(Block* block);
+		ENGINE_EXPORT Block* FindFreeBlock(VkDeviceSize size);
+		ENGINE_EXPORT Block* Split(Block* block, VkDeviceSize size);
 	};
 
+	friend class Buffer;
 	friend class DescriptorSet;
 	friend class CommandBuffer;
+	friend class GraphicsShader;
 	friend class ::Instance;
+	friend class ::StagingRing;
 	ENGINE_EXPORT Device(::Instance* instance, VkPhysicalDevice physicalDevice, uint32_t physicalDeviceIndex, uint32_t graphicsQueue, uint32_t presentQueue, const std::set<std::string>& deviceExtensions, std::vector<const char*> validationLayers);
 	
 	ENGINE_EXPORT void PrintAllocations();
+	ENGINE_EXPORT uint32_t FindMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties);
+	// applies changes in reserved and used bytes to the stats of a memory type, its heap and a tag
+	ENGINE_EXPORT void TrackMemory(uint32_t memoryType, const std::string& tag, int64_t reserved, int64_t used);
+	ENGINE_EXPORT bool RelocateBuffer(Buffer* buffer, CommandBuffer* commandBuffer, VkDeviceMemory source);
+	// reads and validates the pipeline cache saved for this device and driver
+	ENGINE_EXPORT bool LoadPipelineCache(const VkPhysicalDeviceProperties& properties, std::vector<uint8_t>& data);
+	ENGINE_EXPORT VkDescriptorPool CreateDescriptorPool(const std::string& name, uint32_t maxSets, uint32_t descriptorCount, VkDescriptorPoolCreateFlags flags);
+	// frees cached descriptor sets that haven't been used in DESCRIPTOR_CACHE_LIFETIME frames
+	ENGINE_EXPORT void PurgeDescriptorSetCache();
 
 	::Instance* mInstance;
 	uint32_t mFrameContextIndex; // assigned by mInstance
 	FrameContext* mFrameContexts;
 
-	std::unordered_map<uint32_t, std::vector<Allocation>> mMemoryAllocations;
+	std::unordered_map<uint32_t, std::vector<Allocation*>> mMemoryAllocations;
+	// memory -> size
+	std::unordered_map<VkDeviceMemory, VkDeviceSize> mDedicatedAllocations;
+	VkPhysicalDeviceMemoryProperties mMemoryProperties;
+	std::vector<DeviceMemoryBudget> mMemoryBudgets;
+	bool mMemoryBudgetSupported;
+	std::vector<MemoryUsageStats> mMemoryTypeStats;
+	std::vector<MemoryUsageStats> mMemoryHeapStats;
+	std::unordered_map<std::string, MemoryUsageStats> mMemoryTagStats;
+	std::atomic<uint64_t> mAliasedPerFrameContext;
+
+	std::unordered_set<Buffer*> mBuffers;
+	float mDefragmentThreshold;
+	VkDeviceSize mDefragmentBytesPerFrame;
+
+	::StagingRing* mStagingRing;
+	::BindlessTable* mBindlessTable;
+	::MeshPool* mMeshPool;
+	bool mBindlessSupported;
+	bool mMultiDrawIndirect;
+	uint64_t mShaderReloadCount;
 
 	VkPhysicalDeviceLimits mLimits;
 	uint32_t mMaxMSAASamples;
@@ -109,16 +307,47 @@ private:
 	VkPhysicalDevice mPhysicalDevice;
 	VkDevice mDevice;
 	VkPipelineCache mPipelineCache;
+	bool mAsyncPipelineCompilation;
+	std::atomic<uint32_t> mPendingPipelineCount;
+	struct PendingRenderPass {
+		// number of queued pipelines that use the render pass
+		uint32_t mPipelineCount;
+		// set when the RenderPass is destroyed, the last queued pipeline destroys the VkRenderPass
+		bool mCancelled;
+	};
+	std::unordered_map<VkRenderPass, PendingRenderPass> mPendingRenderPasses;
+	// render pass ID -> shaders that have pipelines for it
+	std::unordered_map<uint64_t, std::unordered_set<GraphicsShader*>> mRenderPassShaders;
+	std::mutex mPendingPipelineMutex;
+	std::string mPipelineCacheFile;
 
 	uint32_t mGraphicsQueueFamily;
 	uint32_t mPresentQueueFamily;
+	uint32_t mTransferQueueFamily;
 
 	VkQueue mGraphicsQueue;
 	VkQueue mPresentQueue;
+	VkQueue mTransferQueue;
 
 	VkDescriptorPool mDescriptorPool;
 	uint32_t mDescriptorSetCount;
 
+	struct CachedDescriptorSet {
+		DescriptorSet* mDescriptorSet;
+		// the layout, the handles and parameters of every write
+		std::vector<uint64_t> mKey;
+		std::vector<uint64_t> mHandles;
+		uint64_t mLastUsed;
+	};
+	// hash of mKey -> sets
+	std::unordered_multimap<uint64_t, CachedDescriptorSet> mDescriptorSetCache;
+	// handle -> number of cached sets that reference it
+	std::unordered_map<uint64_t, uint32_t> mDescriptorSetCacheHandles;
+	// Buffer::ID() -> number of descriptors that reference it, these buffers aren't relocated by Defragment. Guarded by mMemoryMutex.
+	// Keyed by ID rather than VkBuffer, since a destroyed buffer's handle can be reused while sets still count it
+	std::unordered_map<uint64_t, uint32_t> mDescriptorBufferReferences;
+
+	std::mutex mDescriptorSetCacheMutex;
 	std::mutex mTmpDescriptorSetMutex;
 	std::mutex mTmpBufferMutex;
 	std::mutex mDescriptorPoolMutex;
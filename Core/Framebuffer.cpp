@@ -6,9 +6,10 @@ using namespace std;
 
 Framebuffer::Framebuffer(const string& name, ::Device* device, uint32_t width, uint32_t height, 
 	const vector<VkFormat>& colorFormats, VkFormat depthFormat, VkSampleCountFlagBits sampleCount,
-	const vector<VkSubpassDependency>& dependencies, VkAttachmentLoadOp loadOp)
+	const vector<VkSubpassDependency>& dependencies, VkAttachmentLoadOp loadOp, bool transient)
 	: mName(name), mDevice(device), mRenderPass(nullptr),
-	mWidth(width), mHeight(height), mSampleCount(sampleCount), mColorFormats(colorFormats), mDepthFormat(depthFormat), mSubpassDependencies(dependencies), mLoadOp(loadOp) {
+	mWidth(width), mHeight(height), mSampleCount(sampleCount), mColorFormats(colorFormats), mDepthFormat(depthFormat), mSubpassDependencies(dependencies), mLoadOp(loadOp),
+	mTransient(transient), mAliasedMemory(0) {
 
 	mFramebuffers = new VkFramebuffer[mDevice->MaxFramesInFlight()];
 	mColorBuffers = colorFormats.size() ? new vector<Texture*>[mDevice->MaxFramesInFlight()] : nullptr;
@@ -30,6 +31,7 @@ Framebuffer::Framebuffer(const string& name, ::Device* device, uint32_t width, u
 	mClearValues[mColorFormats.size()] = { 1.f, 0.f };
 }
 Framebuffer::~Framebuffer() {
+	mDevice->TrackAliasedMemory(-(int64_t)mAliasedMemory);
 	safe_delete(mRenderPass);
 	for (uint32_t i = 0; i < mDevice->MaxFramesInFlight(); i++) {
 		if (mFramebuffers[i] != VK_NULL_HANDLE)
@@ -86,7 +88,7 @@ void Framebuffer::CreateRenderPass() {
 }
 
 bool Framebuffer::UpdateBuffers() {
-	uint32_t frameContextIndex = mDevice->FrameContextIndex();
+	uint32_t frameContextIndex = BufferIndex();
 
 	if (!mRenderPass || mRenderPass->RasterizationSamples() != mSampleCount) CreateRenderPass();
 
@@ -94,8 +96,11 @@ bool Framebuffer::UpdateBuffers() {
 		|| mDepthBuffers[frameContextIndex]->Width() != mWidth || mDepthBuffers[frameContextIndex]->Height() != mHeight || mDepthBuffers[frameContextIndex]->SampleCount() != mSampleCount) {
 		
 		PROFILER_BEGIN("Create Framebuffers");
-		if (mFramebuffers[frameContextIndex] != VK_NULL_HANDLE)
+		if (mFramebuffers[frameContextIndex] != VK_NULL_HANDLE) {
+			// shared attachments, or attachments that were shared before the sample count changed, may still be in use by other frames in flight
+			if (mTransient) vkDeviceWaitIdle(*mDevice);
 			vkDestroyFramebuffer(*mDevice, mFramebuffers[frameContextIndex], nullptr);
+		}
 
 		vector<VkImageView> views((mColorBuffers ? mColorBuffers[frameContextIndex].size() : 0) + 1);
 
@@ -123,6 +128,26 @@ bool Framebuffer::UpdateBuffers() {
 		fb.layers = 1;
 		vkCreateFramebuffer(*mDevice, &fb, nullptr, &mFramebuffers[frameContextIndex]);
 		mDevice->SetObjectName(mFramebuffers[frameContextIndex], mName + " Framebuffer " + to_string(frameContextIndex), VK_OBJECT_TYPE_FRAMEBUFFER);
+
+		VkDeviceSize aliased = 0;
+		if (Shared()) {
+			aliased = mDepthBuffers[frameContextIndex]->Memory().mSize;
+			for (uint32_t i = 0; i < mColorFormats.size(); i++)
+				aliased += mColorBuffers[frameContextIndex][i]->Memory().mSize;
+			// release the per-frame attachments left from rendering single sampled
+			for (uint32_t f = 1; f < mDevice->MaxFramesInFlight(); f++) {
+				if (mFramebuffers[f] == VK_NULL_HANDLE) continue;
+				vkDeviceWaitIdle(*mDevice);
+				vkDestroyFramebuffer(*mDevice, mFramebuffers[f], nullptr);
+				mFramebuffers[f] = VK_NULL_HANDLE;
+				if (mColorBuffers)
+					for (Texture*& t : mColorBuffers[f])
+						safe_delete(t);
+				safe_delete(mDepthBuffers[f]);
+			}
+		}
+		mDevice->TrackAliasedMemory((int64_t)aliased - (int64_t)mAliasedMemory);
+		mAliasedMemory = aliased;
 		PROFILER_END;
 		return true;
 	}
@@ -130,7 +155,7 @@ bool Framebuffer::UpdateBuffers() {
 }
 
 void Framebuffer::BeginRenderPass(CommandBuffer* commandBuffer) {
-	uint32_t frameContextIndex = mDevice->FrameContextIndex();
+	uint32_t frameContextIndex = BufferIndex();
 	if (UpdateBuffers()) {
 		if (mColorFormats.size()) {
 			VkPipelineStageFlags srcStage, destStage;
@@ -145,6 +170,19 @@ void Framebuffer::BeginRenderPass(CommandBuffer* commandBuffer) {
 				(uint32_t)barriers.size(), barriers.data());
 		}
 		mDepthBuffers[frameContextIndex]->TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, commandBuffer);
+	} else if (mTransient) {
+		// the previous frame may still be writing to the shared attachments
+		VkMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		vkCmdPipelineBarrier(*commandBuffer,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+			0,
+			1, &barrier,
+			0, nullptr,
+			0, nullptr);
 	}
 	commandBuffer->BeginRenderPass(mRenderPass, { mWidth, mHeight }, mFramebuffers[frameContextIndex], mClearValues.data(), (uint32_t)mClearValues.size());
 }
@@ -167,7 +205,7 @@ void Framebuffer::Clear(CommandBuffer* commandBuffer) {
 void Framebuffer::ResolveColor(CommandBuffer* commandBuffer, uint32_t index, VkImage destination) {
 	if (!mColorBuffers) return;
 
-	uint32_t frameContextIndex = mDevice->FrameContextIndex();
+	uint32_t frameContextIndex = BufferIndex();
 
 	mColorBuffers[frameContextIndex][index]->TransitionImageLayout(VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, commandBuffer);
 
@@ -196,7 +234,7 @@ void Framebuffer::ResolveColor(CommandBuffer* commandBuffer, uint32_t index, VkI
 	mColorBuffers[frameContextIndex][index]->TransitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, commandBuffer);
 }
 void Framebuffer::ResolveDepth(CommandBuffer* commandBuffer, VkImage destination) {
-	uint32_t frameContextIndex = mDevice->FrameContextIndex();
+	uint32_t frameContextIndex = BufferIndex();
 
 	mDepthBuffers[frameContextIndex]->TransitionImageLayout(VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, commandBuffer);
 
@@ -10,9 +10,12 @@ class Framebuffer {
 public:
 	const std::string mName;
 
+	/// A transient Framebuffer's attachments are only used within a frame (i.e. they are resolved or copied before the frame ends),
+	/// so one set of attachments is shared by every frame context instead of allocating one per frame in flight.
+	/// Attachments are only shared while the sample count isn't VK_SAMPLE_COUNT_1_BIT, since single sampled attachments are read after the frame.
 	ENGINE_EXPORT Framebuffer(const std::string& name, ::Device* device, uint32_t width, uint32_t height,
 		const std::vector<VkFormat>& colorFormats, VkFormat depthFormat, VkSampleCountFlagBits sampleCount,
-		const std::vector<VkSubpassDependency>& dependencies, VkAttachmentLoadOp loadOp);
+		const std::vector<VkSubpassDependency>& dependencies, VkAttachmentLoadOp loadOp, bool transient = false);
 	ENGINE_EXPORT ~Framebuffer();
 
 	inline void Width(uint32_t w) { mWidth = w; }
@@ -22,16 +25,20 @@ public:
 	inline uint32_t Width() const { return mWidth; }
 	inline uint32_t Height() const { return mHeight; }
 	inline VkSampleCountFlagBits SampleCount() const { return mSampleCount; }
+	inline bool Transient() const { return mTransient; }
+	/// Bytes of attachment memory saved by sharing attachments across the frame contexts, which is one set of attachments for every frame in flight after the first.
+	/// Attachments are only shared by the frames in flight of one Framebuffer, not between Framebuffers. Reported in Device::GetMemoryStats()
+	inline VkDeviceSize AliasedMemory() const { return Shared() ? mAliasedMemory * (mDevice->MaxFramesInFlight() - 1) : 0; }
 
 	inline void ClearValue(uint32_t i, const VkClearValue& value) { mClearValues[i] = value; }
 
-	inline Texture* ColorBuffer(uint32_t i) { return mColorBuffers[mDevice->FrameContextIndex()][i]; }
-	inline Texture* DepthBuffer() { return mDepthBuffers[mDevice->FrameContextIndex()]; }
+	inline Texture* ColorBuffer(uint32_t i) { return mColorBuffers[BufferIndex()][i]; }
+	inline Texture* DepthBuffer() { return mDepthBuffers[BufferIndex()]; }
 
 	ENGINE_EXPORT void ResolveColor(CommandBuffer* commandBuffer, uint32_t index, VkImage destination);
 	ENGINE_EXPORT void ResolveDepth(CommandBuffer* commandBuffer, VkImage destination);
 
-	inline uint32_t ColorBufferCount() const { return mColorBuffers ? (uint32_t)mColorBuffers[mDevice->FrameContextIndex()].size() : 0; }
+	inline uint32_t ColorBufferCount() const { return mColorBuffers ? (uint32_t)mColorBuffers[BufferIndex()].size() : 0; }
 
 	ENGINE_EXPORT void Clear(CommandBuffer* commandBuffer);
 	ENGINE_EXPORT void BeginRenderPass(CommandBuffer* commandBuffer);
@@ -55,6 +62,13 @@ private:
 	std::vector<VkClearValue> mClearValues;
 	VkFormat mDepthFormat;
 
+	bool mTransient;
+	// size of the shared attachments
+	VkDeviceSize mAliasedMemory;
+
+	inline bool Shared() const { return mTransient && mSampleCount != VK_SAMPLE_COUNT_1_BIT; }
+	inline uint32_t BufferIndex() const { return Shared() ? 0 : mDevice->FrameContextIndex(); }
+
 	ENGINE_EXPORT void CreateRenderPass();
 	ENGINE_EXPORT bool UpdateBuffers();
 };
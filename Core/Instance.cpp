@@ -61,7 +61,7 @@ LRESULT CALLBACK Instance::WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARA
 #endif
 
 Instance::Instance(int argc, char** argv, PluginManager* pluginManager)
-	: mInstance(VK_NULL_HANDLE), mFrameCount(0), mMaxFramesInFlight(0), mWindow(nullptr), mWindowInput(nullptr), mDestroyPending(false)
+	: mInstance(VK_NULL_HANDLE), mFrameCount(0), mMaxFramesInFlight(0), mWindow(nullptr), mWindowInput(nullptr), mThreadPool(nullptr), mDestroyPending(false)
 	#ifdef ENABLE_DEBUG_LAYERS
 	, mDebugMessenger(VK_NULL_HANDLE)
 	#endif
@@ -215,6 +215,7 @@ Instance::Instance(int argc, char** argv, PluginManager* pluginManager)
 	#endif
 
 	mWindowInput = new MouseKeyboardInput();
+	mThreadPool = new ::ThreadPool();
 
 	mMaxFramesInFlight = 0xFFFF;
 
@@ -273,6 +274,15 @@ Instance::Instance(int argc, char** argv, PluginManager* pluginManager)
 	if (fullscreen) mWindow->Fullscreen(true);
 	#pragma endregion
 
+	// track memory budgets when the device supports it
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+	vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, availableExtensions.data());
+	for (const VkExtensionProperties& e : availableExtensions)
+		if (strcmp(e.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0)
+			mDeviceExtensions.insert(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
 	uint32_t graphicsQueue, presentQueue;
 	Device::FindQueueFamilies(physicalDevice, mWindow->Surface(), graphicsQueue, presentQueue);
 	mDevice = new ::Device(this, physicalDevice, deviceIndex, graphicsQueue, presentQueue, mDeviceExtensions, validationLayers);
@@ -283,6 +293,8 @@ Instance::Instance(int argc, char** argv, PluginManager* pluginManager)
 	mDevice->mFrameContexts = new Device::FrameContext[mMaxFramesInFlight];
 	for (uint32_t i = 0; i < mMaxFramesInFlight; i++)
 		mDevice->mFrameContexts[i].mDevice = mDevice;
+	if (mDevice->mBindlessSupported)
+		mDevice->mBindlessTable = new BindlessTable(mDevice);
 }
 Instance::~Instance() {
 	safe_delete(mWindow);
@@ -299,6 +311,7 @@ Instance::~Instance() {
 	#endif
 
 	safe_delete(mDevice);
+	safe_delete(mThreadPool);
 
 	#ifdef ENABLE_DEBUG_LAYERS
 	if (mDebugMessenger != VK_NULL_HANDLE) DestroyDebugUtilsMessengerEXT(mInstance, mDebugMessenger, nullptr);
@@ -556,4 +569,8 @@ void Instance::AdvanceFrame() {
 
 	mDevice->mFrameContextIndex = mFrameCount % mMaxFramesInFlight;
 	mDevice->CurrentFrameContext()->Reset();
+	mDevice->PurgeDescriptorSetCache();
+	mDevice->UpdateMemoryBudget();
+	mDevice->StagingRing()->Update();
+	if (mDevice->BindlessTable()) mDevice->BindlessTable()->Update();
 }
\ No newline at end of file
@@ -13,6 +13,7 @@ namespace x11{
 #endif
 
 #include <Input/MouseKeyboardInput.hpp>
+#include <Util/ThreadPool.hpp>
 #include <Util/Util.hpp>
 
 class Window;
@@ -29,6 +30,8 @@ public:
 	inline uint64_t FrameCount() const { return mFrameCount; }
 
 	inline uint32_t MaxFramesInFlight() const { return mMaxFramesInFlight; }
+	/// Worker threads for background jobs such as pipeline compilation
+	inline ::ThreadPool* ThreadPool() const { return mThreadPool; }
 
 	inline const std::vector<std::string>& CommandLineArguments() const { return mCmdArguments; }
 
@@ -51,6 +54,7 @@ private:
 
 	::Device* mDevice;
 	::Window* mWindow;
+	::ThreadPool* mThreadPool;
 	uint32_t mMaxFramesInFlight;
 	uint64_t mFrameCount;
 
@@ -0,0 +1,150 @@
+#include <Core/MeshPool.hpp>
+#include <Core/Buffer.hpp>
+#include <Core/Device.hpp>
+#include <Core/Instance.hpp>
+
+using namespace std;
+
+MeshPool::MeshPool(Device* device, VkDeviceSize blockSize) : mDevice(device), mBlockSize(blockSize) {}
+MeshPool::~MeshPool() {
+	// meshes keep their own references to the buffers
+	for (Block* b : mBlocks)
+		safe_delete(b);
+	mBlocks.clear();
+	mRetired.clear();
+}
+
+bool MeshPool::FindRange(map<uint32_t, uint32_t>& freeRanges, uint32_t count, uint32_t& offset) {
+	if (count == 0) {
+		offset = 0;
+		return true;
+	}
+	for (auto it = freeRanges.begin(); it != freeRanges.end(); it++) {
+		if (it->second < count) continue;
+		offset = it->first;
+		uint32_t remaining = it->second - count;
+		freeRanges.erase(it);
+		if (remaining) freeRanges.emplace(offset + count, remaining);
+		return true;
+	}
+	return false;
+}
+void MeshPool::FreeRange(map<uint32_t, uint32_t>& freeRanges, uint32_t offset, uint32_t count) {
+	if (count == 0) return;
+	auto next = freeRanges.lower_bound(offset);
+	// merge with the range after
+	if (next != freeRanges.end() && next->first == offset + count) {
+		count += next->second;
+		next = freeRanges.erase(next);
+	}
+	// merge with the range before
+	if (next != freeRanges.begin()) {
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == offset) {
+			prev->second += count;
+			return;
+		}
+	}
+	freeRanges.emplace(offset, count);
+}
+
+void MeshPool::Recycle() {
+	lock_guard lock(mMutex);
+	RecycleLocked();
+}
+void MeshPool::RecycleLocked() {
+	uint64_t frame = mDevice->Instance()->FrameCount();
+	while (mRetired.size() && mRetired.front().second + mDevice->MaxFramesInFlight() <= frame) {
+		const Allocation& a = mRetired.front().first;
+		for (auto it = mBlocks.begin(); it != mBlocks.end(); it++) {
+			Block* b = *it;
+			if (b->mVertexBuffer != a.mVertexBuffer || b->mIndexBuffer != a.mIndexBuffer) continue;
+			FreeRange(b->mFreeVertices, a.mBaseVertex, a.mVertexCount);
+			FreeRange(b->mFreeIndices, a.mBaseIndex, a.mIndexCount);
+			// empty blocks are released, so meshes that were too large for a block don't keep their memory
+			if (b->mFreeVertices.size() == 1 && b->mFreeVertices.begin()->second == b->mVertexCapacity &&
+				b->mFreeIndices.size() == 1 && b->mFreeIndices.begin()->second == b->mIndexCapacity) {
+				safe_delete(b);
+				mBlocks.erase(it);
+			}
+			break;
+		}
+		mRetired.pop_front();
+	}
+}
+
+MeshPool::Allocation MeshPool::Allocate(const VertexInput* vertexInput, uint32_t vertexSize, const void* vertices, uint32_t vertexCount,
+	VkIndexType indexType, const void* indices, uint32_t indexCount) {
+	uint32_t indexSize = indexType == VK_INDEX_TYPE_UINT32 ? sizeof(uint32_t) : sizeof(uint16_t);
+
+	lock_guard lock(mMutex);
+	RecycleLocked();
+
+	Allocation a = {};
+	a.mVertexCount = vertexCount;
+	a.mIndexCount = indexCount;
+
+	Block* block = nullptr;
+	for (Block* b : mBlocks) {
+		if (b->mVertexInput != vertexInput || b->mVertexSize != vertexSize || b->mIndexType != indexType) continue;
+		if (!FindRange(b->mFreeVertices, vertexCount, a.mBaseVertex)) continue;
+		if (!FindRange(b->mFreeIndices, indexCount, a.mBaseIndex)) {
+			FreeRange(b->mFreeVertices, a.mBaseVertex, vertexCount);
+			continue;
+		}
+		block = b;
+		break;
+	}
+
+	if (!block) {
+		block = new Block();
+		block->mVertexInput = vertexInput;
+		block->mVertexSize = vertexSize;
+		block->mIndexType = indexType;
+		block->mVertexCapacity = max((uint32_t)(mBlockSize / vertexSize), vertexCount);
+		block->mIndexCapacity = max((uint32_t)(mBlockSize / indexSize), indexCount);
+		string name = "Mesh Pool " + to_string(mBlocks.size());
+		block->mVertexBuffer = make_shared<Buffer>(name + " Vertices", mDevice, (VkDeviceSize)vertexSize * block->mVertexCapacity,
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+		block->mIndexBuffer = make_shared<Buffer>(name + " Indices", mDevice, (VkDeviceSize)indexSize * block->mIndexCapacity,
+			VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+		block->mFreeVertices.emplace(0, block->mVertexCapacity);
+		block->mFreeIndices.emplace(0, block->mIndexCapacity);
+		block->mAllocationCount = 0;
+		mBlocks.push_back(block);
+		FindRange(block->mFreeVertices, vertexCount, a.mBaseVertex);
+		FindRange(block->mFreeIndices, indexCount, a.mBaseIndex);
+	}
+
+	a.mVertexBuffer = block->mVertexBuffer;
+	a.mIndexBuffer = block->mIndexBuffer;
+	block->mAllocationCount++;
+	// the rest of the block may be in use, so the ranges are written on the graphics queue
+	a.mVertexBuffer->Upload(vertices, (VkDeviceSize)vertexSize * vertexCount, (VkDeviceSize)vertexSize * a.mBaseVertex);
+	a.mIndexBuffer->Upload(indices, (VkDeviceSize)indexSize * indexCount, (VkDeviceSize)indexSize * a.mBaseIndex);
+	return a;
+}
+void MeshPool::Free(const Allocation& allocation) {
+	lock_guard lock(mMutex);
+	for (Block* b : mBlocks)
+		if (b->mVertexBuffer == allocation.mVertexBuffer && b->mIndexBuffer == allocation.mIndexBuffer) {
+			b->mAllocationCount--;
+			break;
+		}
+	mRetired.push_back(make_pair(allocation, mDevice->Instance()->FrameCount()));
+}
+
+VkDeviceSize MeshPool::ReleasableSize(Buffer* vertexBuffer) {
+	lock_guard lock(mMutex);
+	for (Block* b : mBlocks)
+		if (b->mVertexBuffer.get() == vertexBuffer)
+			return b->mAllocationCount == 1 ? b->mVertexBuffer->Size() + b->mIndexBuffer->Size() : 0;
+	return 0;
+}
+VkDeviceSize MeshPool::PendingReleaseSize() {
+	lock_guard lock(mMutex);
+	VkDeviceSize size = 0;
+	for (Block* b : mBlocks)
+		if (b->mAllocationCount == 0) size += b->mVertexBuffer->Size() + b->mIndexBuffer->Size();
+	return size;
+}
\ No newline at end of file
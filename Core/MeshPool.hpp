@@ -0,0 +1,70 @@
+#pragma once
+
+#include <deque>
+#include <map>
+
+#include <Util/Util.hpp>
+
+class Buffer;
+class Device;
+
+/// Sub-allocates the vertices and indices of static meshes from a few large shared buffers, so that draws of different meshes don't rebind
+/// vertex and index buffers, and can be merged into multi-draw or indirect draws. Meshes with the same VertexInput, vertex size and index type
+/// share blocks, and are addressed with the base vertex and base index of their Allocation. Freed ranges are only reused once the frames that
+/// could reference them are done, like the slots of the BindlessTable.
+class MeshPool {
+public:
+	struct Allocation {
+		std::shared_ptr<Buffer> mVertexBuffer;
+		std::shared_ptr<Buffer> mIndexBuffer;
+		uint32_t mBaseVertex;
+		uint32_t mVertexCount;
+		uint32_t mBaseIndex;
+		uint32_t mIndexCount;
+	};
+
+	/// Blocks hold blockSize bytes of vertices and blockSize bytes of indices, larger meshes get a block of their own
+	ENGINE_EXPORT MeshPool(Device* device, VkDeviceSize blockSize = 64 * 1024 * 1024);
+	ENGINE_EXPORT ~MeshPool();
+
+	/// Finds space for the vertices and indices of a mesh and uploads them through the Device's StagingRing
+	ENGINE_EXPORT Allocation Allocate(const VertexInput* vertexInput, uint32_t vertexSize, const void* vertices, uint32_t vertexCount,
+		VkIndexType indexType, const void* indices, uint32_t indexCount);
+	/// Returns the ranges of an allocation to the pool, they are reused after MaxFramesInFlight() frames
+	ENGINE_EXPORT void Free(const Allocation& allocation);
+	/// Reuses the ranges of allocations that were freed MaxFramesInFlight() frames ago, and releases blocks that became empty. Called once per frame by the AssetManager.
+	ENGINE_EXPORT void Recycle();
+
+	/// Bytes of device memory freeing the allocation in vertexBuffer would release, which is the size of its block if it is the block's last allocation and 0 otherwise
+	ENGINE_EXPORT VkDeviceSize ReleasableSize(Buffer* vertexBuffer);
+	/// Bytes of device memory in blocks whose allocations were all freed, which are released once their ranges can be reused
+	ENGINE_EXPORT VkDeviceSize PendingReleaseSize();
+
+private:
+	struct Block {
+		const VertexInput* mVertexInput;
+		uint32_t mVertexSize;
+		VkIndexType mIndexType;
+		std::shared_ptr<Buffer> mVertexBuffer;
+		std::shared_ptr<Buffer> mIndexBuffer;
+		uint32_t mVertexCapacity;
+		uint32_t mIndexCapacity;
+		// allocations that haven't been freed
+		uint32_t mAllocationCount;
+		// offset -> count of each free range, in vertices and indices
+		std::map<uint32_t, uint32_t> mFreeVertices;
+		std::map<uint32_t, uint32_t> mFreeIndices;
+	};
+
+	Device* mDevice;
+	VkDeviceSize mBlockSize;
+	std::vector<Block*> mBlocks;
+	// allocations that were freed, and the frame they were freed in
+	std::deque<std::pair<Allocation, uint64_t>> mRetired;
+	std::mutex mMutex;
+
+	ENGINE_EXPORT static bool FindRange(std::map<uint32_t, uint32_t>& freeRanges, uint32_t count, uint32_t& offset);
+	ENGINE_EXPORT static void FreeRange(std::map<uint32_t, uint32_t>& freeRanges, uint32_t offset, uint32_t count);
+	/// Recycle() with mMutex held
+	ENGINE_EXPORT void RecycleLocked();
+};
\ No newline at end of file
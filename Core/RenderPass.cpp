@@ -8,6 +8,8 @@ RenderPass::RenderPass(const string& name, ::Device* device,
 	const vector<VkSubpassDescription>& subpasses,
 	const vector<VkSubpassDependency>& dependencies)
 	: mName(name), mDevice(device), mFramebuffer(nullptr) {
+	static atomic<uint64_t> nextID = 1;
+	mID = nextID++;
 	mRasterizationSamples = attachments[subpasses[0].pDepthStencilAttachment->attachment].samples;
 	mColorAttachmentCount = subpasses[0].colorAttachmentCount;
 
@@ -30,5 +32,5 @@ RenderPass::RenderPass(const string& name, ::Framebuffer* frameBuffer,
 	mFramebuffer = frameBuffer;
 }
 RenderPass::~RenderPass() {
-	vkDestroyRenderPass(*mDevice, mRenderPass, nullptr);
+	mDevice->DestroyRenderPass(mID, mRenderPass);
 }
\ No newline at end of file
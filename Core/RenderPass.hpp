@@ -24,6 +24,8 @@ public:
 	inline VkSampleCountFlagBits RasterizationSamples() const { return mRasterizationSamples; }
 	inline ::Device* Device() const { return mDevice; }
 	inline ::Framebuffer* Framebuffer() const { return mFramebuffer; }
+	/// Unique to this render pass, unlike the VkRenderPass handle which can be reused once the render pass is destroyed
+	inline uint64_t ID() const { return mID; }
 
 	inline operator VkRenderPass() const { return mRenderPass; }
 
@@ -31,6 +33,7 @@ private:
 	::Device* mDevice;
 	::Framebuffer* mFramebuffer;
 	VkRenderPass mRenderPass;
+	uint64_t mID;
 	VkSampleCountFlagBits mRasterizationSamples;
 	uint32_t mColorAttachmentCount;
 };
\ No newline at end of file
@@ -32,5 +32,6 @@ Sampler::Sampler(const string& name, Device* device, float maxLod, VkFilter filt
 	mDevice->SetObjectName(mSampler, mName, VK_OBJECT_TYPE_SAMPLER);
 }
 Sampler::~Sampler() {
+	mDevice->InvalidateDescriptorSets((uint64_t)mSampler);
 	vkDestroySampler(*mDevice, mSampler, nullptr);
 }
\ No newline at end of file
@@ -0,0 +1,411 @@
+#include <Core/StagingRing.hpp>
+#include <Core/Buffer.hpp>
+#include <Core/CommandBuffer.hpp>
+#include <Core/Device.hpp>
+#include <Util/Profiler.hpp>
+
+#include <cstring>
+
+using namespace std;
+
+#define STAGING_NO_OFFSET (~(VkDeviceSize)0)
+
+StagingRing::StagingRing(Device* device, VkDeviceSize size)
+	: mDevice(device), mSize(size), mHead(0), mFlushSize(size / 4), mFlushInterval(.005f), mNextToken(1), mCompletedToken(0), mPendingAcquireCount(0),
+	mAsync(device->TransferQueueFamily() != device->GraphicsQueueFamily()), mTransferCommandPool(VK_NULL_HANDLE) {
+	mBuffer = new Buffer("Staging Ring", mDevice, mSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = mDevice->GraphicsQueueFamily();
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	ThrowIfFailed(vkCreateCommandPool(*mDevice, &poolInfo, nullptr, &mCommandPool), "vkCreateCommandPool failed");
+	mDevice->SetObjectName(mCommandPool, "Staging Ring Command Pool", VK_OBJECT_TYPE_COMMAND_POOL);
+
+	if (mAsync) {
+		poolInfo.queueFamilyIndex = mDevice->TransferQueueFamily();
+		ThrowIfFailed(vkCreateCommandPool(*mDevice, &poolInfo, nullptr, &mTransferCommandPool), "vkCreateCommandPool failed");
+		mDevice->SetObjectName(mTransferCommandPool, "Staging Ring Transfer Command Pool", VK_OBJECT_TYPE_COMMAND_POOL);
+	}
+}
+StagingRing::~StagingRing() {
+	Flush();
+	{
+		lock_guard lock(mMutex);
+		while (mBatches.size()) Retire(true);
+	}
+	mPendingAcquires.clear();
+	mFreeCommandBuffers.clear();
+	mFreeTransferCommandBuffers.clear();
+	mFreeSemaphores.clear();
+	vkDestroyCommandPool(*mDevice, mCommandPool, nullptr);
+	if (mTransferCommandPool) vkDestroyCommandPool(*mDevice, mTransferCommandPool, nullptr);
+	safe_delete(mBuffer);
+}
+
+shared_ptr<CommandBuffer> StagingRing::BeginCommandBuffer(VkCommandPool pool, vector<shared_ptr<CommandBuffer>>& freeList, const string& name) {
+	shared_ptr<CommandBuffer> commandBuffer;
+	if (freeList.size()) {
+		commandBuffer = freeList.back();
+		freeList.pop_back();
+		commandBuffer->Reset(name);
+	} else
+		commandBuffer = shared_ptr<CommandBuffer>(new CommandBuffer(mDevice, pool, name));
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	ThrowIfFailed(vkBeginCommandBuffer(*commandBuffer, &beginInfo), "vkBeginCommandBuffer failed");
+	return commandBuffer;
+}
+
+StagingRing::Batch& StagingRing::CurrentBatch() {
+	if (mBatches.size() && !mBatches.back().mSubmitted) return mBatches.back();
+
+	Batch b = {};
+	b.mToken = mNextToken++;
+	b.mSubmitted = false;
+	b.mBegin = STAGING_NO_OFFSET;
+	b.mBytes = 0;
+	b.mOpened = mClock.now();
+	b.mCommandBuffer = BeginCommandBuffer(mCommandPool, mFreeCommandBuffers, "Staging Ring");
+	if (mAsync)
+		b.mTransferCommandBuffer = BeginCommandBuffer(mTransferCommandPool, mFreeTransferCommandBuffers, "Staging Ring Transfer");
+	else
+		b.mTransferCommandBuffer = b.mCommandBuffer;
+
+	mBatches.push_back(b);
+	return mBatches.back();
+}
+
+shared_ptr<Semaphore> StagingRing::GetSemaphore() {
+	if (mFreeSemaphores.size()) {
+		shared_ptr<Semaphore> semaphore = mFreeSemaphores.back();
+		mFreeSemaphores.pop_back();
+		return semaphore;
+	}
+	shared_ptr<Semaphore> semaphore = make_shared<Semaphore>(mDevice);
+	mDevice->SetObjectName(*semaphore, "Staging Ring Semaphore", VK_OBJECT_TYPE_SEMAPHORE);
+	return semaphore;
+}
+
+bool StagingRing::Reserve(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset) {
+	// the ring is in use from the first byte of the oldest batch that used it, up to mHead
+	VkDeviceSize tail = 0;
+	bool used = false;
+	for (const Batch& b : mBatches)
+		if (b.mBegin != STAGING_NO_OFFSET) {
+			tail = b.mBegin;
+			used = true;
+			break;
+		}
+	if (!used) mHead = 0;
+
+	VkDeviceSize start = ((mHead + alignment - 1) / alignment) * alignment;
+	if (!used || mHead > tail) {
+		// free space is [mHead, mSize) and [0, tail)
+		if (start + size <= mSize) offset = start;
+		else if (used && size <= tail) offset = 0;
+		else return false;
+	} else if (mHead < tail) {
+		// free space is [mHead, tail)
+		if (start + size <= tail) offset = start;
+		else return false;
+	} else
+		return false;
+
+	Batch& batch = CurrentBatch();
+	if (batch.mBegin == STAGING_NO_OFFSET) batch.mBegin = offset;
+	mHead = offset + size;
+	return true;
+}
+
+uint64_t StagingRing::Upload(const void* data, VkDeviceSize size, VkDeviceSize alignment, const RecordFunction& record, const RecordFunction& finish) {
+	lock_guard lock(mMutex);
+	if (alignment == 0) alignment = 1;
+
+	Batch* batch = &CurrentBatch();
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+
+	if (data && size) {
+		if (size > mSize / 2) {
+			// too large to share the ring with other uploads
+			Buffer* overflow = new Buffer("Staging Overflow", mDevice, data, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+			batch->mOverflowBuffers.push_back(overflow);
+			buffer = *overflow;
+		} else {
+			while (!Reserve(size, alignment, offset)) {
+				// the ring is full, submit what's in it and wait for the oldest batch to finish
+				PROFILER_BEGIN("Wait for staging memory");
+				if (batch->mBegin != STAGING_NO_OFFSET) {
+					FlushBatch();
+					batch = &CurrentBatch();
+				}
+				Retire(true);
+				PROFILER_END;
+			}
+			memcpy((uint8_t*)mBuffer->MappedData() + offset, data, size);
+			buffer = *mBuffer;
+		}
+		batch->mBytes += size;
+	}
+
+	if (record) record(batch->mTransferCommandBuffer.get(), buffer, offset);
+	if (finish) finish(batch->mCommandBuffer.get(), buffer, offset);
+
+	uint64_t token = batch->mToken;
+	if (batch->mBytes >= mFlushSize) FlushBatch();
+	return token;
+}
+
+void StagingRing::TransferOwnership(VkBuffer buffer) {
+	if (!mAsync) return;
+	Batch& batch = mBatches.back();
+
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcQueueFamilyIndex = mDevice->TransferQueueFamily();
+	barrier.dstQueueFamilyIndex = mDevice->GraphicsQueueFamily();
+	barrier.buffer = buffer;
+	barrier.size = VK_WHOLE_SIZE;
+
+	// release on the transfer queue
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = 0;
+	vkCmdPipelineBarrier(*batch.mTransferCommandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+		0,
+		0, nullptr,
+		1, &barrier,
+		0, nullptr);
+
+	// the graphics queue acquires the buffer once something uses it
+	barrier.srcAccessMask = 0;
+	PendingAcquire p = {};
+	p.mToken = batch.mToken;
+	p.mSemaphore = GetSemaphore();
+	p.mImage = false;
+	p.mBufferBarrier = barrier;
+	batch.mSignalSemaphores.push_back(p.mSemaphore);
+
+	lock_guard lock(mAcquireMutex);
+	mPendingAcquires[(uint64_t)buffer] = p;
+	mPendingAcquireCount = (uint32_t)mPendingAcquires.size();
+}
+bool StagingRing::TransferOwnership(VkImageMemoryBarrier barrier, VkPipelineStageFlags dstStage) {
+	if (!mAsync) return false;
+	Batch& batch = mBatches.back();
+
+	VkAccessFlags dstAccess = barrier.dstAccessMask;
+	barrier.srcQueueFamilyIndex = mDevice->TransferQueueFamily();
+	barrier.dstQueueFamilyIndex = mDevice->GraphicsQueueFamily();
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = 0;
+	vkCmdPipelineBarrier(*batch.mTransferCommandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+		0,
+		0, nullptr,
+		0, nullptr,
+		1, &barrier);
+
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = dstAccess;
+	if (dstStage) {
+		// the batch's own graphics commands use the image. The barrier's source stage is the semaphore's wait stage,
+		// so that it waits for the transfer
+		if (!batch.mSemaphore) {
+			batch.mSemaphore = GetSemaphore();
+			batch.mSemaphoreStage = 0;
+		}
+		batch.mSemaphoreStage |= dstStage;
+		vkCmdPipelineBarrier(*batch.mCommandBuffer,
+			dstStage, dstStage,
+			0,
+			0, nullptr,
+			0, nullptr,
+			1, &barrier);
+		return true;
+	}
+
+	PendingAcquire p = {};
+	p.mToken = batch.mToken;
+	p.mSemaphore = GetSemaphore();
+	p.mImage = true;
+	p.mImageBarrier = barrier;
+	batch.mSignalSemaphores.push_back(p.mSemaphore);
+
+	lock_guard lock(mAcquireMutex);
+	mPendingAcquires[(uint64_t)barrier.image] = p;
+	mPendingAcquireCount = (uint32_t)mPendingAcquires.size();
+	return true;
+}
+
+void StagingRing::Acquire(uint64_t handle, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+	if (mPendingAcquireCount == 0) return;
+
+	lock_guard lock(mMutex);
+	PendingAcquire p;
+	{
+		lock_guard acquireLock(mAcquireMutex);
+		auto it = mPendingAcquires.find(handle);
+		if (it == mPendingAcquires.end()) return;
+		p = it->second;
+		mPendingAcquires.erase(it);
+		mPendingAcquireCount = (uint32_t)mPendingAcquires.size();
+	}
+
+	// recorded into the current batch, which is submitted before any CommandBuffer that could use the resource.
+	// The barrier's source stage is the semaphore's wait stage, so that it waits for the transfer
+	Batch& batch = CurrentBatch();
+	if (p.mImage) {
+		p.mImageBarrier.dstAccessMask |= dstAccess;
+		vkCmdPipelineBarrier(*batch.mCommandBuffer,
+			dstStage, dstStage,
+			0,
+			0, nullptr,
+			0, nullptr,
+			1, &p.mImageBarrier);
+	} else {
+		p.mBufferBarrier.dstAccessMask = dstAccess;
+		vkCmdPipelineBarrier(*batch.mCommandBuffer,
+			dstStage, dstStage,
+			0,
+			0, nullptr,
+			1, &p.mBufferBarrier,
+			0, nullptr);
+	}
+
+	// once the releasing batch is retired, its transfer commands are known to be done
+	if (p.mToken > mCompletedToken) {
+		batch.mWaitSemaphores.push_back(p.mSemaphore);
+		batch.mWaitStages.push_back(dstStage);
+	}
+}
+bool StagingRing::Pending(uint64_t handle) {
+	if (mPendingAcquireCount == 0) return false;
+	lock_guard lock(mAcquireMutex);
+	return mPendingAcquires.count(handle);
+}
+void StagingRing::Discard(uint64_t handle) {
+	if (mPendingAcquireCount == 0) return;
+	// the releasing batch keeps the semaphore alive until its transfer commands are done
+	lock_guard lock(mAcquireMutex);
+	mPendingAcquires.erase(handle);
+	mPendingAcquireCount = (uint32_t)mPendingAcquires.size();
+}
+
+void StagingRing::FlushBatch() {
+	if (mBatches.empty() || mBatches.back().mSubmitted) return;
+	Batch& batch = mBatches.back();
+
+	vector<VkSemaphore> waitSemaphores;
+	vector<VkPipelineStageFlags> waitStages = batch.mWaitStages;
+	for (const shared_ptr<Semaphore>& s : batch.mWaitSemaphores) waitSemaphores.push_back(*s);
+
+	if (mAsync) {
+		ThrowIfFailed(vkEndCommandBuffer(*batch.mTransferCommandBuffer), "vkEndCommandBuffer failed");
+
+		vector<VkSemaphore> signalSemaphores;
+		for (const shared_ptr<Semaphore>& s : batch.mSignalSemaphores) signalSemaphores.push_back(*s);
+		if (batch.mSemaphore) {
+			signalSemaphores.push_back(*batch.mSemaphore);
+			waitSemaphores.push_back(*batch.mSemaphore);
+			waitStages.push_back(batch.mSemaphoreStage);
+		}
+
+		VkCommandBuffer transferCommandBuffer = *batch.mTransferCommandBuffer;
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &transferCommandBuffer;
+		submitInfo.signalSemaphoreCount = (uint32_t)signalSemaphores.size();
+		submitInfo.pSignalSemaphores = signalSemaphores.data();
+		// only the staging ring submits to the transfer queue, and mMutex is held
+		ThrowIfFailed(vkQueueSubmit(mDevice->TransferQueue(), 1, &submitInfo, *batch.mTransferCommandBuffer->mSignalFence), "vkQueueSubmit failed");
+	}
+
+	// make the copies recorded on the graphics queue visible to everything submitted after this batch
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+	vkCmdPipelineBarrier(*batch.mCommandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+		0,
+		1, &barrier,
+		0, nullptr,
+		0, nullptr);
+	ThrowIfFailed(vkEndCommandBuffer(*batch.mCommandBuffer), "vkEndCommandBuffer failed");
+
+	// only waits on the transfer queue for the resources acquired in this batch, at the stages they're used at
+	VkCommandBuffer commandBuffer = *batch.mCommandBuffer;
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	submitInfo.waitSemaphoreCount = (uint32_t)waitSemaphores.size();
+	submitInfo.pWaitSemaphores = waitSemaphores.data();
+	submitInfo.pWaitDstStageMask = waitStages.data();
+	{
+		lock_guard lock(mDevice->mCommandPoolMutex);
+		ThrowIfFailed(vkQueueSubmit(mDevice->GraphicsQueue(), 1, &submitInfo, *batch.mCommandBuffer->mSignalFence), "vkQueueSubmit failed");
+	}
+	batch.mSubmitted = true;
+}
+
+void StagingRing::Retire(bool wait) {
+	while (mBatches.size() && mBatches.front().mSubmitted) {
+		Batch& b = mBatches.front();
+		// the graphics submission doesn't necessarily wait for the transfer submission
+		if (wait) {
+			b.mCommandBuffer->mSignalFence->Wait();
+			if (mAsync) b.mTransferCommandBuffer->mSignalFence->Wait();
+			wait = false;
+		} else if (!b.mCommandBuffer->mSignalFence->Signaled() || (mAsync && !b.mTransferCommandBuffer->mSignalFence->Signaled()))
+			break;
+
+		for (Buffer* o : b.mOverflowBuffers)
+			safe_delete(o);
+		mFreeCommandBuffers.push_back(b.mCommandBuffer);
+		if (mAsync) {
+			mFreeTransferCommandBuffers.push_back(b.mTransferCommandBuffer);
+			// semaphores that were waited on can be signaled again. Semaphores that were never waited on (their resource was acquired
+			// after this point, or destroyed) are destroyed with their last reference
+			if (b.mSemaphore) mFreeSemaphores.push_back(b.mSemaphore);
+			for (const shared_ptr<Semaphore>& s : b.mWaitSemaphores) mFreeSemaphores.push_back(s);
+		}
+		mCompletedToken = b.mToken;
+		mBatches.pop_front();
+	}
+}
+
+void StagingRing::Flush() {
+	lock_guard lock(mMutex);
+	FlushBatch();
+	Retire(false);
+}
+
+void StagingRing::Update() {
+	lock_guard lock(mMutex);
+	if (mBatches.size() && !mBatches.back().mSubmitted && (mClock.now() - mBatches.back().mOpened).count() * 1e-9f > mFlushInterval)
+		FlushBatch();
+	Retire(false);
+}
+
+bool StagingRing::Complete(uint64_t token) {
+	lock_guard lock(mMutex);
+	if (token <= mCompletedToken) return true;
+	Retire(false);
+	return token <= mCompletedToken;
+}
+
+void StagingRing::Wait(uint64_t token) {
+	lock_guard lock(mMutex);
+	if (token <= mCompletedToken) return;
+	if (mBatches.size() && !mBatches.back().mSubmitted && mBatches.back().mToken <= token)
+		FlushBatch();
+	while (token > mCompletedToken && mBatches.size())
+		Retire(true);
+}
\ No newline at end of file
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+
+#include <Util/Util.hpp>
+
+class Buffer;
+class CommandBuffer;
+class Device;
+class Semaphore;
+
+/// A persistently mapped upload ring. Uploads are copied into the ring and their transfer commands are recorded into a
+/// shared CommandBuffer, which is submitted once enough data is batched, once the batch is older than FlushInterval(),
+/// or before any other CommandBuffer is executed on the Device (so a frame always sees the uploads made before it).
+/// Each upload returns a token that can be polled with Complete() or waited on with Wait(). Token 0 is always complete.
+/// When the Device has a dedicated transfer queue, copies execute on it while the graphics queue keeps rendering. Resources written
+/// by a copy are released to the graphics queue with TransferOwnership(), and are acquired by the first Acquire() call, made wherever the
+/// resource is used (vertex and index buffer binds, descriptor writes, copies). Only the batch that acquires a resource waits on the
+/// transfer queue, at the stage the resource is used at, so frames that don't use new resources never wait on uploads.
+class StagingRing {
+public:
+	/// Called with a CommandBuffer of the current batch, and the buffer and offset that the upload's data was copied to
+	typedef std::function<void(CommandBuffer*, VkBuffer, VkDeviceSize)> RecordFunction;
+
+	ENGINE_EXPORT StagingRing(Device* device, VkDeviceSize size = 64 * 1024 * 1024);
+	ENGINE_EXPORT ~StagingRing();
+
+	/// Copies size bytes of data into the ring, then calls record with the batch's transfer CommandBuffer (which may only
+	/// record transfer commands, and should only write to newly created resources), then finish with the batch's graphics CommandBuffer.
+	/// data may be nullptr to only record commands into the current batch. The offset passed to record is a multiple of alignment.
+	ENGINE_EXPORT uint64_t Upload(const void* data, VkDeviceSize size, VkDeviceSize alignment, const RecordFunction& record, const RecordFunction& finish = nullptr);
+
+	/// Releases a buffer written by transfer commands to the graphics queue, which acquires it with Acquire(). Must be called from a RecordFunction.
+	ENGINE_EXPORT void TransferOwnership(VkBuffer buffer);
+	/// Releases an image written by transfer commands to the graphics queue. barrier describes the layout transition and accesses the graphics
+	/// queue needs. If dstStage isn't 0, the batch's graphics CommandBuffer acquires the image before dstStage (for finish functions that use it),
+	/// otherwise the image is acquired with Acquire(). Must be called from a RecordFunction. Returns false if the ring isn't async, in which
+	/// case nothing is recorded and the caller records barrier itself.
+	ENGINE_EXPORT bool TransferOwnership(VkImageMemoryBarrier barrier, VkPipelineStageFlags dstStage = 0);
+	/// Acquires a buffer or image released by TransferOwnership() on the graphics queue, before it's used at dstStage with dstAccess.
+	/// Does nothing if the resource isn't waiting to be acquired, so it can be called every time a resource is used.
+	ENGINE_EXPORT void Acquire(uint64_t handle, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess);
+	/// True if a resource was released by TransferOwnership() and hasn't been acquired yet
+	ENGINE_EXPORT bool Pending(uint64_t handle);
+	/// Forgets the pending acquire of a resource that is being destroyed
+	ENGINE_EXPORT void Discard(uint64_t handle);
+	/// True when copies execute on a different queue family than rendering
+	inline bool Async() const { return mAsync; }
+
+	/// Submits the current batch, if it has any commands
+	ENGINE_EXPORT void Flush();
+	/// Flushes the current batch if it is older than FlushInterval() and recycles batches that have finished
+	ENGINE_EXPORT void Update();
+
+	ENGINE_EXPORT bool Complete(uint64_t token);
+	/// Flushes the batch the token belongs to (if necessary) and blocks until the GPU has executed it
+	ENGINE_EXPORT void Wait(uint64_t token);
+
+	inline VkDeviceSize Size() const { return mSize; }
+	inline VkDeviceSize FlushSize() const { return mFlushSize; }
+	inline void FlushSize(VkDeviceSize s) { mFlushSize = s; }
+	inline float FlushInterval() const { return mFlushInterval; }
+	inline void FlushInterval(float s) { mFlushInterval = s; }
+
+private:
+	struct Batch {
+		uint64_t mToken;
+		// the same CommandBuffer unless the ring is async
+		std::shared_ptr<CommandBuffer> mTransferCommandBuffer;
+		std::shared_ptr<CommandBuffer> mCommandBuffer;
+		// signaled by the transfer submission and waited on by the graphics submission at mSemaphoreStage, when the
+		// graphics CommandBuffer uses images that it released. nullptr otherwise
+		std::shared_ptr<Semaphore> mSemaphore;
+		VkPipelineStageFlags mSemaphoreStage;
+		// signaled by the transfer submission, one for each resource waiting for Acquire()
+		std::vector<std::shared_ptr<Semaphore>> mSignalSemaphores;
+		// waited on by the graphics submission, for each resource acquired in this batch
+		std::vector<std::shared_ptr<Semaphore>> mWaitSemaphores;
+		std::vector<VkPipelineStageFlags> mWaitStages;
+		bool mSubmitted;
+		// offset of the first byte used by this batch, or -1 if the batch hasn't used the ring
+		VkDeviceSize mBegin;
+		VkDeviceSize mBytes;
+		// staging buffers for uploads that don't fit in the ring
+		std::vector<Buffer*> mOverflowBuffers;
+		std::chrono::high_resolution_clock::time_point mOpened;
+	};
+
+	struct PendingAcquire {
+		// the batch that released the resource
+		uint64_t mToken;
+		// signaled when the batch's transfer commands are done
+		std::shared_ptr<Semaphore> mSemaphore;
+		bool mImage;
+		VkBufferMemoryBarrier mBufferBarrier;
+		VkImageMemoryBarrier mImageBarrier;
+	};
+
+	Device* mDevice;
+	Buffer* mBuffer;
+	VkDeviceSize mSize;
+	VkDeviceSize mHead;
+
+	VkDeviceSize mFlushSize;
+	float mFlushInterval;
+
+	bool mAsync;
+	VkCommandPool mCommandPool;
+	VkCommandPool mTransferCommandPool;
+	std::vector<std::shared_ptr<CommandBuffer>> mFreeCommandBuffers;
+	std::vector<std::shared_ptr<CommandBuffer>> mFreeTransferCommandBuffers;
+	std::vector<std::shared_ptr<Semaphore>> mFreeSemaphores;
+
+	// in submission order, the last batch may still be recording
+	std::deque<Batch> mBatches;
+	uint64_t mNextToken;
+	uint64_t mCompletedToken;
+
+	// handle -> acquire barrier of resources released to the graphics queue, guarded by mAcquireMutex (taken after mMutex)
+	std::unordered_map<uint64_t, PendingAcquire> mPendingAcquires;
+	// checked without a lock, so that Acquire() is free when nothing is pending
+	std::atomic<uint32_t> mPendingAcquireCount;
+
+	std::chrono::high_resolution_clock mClock;
+	std::mutex mMutex;
+	std::mutex mAcquireMutex;
+
+	ENGINE_EXPORT std::shared_ptr<CommandBuffer> BeginCommandBuffer(VkCommandPool pool, std::vector<std::shared_ptr<CommandBuffer>>& freeList, const std::string& name);
+	ENGINE_EXPORT Batch& CurrentBatch();
+	ENGINE_EXPORT std::shared_ptr<Semaphore> GetSemaphore();
+	ENGINE_EXPORT bool Reserve(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+	ENGINE_EXPORT void FlushBatch();
+	ENGINE_EXPORT void Retire(bool wait);
+};
\ No newline at end of file
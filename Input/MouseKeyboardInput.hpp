@@ -259,6 +259,7 @@ public:
 	ENGINE_EXPORT void NextFrame() override;
 
 private:
+	friend class Benchmark;
 	friend class GUI;
 	friend class Window;
 	friend class Instance;
@@ -9,7 +9,7 @@ ENGINE_PLUGIN(CameraControl)
 
 CameraControl::CameraControl()
 	: mScene(nullptr), mCameraPivot(nullptr), mInput(nullptr), mCameraDistance(1.5f), mCameraEuler(float3(0)),
-	mSnapshotPerformance(false), mShowPerformance(false), mSelectedFrame(PROFILER_FRAME_COUNT) {
+	mSnapshotPerformance(false), mShowPerformance(false), mSelectedFrame(PROFILER_FRAME_COUNT), mShowMemory(false) {
 	mEnabled = true;
 	memset(mProfilerFrames, 0, sizeof(ProfilerSample) * (PROFILER_FRAME_COUNT - 1));
 }
@@ -45,6 +45,10 @@ void CameraControl::Update(CommandBuffer* commandBuffer) {
 		mScene->DrawGizmos(!mScene->DrawGizmos());
 	if (mInput->KeyDownFirst(KEY_TILDE))
 		mShowPerformance = !mShowPerformance;
+	if (mInput->KeyDownFirst(KEY_F4))
+		mShowMemory = !mShowMemory;
+	if (mInput->KeyDownFirst(KEY_F5) && mScene->Instance()->Device()->WriteMemoryStats("MemoryStats.json"))
+		printf_color(COLOR_YELLOW, "Wrote MemoryStats.json\n");
 
 	// Snapshot profiler frames
 	if (mInput->KeyDownFirst(KEY_F3)) {
@@ -200,7 +204,51 @@ void CameraControl::PreRenderScene(CommandBuffer* commandBuffer, Camera* camera,
 		}
 		#endif
 
-		snprintf(tmpText, 64, "%.2fms\n%d DescriptorSets", mScene->FPS(), commandBuffer->Device()->DescriptorSetCount());
+		snprintf(tmpText, 64, "%.2fms\n%d DescriptorSets (%d cached)", mScene->FPS(), commandBuffer->Device()->DescriptorSetCount(), commandBuffer->Device()->CachedDescriptorSetCount());
 		GUI::DrawString(sem16, tmpText, 1.f, float2(5, camera->FramebufferHeight() - 30), 18.f);
 	}
+
+	if (mShowMemory) {
+		Font* reg14 = mScene->AssetManager()->LoadFont("Assets/Fonts/OpenSans-Regular.ttf", 14);
+		Font* sem16 = mScene->AssetManager()->LoadFont("Assets/Fonts/OpenSans-SemiBold.ttf", 16);
+
+		Device* device = commandBuffer->Device();
+		DeviceMemoryStats stats = device->GetMemoryStats();
+
+		vector<pair<string, MemoryUsageStats>> tags(stats.mTags.begin(), stats.mTags.end());
+		sort(tags.begin(), tags.end(), [](const auto& a, const auto& b) { return a.second.mUsed > b.second.mUsed; });
+		if (tags.size() > 16) tags.resize(16);
+
+		const float lineHeight = 16;
+		float w = 560;
+		float h = lineHeight * (stats.mHeaps.size() + tags.size() + 4) + 14;
+		float2 p(camera->FramebufferWidth() - w - 5, camera->FramebufferHeight() - 5);
+		GUI::Rect(fRect2D(p.x, p.y - h, w, h), float4(.1f, .1f, .1f, .8f));
+		p.x += 5;
+
+		char tmpText[128];
+		p.y -= lineHeight + 2;
+		GUI::DrawString(sem16, "Heaps (used / reserved / peak, largest free)", 1.f, p, 16.f);
+		for (uint32_t i = 0; i < stats.mHeaps.size(); i++) {
+			const MemoryUsageStats& heap = stats.mHeaps[i];
+			p.y -= lineHeight;
+			snprintf(tmpText, 128, "%u: %.1f / %.1f / %.1f MiB, %.1f MiB free block, %u blocks (%.0f MiB heap)", i,
+				heap.mUsed / (1024.f * 1024.f), heap.mReserved / (1024.f * 1024.f), heap.mPeakReserved / (1024.f * 1024.f),
+				heap.mLargestFreeBlock / (1024.f * 1024.f), heap.mBlockCount, device->MemoryHeapSize(i) / (1024.f * 1024.f));
+			GUI::DrawString(reg14, tmpText, float4(.8f, .8f, .8f, 1.f), p, 14.f);
+		}
+
+		p.y -= lineHeight + 4;
+		snprintf(tmpText, 128, "Aliased attachments: %.1f MiB per frame context, %.1f MiB saved over %u frames in flight",
+			stats.mAliasedPerFrameContext / (1024.f * 1024.f), stats.mAliasedPerFrameContext * (device->MaxFramesInFlight() - 1) / (1024.f * 1024.f), device->MaxFramesInFlight());
+		GUI::DrawString(reg14, tmpText, float4(.8f, .8f, .8f, 1.f), p, 14.f);
+
+		p.y -= lineHeight + 4;
+		GUI::DrawString(sem16, "Tags (used / peak)", 1.f, p, 16.f);
+		for (const auto& t : tags) {
+			p.y -= lineHeight;
+			snprintf(tmpText, 128, "%.40s: %.2f / %.2f MiB (%u)", t.first.c_str(), t.second.mUsed / (1024.f * 1024.f), t.second.mPeakUsed / (1024.f * 1024.f), t.second.mAllocationCount);
+			GUI::DrawString(reg14, tmpText, float4(.8f, .8f, .8f, 1.f), p, 14.f);
+		}
+	}
 }
\ No newline at end of file
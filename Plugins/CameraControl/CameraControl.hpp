@@ -21,6 +21,8 @@ private:
 	ProfilerSample mProfilerFrames[PROFILER_FRAME_COUNT - 1];
 	uint32_t mSelectedFrame;
 
+	bool mShowMemory;
+
 public:
 	PLUGIN_EXPORT CameraControl();
 	PLUGIN_EXPORT ~CameraControl();
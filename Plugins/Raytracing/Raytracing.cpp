@@ -94,6 +94,9 @@ private:
 		unordered_map<Mesh*, uint2> triangleRanges;
 		unordered_map<Buffer*, vector<VkBufferCopy>> vertexCopies;
 
+		// the tracer reads StdVertex buffers, quantized meshes are skipped
+		auto Traced = [](MeshRenderer* mr) { return mr && mr->Visible() && mr->Mesh()->VertexInput() == &StdVertex::VertexInput; };
+
 		PROFILER_BEGIN("Copy meshes");
 		// Copy mesh BVHs
 		for (uint32_t sni = 0; sni < sceneBvh->Nodes().size(); sni++){
@@ -101,9 +104,11 @@ private:
 			if (sn.mRightOffset == 0) {
 				for (uint32_t i = 0; i < sn.mCount; i++) {
 					MeshRenderer* mr = dynamic_cast<MeshRenderer*>(sceneBvh->GetObject(sn.mStartIndex + i));
-					if (mr && mr->Visible()) {
+					if (Traced(mr)) {
 						leafNodes.push_back({});
 						Mesh* m = mr->Mesh();
+						// the mesh's BVH and vertices are copied below, so it can't be evicted this frame
+						m->MarkUsed(commandBuffer->Device()->Instance()->FrameCount());
 
 						if (!fd.mMeshes.count(m)) {
 							fd.mMeshes.emplace(m, nodeBaseIndex);
@@ -165,7 +170,7 @@ private:
 			if (n.mRightOffset == 0) {
 				for (uint32_t i = 0; i < n.mCount; i++) {
 					MeshRenderer* mr = dynamic_cast<MeshRenderer*>(sceneBvh->GetObject(n.mStartIndex + i));
-					if (mr && mr->Visible()) {
+					if (Traced(mr)) {
 						leafNodes[leafNodeIndex].NodeToWorld = mr->ObjectToWorld();
 						leafNodes[leafNodeIndex].WorldToNode = mr->WorldToObject();
 						leafNodes[leafNodeIndex].RootIndex = fd.mMeshes.at(mr->Mesh());
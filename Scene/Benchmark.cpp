@@ -0,0 +1,209 @@
+#include <Scene/Benchmark.hpp>
+#include <Scene/Scene.hpp>
+#include <Core/CommandBuffer.hpp>
+#include <Input/MouseKeyboardInput.hpp>
+#include <Util/Profiler.hpp>
+
+using namespace std;
+
+#define BENCHMARK_MAGIC 0x4D424E53 // "SNBM"
+#define BENCHMARK_VERSION 1
+
+Benchmark::Benchmark(Scene* scene) : mScene(scene), mMode(BENCHMARK_NONE), mFixedTimeStep(0), mFrame({}) {
+	const vector<string>& args = mScene->Instance()->CommandLineArguments();
+	for (uint32_t i = 0; i < args.size(); i++) {
+		if (args[i] == "--record" && i + 1 < args.size()) {
+			mMode = BENCHMARK_RECORD;
+			mPath = args[++i];
+		} else if (args[i] == "--benchmark" && i + 1 < args.size()) {
+			mMode = BENCHMARK_REPLAY;
+			mPath = args[++i];
+		} else if (args[i] == "--timestep" && i + 1 < args.size())
+			mFixedTimeStep = (float)atof(args[++i].c_str());
+	}
+
+	uint32_t magic = BENCHMARK_MAGIC;
+	uint32_t version = BENCHMARK_VERSION;
+	switch (mMode) {
+	case BENCHMARK_RECORD:
+		mOutput.open(mPath, ios::binary);
+		if (!mOutput.is_open()) {
+			fprintf_color(COLOR_RED, stderr, "Failed to open %s for recording\n", mPath.c_str());
+			mMode = BENCHMARK_NONE;
+			break;
+		}
+		mOutput.write(reinterpret_cast<const char*>(&magic), sizeof(uint32_t));
+		mOutput.write(reinterpret_cast<const char*>(&version), sizeof(uint32_t));
+		printf_color(COLOR_YELLOW, "Recording session to %s\n", mPath.c_str());
+		break;
+
+	case BENCHMARK_REPLAY:
+		mInput.open(mPath, ios::binary);
+		if (mInput.is_open()) {
+			mInput.read(reinterpret_cast<char*>(&magic), sizeof(uint32_t));
+			mInput.read(reinterpret_cast<char*>(&version), sizeof(uint32_t));
+		}
+		if (!mInput.is_open() || magic != BENCHMARK_MAGIC || version != BENCHMARK_VERSION) {
+			fprintf_color(COLOR_RED, stderr, "Failed to read benchmark %s\n", mPath.c_str());
+			mMode = BENCHMARK_NONE;
+			break;
+		}
+		printf_color(COLOR_YELLOW, "Replaying benchmark %s\n", mPath.c_str());
+		break;
+
+	default:
+		break;
+	}
+}
+Benchmark::~Benchmark() {
+	if (mMode == BENCHMARK_REPLAY) PrintReport();
+	if (mOutput.is_open()) mOutput.close();
+	if (mInput.is_open()) mInput.close();
+}
+
+void Benchmark::RecordEvent(uint32_t id, const void* data, uint32_t size) {
+	if (mMode != BENCHMARK_RECORD) return;
+	BenchmarkEvent e = {};
+	e.mId = id;
+	e.mData.resize(size);
+	if (size) memcpy(e.mData.data(), data, size);
+	mFrame.mEvents.push_back(e);
+}
+
+bool Benchmark::ReadFrame() {
+	mFrame.mKeys.clear();
+	mFrame.mEvents.clear();
+
+	mInput.read(reinterpret_cast<char*>(&mFrame.mDeltaTime), sizeof(float));
+	if (mInput.eof()) return false;
+	mInput.read(reinterpret_cast<char*>(&mFrame.mCursorPos), sizeof(float2));
+	mInput.read(reinterpret_cast<char*>(&mFrame.mCursorDelta), sizeof(float2));
+	mInput.read(reinterpret_cast<char*>(&mFrame.mScrollDelta), sizeof(float));
+
+	uint32_t c;
+	mInput.read(reinterpret_cast<char*>(&c), sizeof(uint32_t));
+	mFrame.mKeys.resize(c);
+	mInput.read(reinterpret_cast<char*>(mFrame.mKeys.data()), c * sizeof(uint32_t));
+
+	mInput.read(reinterpret_cast<char*>(&c), sizeof(uint32_t));
+	mFrame.mEvents.resize(c);
+	for (BenchmarkEvent& e : mFrame.mEvents) {
+		uint32_t size;
+		mInput.read(reinterpret_cast<char*>(&e.mId), sizeof(uint32_t));
+		mInput.read(reinterpret_cast<char*>(&size), sizeof(uint32_t));
+		e.mData.resize(size);
+		mInput.read(reinterpret_cast<char*>(e.mData.data()), size);
+	}
+	return mInput.good();
+}
+void Benchmark::WriteFrame() {
+	mOutput.write(reinterpret_cast<const char*>(&mFrame.mDeltaTime), sizeof(float));
+	mOutput.write(reinterpret_cast<const char*>(&mFrame.mCursorPos), sizeof(float2));
+	mOutput.write(reinterpret_cast<const char*>(&mFrame.mCursorDelta), sizeof(float2));
+	mOutput.write(reinterpret_cast<const char*>(&mFrame.mScrollDelta), sizeof(float));
+
+	uint32_t c = (uint32_t)mFrame.mKeys.size();
+	mOutput.write(reinterpret_cast<const char*>(&c), sizeof(uint32_t));
+	mOutput.write(reinterpret_cast<const char*>(mFrame.mKeys.data()), c * sizeof(uint32_t));
+
+	c = (uint32_t)mFrame.mEvents.size();
+	mOutput.write(reinterpret_cast<const char*>(&c), sizeof(uint32_t));
+	for (const BenchmarkEvent& e : mFrame.mEvents) {
+		uint32_t size = (uint32_t)e.mData.size();
+		mOutput.write(reinterpret_cast<const char*>(&e.mId), sizeof(uint32_t));
+		mOutput.write(reinterpret_cast<const char*>(&size), sizeof(uint32_t));
+		mOutput.write(reinterpret_cast<const char*>(e.mData.data()), size);
+	}
+
+	mFrame.mKeys.clear();
+	mFrame.mEvents.clear();
+}
+
+bool Benchmark::BeginFrame() {
+	if (mStats.empty()) mFrameStart = mClock.now();
+	if (mMode == BENCHMARK_NONE) return true;
+
+	MouseKeyboardInput* input = mScene->InputManager()->GetFirst<MouseKeyboardInput>();
+
+	if (mMode == BENCHMARK_RECORD) {
+		if (!input) return true;
+		mFrame.mCursorPos = input->mCurrent.mCursorPos;
+		mFrame.mCursorDelta = input->mCurrent.mCursorDelta;
+		mFrame.mScrollDelta = input->mCurrent.mScrollDelta;
+		for (const auto& kp : input->mCurrent.mKeys)
+			if (kp.second) mFrame.mKeys.push_back((uint32_t)kp.first);
+		return true;
+	}
+
+	if (!ReadFrame()) return false;
+	if (input) {
+		input->mCurrent.mCursorPos = mFrame.mCursorPos;
+		input->mCurrent.mCursorDelta = mFrame.mCursorDelta;
+		input->mCurrent.mScrollDelta = mFrame.mScrollDelta;
+		input->mCurrent.mKeys.clear();
+		for (uint32_t k : mFrame.mKeys)
+			input->mCurrent.mKeys[(KeyCode)k] = true;
+	}
+	return true;
+}
+
+void Benchmark::DeltaTime(float deltaTime) {
+	if (mMode == BENCHMARK_RECORD) mFrame.mDeltaTime = deltaTime;
+}
+
+void Benchmark::EndFrame(CommandBuffer* commandBuffer) {
+	if (mMode == BENCHMARK_RECORD) {
+		WriteFrame();
+		return;
+	}
+	if (mMode != BENCHMARK_REPLAY) return;
+
+	auto t = mClock.now();
+	FrameStats s = {};
+	s.mFrameTime = (t - mFrameStart).count() * 1e-6f;
+	s.mTriangleCount = commandBuffer->mTriangleCount;
+	mStats.push_back(s);
+	mFrameStart = t;
+
+	#ifdef PROFILER_ENABLE
+	// the profiler frame hasn't ended yet, so the current sample is the root of this frame
+	const ProfilerSample* frame = &Profiler::Frames()[(Profiler::CurrentFrameIndex() + 1) % PROFILER_FRAME_COUNT];
+	for (const ProfilerSample& pass : frame->mChildren) {
+		auto& p = mPassTimes[pass.mLabel];
+		p.first += pass.mDuration.count() * 1e-6;
+		p.second++;
+		for (const ProfilerSample& child : pass.mChildren) {
+			auto& c = mPassTimes[string(pass.mLabel) + "/" + child.mLabel];
+			c.first += child.mDuration.count() * 1e-6;
+			c.second++;
+		}
+	}
+	#endif
+}
+
+void Benchmark::PrintReport() {
+	if (mStats.empty()) return;
+
+	vector<float> times(mStats.size());
+	double total = 0;
+	size_t triangles = 0;
+	size_t maxTriangles = 0;
+	for (uint32_t i = 0; i < mStats.size(); i++) {
+		times[i] = mStats[i].mFrameTime;
+		total += times[i];
+		triangles += mStats[i].mTriangleCount;
+		maxTriangles = max(maxTriangles, mStats[i].mTriangleCount);
+	}
+	sort(times.begin(), times.end());
+	auto percentile = [&](float p) { return times[min((size_t)(p * times.size()), times.size() - 1)]; };
+
+	printf_color(COLOR_YELLOW, "Benchmark %s: %u frames\n", mPath.c_str(), (uint32_t)mStats.size());
+	printf("\tFrame time (ms): avg %.3f  min %.3f  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+		total / times.size(), times.front(), percentile(.5f), percentile(.9f), percentile(.99f), times.back());
+	printf("\tTriangles: avg %llu  max %llu\n", (unsigned long long)(triangles / mStats.size()), (unsigned long long)maxTriangles);
+
+	vector<pair<string, pair<double, uint32_t>>> passes(mPassTimes.begin(), mPassTimes.end());
+	sort(passes.begin(), passes.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+	for (const auto& p : passes)
+		printf("\t%-48s %.3f ms\n", p.first.c_str(), p.second.first / p.second.second);
+}
\ No newline at end of file
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <fstream>
+#include <Util/Util.hpp>
+
+class CommandBuffer;
+class MouseKeyboardInput;
+class Scene;
+
+enum BenchmarkMode {
+	BENCHMARK_NONE = 0,
+	BENCHMARK_RECORD = 1,
+	BENCHMARK_REPLAY = 2
+};
+
+/// An event recorded into (or replayed from) a benchmark log. Plugins use these to capture anything that affects the
+/// simulation but doesn't come from an InputDevice (i.e. network messages, UI state)
+struct BenchmarkEvent {
+	uint32_t mId;
+	std::vector<uint8_t> mData;
+};
+
+/// Records a session (input state, delta time and plugin events) to a binary log, or replays a log with a deterministic
+/// time step and reports frame time percentiles, triangle counts and per-pass timings.
+/// Enabled with --record <file> or --benchmark <file> [--timestep <seconds>]
+class Benchmark {
+public:
+	ENGINE_EXPORT Benchmark(Scene* scene);
+	ENGINE_EXPORT ~Benchmark();
+
+	inline BenchmarkMode Mode() const { return mMode; }
+	inline bool Recording() const { return mMode == BENCHMARK_RECORD; }
+	inline bool Replaying() const { return mMode == BENCHMARK_REPLAY; }
+
+	/// Records an event into the current frame. Does nothing unless recording.
+	ENGINE_EXPORT void RecordEvent(uint32_t id, const void* data, uint32_t size);
+	/// Events recorded during the frame currently being replayed
+	inline const std::vector<BenchmarkEvent>& Events() const { return mFrame.mEvents; }
+
+	/// The delta time the scene should use this frame, when replaying
+	inline float DeltaTime() const { return mFixedTimeStep > 0 ? mFixedTimeStep : mFrame.mDeltaTime; }
+
+private:
+	friend class Scene;
+	friend class Stratum;
+
+	struct Frame {
+		float mDeltaTime;
+		float2 mCursorPos;
+		float2 mCursorDelta;
+		float mScrollDelta;
+		std::vector<uint32_t> mKeys;
+		std::vector<BenchmarkEvent> mEvents;
+	};
+	struct FrameStats {
+		float mFrameTime;
+		size_t mTriangleCount;
+	};
+
+	/// Called after input devices have polled events. Overwrites the input state when replaying.
+	/// Returns false when the replay has finished.
+	ENGINE_EXPORT bool BeginFrame();
+	/// Called after the scene's delta time has been computed
+	ENGINE_EXPORT void DeltaTime(float deltaTime);
+	/// Called after the frame's CommandBuffer has been executed
+	ENGINE_EXPORT void EndFrame(CommandBuffer* commandBuffer);
+
+	ENGINE_EXPORT bool ReadFrame();
+	ENGINE_EXPORT void WriteFrame();
+	ENGINE_EXPORT void PrintReport();
+
+	Scene* mScene;
+	BenchmarkMode mMode;
+	std::string mPath;
+	std::ifstream mInput;
+	std::ofstream mOutput;
+
+	float mFixedTimeStep;
+	Frame mFrame;
+
+	std::chrono::high_resolution_clock mClock;
+	std::chrono::high_resolution_clock::time_point mFrameStart;
+	std::vector<FrameStats> mStats;
+	// label -> (total time, sample count)
+	std::unordered_map<std::string, std::pair<double, uint32_t>> mPassTimes;
+};
\ No newline at end of file
@@ -62,7 +62,7 @@ Camera::Camera(const string& name, ::Device* device, VkFormat renderFormat, VkFo
 	mRenderPriority(100), mStereoMode(STEREO_NONE) {
 
 	vector<VkFormat> colorFormats{ renderFormat, VK_FORMAT_R16G16B16A16_SFLOAT };
-	mFramebuffer = new ::Framebuffer(name, mDevice, 1600, 900, colorFormats, depthFormat, sampleCount, {}, VK_ATTACHMENT_LOAD_OP_CLEAR);
+	mFramebuffer = new ::Framebuffer(name, mDevice, 1600, 900, colorFormats, depthFormat, sampleCount, {}, VK_ATTACHMENT_LOAD_OP_CLEAR, sampleCount != VK_SAMPLE_COUNT_1_BIT);
 
 	mResolveBuffers = new vector<Texture*>[mDevice->MaxFramesInFlight()];
 	memset(mResolveBuffers, 0, sizeof(Texture*) * mDevice->MaxFramesInFlight());
@@ -83,7 +83,7 @@ Camera::Camera(const string& name, Window* targetWindow, VkFormat depthFormat, V
 	VkFormat fmt = targetWindow->Format().format;
 
 	vector<VkFormat> colorFormats{ fmt, VK_FORMAT_R16G16B16A16_SFLOAT };
-	mFramebuffer = new ::Framebuffer(name, mDevice, targetWindow->ClientRect().extent.width, targetWindow->ClientRect().extent.height, colorFormats, depthFormat, sampleCount, {}, VK_ATTACHMENT_LOAD_OP_CLEAR);
+	mFramebuffer = new ::Framebuffer(name, mDevice, targetWindow->ClientRect().extent.width, targetWindow->ClientRect().extent.height, colorFormats, depthFormat, sampleCount, {}, VK_ATTACHMENT_LOAD_OP_CLEAR, sampleCount != VK_SAMPLE_COUNT_1_BIT);
 	
 	VkClearValue c = {};
 	c.color.float32[0] = 1.f;
@@ -227,7 +227,7 @@ void Camera::Set(CommandBuffer* commandBuffer) {
 void Camera::SetStereo(CommandBuffer* commandBuffer, ShaderVariant* shader, StereoEye eye) {
 	if (!shader) return;
 	uint32_t eyec = eye;
-	commandBuffer->PushConstant(shader, "StereoEye", &eyec);
+	commandBuffer->PushConstant(shader, SHADER_NAME_ID("StereoEye"), &eyec);
 
 	float4 clipst(1, 1, 0, 0);
 	VkRect2D scissor{ { 0, 0 }, { mFramebuffer->Width(), mFramebuffer->Height() } };
@@ -241,7 +241,7 @@ void Camera::SetStereo(CommandBuffer* commandBuffer, ShaderVariant* shader, Ster
 		scissor.offset.y = eye == EYE_LEFT ? 0 : scissor.extent.height;
 	}
 
-	commandBuffer->PushConstant(shader, "StereoClipTransform", &clipst);
+	commandBuffer->PushConstant(shader, SHADER_NAME_ID("StereoClipTransform"), &clipst);
 
 	vkCmdSetScissor(*commandBuffer, 0, 1, &scissor);
 }
@@ -17,6 +17,11 @@ ClothRenderer::ClothRenderer(const string& name)
 ClothRenderer::~ClothRenderer() { safe_delete(mVertexBuffer); safe_delete(mVelocityBuffer); safe_delete(mForceBuffer); safe_delete(mEdgeBuffer); }
 
 void ClothRenderer::Mesh(::Mesh* m) {
+	// the simulation reads and writes StdVertex buffers
+	if (m && m->VertexInput() != &StdVertex::VertexInput) {
+		fprintf_color(COLOR_RED, stderr, "%s: cloth meshes must have StdVertex vertices, %s doesn't\n", mName.c_str(), m->mName.c_str());
+		return;
+	}
 	mMesh = m;
 	Dirty();
 
@@ -27,7 +32,7 @@ void ClothRenderer::Mesh(::Mesh* m) {
 	if (m) {
 		uint32_t x = m->VertexCount()-1;
 
-		mVertexBuffer = new Buffer(mName + "Vertices", m->VertexBuffer()->Device(), m->VertexBuffer()->Size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		mVertexBuffer = new Buffer(mName + "Vertices", m->VertexBuffer()->Device(), m->VertexSize() * m->VertexCount(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 		mVelocityBuffer = new Buffer(mName + "Velocities", m->VertexBuffer()->Device(), m->VertexCount() * sizeof(float4), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 		mForceBuffer = new Buffer(mName + "Forces", m->VertexBuffer()->Device(), sizeof(float4) * m->VertexCount(), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 		mEdgeBuffer = new Buffer(mName + "Edges", m->VertexBuffer()->Device(), (((x+x)*(x+x+1)/2+x)+31)/32, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
@@ -35,6 +40,11 @@ void ClothRenderer::Mesh(::Mesh* m) {
 	}
 }
 void ClothRenderer::Mesh(std::shared_ptr<::Mesh> m) {
+	// the simulation reads and writes StdVertex buffers
+	if (m && m->VertexInput() != &StdVertex::VertexInput) {
+		fprintf_color(COLOR_RED, stderr, "%s: cloth meshes must have StdVertex vertices, %s doesn't\n", mName.c_str(), m->mName.c_str());
+		return;
+	}
 	mMesh = m;
 	Dirty();
 
@@ -45,7 +55,7 @@ void ClothRenderer::Mesh(std::shared_ptr<::Mesh> m) {
 	if (m) {
 		uint32_t x = m->VertexCount()-1;
 
-		mVertexBuffer = new Buffer(mName + "Vertices", m->VertexBuffer()->Device(), m->VertexBuffer()->Size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		mVertexBuffer = new Buffer(mName + "Vertices", m->VertexBuffer()->Device(), m->VertexSize() * m->VertexCount(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 		mVelocityBuffer = new Buffer(mName + "Velocities", m->VertexBuffer()->Device(), m->VertexCount() * sizeof(float4), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 		mForceBuffer = new Buffer(mName + "Forces", m->VertexBuffer()->Device(), sizeof(float4) * m->VertexCount(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 		mEdgeBuffer = new Buffer(mName + "Edges", m->VertexBuffer()->Device(), (((x+x)*(x+x+1)/2+x)+31)/32, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
@@ -239,19 +249,17 @@ void ClothRenderer::DrawInstanced(CommandBuffer* commandBuffer, Camera* camera,
 	VkCullModeFlags cull = (pass == PASS_DEPTH) ? VK_CULL_MODE_NONE : VK_CULL_MODE_FLAG_BITS_MAX_ENUM;
 	VkPipelineLayout layout = commandBuffer->BindMaterial(mMaterial.get(), pass, mesh->VertexInput(), camera, mesh->Topology(), cull);
 	if (!layout) return;
-	auto shader = mMaterial->GetShader(pass);
+	auto shader = mMaterial->GetShader(pass, mesh->VertexInput());
 
-	for (const auto& kp : mPushConstants)
-		commandBuffer->PushConstant(shader, kp.first, &kp.second);
+	PushConstants(commandBuffer, shader);
 
 	uint32_t lc = (uint32_t)Scene()->ActiveLights().size();
 	float2 s = Scene()->ShadowTexelSize();
 	float t = Scene()->TotalTime();
-	commandBuffer->PushConstant(shader, "Time", &t);
-	commandBuffer->PushConstant(shader, "LightCount", &lc);
-	commandBuffer->PushConstant(shader, "ShadowTexelSize", &s);
-	for (const auto& kp : mPushConstants)
-		commandBuffer->PushConstant(shader, kp.first, &kp.second);
+	commandBuffer->PushConstant(shader, SHADER_NAME_ID("Time"), &t);
+	commandBuffer->PushConstant(shader, SHADER_NAME_ID("LightCount"), &lc);
+	commandBuffer->PushConstant(shader, SHADER_NAME_ID("ShadowTexelSize"), &s);
+	PushConstants(commandBuffer, shader);
 
 	if (instanceDS != VK_NULL_HANDLE)
 		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, &instanceDS, 0, nullptr);
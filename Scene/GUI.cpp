@@ -126,7 +126,7 @@ void GUI::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 		VkPipelineLayout layout = commandBuffer->BindShader(shader, PASS_MAIN, nullptr);
 		if (!layout) return;
 		float2 s(camera->FramebufferWidth(), camera->FramebufferHeight());
-		commandBuffer->PushConstant(shader, "ScreenSize", &s);
+		commandBuffer->PushConstant(shader, SHADER_NAME_ID("ScreenSize"), &s);
 
 		Buffer* transforms = commandBuffer->Device()->GetTempBuffer("Transforms", sizeof(float4x4) * mWorldStrings.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 		float4x4* m = (float4x4*)transforms->MappedData();
@@ -174,10 +174,10 @@ void GUI::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 			descriptorSet->CreateStorageBufferDescriptor(glyphBuffer, 0, glyphBuffer->Size(), BINDING_START + 2);
 			descriptorSet->FlushWrites();
 			vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, *descriptorSet, 0, nullptr);
-			commandBuffer->PushConstant(shader, "Color", &s.mColor);
-			commandBuffer->PushConstant(shader, "Offset", &s.mOffset);
-			commandBuffer->PushConstant(shader, "Bounds", &s.mBounds);
-			commandBuffer->PushConstant(shader, "Depth", &s.mDepth);
+			commandBuffer->PushConstant(shader, SHADER_NAME_ID("Color"), &s.mColor);
+			commandBuffer->PushConstant(shader, SHADER_NAME_ID("Offset"), &s.mOffset);
+			commandBuffer->PushConstant(shader, SHADER_NAME_ID("Bounds"), &s.mBounds);
+			commandBuffer->PushConstant(shader, SHADER_NAME_ID("Depth"), &s.mDepth);
 			vkCmdDraw(*commandBuffer, (glyphBuffer->Size() / sizeof(TextGlyph)) * 6, 1, 0, idx);
 
 			idx++;
@@ -201,7 +201,7 @@ void GUI::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, *ds, 0, nullptr);
 
 		float2 s(camera->FramebufferWidth(), camera->FramebufferHeight());
-		commandBuffer->PushConstant(shader, "ScreenSize", &s);
+		commandBuffer->PushConstant(shader, SHADER_NAME_ID("ScreenSize"), &s);
 
 		vkCmdDraw(*commandBuffer, 6, (uint32_t)mScreenRects.size(), 0, 0);
 	}
@@ -229,7 +229,7 @@ void GUI::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 		VkPipelineLayout layout = commandBuffer->BindShader(shader, PASS_MAIN, nullptr);
 		if (!layout) return;
 		float2 s(camera->FramebufferWidth(), camera->FramebufferHeight());
-		commandBuffer->PushConstant(shader, "ScreenSize", &s);
+		commandBuffer->PushConstant(shader, SHADER_NAME_ID("ScreenSize"), &s);
 
 		for (const GuiString& s : mScreenStrings) {
 			Buffer* glyphBuffer = nullptr;
@@ -268,10 +268,10 @@ void GUI::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 			descriptorSet->FlushWrites();
 			vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, *descriptorSet, 0, nullptr);
 
-			commandBuffer->PushConstant(shader, "Color", &s.mColor);
-			commandBuffer->PushConstant(shader, "Offset", &s.mOffset);
-			commandBuffer->PushConstant(shader, "Bounds", &s.mBounds);
-			commandBuffer->PushConstant(shader, "Depth", &s.mDepth);
+			commandBuffer->PushConstant(shader, SHADER_NAME_ID("Color"), &s.mColor);
+			commandBuffer->PushConstant(shader, SHADER_NAME_ID("Offset"), &s.mOffset);
+			commandBuffer->PushConstant(shader, SHADER_NAME_ID("Bounds"), &s.mBounds);
+			commandBuffer->PushConstant(shader, SHADER_NAME_ID("Depth"), &s.mDepth);
 			vkCmdDraw(*commandBuffer, (glyphBuffer->Size() / sizeof(TextGlyph)) * 6, 1, 0, 0);
 		}
 	}
@@ -292,14 +292,14 @@ void GUI::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, *ds, 0, nullptr);
 
 		float4 sz(0, 0, camera->FramebufferWidth(), camera->FramebufferHeight());
-		commandBuffer->PushConstant(shader, "ScreenSize", &sz.z);
+		commandBuffer->PushConstant(shader, SHADER_NAME_ID("ScreenSize"), &sz.z);
 
 		for (const GuiLine& l : mScreenLines) {
 			vkCmdSetLineWidth(*commandBuffer, l.mThickness);
-			commandBuffer->PushConstant(shader, "Color", &l.mColor);
-			commandBuffer->PushConstant(shader, "ScaleTranslate", &l.mScaleTranslate);
-			commandBuffer->PushConstant(shader, "Bounds", &l.mBounds);
-			commandBuffer->PushConstant(shader, "Depth", &l.mDepth);
+			commandBuffer->PushConstant(shader, SHADER_NAME_ID("Color"), &l.mColor);
+			commandBuffer->PushConstant(shader, SHADER_NAME_ID("ScaleTranslate"), &l.mScaleTranslate);
+			commandBuffer->PushConstant(shader, SHADER_NAME_ID("Bounds"), &l.mBounds);
+			commandBuffer->PushConstant(shader, SHADER_NAME_ID("Depth"), &l.mDepth);
 			vkCmdDraw(*commandBuffer, l.mCount, 1, l.mIndex, 0);
 		}
 	}
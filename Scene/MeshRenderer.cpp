@@ -10,7 +10,7 @@
 using namespace std;
 
 MeshRenderer::MeshRenderer(const string& name)
-	: Object(name), mVisible(true), mMesh(nullptr), mRayMask(0) {}
+	: Object(name), mVisible(true), mMesh(nullptr), mRayMask(0), mPushConstantShader(nullptr), mMeshRevision(0) {}
 MeshRenderer::~MeshRenderer() {}
 
 bool MeshRenderer::UpdateTransform() {
@@ -19,40 +19,140 @@ bool MeshRenderer::UpdateTransform() {
 	return true;
 }
 
+void MeshRenderer::PushConstants(CommandBuffer* commandBuffer, ShaderVariant* shader) {
+	if (mPushConstantShader != shader) {
+		mCompiledPushConstants.clear();
+		for (const auto& kp : mPushConstants)
+			if (shader->mPushConstants.count(kp.first))
+				mCompiledPushConstants.push_back(make_pair(shader->mPushConstants.at(kp.first), kp.second));
+		mPushConstantShader = shader;
+	}
+	for (const auto& p : mCompiledPushConstants)
+		vkCmdPushConstants(*commandBuffer, shader->mPipelineLayout, p.first.stageFlags, p.first.offset, p.first.size, &p.second);
+}
+
+void MeshRenderer::PreFrame(CommandBuffer* commandBuffer) {
+	// reloaded meshes are swapped in place and may have different bounds
+	uint64_t revision = Mesh() ? Mesh()->Revision() : 0;
+	if (revision != mMeshRevision) {
+		mMeshRevision = revision;
+		Dirty();
+	}
+}
+
 void MeshRenderer::PreRender(CommandBuffer* commandBuffer, Camera* camera, PassType pass) {
-	if (pass == PASS_MAIN) Scene()->Environment()->SetEnvironment(camera, mMaterial.get());
+	Mesh()->MarkUsed(commandBuffer->Device()->Instance()->FrameCount());
+	if (pass == PASS_MAIN) {
+		Scene()->Environment()->SetEnvironment(camera, mMaterial.get());
+
+		// texture streaming feedback, the uv distance one pixel covers at the point of the bounds nearest to the camera
+		AABB bounds = Bounds();
+		float3 cameraPosition = camera->WorldPosition();
+		float distance = camera->Orthographic() ? 1.f : max(length(clamp(cameraPosition, bounds.mMin, bounds.mMax) - cameraPosition), camera->Near());
+		float pixelsPerUnit = fabsf(camera->Projection()[1][1]) * camera->FramebufferHeight() * .5f / distance;
+		float3 scale = abs(WorldScale());
+		float minScale = min(min(scale.x, scale.y), scale.z);
+		if (pixelsPerUnit > 0 && minScale > 0)
+			mMaterial->RequestMipLevels(Mesh()->UVDensity() / (minScale * pixelsPerUnit));
+	}
 }
 
 void MeshRenderer::DrawInstanced(CommandBuffer* commandBuffer, Camera* camera, uint32_t instanceCount, VkDescriptorSet instanceDS, PassType pass) {
 	::Mesh* mesh = Mesh();
+	// evicted meshes have no buffers until AssetManager reloads them
+	if (!mesh->VertexBuffer()) return;
 
 	VkCullModeFlags cull = (pass == PASS_DEPTH) ? VK_CULL_MODE_NONE : VK_CULL_MODE_FLAG_BITS_MAX_ENUM;
 	VkPipelineLayout layout = commandBuffer->BindMaterial(mMaterial.get(), pass, mesh->VertexInput(), camera, mesh->Topology(), cull);
 	if (!layout) return;
-	auto shader = mMaterial->GetShader(pass);
+	auto shader = mMaterial->GetShader(pass, mesh->VertexInput());
 
 	uint32_t lc = (uint32_t)Scene()->ActiveLights().size();
 	float2 s = Scene()->ShadowTexelSize();
 	float t = Scene()->TotalTime();
-	commandBuffer->PushConstant(shader, "Time", &t);
-	commandBuffer->PushConstant(shader, "LightCount", &lc);
-	commandBuffer->PushConstant(shader, "ShadowTexelSize", &s);
-	for (const auto& kp : mPushConstants)
-		commandBuffer->PushConstant(shader, kp.first, &kp.second);
+	commandBuffer->PushConstant(shader, SHADER_NAME_ID("Time"), &t);
+	commandBuffer->PushConstant(shader, SHADER_NAME_ID("LightCount"), &lc);
+	commandBuffer->PushConstant(shader, SHADER_NAME_ID("ShadowTexelSize"), &s);
+	PushConstants(commandBuffer, shader);
 	
 	if (instanceDS != VK_NULL_HANDLE)
 		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, &instanceDS, 0, nullptr);
 
+	// the scene doesn't batch renderers of clustered meshes, so the clusters are culled with this renderer's transform
+	vector<VkDrawIndexedIndirectCommand> draws;
+	if (mesh->Clusters().size() > 1 && instanceCount == 1) {
+		PROFILER_BEGIN("Cull Clusters");
+		CullClusters(camera, pass, draws);
+		PROFILER_END;
+		if (draws.empty()) return;
+	} else
+		draws.push_back({ mesh->IndexCount(), instanceCount, mesh->BaseIndex(), (int32_t)mesh->BaseVertex(), 0 });
+
+	Buffer* indirectBuffer = nullptr;
+	if (draws.size() > 1 && commandBuffer->Device()->MultiDrawIndirect()) {
+		indirectBuffer = commandBuffer->Device()->GetTempBuffer("Cluster Draws", sizeof(VkDrawIndexedIndirectCommand) * draws.size(), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+		memcpy(indirectBuffer->MappedData(), draws.data(), sizeof(VkDrawIndexedIndirectCommand) * draws.size());
+	}
+	uint32_t triangleCount = 0;
+	for (const VkDrawIndexedIndirectCommand& d : draws)
+		triangleCount += d.instanceCount * (d.indexCount / 3);
+
+	auto Draw = [&]() {
+		if (indirectBuffer)
+			vkCmdDrawIndexedIndirect(*commandBuffer, *indirectBuffer, 0, (uint32_t)draws.size(), sizeof(VkDrawIndexedIndirectCommand));
+		else
+			for (const VkDrawIndexedIndirectCommand& d : draws)
+				vkCmdDrawIndexed(*commandBuffer, d.indexCount, d.instanceCount, d.firstIndex, d.vertexOffset, d.firstInstance);
+		commandBuffer->mTriangleCount += triangleCount;
+	};
+
 	commandBuffer->BindVertexBuffer(mesh->VertexBuffer().get(), 0, 0);
 	commandBuffer->BindIndexBuffer(mesh->IndexBuffer().get(), 0, mesh->IndexType());
 	camera->SetStereo(commandBuffer, shader, EYE_LEFT);
-	vkCmdDrawIndexed(*commandBuffer, mesh->IndexCount(), instanceCount, mesh->BaseIndex(), mesh->BaseVertex(), 0);
-	commandBuffer->mTriangleCount += instanceCount * (mesh->IndexCount() / 3);
+	Draw();
 	
 	if (camera->StereoMode() != STEREO_NONE) {
 		camera->SetStereo(commandBuffer, shader, EYE_RIGHT);
-		vkCmdDrawIndexed(*commandBuffer, mesh->IndexCount(), instanceCount, mesh->BaseIndex(), mesh->BaseVertex(), 0);
-		commandBuffer->mTriangleCount += instanceCount * (mesh->IndexCount() / 3);
+		Draw();
+	}
+}
+
+void MeshRenderer::CullClusters(Camera* camera, PassType pass, vector<VkDrawIndexedIndirectCommand>& draws) {
+	::Mesh* mesh = Mesh();
+	float4x4 o2w = ObjectToWorld();
+	float3 scale(length(o2w[0].xyz), length(o2w[1].xyz), length(o2w[2].xyz));
+	float maxScale = max(max(scale.x, scale.y), scale.z);
+	float minScale = min(min(scale.x, scale.y), scale.z);
+
+	// the camera's frustum is the left eye's, which doesn't contain everything the right eye sees
+	bool frustumCull = camera->StereoMode() == STEREO_NONE;
+	// cones only hold under uniform scale, and only matter when back faces are culled. The depth pass doesn't cull back faces.
+	bool coneCull = pass == PASS_MAIN && !camera->Orthographic() && mMaterial->CullMode() == VK_CULL_MODE_BACK_BIT && maxScale - minScale <= maxScale * 1e-3f;
+	const float4* frustum = camera->Frustum();
+	float3 eye = camera->WorldPosition();
+
+	for (const MeshCluster& c : mesh->Clusters()) {
+		float3 center = (o2w * float4(c.mCenter, 1)).xyz;
+		float radius = c.mRadius * maxScale;
+
+		if (frustumCull) {
+			bool inside = true;
+			for (uint32_t i = 0; i < 6 && inside; i++)
+				inside = dot(center, frustum[i].xyz) - frustum[i].w > -radius;
+			if (!inside) continue;
+		}
+		if (coneCull) {
+			float3 axis = normalize((o2w * float4(c.mConeAxis, 0)).xyz);
+			float3 d = center - eye;
+			if (dot(d, axis) >= c.mConeCutoff * length(d) + radius) continue;
+		}
+
+		// the clusters are contiguous in the index buffer, so visible neighbours merge into one draw
+		uint32_t firstIndex = mesh->BaseIndex() + c.mIndexOffset;
+		if (draws.size() && draws.back().firstIndex + draws.back().indexCount == firstIndex)
+			draws.back().indexCount += c.mIndexCount;
+		else
+			draws.push_back({ c.mIndexCount, 1, firstIndex, (int32_t)mesh->BaseVertex(), 0 });
 	}
 }
 
@@ -50,13 +50,16 @@ public:
 	ENGINE_EXPORT virtual void Material(std::shared_ptr<::Material> m) { mMaterial = m; }
 
 	template<typename T>
-	inline void PushConstant(const std::string& name, const T& value) { mPushConstants.emplace(name, PushConstantValue(value)); }
+	inline void PushConstant(const std::string& name, const T& value) { mPushConstants.emplace(name, PushConstantValue(value)); mPushConstantShader = nullptr; }
 	inline PushConstantValue PushConstant(const std::string& name) { return mPushConstants.at(name); }
+	inline bool HasPushConstant(const std::string& name) const { return mPushConstants.count(name); }
 
 	inline virtual bool Visible() override { return mVisible && Mesh() && mMaterial && EnabledHierarchy(); }
 	inline virtual uint32_t RenderQueue() override { return mMaterial ? mMaterial->RenderQueue() : Renderer::RenderQueue(); }
 	ENGINE_EXPORT virtual void Draw(CommandBuffer* commandBuffer, Camera* camera, PassType pass) override;
 
+	/// Refreshes the bounds if the mesh was reloaded in place
+	ENGINE_EXPORT virtual void PreFrame(CommandBuffer* commandBuffer) override;
 	ENGINE_EXPORT virtual void PreRender(CommandBuffer* commandBuffer, Camera* camera, PassType pass) override;
 	ENGINE_EXPORT virtual void DrawInstanced(CommandBuffer* commandBuffer, Camera* camera, uint32_t instanceCount, VkDescriptorSet instanceDS, PassType pass);
 
@@ -69,8 +72,16 @@ private:
 protected:
 	std::shared_ptr<::Material> mMaterial;
 	std::unordered_map<std::string, PushConstantValue> mPushConstants;
+	// mPushConstants resolved against mPushConstantShader, so drawing doesn't look up names
+	ShaderVariant* mPushConstantShader;
+	std::vector<std::pair<VkPushConstantRange, PushConstantValue>> mCompiledPushConstants;
+	ENGINE_EXPORT void PushConstants(CommandBuffer* commandBuffer, ShaderVariant* shader);
+	/// Appends a draw for each run of the mesh's clusters that the camera can see, using frustum and backface cone tests
+	ENGINE_EXPORT void CullClusters(Camera* camera, PassType pass, std::vector<VkDrawIndexedIndirectCommand>& draws);
 
 	AABB mAABB;
 	std::variant<::Mesh*, std::shared_ptr<::Mesh>> mMesh;
+	// Mesh()->Revision() when the bounds were last refreshed
+	uint64_t mMeshRevision;
 	ENGINE_EXPORT virtual bool UpdateTransform() override;
 };
\ No newline at end of file
@@ -37,15 +37,16 @@ const ::VertexInput Float3VertexInput{
 	}
 };
 
+// bones are IDs into the model's unique bone names, ~0u if unused
 struct AIWeight {
-	string bones[4];
+	uint32_t bones[4];
 	float4 weights;
 
 	AIWeight() {
-		bones[0] = bones[1] = bones[2] = bones[3] = "";
+		bones[0] = bones[1] = bones[2] = bones[3] = ~0u;
 		weights[0] = weights[1] = weights[2] = weights[3] = 0.f;
 	}
-	inline void Set(const std::string& cluster, float weight) {
+	inline void Set(uint32_t cluster, float weight) {
 		if (weight < .001f) return;
 
 		uint32_t index = 0;
@@ -144,7 +145,7 @@ Scene::Scene(::Instance* instance, ::AssetManager* assetManager, ::InputManager*
 	mShadowTexelSize = float2(1.f / SHADOW_ATLAS_RESOLUTION, 1.f / SHADOW_ATLAS_RESOLUTION) * .75f;
 	mEnvironment = new ::Environment(this);
 
-	mShadowAtlasFramebuffer = new Framebuffer("ShadowAtlas", mInstance->Device(), SHADOW_ATLAS_RESOLUTION, SHADOW_ATLAS_RESOLUTION, {}, VK_FORMAT_D32_SFLOAT, VK_SAMPLE_COUNT_1_BIT, {}, VK_ATTACHMENT_LOAD_OP_LOAD);
+	mShadowAtlasFramebuffer = new Framebuffer("ShadowAtlas", mInstance->Device(), SHADOW_ATLAS_RESOLUTION, SHADOW_ATLAS_RESOLUTION, {}, VK_FORMAT_D32_SFLOAT, VK_SAMPLE_COUNT_1_BIT, {}, VK_ATTACHMENT_LOAD_OP_LOAD, true);
 	mShadowAtlases = new Texture*[mInstance->Device()->MaxFramesInFlight()];
 	
 	auto commandBuffer = mInstance->Device()->GetCommandBuffer();
@@ -182,6 +183,8 @@ Scene::Scene(::Instance* instance, ::AssetManager* assetManager, ::InputManager*
 	};
 	mSkyboxCube = new Mesh("SkyCube", mInstance->Device(), verts, indices, 8, sizeof(float3), 36, &Float3VertexInput, VK_INDEX_TYPE_UINT16);
 
+	mBenchmark = new ::Benchmark(this);
+
 	mStartTime = mClock.now();
 	mLastFrame = mClock.now();
 }
@@ -193,6 +196,7 @@ Scene::~Scene(){
 		RemoveObject(mObjects[0].get());
 
 	safe_delete(mEnvironment);
+	safe_delete(mBenchmark);
 
 	for (uint32_t i = 0; i < mInstance->Device()->MaxFramesInFlight(); i++) {
 		safe_delete(mShadowAtlases[i]);
@@ -227,24 +231,30 @@ Object* Scene::LoadModelScene(const string& filename,
 	vector<shared_ptr<Material>> materials;
 	unordered_map<aiNode*, Object*> objectMap;
 
-	vector<AIWeight> weights;
-	unordered_map<string, aiBone*> uniqueBones;
-
-	vector<StdVertex> vertices;
-	vector<uint32_t> indices;
-
 	uint32_t totalVertices = 0;
 	uint32_t totalIndices = 0;
 
 	bool hasBones = false;
 
+	// offsets of each mesh in the shared buffers, so meshes can be imported in parallel. Bone names are mapped to IDs up front, so weights compare integers.
+	vector<uint32_t> baseVertices(scene->mNumMeshes);
+	vector<uint32_t> baseIndices(scene->mNumMeshes);
+	vector<aiBone*> uniqueBones;
+	unordered_map<string, uint32_t> boneIds;
 	for (uint32_t m = 0; m < scene->mNumMeshes; m++) {
 		const aiMesh* mesh = scene->mMeshes[m];
+		baseVertices[m] = totalVertices;
+		baseIndices[m] = totalIndices;
+		if (mesh->mPrimitiveTypes != aiPrimitiveType_TRIANGLE) continue;
+
 		totalVertices += mesh->mNumVertices;
 		for (uint32_t i = 0; i < mesh->mNumFaces; i++)
 			totalIndices += min(mesh->mFaces[i].mNumIndices, 3u);
 
 		if (mesh->HasBones()) hasBones = true;
+		for (uint32_t c = 0; c < mesh->mNumBones; c++)
+			if (boneIds.emplace(mesh->mBones[c]->mName.C_Str(), (uint32_t)uniqueBones.size()).second)
+				uniqueBones.push_back(mesh->mBones[c]);
 	}
 
 	shared_ptr<Buffer> vertexBuffer = make_shared<Buffer>(filename + " Vertices", mInstance->Device(), sizeof(StdVertex) * totalVertices, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
@@ -255,24 +265,35 @@ Object* Scene::LoadModelScene(const string& filename,
 	for (uint32_t m = 0; m < scene->mNumMaterials; m++)
 		materials.push_back(materialSetupFunc(this, scene->mMaterials[m]));
 
-	for (uint32_t m = 0; m < scene->mNumMeshes; m++) {
+	struct ImportedMesh {
+		AABB mBounds;
+		TriangleBvh2* mBvh;
+		VkPrimitiveTopology mTopology;
+		uint32_t mVertexCount;
+		uint32_t mIndexCount;
+	};
+	vector<StdVertex> vertices(totalVertices);
+	vector<uint32_t> indices(totalIndices);
+	vector<AIWeight> weights(hasBones ? totalVertices : 0);
+	vector<ImportedMesh> imported(scene->mNumMeshes);
+
+	// each mesh writes its own range of vertices, indices and weights
+	PROFILER_BEGIN("Import Meshes");
+	mInstance->ThreadPool()->ParallelFor(scene->mNumMeshes, [&](uint32_t m) {
 		const aiMesh* mesh = scene->mMeshes[m];
+		if (mesh->mPrimitiveTypes != aiPrimitiveType_TRIANGLE) return;
 
-		if (mesh->mPrimitiveTypes != aiPrimitiveType_TRIANGLE) {
-			meshes.push_back(nullptr);
-			continue;
-		}
-
-		VkPrimitiveTopology topo = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		ImportedMesh& result = imported[m];
+		result.mTopology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		result.mVertexCount = mesh->mNumVertices;
+		result.mBvh = nullptr;
 
-		uint32_t baseVertex = (uint32_t)vertices.size();
-		uint32_t baseIndex  = (uint32_t)indices.size();
+		uint32_t baseVertex = baseVertices[m];
+		uint32_t baseIndex = baseIndices[m];
 
 		// vertex data
 		for (uint32_t i = 0; i < mesh->mNumVertices; i++) {
-			StdVertex vertex = {};
-			memset(&vertex, 0, sizeof(StdVertex));
-
+			StdVertex& vertex = vertices[baseVertex + i];
 			vertex.position = { (float)mesh->mVertices[i].x, (float)mesh->mVertices[i].y, (float)mesh->mVertices[i].z };
 			if (mesh->HasNormals()) vertex.normal = { (float)mesh->mNormals[i].x, (float)mesh->mNormals[i].y, (float)mesh->mNormals[i].z };
 			if (mesh->HasTangentsAndBitangents()) {
@@ -282,60 +303,54 @@ Object* Scene::LoadModelScene(const string& filename,
 			}
 			if (mesh->HasTextureCoords(0)) vertex.uv = { (float)mesh->mTextureCoords[0][i].x, (float)mesh->mTextureCoords[0][i].y };
 			vertex.position *= scale;
-
-			vertices.push_back(vertex);
-			weights.push_back(AIWeight());
 		}
 
 		// index data
+		uint32_t* index = indices.data() + baseIndex;
 		float3 mn = vertices[baseVertex].position, mx = vertices[baseVertex].position;
 		for (uint32_t i = 0; i < mesh->mNumFaces; i++) {
 			const aiFace& f = mesh->mFaces[i];
-			indices.push_back(f.mIndices[0]);
-			mn = min(vertices[baseVertex + f.mIndices[0]].position, mn);
-			mx = max(vertices[baseVertex + f.mIndices[0]].position, mx);
-			if (f.mNumIndices > 1) {
-				indices.push_back(f.mIndices[1]);
-				mn = min(vertices[baseVertex + f.mIndices[1]].position, mn);
-				mx = max(vertices[baseVertex + f.mIndices[1]].position, mx);
-				if (f.mNumIndices > 2) {
-					indices.push_back(f.mIndices[2]);
-					mn = min(vertices[baseVertex + f.mIndices[2]].position, mn);
-					mx = max(vertices[baseVertex + f.mIndices[2]].position, mx);
-				} else
-					topo = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
-			} else
-				topo = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+			uint32_t n = min(f.mNumIndices, 3u);
+			for (uint32_t j = 0; j < n; j++) {
+				*index++ = f.mIndices[j];
+				mn = min(vertices[baseVertex + f.mIndices[j]].position, mn);
+				mx = max(vertices[baseVertex + f.mIndices[j]].position, mx);
+			}
+			if (n == 2) result.mTopology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+			else if (n == 1) result.mTopology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
 		}
+		result.mIndexCount = (uint32_t)(index - (indices.data() + baseIndex));
+		result.mBounds = AABB(mn, mx);
 
-		uint32_t vertexCount = (uint32_t)vertices.size() - baseVertex;
-		uint32_t indexCount  = (uint32_t)indices.size() - baseIndex;
-
-		TriangleBvh2* bvh = nullptr;
-		if (topo == VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST) {
-			bvh = new TriangleBvh2();
-			bvh->Build(vertices.data() + baseVertex, 0, vertexCount, sizeof(StdVertex), indices.data() + baseIndex, indexCount, VK_INDEX_TYPE_UINT32);
+		if (result.mTopology == VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST) {
+			result.mBvh = new TriangleBvh2();
+			result.mBvh->Build(vertices.data() + baseVertex, 0, result.mVertexCount, sizeof(StdVertex), indices.data() + baseIndex, result.mIndexCount, VK_INDEX_TYPE_UINT32);
 		}
 
-		if (mesh->HasBones()) {
-			for (uint16_t c = 0; c < mesh->mNumBones; c++) {
-				aiBone* bone = mesh->mBones[c];
-				for (uint32_t i = 0; i < bone->mNumWeights; i++) {
-					uint32_t index = baseVertex + bone->mWeights[i].mVertexId;
-					weights[index].Set(bone->mName.C_Str(), (float)bone->mWeights[i].mWeight);
-				}
-				if (uniqueBones.count(bone->mName.C_Str()) == 0)
-					uniqueBones.emplace(bone->mName.C_Str(), bone);
-			}
+		for (uint32_t c = 0; c < mesh->mNumBones; c++) {
+			aiBone* bone = mesh->mBones[c];
+			uint32_t id = boneIds.at(bone->mName.C_Str());
+			for (uint32_t i = 0; i < bone->mNumWeights; i++)
+				weights[baseVertex + bone->mWeights[i].mVertexId].Set(id, (float)bone->mWeights[i].mWeight);
+		}
+	});
+	PROFILER_END;
 
+	for (uint32_t m = 0; m < scene->mNumMeshes; m++) {
+		const aiMesh* mesh = scene->mMeshes[m];
+		if (mesh->mPrimitiveTypes != aiPrimitiveType_TRIANGLE) {
+			meshes.push_back(nullptr);
+			continue;
+		}
+		const ImportedMesh& im = imported[m];
+		if (mesh->HasBones())
 			meshes.push_back(make_shared<Mesh>(mesh->mName.C_Str(), mInstance->Device(),
-				AABB(mn, mx), bvh, vertexBuffer, indexBuffer, weightBuffer, baseVertex, vertexCount, baseIndex, indexCount,
-				&StdVertex::VertexInput, VK_INDEX_TYPE_UINT32, topo));
-		} else {
+				im.mBounds, im.mBvh, vertexBuffer, indexBuffer, weightBuffer, baseVertices[m], im.mVertexCount, baseIndices[m], im.mIndexCount,
+				&StdVertex::VertexInput, VK_INDEX_TYPE_UINT32, im.mTopology));
+		else
 			meshes.push_back(make_shared<Mesh>(mesh->mName.C_Str(), mInstance->Device(),
-				AABB(mn, mx), bvh, vertexBuffer, indexBuffer, baseVertex, vertexCount, baseIndex, indexCount,
-				&StdVertex::VertexInput, VK_INDEX_TYPE_UINT32, topo));
-		}
+				im.mBounds, im.mBvh, vertexBuffer, indexBuffer, baseVertices[m], im.mVertexCount, baseIndices[m], im.mIndexCount,
+				&StdVertex::VertexInput, VK_INDEX_TYPE_UINT32, im.mTopology));
 	}
 
 	AnimationRig rig;
@@ -346,8 +361,8 @@ Object* Scene::LoadModelScene(const string& filename,
 		// find root node
 		aiNode* root = scene->mRootNode;
 		uint32_t rootDepth = 0xFFFFFFFF;
-		for (auto& b : uniqueBones) {
-			aiNode* node = scene->mRootNode->FindNode(b.second->mName);
+		for (aiBone* b : uniqueBones) {
+			aiNode* node = scene->mRootNode->FindNode(b->mName);
 			while (node && node->mName == aiString(""))
 				node = node->mParent;
 			uint32_t d = GetDepth(node);
@@ -360,17 +375,17 @@ Object* Scene::LoadModelScene(const string& filename,
 			}
 		}
 
-		// compute bone matrices and bonesByName
-		unordered_map<string, uint32_t> bonesByName;
-		for (auto& b : uniqueBones) {
-			aiNode* node = scene->mRootNode->FindNode(b.second->mName);
+		// compute bone matrices and the rig index of each bone ID
+		vector<uint32_t> rigIndices(uniqueBones.size(), ~0u);
+		for (uint32_t b = 0; b < uniqueBones.size(); b++) {
+			aiNode* node = scene->mRootNode->FindNode(uniqueBones[b]->mName);
 			Bone* bone = AddBone(rig, node, scene, root, boneMap, scale);
 			if (!bone) continue;
 			BoneTransform bt;
-			ConvertMatrix(b.second->mOffsetMatrix).Decompose(&bt.mPosition, &bt.mRotation, &bt.mScale);
+			ConvertMatrix(uniqueBones[b]->mOffsetMatrix).Decompose(&bt.mPosition, &bt.mRotation, &bt.mScale);
 			bt.mPosition *= scale;
 			bone->mInverseBind = float4x4::TRS(bt.mPosition, bt.mRotation, bt.mScale);
-			bonesByName.emplace(b.second->mName.C_Str(), bone->mBoneIndex);
+			rigIndices[b] = bone->mBoneIndex;
 		}
 		/*
 		float4x4 rootTransform(1.f);
@@ -400,8 +415,8 @@ Object* Scene::LoadModelScene(const string& filename,
 		for (uint32_t i = 0; i < vertices.size(); i++) {
 			weights[i].Normalize();
 			for (uint32_t j = 0; j < 4; j++) {
-				if (bonesByName.count(weights[i].bones[j])) {
-					vertexWeights[i].Indices[j] = bonesByName.at(weights[i].bones[j]);
+				if (weights[i].bones[j] != ~0u && rigIndices[weights[i].bones[j]] != ~0u) {
+					vertexWeights[i].Indices[j] = rigIndices[weights[i].bones[j]];
 					vertexWeights[i].Weights[j] = weights[i].weights[j];
 				}
 			}
@@ -560,8 +575,15 @@ Object* Scene::LoadModelScene(const string& filename,
 
 void Scene::Update(CommandBuffer* commandBuffer) {
 	auto t1 = mClock.now();
-	mDeltaTime = (t1 - mLastFrame).count() * 1e-9f;
-	mTotalTime = (t1 - mStartTime).count() * 1e-9f;
+	if (mBenchmark->Replaying()) {
+		// replays advance by the recorded (or fixed) time step, regardless of how long the frame actually took
+		mDeltaTime = mBenchmark->DeltaTime();
+		mTotalTime += mDeltaTime;
+	} else {
+		mDeltaTime = (t1 - mLastFrame).count() * 1e-9f;
+		mTotalTime = (t1 - mStartTime).count() * 1e-9f;
+		mBenchmark->DeltaTime(mDeltaTime);
+	}
 	mLastFrame = t1;
 
 	// count fps
@@ -577,7 +599,7 @@ void Scene::Update(CommandBuffer* commandBuffer) {
 	float physicsTime = 0;
 	mFixedAccumulator += mDeltaTime;
 	t1 = mClock.now();
-	while (mFixedAccumulator > mFixedTimeStep && physicsTime < mPhysicsTimeLimitPerFrame) {
+	while (mFixedAccumulator > mFixedTimeStep && (physicsTime < mPhysicsTimeLimitPerFrame || mBenchmark->Mode() != BENCHMARK_NONE)) {
 		for (auto o : mObjects)
 			if (o->EnabledHierarchy())
 				o->FixedUpdate(commandBuffer);
@@ -965,17 +987,19 @@ void Scene::Render(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* fr
 	// skybox
 	if (mEnvironment->mSkyboxMaterial && pass == PASS_MAIN) {
 		PROFILER_BEGIN("Draw skybox");
-		ShaderVariant* shader = mEnvironment->mSkyboxMaterial->GetShader(PASS_MAIN);
+		ShaderVariant* shader = mEnvironment->mSkyboxMaterial->GetShader(PASS_MAIN, mSkyboxCube->VertexInput());
 		VkPipelineLayout layout = commandBuffer->BindMaterial(mEnvironment->mSkyboxMaterial.get(), pass, mSkyboxCube->VertexInput(), camera, mSkyboxCube->Topology());
-		commandBuffer->BindVertexBuffer(mSkyboxCube->VertexBuffer().get(), 0, 0);
-		commandBuffer->BindIndexBuffer(mSkyboxCube->IndexBuffer().get(), 0, mSkyboxCube->IndexType());
-		camera->SetStereo(commandBuffer, shader, EYE_LEFT);
-		vkCmdDrawIndexed(*commandBuffer, mSkyboxCube->IndexCount(), 1, mSkyboxCube->BaseIndex(), mSkyboxCube->BaseVertex(), 0);
-		commandBuffer->mTriangleCount += mSkyboxCube->IndexCount() / 3;
-		if (camera->StereoMode() != STEREO_NONE) {
-			camera->SetStereo(commandBuffer, shader, EYE_RIGHT);
+		if (layout) {
+			commandBuffer->BindVertexBuffer(mSkyboxCube->VertexBuffer().get(), 0, 0);
+			commandBuffer->BindIndexBuffer(mSkyboxCube->IndexBuffer().get(), 0, mSkyboxCube->IndexType());
+			camera->SetStereo(commandBuffer, shader, EYE_LEFT);
 			vkCmdDrawIndexed(*commandBuffer, mSkyboxCube->IndexCount(), 1, mSkyboxCube->BaseIndex(), mSkyboxCube->BaseVertex(), 0);
 			commandBuffer->mTriangleCount += mSkyboxCube->IndexCount() / 3;
+			if (camera->StereoMode() != STEREO_NONE) {
+				camera->SetStereo(commandBuffer, shader, EYE_RIGHT);
+				vkCmdDrawIndexed(*commandBuffer, mSkyboxCube->IndexCount(), 1, mSkyboxCube->BaseIndex(), mSkyboxCube->BaseVertex(), 0);
+				commandBuffer->mTriangleCount += mSkyboxCube->IndexCount() / 3;
+			}
 		}
 		PROFILER_END;
 	}
@@ -983,6 +1007,7 @@ void Scene::Render(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* fr
 	#pragma region Render renderers
 	uint32_t frameContextIndex = commandBuffer->Device()->FrameContextIndex();
 	DescriptorSet* batchDS = nullptr;
+	vector<DescriptorSetWrite> batchWrites;
 	Buffer* batchBuffer = nullptr;
 	InstanceBuffer* curBatch = nullptr;
 	MeshRenderer* batchStart = nullptr;
@@ -1000,9 +1025,9 @@ void Scene::Render(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* fr
 		Renderer* r = dynamic_cast<Renderer*>(o);
 		bool batched = false;
 		if (MeshRenderer* cur = dynamic_cast<MeshRenderer*>(r)) {
-			GraphicsShader* curShader = cur->Material()->GetShader(pass);
-			if (curShader->mDescriptorBindings.count("Instances")) {
-				if (!batchStart || batchSize + 1 >= INSTANCE_BATCH_SIZE || (batchStart->Material() != cur->Material()) || batchStart->Mesh() != cur->Mesh()) {
+			GraphicsShader* curShader = cur->Material()->GetShader(pass, cur->Mesh()->VertexInput());
+			if (curShader->DescriptorBinding(SHADER_NAME_ID("Instances"))) {
+				if (!batchStart || batchSize + 1 >= INSTANCE_BATCH_SIZE || !batchStart->Material()->CanBatch(cur->Material(), pass) || batchStart->Mesh() != cur->Mesh() || cur->Mesh()->Clusters().size() > 1) {
 					// render last batch
 					DrawLastBatch();
 
@@ -1014,25 +1039,30 @@ void Scene::Render(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* fr
 					batchBuffer = commandBuffer->Device()->GetTempBuffer("Instance Batch", sizeof(InstanceBuffer) * INSTANCE_BATCH_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
 					curBatch = (InstanceBuffer*)batchBuffer->MappedData();
 
-					batchDS = commandBuffer->Device()->GetTempDescriptorSet("Instance Batch", curShader->mDescriptorSetLayouts[PER_OBJECT]);
-					batchDS->CreateStorageBufferDescriptor(batchBuffer, 0, batchBuffer->Size(), INSTANCE_BUFFER_BINDING);
+					// the batch buffers and per-frame buffers are reused, so the same sets come back every frame
+					batchWrites.clear();
+					batchWrites.push_back(DescriptorSetWrite(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, INSTANCE_BUFFER_BINDING, batchBuffer, 0, batchBuffer->Size()));
 					if (pass == PASS_MAIN) {
-						if (curShader->mDescriptorBindings.count("Lights"))
-							batchDS->CreateStorageBufferDescriptor(mLightBuffers[frameContextIndex], 0, mLightBuffers[frameContextIndex]->Size(), LIGHT_BUFFER_BINDING);
-						if (curShader->mDescriptorBindings.count("Shadows"))
-							batchDS->CreateStorageBufferDescriptor(mShadowBuffers[frameContextIndex], 0, mShadowBuffers[frameContextIndex]->Size(), SHADOW_BUFFER_BINDING);
-						if (curShader->mDescriptorBindings.count("ShadowAtlas"))
-							batchDS->CreateSampledTextureDescriptor(mShadowAtlases[frameContextIndex], SHADOW_ATLAS_BINDING);
+						if (curShader->DescriptorBinding(SHADER_NAME_ID("Lights")))
+							batchWrites.push_back(DescriptorSetWrite(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, LIGHT_BUFFER_BINDING, mLightBuffers[frameContextIndex], 0, mLightBuffers[frameContextIndex]->Size()));
+						if (curShader->DescriptorBinding(SHADER_NAME_ID("Shadows")))
+							batchWrites.push_back(DescriptorSetWrite(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, SHADOW_BUFFER_BINDING, mShadowBuffers[frameContextIndex], 0, mShadowBuffers[frameContextIndex]->Size()));
+						if (curShader->DescriptorBinding(SHADER_NAME_ID("ShadowAtlas")))
+							batchWrites.push_back(DescriptorSetWrite(VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, SHADOW_ATLAS_BINDING, mShadowAtlases[frameContextIndex]));
 					}
-					batchDS->FlushWrites();
+					batchDS = commandBuffer->Device()->GetCachedDescriptorSet("Instance Batch", curShader->mDescriptorSetLayouts[PER_OBJECT], batchWrites);
 
 					PROFILER_END;
 				}
 
 				// append to batch
 				PROFILER_BEGIN("Append to batch");
-				curBatch[batchSize].ObjectToWorld = cur->ObjectToWorld();
+				curBatch[batchSize].ObjectToWorld = cur->ObjectToWorld() * cur->Mesh()->VertexTransform();
 				curBatch[batchSize].WorldToObject = cur->WorldToObject();
+				if (cur->Material()->Bindless())
+					curBatch[batchSize].MaterialIndex = cur->Material()->BindlessIndex(cur->HasPushConstant("TextureIndex") ? cur->PushConstant("TextureIndex").uintValue : 0);
+				else
+					curBatch[batchSize].MaterialIndex = 0;
 				batchSize++;
 				batched = true;
 				PROFILER_END;
@@ -6,6 +6,7 @@
 #include <Core/DescriptorSet.hpp>
 #include <Core/PluginManager.hpp>
 #include <Input/InputManager.hpp>
+#include <Scene/Benchmark.hpp>
 #include <Scene/ObjectBvh2.hpp>
 #include <Scene/Camera.hpp>
 #include <Scene/Gizmos.hpp>
@@ -70,6 +71,7 @@ public:
 	inline ::PluginManager* PluginManager() const { return mPluginManager; }
 	inline ::Environment* Environment() const { return mEnvironment; }
 	inline ::Instance* Instance() const { return mInstance; }
+	inline ::Benchmark* Benchmark() const { return mBenchmark; }
 
 	inline void DrawGizmos(bool g) { mDrawGizmos = g; }
 	inline bool DrawGizmos() const { return mDrawGizmos; }
@@ -131,6 +133,7 @@ private:
 	::InputManager* mInputManager;
 	::PluginManager* mPluginManager;
 	::Environment* mEnvironment;
+	::Benchmark* mBenchmark;
 	std::vector<std::shared_ptr<Object>> mObjects;
 	std::vector<Light*> mLights;
 	std::vector<Camera*> mCameras;
@@ -18,6 +18,7 @@ Bone* SkinnedMeshRenderer::GetBone(const string& boneName) const {
 }
 
 void SkinnedMeshRenderer::PreFrame(CommandBuffer* commandBuffer) {
+	MeshRenderer::PreFrame(commandBuffer);
 	Shader* skinner = Scene()->AssetManager()->LoadShader("Shaders/skinner.stm");
 	::Mesh* m = MeshRenderer::Mesh();
 
@@ -132,19 +133,17 @@ void SkinnedMeshRenderer::DrawInstanced(CommandBuffer* commandBuffer, Camera* ca
 	VkCullModeFlags cull = (pass == PASS_DEPTH) ? VK_CULL_MODE_NONE : VK_CULL_MODE_FLAG_BITS_MAX_ENUM;
 	VkPipelineLayout layout = commandBuffer->BindMaterial(mMaterial.get(), pass, mesh->VertexInput(), camera, mesh->Topology(), cull);
 	if (!layout) return;
-	auto shader = mMaterial->GetShader(pass);
+	auto shader = mMaterial->GetShader(pass, mesh->VertexInput());
 
-	for (const auto& kp : mPushConstants)
-		commandBuffer->PushConstant(shader, kp.first, &kp.second);
+	PushConstants(commandBuffer, shader);
 
 	uint32_t lc = (uint32_t)Scene()->ActiveLights().size();
 	float2 s = Scene()->ShadowTexelSize();
 	float t = Scene()->TotalTime();
-	commandBuffer->PushConstant(shader, "Time", &t);
-	commandBuffer->PushConstant(shader, "LightCount", &lc);
-	commandBuffer->PushConstant(shader, "ShadowTexelSize", &s);
-	for (const auto& kp : mPushConstants)
-		commandBuffer->PushConstant(shader, kp.first, &kp.second);
+	commandBuffer->PushConstant(shader, SHADER_NAME_ID("Time"), &t);
+	commandBuffer->PushConstant(shader, SHADER_NAME_ID("LightCount"), &lc);
+	commandBuffer->PushConstant(shader, SHADER_NAME_ID("ShadowTexelSize"), &s);
+	PushConstants(commandBuffer, shader);
 	
 	if (instanceDS != VK_NULL_HANDLE)
 		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, &instanceDS, 0, nullptr);
@@ -131,6 +131,12 @@ void TriangleBvh2::Build(const void* vertices, uint32_t baseVertex, uint32_t ver
 	}
 }
 
+void TriangleBvh2::Load(const Node* nodes, uint32_t nodeCount, const uint3* triangles, uint32_t triangleCount, const float3* vertices, uint32_t vertexCount) {
+	mNodes.assign(nodes, nodes + nodeCount);
+	mTriangles.assign(triangles, triangles + triangleCount);
+	mVertices.assign(vertices, vertices + vertexCount);
+}
+
 bool TriangleBvh2::Intersect(const Ray& ray, float* t, bool any) {
 	if (mNodes.size() == 0) return false;
 
@@ -20,6 +20,8 @@ public:
 	inline ~TriangleBvh2() {}
 
 	const std::vector<Node>& Nodes() const { return mNodes; }
+	const std::vector<uint3>& Triangles() const { return mTriangles; }
+	const std::vector<float3>& Vertices() const { return mVertices; }
 
 	float3 GetVertex(uint32_t index) const { return mVertices[index]; }
 	uint3 GetTriangle(uint32_t index) const { return mTriangles[index]; }
@@ -29,6 +31,9 @@ public:
 
 	ENGINE_EXPORT void Build(const void* vertices, uint32_t baseVertex, uint32_t vertexCount, size_t vertexStride, const void* indices, uint32_t indexCount, VkIndexType indexType);
 
+	/// Restores a BVH from the Nodes(), Triangles() and Vertices() of one that was built before
+	ENGINE_EXPORT void Load(const Node* nodes, uint32_t nodeCount, const uint3* triangles, uint32_t triangleCount, const float3* vertices, uint32_t vertexCount);
+
 	ENGINE_EXPORT bool Intersect(const Ray& ray, float* t, bool any);
 
 private:
@@ -6,6 +6,7 @@
 #define PER_CAMERA 0
 #define PER_MATERIAL 1
 #define PER_OBJECT 2
+#define PER_BINDLESS 3
 
 #define CAMERA_BUFFER_BINDING 0
 #define INSTANCE_BUFFER_BINDING 1
@@ -14,6 +15,13 @@
 #define SHADOW_BUFFER_BINDING 4
 #define BINDING_START 5
 
+#define BINDLESS_TEXTURE_BINDING 0
+#define MATERIAL_BUFFER_BINDING 1
+#define BINDLESS_TEXTURE_COUNT 4096
+// bindless texture slot of a 1x1 white texture, used for textures a material doesn't have
+#define BINDLESS_DEFAULT_TEXTURE 0
+#define BINDLESS_MATERIAL_COUNT 4096
+
 #define LIGHT_SUN 0
 #define LIGHT_POINT 1
 #define LIGHT_SPOT 2
@@ -33,6 +41,22 @@ float2 ShadowTexelSize;
 struct InstanceBuffer {
 	float4x4 ObjectToWorld;
 	float4x4 WorldToObject;
+	uint MaterialIndex; // index into Materials, for bindless materials
+	uint3 pad;
+};
+
+// parameters of a bindless material, texture indices refer to the bindless texture array
+struct MaterialData {
+	float4 Color;
+	float4 TextureST;
+	float3 Emission;
+	float Metallic;
+	float Roughness;
+	float BumpStrength;
+	uint MainTexture;
+	uint NormalTexture;
+	uint MaskTexture;
+	uint3 pad;
 };
 
 struct CameraBuffer {
@@ -16,4 +16,10 @@ float3 ComputeView(float3 worldPos, float4 screenPos) {
 }
 float LinearDepth01(float screenPos_z) {
 	return screenPos_z / STRATUM_MATRIX_P[2][2] / (Camera.Viewport.w - Camera.Viewport.z);
+}
+// Reverses the octahedral encoding of a unit vector written by Mesh::Cook
+float3 DecodeOctahedral(float2 e) {
+	float3 v = float3(e, 1 - abs(e.x) - abs(e.y));
+	if (v.z < 0) v.xy = (1 - abs(v.yx)) * (v.xy >= 0 ? 1 : -1);
+	return normalize(v);
 }
\ No newline at end of file
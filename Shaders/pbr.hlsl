@@ -6,6 +6,8 @@
 
 #pragma multi_compile ALPHA_CLIP
 #pragma multi_compile TEXTURED
+#pragma multi_compile BINDLESS
+#pragma multi_compile QUANTIZED_VERTEX
 
 #pragma render_queue 1000
 
@@ -41,6 +43,12 @@
 [[vk::binding(BINDING_START + 8, PER_MATERIAL)]] SamplerComparisonState ShadowSampler : register(s1);
 [[vk::binding(BINDING_START + 9, PER_MATERIAL)]] SamplerState AtmosphereSampler : register(s2);
 
+#ifdef BINDLESS
+// bindless, indexed by Instances[].MaterialIndex
+[[vk::binding(BINDLESS_TEXTURE_BINDING, PER_BINDLESS)]] Texture2D<float4> BindlessTextures[BINDLESS_TEXTURE_COUNT] : register(t0, space1);
+[[vk::binding(MATERIAL_BUFFER_BINDING, PER_BINDLESS)]] StructuredBuffer<MaterialData> Materials : register(t0, space2);
+#endif
+
 [[vk::push_constant]] cbuffer PushConstants : register(b2) {
 	STRATUM_PUSH_CONSTANTS
 
@@ -70,17 +78,47 @@ struct v2f {
 	float3 tangent : TANGENT;
 	float2 texcoord : TEXCOORD2;
 	#endif
+	#ifdef BINDLESS
+	nointerpolation uint material : TEXCOORD3;
+	#endif
 };
 
+// material parameters come from the material buffer when bindless, and from push constants otherwise
+#ifdef BINDLESS
+#define MATERIAL_PARAM(m, name) Materials[m].name
+#define SAMPLE_TEXTURE(m, name, uv) BindlessTextures[NonUniformResourceIndex(Materials[m].name##Texture)].Sample(Sampler, uv)
+#else
+#define MATERIAL_PARAM(m, name) name
+#define SAMPLE_TEXTURE(m, name, uv) name##Textures[TextureIndex].Sample(Sampler, uv)
+#endif
+
 v2f vsmain(
+	#ifdef QUANTIZED_VERTEX
+	[[vk::location(0)]] float4 quantizedVertex : POSITION,
+	[[vk::location(1)]] float2 quantizedNormal : NORMAL,
+	#ifdef TEXTURED
+	[[vk::location(2)]] float2 quantizedTangent : TANGENT,
+	[[vk::location(3)]] float2 texcoord : TEXCOORD0,
+	#endif
+	#else
 	[[vk::location(0)]] float3 vertex : POSITION,
 	[[vk::location(1)]] float3 normal : NORMAL,
 	#ifdef TEXTURED
 	[[vk::location(2)]] float4 tangent : TANGENT,
 	[[vk::location(3)]] float2 texcoord : TEXCOORD0,
 	#endif
+	#endif
 	uint instance : SV_InstanceID ) {
 	v2f o;
+
+	#ifdef QUANTIZED_VERTEX
+	// positions are within the mesh bounds, Instances[].ObjectToWorld includes the mesh's VertexTransform
+	float3 vertex = quantizedVertex.xyz;
+	float3 normal = DecodeOctahedral(quantizedNormal);
+	#ifdef TEXTURED
+	float4 tangent = float4(DecodeOctahedral(quantizedTangent), quantizedVertex.w * 2 - 1);
+	#endif
+	#endif
 	
 	float4x4 ct = float4x4(
 		1,0,0,-Camera.Position.x,
@@ -96,17 +134,24 @@ v2f vsmain(
 	o.screenPos = ComputeScreenPos(o.position);
 	o.normal = mul(float4(normal, 1), Instances[instance].WorldToObject).xyz;
 	
+	#ifdef BINDLESS
+	o.material = Instances[instance].MaterialIndex;
+	#endif
+
 	#ifdef TEXTURED
 	o.tangent = mul(tangent, Instances[instance].WorldToObject).xyz * tangent.w;
-	o.texcoord = texcoord * TextureST.xy + TextureST.zw;
+	o.texcoord = texcoord * MATERIAL_PARAM(o.material, TextureST).xy + MATERIAL_PARAM(o.material, TextureST).zw;
 	#endif
 
 	return o;
 }
 
-#ifdef ALPHA_CLIP
+#if defined(ALPHA_CLIP) && defined(BINDLESS)
+float fsdepth(in float4 worldPos : TEXCOORD0, in float2 texcoord : TEXCOORD2, in nointerpolation uint material : TEXCOORD3) : SV_Target0 {
+	clip((SAMPLE_TEXTURE(material, Main, texcoord) * MATERIAL_PARAM(material, Color)).a - .75);
+#elif defined(ALPHA_CLIP)
 float fsdepth(in float4 worldPos : TEXCOORD0, in float2 texcoord : TEXCOORD2) : SV_Target0 {
-	clip((MainTextures[TextureIndex].Sample(Sampler, texcoord) * Color).a - .75);
+	clip((SAMPLE_TEXTURE(0, Main, texcoord) * Color).a - .75);
 #else
 float fsdepth(in float4 worldPos : TEXCOORD0) : SV_Target0 {
 #endif
@@ -121,9 +166,9 @@ void fsmain(v2f i,
 	float3 view = ComputeView(i.worldPos.xyz, i.screenPos);
 
 	#ifdef TEXTURED
-	float4 col = MainTextures[TextureIndex].Sample(Sampler, i.texcoord) * Color;
+	float4 col = SAMPLE_TEXTURE(i.material, Main, i.texcoord) * MATERIAL_PARAM(i.material, Color);
 	#else
-	float4 col = Color;
+	float4 col = MATERIAL_PARAM(i.material, Color);
 	#endif
 
 	bool ff = dot(i.normal, view) > 0;
@@ -131,26 +176,26 @@ void fsmain(v2f i,
 	float3 normal = normalize(i.normal) * (ff ? 1 : -1);
 
 	#ifdef TEXTURED
-	float4 bump = NormalTextures[TextureIndex].Sample(Sampler, i.texcoord);
+	float4 bump = SAMPLE_TEXTURE(i.material, Normal, i.texcoord);
 	bump.xyz = bump.xyz * 2 - 1;
 	float3 tangent = normalize(i.tangent);
 	float3 bitangent = normalize(cross(normal, tangent));// * (ff ? 1 : -1);
-	bump.xy *= BumpStrength;
+	bump.xy *= MATERIAL_PARAM(i.material, BumpStrength);
 	normal = normalize(tangent * bump.x + bitangent * bump.y + normal * bump.z);
 	#endif
 
 	#ifdef TEXTURED
-	float4 mask = MaskTextures[TextureIndex].Sample(Sampler, i.texcoord);
+	float4 mask = SAMPLE_TEXTURE(i.material, Mask, i.texcoord);
 	#else
 	float4 mask = 1;
 	#endif
 
 	MaterialInfo material;
-	material.diffuse = DiffuseAndSpecularFromMetallic(col.rgb, Metallic*mask.b, material.specular, material.oneMinusReflectivity);
-	material.perceptualRoughness = Roughness * mask.g * .99;
+	material.diffuse = DiffuseAndSpecularFromMetallic(col.rgb, MATERIAL_PARAM(i.material, Metallic)*mask.b, material.specular, material.oneMinusReflectivity);
+	material.perceptualRoughness = MATERIAL_PARAM(i.material, Roughness) * mask.g * .99;
 	material.roughness = max(.002, material.perceptualRoughness * material.perceptualRoughness);
 	material.occlusion = mask.r;
-	material.emission = Emission;
+	material.emission = MATERIAL_PARAM(i.material, Emission);
 
 	float3 eval = EvaluateLighting(material, i.worldPos.xyz, normal, view, i.worldPos.w);
 
@@ -99,12 +99,16 @@ public:
 			PROFILER_BEGIN("Poll Events");
 			for (InputDevice* d : mInputManager->mInputDevices)
 				d->NextFrame();
-			if (!mInstance->PollEvents()) {
+			if (!mInstance->PollEvents() || !mScene->mBenchmark->BeginFrame()) {
 				PROFILER_END;
 				break;
 			}
 			PROFILER_END;
 
+			PROFILER_BEGIN("Reload Assets");
+			mAssetManager->Update();
+			PROFILER_END;
+
 			PROFILER_BEGIN("Acquire Image");
 			mInstance->Window()->AcquireNextImage();
 			PROFILER_END;
@@ -112,6 +116,7 @@ public:
 			PROFILER_BEGIN("Get CommandBuffer");
 			shared_ptr<CommandBuffer> commandBuffer = mScene->Instance()->Device()->GetCommandBuffer();
 			PROFILER_END;
+			mInstance->Device()->Defragment(commandBuffer.get());
 			mScene->Update(commandBuffer.get());
 			Render(commandBuffer.get());
 			PROFILER_BEGIN("Execute CommandBuffer");
@@ -123,6 +128,8 @@ public:
 
 			mInstance->AdvanceFrame();
 
+			mScene->mBenchmark->EndFrame(commandBuffer.get());
+
 			#ifdef PROFILER_ENABLE
 			Profiler::FrameEnd();
 			#endif
@@ -130,6 +137,11 @@ public:
 
 		mInstance->Device()->Flush();
 
+		// dump memory statistics (including high-water marks) before anything is unloaded
+		for (uint32_t i = 0; i + 1 < mInstance->CommandLineArguments().size(); i++)
+			if (mInstance->CommandLineArguments()[i] == "--memory-stats")
+				mInstance->Device()->WriteMemoryStats(mInstance->CommandLineArguments()[i + 1]);
+
 		mPluginManager->UnloadPlugins();
 
 		return this;
@@ -0,0 +1,588 @@
+#include <cmath>
+#include <fstream>
+
+#include "TextureCooker.hpp"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <ThirdParty/stb_image.h>
+
+using namespace std;
+
+// KHR_DF color models and channels of the block-compressed formats
+#define KHR_DF_MODEL_BC1A 128
+#define KHR_DF_MODEL_BC3 130
+#define KHR_DF_MODEL_BC5 132
+#define KHR_DF_MODEL_BC6H 133
+#define KHR_DF_MODEL_BC7 134
+#define KHR_DF_SAMPLE_DATATYPE_FLOAT 0x80
+
+// BC6H and BC7 interpolation weights for 4 bit indices
+const uint32_t Weights4[16] { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+enum CookFormat { COOK_BC1, COOK_BC3, COOK_BC5, COOK_BC6H, COOK_BC7 };
+
+// An image with a float RGBA value per pixel, in linear space
+struct Image {
+	uint32_t mWidth;
+	uint32_t mHeight;
+	vector<float4> mPixels;
+
+	inline const float4& Get(uint32_t x, uint32_t y) const {
+		return mPixels[min(y, mHeight - 1) * mWidth + min(x, mWidth - 1)];
+	}
+};
+
+// Writes bits of a 128 bit block, least significant bit first
+struct BlockWriter {
+	uint64_t mBits[2] = { 0, 0 };
+	uint32_t mOffset = 0;
+
+	inline void Write(uint32_t value, uint32_t count) {
+		for (uint32_t i = 0; i < count; i++, mOffset++)
+			if (value & (1u << i)) mBits[mOffset / 64] |= 1ull << (mOffset % 64);
+	}
+};
+
+inline float SrgbToLinear(float c) { return c <= .04045f ? c / 12.92f : powf((c + .055f) / 1.055f, 2.4f); }
+inline float LinearToSrgb(float c) { return c <= .0031308f ? c * 12.92f : 1.055f * powf(c, 1.f / 2.4f) - .055f; }
+inline uint8_t ToUnorm8(float c) { return (uint8_t)(fminf(fmaxf(c, 0.f), 1.f) * 255.f + .5f); }
+
+inline uint16_t FloatToUnsignedHalf(float f) {
+	// BC6H_UFLOAT can't store negative values
+	if (!(f > 0.f)) return 0;
+	if (f >= 65504.f) return 0x7BFF;
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(float));
+	int32_t exponent = (int32_t)((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFF;
+	if (exponent <= 0) {
+		if (exponent < -10) return 0;
+		mantissa |= 0x800000;
+		return (uint16_t)(mantissa >> (14 - exponent));
+	}
+	return (uint16_t)min(((uint32_t)exponent << 10) + (mantissa >> 13) + ((mantissa >> 12) & 1), 0x7BFFu);
+}
+
+inline int32_t Distance(const int32_t* a, const int32_t* b, uint32_t channels) {
+	int32_t d = 0;
+	for (uint32_t c = 0; c < channels; c++)
+		d += (a[c] - b[c]) * (a[c] - b[c]);
+	return d;
+}
+
+// Chooses the endpoints along the diagonal of the bounding box that follows the direction the pixels vary in
+void BoundingBoxEndpoints(const int32_t pixels[16][4], uint32_t channels, int32_t* e0, int32_t* e1) {
+	int32_t mean[4] {};
+	for (uint32_t c = 0; c < channels; c++) {
+		e0[c] = pixels[0][c];
+		e1[c] = pixels[0][c];
+		for (uint32_t i = 0; i < 16; i++) {
+			e0[c] = min(e0[c], pixels[i][c]);
+			e1[c] = max(e1[c], pixels[i][c]);
+			mean[c] += pixels[i][c];
+		}
+		mean[c] /= 16;
+	}
+
+	uint32_t major = 0;
+	for (uint32_t c = 1; c < channels; c++)
+		if (e1[c] - e0[c] > e1[major] - e0[major]) major = c;
+
+	for (uint32_t c = 0; c < channels; c++) {
+		if (c == major) continue;
+		int32_t covariance = 0;
+		for (uint32_t i = 0; i < 16; i++)
+			covariance += (pixels[i][major] - mean[major]) * (pixels[i][c] - mean[c]);
+		if (covariance < 0) swap(e0[c], e1[c]);
+	}
+}
+
+inline uint16_t Pack565(const int32_t* c) {
+	return (uint16_t)((((c[0] * 31 + 127) / 255) << 11) | (((c[1] * 63 + 127) / 255) << 5) | ((c[2] * 31 + 127) / 255));
+}
+inline void Unpack565(uint16_t v, int32_t* c) {
+	int32_t r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+	c[0] = (r << 3) | (r >> 2);
+	c[1] = (g << 2) | (g >> 4);
+	c[2] = (b << 3) | (b >> 2);
+}
+
+// Encodes a BC1 color block. When punchThrough is set, pixels with alpha under 128 are encoded as transparent.
+void EncodeBC1(const uint8_t pixels[16][4], uint8_t* dest, bool punchThrough) {
+	int32_t color[16][4];
+	bool transparent[16];
+	bool anyTransparent = false;
+	uint32_t opaqueCount = 0;
+	for (uint32_t i = 0; i < 16; i++) {
+		transparent[i] = punchThrough && pixels[i][3] < 128;
+		anyTransparent |= transparent[i];
+	}
+	// endpoints are fit to the opaque pixels only
+	for (uint32_t i = 0; i < 16; i++) {
+		uint32_t src = i;
+		if (transparent[i]) {
+			src = 0;
+			while (src < 16 && transparent[src]) src++;
+			if (src == 16) src = i;
+		} else
+			opaqueCount++;
+		for (uint32_t c = 0; c < 3; c++) color[i][c] = transparent[src] ? 0 : pixels[src][c];
+	}
+
+	int32_t e0[4], e1[4];
+	BoundingBoxEndpoints(color, 3, e0, e1);
+	// inset the endpoints, the extremes are rarely the best fit
+	for (uint32_t c = 0; c < 3; c++) {
+		int32_t inset = (e1[c] - e0[c]) / 16;
+		e0[c] += inset;
+		e1[c] -= inset;
+	}
+
+	uint16_t c0 = Pack565(e1);
+	uint16_t c1 = Pack565(e0);
+	// c0 > c1 selects four colors, c0 <= c1 selects three colors and transparent black
+	if ((anyTransparent && c0 > c1) || (!anyTransparent && c0 < c1)) swap(c0, c1);
+
+	int32_t palette[4][4] {};
+	Unpack565(c0, palette[0]);
+	Unpack565(c1, palette[1]);
+	uint32_t paletteSize;
+	if (c0 > c1) {
+		for (uint32_t c = 0; c < 3; c++) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		paletteSize = 4;
+	} else {
+		for (uint32_t c = 0; c < 3; c++)
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+		paletteSize = 3;
+	}
+
+	uint32_t indices = 0;
+	for (uint32_t i = 0; i < 16; i++) {
+		uint32_t best = 3;
+		if (!transparent[i] && opaqueCount) {
+			best = 0;
+			for (uint32_t p = 1; p < paletteSize; p++)
+				if (Distance(color[i], palette[p], 3) < Distance(color[i], palette[best], 3)) best = p;
+		}
+		indices |= best << (2 * i);
+	}
+
+	memcpy(dest, &c0, sizeof(uint16_t));
+	memcpy(dest + 2, &c1, sizeof(uint16_t));
+	memcpy(dest + 4, &indices, sizeof(uint32_t));
+}
+
+// Encodes a single channel block, used for BC3 alpha and both channels of BC5
+void EncodeBC4(const uint8_t values[16], uint8_t* dest) {
+	int32_t mn = values[0], mx = values[0];
+	for (uint32_t i = 1; i < 16; i++) {
+		mn = min(mn, (int32_t)values[i]);
+		mx = max(mx, (int32_t)values[i]);
+	}
+
+	// a0 > a1 selects eight interpolated values
+	int32_t palette[8];
+	palette[0] = mx;
+	palette[1] = mn;
+	for (uint32_t i = 1; i < 7; i++)
+		palette[i + 1] = ((7 - i) * mx + i * mn) / 7;
+
+	uint64_t indices = 0;
+	if (mx != mn)
+		for (uint32_t i = 0; i < 16; i++) {
+			uint32_t best = 0;
+			for (uint32_t p = 1; p < 8; p++)
+				if (abs(values[i] - palette[p]) < abs(values[i] - palette[best])) best = p;
+			indices |= (uint64_t)best << (3 * i);
+		}
+
+	dest[0] = (uint8_t)mx;
+	dest[1] = (uint8_t)mn;
+	for (uint32_t i = 0; i < 6; i++)
+		dest[2 + i] = (uint8_t)(indices >> (8 * i));
+}
+
+// Encodes a BC7 block in mode 6: one subset, 7 bit RGBA endpoints with a p-bit each, and 4 bit indices
+void EncodeBC7(const uint8_t pixels[16][4], uint8_t* dest) {
+	int32_t color[16][4];
+	for (uint32_t i = 0; i < 16; i++)
+		for (uint32_t c = 0; c < 4; c++)
+			color[i][c] = pixels[i][c];
+
+	int32_t e[2][4];
+	BoundingBoxEndpoints(color, 4, e[0], e[1]);
+
+	// quantize each endpoint with the p-bit that fits it best
+	int32_t q[2][4];
+	uint32_t pbit[2];
+	int32_t palette[16][4];
+	for (uint32_t j = 0; j < 2; j++) {
+		int32_t bestError = -1;
+		for (uint32_t p = 0; p < 2; p++) {
+			int32_t qp[4], error = 0;
+			for (uint32_t c = 0; c < 4; c++) {
+				qp[c] = min(max((e[j][c] - (int32_t)p + 1) / 2, 0), 127);
+				int32_t d = ((qp[c] << 1) | (int32_t)p) - e[j][c];
+				error += d * d;
+			}
+			if (bestError < 0 || error < bestError) {
+				bestError = error;
+				pbit[j] = p;
+				memcpy(q[j], qp, sizeof(qp));
+			}
+		}
+	}
+
+	int32_t r[2][4];
+	for (uint32_t j = 0; j < 2; j++)
+		for (uint32_t c = 0; c < 4; c++)
+			r[j][c] = (q[j][c] << 1) | (int32_t)pbit[j];
+	for (uint32_t p = 0; p < 16; p++)
+		for (uint32_t c = 0; c < 4; c++)
+			palette[p][c] = ((64 - Weights4[p]) * r[0][c] + Weights4[p] * r[1][c] + 32) >> 6;
+
+	uint32_t indices[16];
+	for (uint32_t i = 0; i < 16; i++) {
+		indices[i] = 0;
+		for (uint32_t p = 1; p < 16; p++)
+			if (Distance(color[i], palette[p], 4) < Distance(color[i], palette[indices[i]], 4)) indices[i] = p;
+	}
+
+	// the first index is stored without its most significant bit, which must be 0
+	if (indices[0] & 8) {
+		swap(q[0], q[1]);
+		swap(pbit[0], pbit[1]);
+		for (uint32_t i = 0; i < 16; i++) indices[i] = 15 - indices[i];
+	}
+
+	BlockWriter block;
+	block.Write(1 << 6, 7);
+	for (uint32_t c = 0; c < 4; c++) {
+		block.Write(q[0][c], 7);
+		block.Write(q[1][c], 7);
+	}
+	block.Write(pbit[0], 1);
+	block.Write(pbit[1], 1);
+	block.Write(indices[0], 3);
+	for (uint32_t i = 1; i < 16; i++)
+		block.Write(indices[i], 4);
+	memcpy(dest, block.mBits, 16);
+}
+
+// Encodes a BC6H_UFLOAT block in mode 11: one region, 10 bit endpoints and 4 bit indices
+void EncodeBC6H(const float4 pixels[16], uint8_t* dest) {
+	// half float bits, and the same value before the decoder's final scale by 31/64
+	int32_t half[16][4];
+	int32_t scaled[16][4];
+	for (uint32_t i = 0; i < 16; i++)
+		for (uint32_t c = 0; c < 3; c++) {
+			half[i][c] = FloatToUnsignedHalf(pixels[i][c]);
+			scaled[i][c] = (half[i][c] * 64 + 30) / 31;
+		}
+
+	int32_t e[2][4];
+	BoundingBoxEndpoints(scaled, 3, e[0], e[1]);
+
+	int32_t q[2][3];
+	int32_t r[2][3];
+	for (uint32_t j = 0; j < 2; j++)
+		for (uint32_t c = 0; c < 3; c++) {
+			// the decoder expands a 10 bit endpoint q to q * 64 + 32
+			q[j][c] = min(max(e[j][c] / 64, 0), 1023);
+			if (q[j][c] == 0) r[j][c] = 0;
+			else if (q[j][c] == 1023) r[j][c] = 0xFFFF;
+			else r[j][c] = ((q[j][c] << 16) + 0x8000) >> 10;
+		}
+
+	int32_t palette[16][4];
+	for (uint32_t p = 0; p < 16; p++)
+		for (uint32_t c = 0; c < 3; c++)
+			palette[p][c] = ((((64 - Weights4[p]) * r[0][c] + Weights4[p] * r[1][c] + 32) >> 6) * 31) >> 6;
+
+	uint32_t indices[16];
+	for (uint32_t i = 0; i < 16; i++) {
+		indices[i] = 0;
+		for (uint32_t p = 1; p < 16; p++)
+			if (Distance(half[i], palette[p], 3) < Distance(half[i], palette[indices[i]], 3)) indices[i] = p;
+	}
+
+	if (indices[0] & 8) {
+		swap(q[0], q[1]);
+		for (uint32_t i = 0; i < 16; i++) indices[i] = 15 - indices[i];
+	}
+
+	BlockWriter block;
+	block.Write(0x03, 5);
+	for (uint32_t j = 0; j < 2; j++)
+		for (uint32_t c = 0; c < 3; c++)
+			block.Write(q[j][c], 10);
+	block.Write(indices[0], 3);
+	for (uint32_t i = 1; i < 16; i++)
+		block.Write(indices[i], 4);
+	memcpy(dest, block.mBits, 16);
+}
+
+void EncodeImage(const Image& image, CookFormat format, bool srgb, vector<uint8_t>& dest) {
+	uint32_t blockSize = (format == COOK_BC1) ? 8 : 16;
+	uint32_t bw = (image.mWidth + 3) / 4;
+	uint32_t bh = (image.mHeight + 3) / 4;
+	size_t offset = dest.size();
+	dest.resize(offset + (size_t)bw * bh * blockSize);
+
+	for (uint32_t by = 0; by < bh; by++)
+		for (uint32_t bx = 0; bx < bw; bx++) {
+			uint8_t* block = dest.data() + offset + ((size_t)by * bw + bx) * blockSize;
+
+			// pixels past the edge of the image repeat the last row and column
+			float4 pixels[16];
+			uint8_t ldr[16][4];
+			for (uint32_t i = 0; i < 16; i++) {
+				pixels[i] = image.Get(bx * 4 + i % 4, by * 4 + i / 4);
+				for (uint32_t c = 0; c < 4; c++)
+					ldr[i][c] = ToUnorm8(srgb && c < 3 ? LinearToSrgb(pixels[i][c]) : pixels[i][c]);
+			}
+
+			switch (format) {
+			case COOK_BC1:
+				EncodeBC1(ldr, block, true);
+				break;
+			case COOK_BC3: {
+				uint8_t alpha[16];
+				for (uint32_t i = 0; i < 16; i++) alpha[i] = ldr[i][3];
+				EncodeBC4(alpha, block);
+				EncodeBC1(ldr, block + 8, false);
+				break;
+			}
+			case COOK_BC5: {
+				uint8_t red[16], green[16];
+				for (uint32_t i = 0; i < 16; i++) {
+					red[i] = ldr[i][0];
+					green[i] = ldr[i][1];
+				}
+				EncodeBC4(red, block);
+				EncodeBC4(green, block + 8);
+				break;
+			}
+			case COOK_BC6H:
+				EncodeBC6H(pixels, block);
+				break;
+			case COOK_BC7:
+				EncodeBC7(ldr, block);
+				break;
+			}
+		}
+}
+
+// Box filters an image to half its size. Pixels are in linear space, so sRGB images are averaged correctly.
+Image Downsample(const Image& src) {
+	Image dst;
+	dst.mWidth = max(src.mWidth / 2, 1u);
+	dst.mHeight = max(src.mHeight / 2, 1u);
+	dst.mPixels.resize(dst.mWidth * dst.mHeight);
+	for (uint32_t y = 0; y < dst.mHeight; y++)
+		for (uint32_t x = 0; x < dst.mWidth; x++)
+			dst.mPixels[y * dst.mWidth + x] = (src.Get(2 * x, 2 * y) + src.Get(2 * x + 1, 2 * y) + src.Get(2 * x, 2 * y + 1) + src.Get(2 * x + 1, 2 * y + 1)) * .25f;
+	return dst;
+}
+
+bool ReadImage(const char* filename, bool srgb, Image& image) {
+	int32_t x, y, channels;
+	float* hdr = nullptr;
+	uint16_t* ldr16 = nullptr;
+	uint8_t* ldr = nullptr;
+	if (stbi_is_hdr(filename))
+		hdr = stbi_loadf(filename, &x, &y, &channels, 4);
+	else if (stbi_is_16_bit(filename))
+		ldr16 = stbi_load_16(filename, &x, &y, &channels, 4);
+	else
+		ldr = stbi_load(filename, &x, &y, &channels, 4);
+	if (!hdr && !ldr16 && !ldr) {
+		fprintf(stderr, "Failed to load image: %s\n", filename);
+		return false;
+	}
+
+	image.mWidth = x;
+	image.mHeight = y;
+	image.mPixels.resize((size_t)x * y);
+	for (size_t i = 0; i < image.mPixels.size(); i++)
+		for (uint32_t c = 0; c < 4; c++) {
+			if (hdr) image.mPixels[i][c] = hdr[4 * i + c];
+			else if (ldr16) image.mPixels[i][c] = ldr16[4 * i + c] / 65535.f;
+			else image.mPixels[i][c] = srgb && c < 3 ? SrgbToLinear(ldr[4 * i + c] / 255.f) : ldr[4 * i + c] / 255.f;
+		}
+
+	stbi_image_free(hdr ? (void*)hdr : ldr16 ? (void*)ldr16 : (void*)ldr);
+	return true;
+}
+
+// Writes a basic data format descriptor, which KTX2 requires
+void WriteDfd(CookFormat format, bool srgb, vector<uint8_t>& dest) {
+	struct Sample { uint32_t mBitOffset, mBitLength, mChannel, mLower, mUpper; };
+	vector<Sample> samples;
+	uint32_t model, blockSize;
+	switch (format) {
+	case COOK_BC1:
+		model = KHR_DF_MODEL_BC1A;
+		blockSize = 8;
+		samples.push_back({ 0, 64, 0, 0, 0xFFFFFFFF });
+		break;
+	case COOK_BC3:
+		model = KHR_DF_MODEL_BC3;
+		blockSize = 16;
+		samples.push_back({ 0, 64, 15, 0, 0xFFFFFFFF });
+		samples.push_back({ 64, 64, 0, 0, 0xFFFFFFFF });
+		break;
+	case COOK_BC5:
+		model = KHR_DF_MODEL_BC5;
+		blockSize = 16;
+		samples.push_back({ 0, 64, 0, 0, 0xFFFFFFFF });
+		samples.push_back({ 64, 64, 1, 0, 0xFFFFFFFF });
+		break;
+	case COOK_BC6H:
+		model = KHR_DF_MODEL_BC6H;
+		blockSize = 16;
+		samples.push_back({ 0, 128, KHR_DF_SAMPLE_DATATYPE_FLOAT, 0, 0x3F800000 });
+		break;
+	case COOK_BC7:
+		model = KHR_DF_MODEL_BC7;
+		blockSize = 16;
+		samples.push_back({ 0, 128, 0, 0, 0xFFFFFFFF });
+		break;
+	}
+
+	vector<uint32_t> words;
+	uint32_t blockBytes = 24 + 16 * (uint32_t)samples.size();
+	words.push_back(4 + blockBytes); // dfdTotalSize
+	words.push_back(0); // vendorId, descriptorType
+	words.push_back(2 | (blockBytes << 16)); // versionNumber, descriptorBlockSize
+	words.push_back(model | (1 << 8) | ((srgb ? 2 : 1) << 16)); // colorModel, BT709 primaries, transferFunction, flags
+	words.push_back(3 | (3 << 8)); // 4x4x1x1 texel blocks
+	words.push_back(blockSize);
+	words.push_back(0);
+	for (const Sample& s : samples) {
+		words.push_back(s.mBitOffset | ((s.mBitLength - 1) << 16) | (s.mChannel << 24));
+		words.push_back(0);
+		words.push_back(s.mLower);
+		words.push_back(s.mUpper);
+	}
+
+	size_t offset = dest.size();
+	dest.resize(offset + words.size() * sizeof(uint32_t));
+	memcpy(dest.data() + offset, words.data(), words.size() * sizeof(uint32_t));
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 4) {
+		fprintf(stderr, "Usage: %s <output.ktx2> <bc1|bc3|bc5|bc6h|bc7> [--linear] <input> [-x +y -y +z -z inputs for a cubemap, after +x]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const char* outputFile = argv[1];
+	string formatName = argv[2];
+	int arg = 3;
+	bool srgb = true;
+	if (string(argv[arg]) == "--linear") {
+		srgb = false;
+		arg++;
+	}
+
+	CookFormat format;
+	VkFormat vkFormat;
+	if (formatName == "bc1") {
+		format = COOK_BC1;
+		vkFormat = srgb ? VK_FORMAT_BC1_RGBA_SRGB_BLOCK : VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	} else if (formatName == "bc3") {
+		format = COOK_BC3;
+		vkFormat = srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+	} else if (formatName == "bc5") {
+		format = COOK_BC5;
+		vkFormat = VK_FORMAT_BC5_UNORM_BLOCK;
+		srgb = false;
+	} else if (formatName == "bc6h") {
+		format = COOK_BC6H;
+		vkFormat = VK_FORMAT_BC6H_UFLOAT_BLOCK;
+		srgb = false;
+	} else if (formatName == "bc7") {
+		format = COOK_BC7;
+		vkFormat = srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+	} else {
+		fprintf(stderr, "Unknown format %s\n", formatName.c_str());
+		return EXIT_FAILURE;
+	}
+
+	uint32_t faceCount = (uint32_t)(argc - arg);
+	if (faceCount != 1 && faceCount != 6) {
+		fprintf(stderr, "Expected 1 input, or 6 inputs for a cubemap\n");
+		return EXIT_FAILURE;
+	}
+
+	vector<Image> faces(faceCount);
+	for (uint32_t f = 0; f < faceCount; f++) {
+		if (!ReadImage(argv[arg + f], srgb, faces[f])) return EXIT_FAILURE;
+		if (faces[f].mWidth != faces[0].mWidth || faces[f].mHeight != faces[0].mHeight) {
+			fprintf(stderr, "Cubemap faces must be the same size\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	printf("Cooking %s\n", argv[arg]);
+
+	uint32_t width = faces[0].mWidth;
+	uint32_t height = faces[0].mHeight;
+	uint32_t levelCount = (uint32_t)floor(log2(max(width, height))) + 1;
+
+	// encode every level, largest first
+	vector<vector<uint8_t>> levels(levelCount);
+	for (uint32_t l = 0; l < levelCount; l++) {
+		for (uint32_t f = 0; f < faceCount; f++) {
+			if (l > 0) faces[f] = Downsample(faces[f]);
+			EncodeImage(faces[f], format, srgb, levels[l]);
+		}
+	}
+
+	Ktx2Header header = {};
+	const uint8_t identifier[12] = KTX2_IDENTIFIER;
+	memcpy(header.mIdentifier, identifier, sizeof(identifier));
+	header.mVkFormat = vkFormat;
+	header.mTypeSize = 1;
+	header.mPixelWidth = width;
+	header.mPixelHeight = height;
+	header.mPixelDepth = 0;
+	header.mLayerCount = 0;
+	header.mFaceCount = faceCount;
+	header.mLevelCount = levelCount;
+	header.mSupercompressionScheme = 0;
+
+	vector<uint8_t> file(sizeof(Ktx2Header) + sizeof(Ktx2Level) * levelCount);
+	header.mDfdByteOffset = (uint32_t)file.size();
+	WriteDfd(format, srgb, file);
+	header.mDfdByteLength = (uint32_t)file.size() - header.mDfdByteOffset;
+
+	// levels are stored smallest first, each aligned to the block size
+	vector<Ktx2Level> levelIndex(levelCount);
+	for (int32_t l = (int32_t)levelCount - 1; l >= 0; l--) {
+		file.resize(AlignUp(file.size(), 16));
+		levelIndex[l].mByteOffset = file.size();
+		levelIndex[l].mByteLength = levels[l].size();
+		levelIndex[l].mUncompressedByteLength = levels[l].size();
+		file.insert(file.end(), levels[l].begin(), levels[l].end());
+	}
+
+	memcpy(file.data(), &header, sizeof(Ktx2Header));
+	memcpy(file.data() + sizeof(Ktx2Header), levelIndex.data(), sizeof(Ktx2Level) * levelCount);
+
+	ofstream output(outputFile, ios::binary);
+	if (!output.is_open()) {
+		fprintf(stderr, "Failed to open %s\n", outputFile);
+		return EXIT_FAILURE;
+	}
+	output.write((const char*)file.data(), file.size());
+	output.close();
+
+	printf("Wrote %s: %ux%u %u levels %s\n", outputFile, width, height, levelCount, FormatToString(vkFormat));
+
+	return EXIT_SUCCESS;
+}
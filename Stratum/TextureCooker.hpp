@@ -0,0 +1,60 @@
+#pragma once
+
+#include <Util/Util.hpp>
+
+// KTX2 container layout, shared by the TextureCooker and Texture's loader
+// https://github.khronos.org/KTX-Specification/
+
+#define KTX2_IDENTIFIER { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A }
+
+struct Ktx2Header {
+	uint8_t mIdentifier[12];
+	uint32_t mVkFormat;
+	uint32_t mTypeSize;
+	uint32_t mPixelWidth;
+	uint32_t mPixelHeight;
+	uint32_t mPixelDepth;
+	uint32_t mLayerCount;
+	uint32_t mFaceCount;
+	uint32_t mLevelCount;
+	uint32_t mSupercompressionScheme;
+
+	uint32_t mDfdByteOffset;
+	uint32_t mDfdByteLength;
+	uint32_t mKvdByteOffset;
+	uint32_t mKvdByteLength;
+	uint64_t mSgdByteOffset;
+	uint64_t mSgdByteLength;
+};
+// follows the header, once per mip level
+struct Ktx2Level {
+	uint64_t mByteOffset;
+	uint64_t mByteLength;
+	uint64_t mUncompressedByteLength;
+};
+
+/// Size in bytes of a 4x4 block of a block-compressed format, 0 for other formats
+inline uint32_t BlockCompressedSize(VkFormat format) {
+	switch (format) {
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC4_SNORM_BLOCK:
+		return 8;
+	case VK_FORMAT_BC2_UNORM_BLOCK:
+	case VK_FORMAT_BC2_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC5_SNORM_BLOCK:
+	case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+	case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		return 16;
+	default:
+		return 0;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include <Util/MappedFile.hpp>
+
+#ifndef WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifdef WINDOWS
+MappedFile::MappedFile() : mData(nullptr), mSize(0), mFile(INVALID_HANDLE_VALUE), mMapping(NULL) {}
+#else
+MappedFile::MappedFile() : mData(nullptr), mSize(0), mFile(-1) {}
+#endif
+MappedFile::~MappedFile() {
+	Close();
+}
+
+bool MappedFile::Open(const string& filename) {
+	Close();
+
+	#ifdef WINDOWS
+	mFile = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (mFile == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mFile, &size) || size.QuadPart == 0) {
+		Close();
+		return false;
+	}
+	mSize = (size_t)size.QuadPart;
+	mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mMapping) mData = (const uint8_t*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+	#else
+	mFile = open(filename.c_str(), O_RDONLY);
+	if (mFile < 0) return false;
+	struct stat st;
+	if (fstat(mFile, &st) != 0 || st.st_size == 0) {
+		Close();
+		return false;
+	}
+	mSize = (size_t)st.st_size;
+	void* data = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, mFile, 0);
+	if (data != MAP_FAILED) {
+		mData = (const uint8_t*)data;
+		// the file is read front to back once
+		madvise(data, mSize, MADV_SEQUENTIAL);
+	}
+	#endif
+
+	if (!mData) {
+		Close();
+		return false;
+	}
+	return true;
+}
+void MappedFile::Close() {
+	#ifdef WINDOWS
+	if (mData) UnmapViewOfFile(mData);
+	if (mMapping) CloseHandle(mMapping);
+	if (mFile != INVALID_HANDLE_VALUE) CloseHandle(mFile);
+	mMapping = NULL;
+	mFile = INVALID_HANDLE_VALUE;
+	#else
+	if (mData) munmap((void*)mData, mSize);
+	if (mFile >= 0) close(mFile);
+	mFile = -1;
+	#endif
+	mData = nullptr;
+	mSize = 0;
+}
\ No newline at end of file
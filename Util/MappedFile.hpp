@@ -0,0 +1,28 @@
+#pragma once
+
+#include <Util/Util.hpp>
+
+/// A read-only view of a file's contents, mapped into memory
+class MappedFile {
+public:
+	ENGINE_EXPORT MappedFile();
+	ENGINE_EXPORT ~MappedFile();
+
+	/// Maps the file, returns false if it can't be opened
+	ENGINE_EXPORT bool Open(const std::string& filename);
+	ENGINE_EXPORT void Close();
+
+	inline const uint8_t* Data() const { return mData; }
+	inline size_t Size() const { return mSize; }
+
+private:
+	const uint8_t* mData;
+	size_t mSize;
+
+	#ifdef WINDOWS
+	HANDLE mFile;
+	HANDLE mMapping;
+	#else
+	int mFile;
+	#endif
+};
\ No newline at end of file
@@ -0,0 +1,208 @@
+#include <Util/MeshOptimizer.hpp>
+
+using namespace std;
+
+// Forsyth's scoring constants, as published
+#define VERTEX_CACHE_SIZE 32
+#define CACHE_DECAY_POWER 1.5f
+#define LAST_TRIANGLE_SCORE .75f
+#define VALENCE_BOOST_SCALE 2.f
+#define VALENCE_BOOST_POWER .5f
+
+inline float VertexScore(int32_t cachePosition, uint32_t remainingTriangles) {
+	if (remainingTriangles == 0) return -1.f;
+	float score = 0;
+	if (cachePosition >= 0) {
+		// the vertices of the last triangle get a fixed score, so the next triangle doesn't just reuse its edge
+		if (cachePosition < 3)
+			score = LAST_TRIANGLE_SCORE;
+		else
+			score = powf(1.f - (cachePosition - 3) / (float)(VERTEX_CACHE_SIZE - 3), CACHE_DECAY_POWER);
+	}
+	// vertices with few triangles left are finished first, so they leave the cache for good
+	return score + VALENCE_BOOST_SCALE * powf((float)remainingTriangles, -VALENCE_BOOST_POWER);
+}
+
+void MeshOptimizer::OptimizeVertexCache(uint32_t* indices, size_t indexCount, uint32_t vertexCount) {
+	uint32_t triangleCount = (uint32_t)(indexCount / 3);
+	if (triangleCount == 0) return;
+
+	// triangles that use each vertex, packed into one array. The triangles that haven't been emitted are kept at the front of each list
+	vector<uint32_t> adjacencyOffset(vertexCount + 1, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+		adjacencyOffset[indices[i] + 1]++;
+	for (uint32_t v = 0; v < vertexCount; v++)
+		adjacencyOffset[v + 1] += adjacencyOffset[v];
+	vector<uint32_t> adjacency(triangleCount * 3);
+	vector<uint32_t> remaining(vertexCount, 0);
+	for (uint32_t t = 0; t < triangleCount; t++)
+		for (uint32_t k = 0; k < 3; k++) {
+			uint32_t v = indices[3 * t + k];
+			adjacency[adjacencyOffset[v] + remaining[v]++] = t;
+		}
+
+	vector<int32_t> cachePosition(vertexCount, -1);
+	vector<float> vertexScore(vertexCount);
+	for (uint32_t v = 0; v < vertexCount; v++)
+		vertexScore[v] = VertexScore(-1, remaining[v]);
+
+	vector<float> triangleScore(triangleCount);
+	vector<bool> emitted(triangleCount, false);
+	int32_t best = 0;
+	for (uint32_t t = 0; t < triangleCount; t++) {
+		triangleScore[t] = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+		if (triangleScore[t] > triangleScore[best]) best = t;
+	}
+
+	vector<uint32_t> result;
+	result.reserve(triangleCount * 3);
+	uint32_t cache[VERTEX_CACHE_SIZE + 3];
+	uint32_t cacheSize = 0;
+	uint32_t nextTriangle = 0;
+
+	while (best >= 0) {
+		const uint32_t* triangle = indices + 3 * best;
+		emitted[best] = true;
+		result.insert(result.end(), triangle, triangle + 3);
+
+		// remove the triangle from its vertices' lists
+		for (uint32_t k = 0; k < 3; k++) {
+			uint32_t v = triangle[k];
+			uint32_t* list = adjacency.data() + adjacencyOffset[v];
+			for (uint32_t i = 0; i < remaining[v]; i++)
+				if (list[i] == (uint32_t)best) {
+					swap(list[i], list[remaining[v] - 1]);
+					remaining[v]--;
+					break;
+				}
+		}
+
+		// the triangle's vertices move to the front of the cache, and the rest of the cache moves back
+		uint32_t newCache[VERTEX_CACHE_SIZE + 3];
+		uint32_t newCacheSize = 0;
+		for (uint32_t k = 0; k < 3; k++)
+			if (find(newCache, newCache + newCacheSize, triangle[k]) == newCache + newCacheSize)
+				newCache[newCacheSize++] = triangle[k];
+		for (uint32_t i = 0; i < cacheSize; i++)
+			if (find(newCache, newCache + newCacheSize, cache[i]) == newCache + newCacheSize)
+				newCache[newCacheSize++] = cache[i];
+		for (uint32_t i = 0; i < newCacheSize; i++) {
+			uint32_t v = newCache[i];
+			cachePosition[v] = i < VERTEX_CACHE_SIZE ? (int32_t)i : -1;
+			vertexScore[v] = VertexScore(cachePosition[v], remaining[v]);
+		}
+
+		// only triangles that use a vertex whose score changed need to be scored again, and the best of them is next
+		best = -1;
+		float bestScore = -1.f;
+		for (uint32_t i = 0; i < newCacheSize; i++) {
+			uint32_t v = newCache[i];
+			const uint32_t* list = adjacency.data() + adjacencyOffset[v];
+			for (uint32_t j = 0; j < remaining[v]; j++) {
+				uint32_t t = list[j];
+				triangleScore[t] = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+				if (cachePosition[v] >= 0 && triangleScore[t] > bestScore) {
+					best = t;
+					bestScore = triangleScore[t];
+				}
+			}
+		}
+
+		cacheSize = min(newCacheSize, (uint32_t)VERTEX_CACHE_SIZE);
+		memcpy(cache, newCache, sizeof(uint32_t) * cacheSize);
+
+		// nothing in the cache has triangles left, start over at the next triangle that hasn't been emitted
+		if (best < 0) {
+			while (nextTriangle < triangleCount && emitted[nextTriangle]) nextTriangle++;
+			if (nextTriangle < triangleCount) best = nextTriangle;
+		}
+	}
+
+	memcpy(indices, result.data(), sizeof(uint32_t) * result.size());
+}
+
+void MeshOptimizer::OptimizeOverdraw(uint32_t* indices, size_t indexCount, const void* positions, size_t positionStride, uint32_t vertexCount) {
+	uint32_t triangleCount = (uint32_t)(indexCount / 3);
+	if (triangleCount == 0) return;
+	auto Position = [&](uint32_t v) { return *(const float3*)((const uint8_t*)positions + v * positionStride); };
+
+	// a new cluster starts wherever all three vertices of a triangle miss a FIFO cache, moving whole clusters keeps the cache hits within them
+	vector<uint32_t> clusterStart;
+	vector<uint32_t> cachedAt(vertexCount, 0);
+	uint32_t time = VERTEX_CACHE_SIZE + 1;
+	for (uint32_t t = 0; t < triangleCount; t++) {
+		uint32_t misses = 0;
+		for (uint32_t k = 0; k < 3; k++) {
+			uint32_t v = indices[3 * t + k];
+			if (time - cachedAt[v] > VERTEX_CACHE_SIZE) {
+				cachedAt[v] = time++;
+				misses++;
+			}
+		}
+		if (t == 0 || misses == 3) clusterStart.push_back(t);
+	}
+	clusterStart.push_back(triangleCount);
+	uint32_t clusterCount = (uint32_t)clusterStart.size() - 1;
+	if (clusterCount < 2) return;
+
+	// area weighted centroids and normals of each cluster
+	vector<float3> clusterCentroid(clusterCount);
+	vector<float3> clusterNormal(clusterCount);
+	float3 meshCentroid = 0;
+	float meshArea = 0;
+	for (uint32_t c = 0; c < clusterCount; c++) {
+		float3 centroid = 0;
+		float3 normal = 0;
+		float area = 0;
+		for (uint32_t t = clusterStart[c]; t < clusterStart[c + 1]; t++) {
+			float3 p0 = Position(indices[3 * t]);
+			float3 p1 = Position(indices[3 * t + 1]);
+			float3 p2 = Position(indices[3 * t + 2]);
+			float3 n = cross(p1 - p0, p2 - p0);
+			float a = length(n);
+			centroid += (p0 + p1 + p2) * (a / 3.f);
+			normal += n;
+			area += a;
+		}
+		meshCentroid += centroid;
+		meshArea += area;
+		clusterCentroid[c] = area > 0 ? centroid / area : Position(indices[3 * clusterStart[c]]);
+		clusterNormal[c] = normal;
+	}
+	if (meshArea > 0) meshCentroid /= meshArea;
+
+	// clusters that face away from the center are on the outside of the mesh
+	vector<float> sortKey(clusterCount);
+	vector<uint32_t> order(clusterCount);
+	for (uint32_t c = 0; c < clusterCount; c++) {
+		float l = length(clusterNormal[c]);
+		sortKey[c] = l > 0 ? dot(clusterCentroid[c] - meshCentroid, clusterNormal[c] / l) : 0;
+		order[c] = c;
+	}
+	stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKey[a] > sortKey[b]; });
+
+	vector<uint32_t> result;
+	result.reserve(triangleCount * 3);
+	for (uint32_t c : order)
+		result.insert(result.end(), indices + 3 * clusterStart[c], indices + 3 * clusterStart[c + 1]);
+	memcpy(indices, result.data(), sizeof(uint32_t) * result.size());
+}
+
+void MeshOptimizer::OptimizeVertexFetch(uint32_t* indices, size_t indexCount, uint32_t vertexCount, vector<uint32_t>& remap) {
+	remap.assign(vertexCount, ~0u);
+	uint32_t next = 0;
+	for (size_t i = 0; i < indexCount; i++) {
+		uint32_t& v = remap[indices[i]];
+		if (v == ~0u) v = next++;
+		indices[i] = v;
+	}
+	for (uint32_t& v : remap)
+		if (v == ~0u) v = next++;
+}
+
+void MeshOptimizer::RemapVertices(void* vertices, size_t stride, const vector<uint32_t>& remap) {
+	vector<uint8_t> tmp(remap.size() * stride);
+	for (size_t i = 0; i < remap.size(); i++)
+		memcpy(tmp.data() + remap[i] * stride, (const uint8_t*)vertices + i * stride, stride);
+	memcpy(vertices, tmp.data(), tmp.size());
+}
\ No newline at end of file
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <Util/Util.hpp>
+
+/// Reorders triangle lists for the GPU when meshes are imported. The optimizations are meant to be run in the order they are declared in:
+/// the vertex cache order groups triangles into clusters, the overdraw pass reorders whole clusters, and the fetch pass reorders vertices to match.
+class MeshOptimizer {
+public:
+	/// Reorders triangles so that consecutive triangles share vertices in the post-transform cache, using Forsyth's linear-speed algorithm
+	ENGINE_EXPORT static void OptimizeVertexCache(uint32_t* indices, size_t indexCount, uint32_t vertexCount);
+	/// Splits the triangles into the clusters the vertex cache order starts over at, then sorts the clusters so the ones facing away from
+	/// the center of the mesh are drawn first. They occlude the rest from most directions, without changing the cache order within a cluster.
+	ENGINE_EXPORT static void OptimizeOverdraw(uint32_t* indices, size_t indexCount, const void* positions, size_t positionStride, uint32_t vertexCount);
+	/// Numbers vertices in the order the triangles first use them, so vertex fetches walk the vertex buffer linearly, and rewrites indices to match.
+	/// remap receives the new index of each vertex, vertices that no triangle uses are moved to the end.
+	ENGINE_EXPORT static void OptimizeVertexFetch(uint32_t* indices, size_t indexCount, uint32_t vertexCount, std::vector<uint32_t>& remap);
+
+	/// Moves each element of an array of remap.size() elements of size stride to the index remap gives it
+	ENGINE_EXPORT static void RemapVertices(void* vertices, size_t stride, const std::vector<uint32_t>& remap);
+};
\ No newline at end of file
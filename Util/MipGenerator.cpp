@@ -0,0 +1,304 @@
+#include <Util/MipGenerator.hpp>
+#include <Util/ThreadPool.hpp>
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define MIP_SSE
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Kaiser windowed sinc, in units of destination pixels
+#define KAISER_RADIUS 2.f
+#define KAISER_BETA 4.f
+// rows per ThreadPool job
+#define ROWS_PER_JOB 16
+
+enum ComponentType { COMPONENT_UNORM8, COMPONENT_UNORM16, COMPONENT_FLOAT16, COMPONENT_FLOAT32 };
+
+struct PixelFormat {
+	ComponentType mType;
+	uint32_t mChannels;
+	bool mSrgb;
+};
+
+inline bool GetPixelFormat(VkFormat format, PixelFormat& f) {
+	switch (format) {
+	case VK_FORMAT_R8_UNORM:			f = { COMPONENT_UNORM8, 1, false }; return true;
+	case VK_FORMAT_R8_SRGB:				f = { COMPONENT_UNORM8, 1, true }; return true;
+	case VK_FORMAT_R8G8_UNORM:			f = { COMPONENT_UNORM8, 2, false }; return true;
+	case VK_FORMAT_R8G8_SRGB:			f = { COMPONENT_UNORM8, 2, true }; return true;
+	case VK_FORMAT_R8G8B8_UNORM:		f = { COMPONENT_UNORM8, 3, false }; return true;
+	case VK_FORMAT_R8G8B8_SRGB:			f = { COMPONENT_UNORM8, 3, true }; return true;
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_B8G8R8A8_UNORM:		f = { COMPONENT_UNORM8, 4, false }; return true;
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_B8G8R8A8_SRGB:		f = { COMPONENT_UNORM8, 4, true }; return true;
+	case VK_FORMAT_R16_UNORM:			f = { COMPONENT_UNORM16, 1, false }; return true;
+	case VK_FORMAT_R16G16_UNORM:		f = { COMPONENT_UNORM16, 2, false }; return true;
+	case VK_FORMAT_R16G16B16_UNORM:		f = { COMPONENT_UNORM16, 3, false }; return true;
+	case VK_FORMAT_R16G16B16A16_UNORM:	f = { COMPONENT_UNORM16, 4, false }; return true;
+	case VK_FORMAT_R16_SFLOAT:			f = { COMPONENT_FLOAT16, 1, false }; return true;
+	case VK_FORMAT_R16G16_SFLOAT:		f = { COMPONENT_FLOAT16, 2, false }; return true;
+	case VK_FORMAT_R16G16B16_SFLOAT:	f = { COMPONENT_FLOAT16, 3, false }; return true;
+	case VK_FORMAT_R16G16B16A16_SFLOAT:	f = { COMPONENT_FLOAT16, 4, false }; return true;
+	case VK_FORMAT_R32_SFLOAT:			f = { COMPONENT_FLOAT32, 1, false }; return true;
+	case VK_FORMAT_R32G32_SFLOAT:		f = { COMPONENT_FLOAT32, 2, false }; return true;
+	case VK_FORMAT_R32G32B32_SFLOAT:	f = { COMPONENT_FLOAT32, 3, false }; return true;
+	case VK_FORMAT_R32G32B32A32_SFLOAT:	f = { COMPONENT_FLOAT32, 4, false }; return true;
+	default: return false;
+	}
+}
+
+inline float SrgbToLinear(float c) { return c <= .04045f ? c / 12.92f : powf((c + .055f) / 1.055f, 2.4f); }
+inline float LinearToSrgb(float c) { return c <= .0031308f ? c * 12.92f : 1.055f * powf(c, 1.f / 2.4f) - .055f; }
+
+// Converts count pixels to RGBA floats, missing channels are 0 and missing alpha is 1
+inline void Decode(const uint8_t* src, const PixelFormat& format, float* dst, uint32_t count, const float* srgbTable) {
+	for (uint32_t i = 0; i < count; i++) {
+		float* px = dst + 4 * i;
+		px[0] = px[1] = px[2] = 0;
+		px[3] = 1;
+		for (uint32_t c = 0; c < format.mChannels; c++) {
+			switch (format.mType) {
+			case COMPONENT_UNORM8: {
+				uint8_t v = src[i * format.mChannels + c];
+				px[c] = (format.mSrgb && c < 3) ? srgbTable[v] : v / 255.f;
+				break;
+			}
+			case COMPONENT_UNORM16:
+				px[c] = ((const uint16_t*)src)[i * format.mChannels + c] / 65535.f;
+				break;
+			case COMPONENT_FLOAT16:
+				px[c] = HalfToFloat(((const uint16_t*)src)[i * format.mChannels + c]);
+				break;
+			case COMPONENT_FLOAT32:
+				px[c] = ((const float*)src)[i * format.mChannels + c];
+				break;
+			}
+		}
+	}
+}
+inline void Encode(const float* src, const PixelFormat& format, uint8_t* dst, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		const float* px = src + 4 * i;
+		for (uint32_t c = 0; c < format.mChannels; c++) {
+			switch (format.mType) {
+			case COMPONENT_UNORM8: {
+				float v = fminf(fmaxf(px[c], 0.f), 1.f);
+				if (format.mSrgb && c < 3) v = LinearToSrgb(v);
+				dst[i * format.mChannels + c] = (uint8_t)(v * 255.f + .5f);
+				break;
+			}
+			case COMPONENT_UNORM16:
+				((uint16_t*)dst)[i * format.mChannels + c] = (uint16_t)(fminf(fmaxf(px[c], 0.f), 1.f) * 65535.f + .5f);
+				break;
+			case COMPONENT_FLOAT16:
+				((uint16_t*)dst)[i * format.mChannels + c] = FloatToHalf(px[c]);
+				break;
+			case COMPONENT_FLOAT32:
+				((float*)dst)[i * format.mChannels + c] = px[c];
+				break;
+			}
+		}
+	}
+}
+
+// Weights of the source pixels that contribute to each destination pixel along one axis
+struct FilterTaps {
+	vector<uint32_t> mStart;
+	uint32_t mTapCount;
+	vector<float> mWeights; // mTapCount per destination pixel
+};
+
+inline float BesselI0(float x) {
+	float sum = 1, term = 1;
+	for (uint32_t k = 1; k < 16; k++) {
+		term *= (x * .5f / k) * (x * .5f / k);
+		sum += term;
+	}
+	return sum;
+}
+inline float Kaiser(float t) {
+	if (fabsf(t) >= KAISER_RADIUS) return 0;
+	float sinc = t == 0 ? 1.f : sinf(PI * t) / (PI * t);
+	float r = t / KAISER_RADIUS;
+	return sinc * BesselI0(KAISER_BETA * sqrtf(1 - r * r)) / BesselI0(KAISER_BETA);
+}
+
+inline FilterTaps ComputeTaps(uint32_t srcSize, uint32_t dstSize, MipFilter filter) {
+	FilterTaps taps;
+	float scale = (float)srcSize / (float)dstSize;
+	float support = filter == MIP_FILTER_BOX ? scale * .5f : KAISER_RADIUS * scale;
+	// the filter window can be wider than small levels, taps never reach past the source since edge pixels are replicated
+	uint32_t windowSize = (uint32_t)ceilf(support * 2) + 1;
+	taps.mTapCount = min(windowSize, srcSize);
+	taps.mStart.resize(dstSize);
+	taps.mWeights.resize(dstSize * taps.mTapCount);
+
+	for (uint32_t d = 0; d < dstSize; d++) {
+		float center = (d + .5f) * scale;
+		int32_t first = (int32_t)floorf(center - support);
+		// taps are relative to a start that keeps them all inside the source, weights past the edges go to the edge pixels
+		int32_t start = min(max(first, 0), max((int32_t)srcSize - (int32_t)taps.mTapCount, 0));
+		taps.mStart[d] = start;
+		float* w = taps.mWeights.data() + d * taps.mTapCount;
+		memset(w, 0, taps.mTapCount * sizeof(float));
+
+		float total = 0;
+		for (int32_t s = first; s <= first + (int32_t)windowSize; s++) {
+			float weight;
+			if (filter == MIP_FILTER_BOX)
+				// coverage of [s, s+1] by [center - support, center + support]
+				weight = max(0.f, min(s + 1.f, center + support) - max((float)s, center - support));
+			else
+				weight = Kaiser((s + .5f - center) / scale);
+			if (weight == 0) continue;
+			int32_t i = min(max(s, 0), (int32_t)srcSize - 1) - start;
+			if (i < 0 || i >= (int32_t)taps.mTapCount) continue;
+			w[i] += weight;
+			total += weight;
+		}
+		for (uint32_t i = 0; i < taps.mTapCount; i++)
+			w[i] /= total;
+	}
+	return taps;
+}
+
+// Filters along x: each destination pixel is a weighted sum of the source pixels in its row
+inline void FilterRow(const float* src, float* dst, uint32_t dstWidth, const FilterTaps& taps) {
+	for (uint32_t x = 0; x < dstWidth; x++) {
+		const float* s = src + 4 * taps.mStart[x];
+		const float* w = taps.mWeights.data() + x * taps.mTapCount;
+		#ifdef MIP_SSE
+		__m128 sum = _mm_setzero_ps();
+		for (uint32_t i = 0; i < taps.mTapCount; i++)
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(s + 4 * i), _mm_set1_ps(w[i])));
+		_mm_storeu_ps(dst + 4 * x, sum);
+		#else
+		float sum[4] { 0, 0, 0, 0 };
+		for (uint32_t i = 0; i < taps.mTapCount; i++)
+			for (uint32_t c = 0; c < 4; c++)
+				sum[c] += s[4 * i + c] * w[i];
+		memcpy(dst + 4 * x, sum, sizeof(sum));
+		#endif
+	}
+}
+// Filters along y or z: each destination row is a weighted sum of whole source rows, which are stride floats apart
+inline void FilterRows(const float* src, size_t stride, float* dst, size_t floatCount, const float* weights, uint32_t tapCount) {
+	size_t i = 0;
+	#ifdef __AVX__
+	for (; i + 8 <= floatCount; i += 8) {
+		__m256 sum = _mm256_setzero_ps();
+		for (uint32_t t = 0; t < tapCount; t++)
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(src + t * stride + i), _mm256_set1_ps(weights[t])));
+		_mm256_storeu_ps(dst + i, sum);
+	}
+	#endif
+	#ifdef MIP_SSE
+	for (; i + 4 <= floatCount; i += 4) {
+		__m128 sum = _mm_setzero_ps();
+		for (uint32_t t = 0; t < tapCount; t++)
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(src + t * stride + i), _mm_set1_ps(weights[t])));
+		_mm_storeu_ps(dst + i, sum);
+	}
+	#endif
+	for (; i < floatCount; i++) {
+		float sum = 0;
+		for (uint32_t t = 0; t < tapCount; t++)
+			sum += src[t * stride + i] * weights[t];
+		dst[i] = sum;
+	}
+}
+
+inline void ParallelRows(ThreadPool* threadPool, uint32_t rowCount, const function<void(uint32_t)>& row) {
+	uint32_t jobCount = (rowCount + ROWS_PER_JOB - 1) / ROWS_PER_JOB;
+	auto job = [&](uint32_t j) {
+		for (uint32_t r = j * ROWS_PER_JOB; r < min((j + 1) * ROWS_PER_JOB, rowCount); r++)
+			row(r);
+	};
+	if (threadPool)
+		threadPool->ParallelFor(jobCount, job);
+	else
+		for (uint32_t j = 0; j < jobCount; j++) job(j);
+}
+
+bool MipGenerator::Supported(VkFormat format) {
+	PixelFormat f;
+	return GetPixelFormat(format, f);
+}
+
+void MipGenerator::Generate(const void* pixels, VkFormat format, uint32_t width, uint32_t height, uint32_t depth, uint32_t layers, uint32_t mipLevels,
+	MipFilter filter, ThreadPool* threadPool, vector<uint8_t>& dest, vector<VkDeviceSize>& levelOffsets) {
+	PixelFormat pixelFormat;
+	if (!GetPixelFormat(format, pixelFormat)) {
+		fprintf_color(COLOR_RED, stderr, "MipGenerator doesn't support %s\n", FormatToString(format));
+		throw;
+	}
+	VkDeviceSize pixelSize = FormatSize(format);
+
+	float srgbTable[256];
+	for (uint32_t i = 0; i < 256; i++)
+		srgbTable[i] = SrgbToLinear(i / 255.f);
+
+	// level offsets are multiples of both the texel size and 4, as vkCmdCopyBufferToImage requires
+	auto levelSize = [&](uint32_t w, uint32_t h, uint32_t d) { return AlignUp(w * h * d * layers * pixelSize, pixelSize * 4); };
+	levelOffsets.resize(mipLevels);
+	VkDeviceSize total = 0;
+	for (uint32_t i = 0; i < mipLevels; i++) {
+		levelOffsets[i] = total;
+		total += levelSize(max(width >> i, 1u), max(height >> i, 1u), max(depth >> i, 1u));
+	}
+	dest.resize(total);
+	memcpy(dest.data(), pixels, width * height * depth * layers * pixelSize);
+
+	uint32_t w = width, h = height, d = depth;
+	vector<float> level((size_t)w * h * d * layers * 4);
+	ParallelRows(threadPool, h * d * layers, [&](uint32_t r) {
+		Decode((const uint8_t*)pixels + (size_t)r * w * pixelSize, pixelFormat, level.data() + (size_t)r * w * 4, w, srgbTable);
+	});
+
+	vector<float> tmp0, tmp1;
+	for (uint32_t i = 1; i < mipLevels; i++) {
+		uint32_t nw = max(w >> 1, 1u), nh = max(h >> 1, 1u), nd = max(d >> 1, 1u);
+
+		// x: w*h*d -> nw*h*d
+		if (nw != w) {
+			FilterTaps taps = ComputeTaps(w, nw, filter);
+			tmp0.resize((size_t)nw * h * d * layers * 4);
+			ParallelRows(threadPool, h * d * layers, [&](uint32_t r) {
+				FilterRow(level.data() + (size_t)r * w * 4, tmp0.data() + (size_t)r * nw * 4, nw, taps);
+			});
+			swap(level, tmp0);
+		}
+		// y: nw*h*d -> nw*nh*d
+		if (nh != h) {
+			FilterTaps taps = ComputeTaps(h, nh, filter);
+			tmp0.resize((size_t)nw * nh * d * layers * 4);
+			ParallelRows(threadPool, nh * d * layers, [&](uint32_t r) {
+				uint32_t y = r % nh, slice = r / nh;
+				FilterRows(level.data() + ((size_t)slice * h + taps.mStart[y]) * nw * 4, (size_t)nw * 4,
+					tmp0.data() + (size_t)r * nw * 4, (size_t)nw * 4, taps.mWeights.data() + y * taps.mTapCount, taps.mTapCount);
+			});
+			swap(level, tmp0);
+		}
+		// z: nw*nh*d -> nw*nh*nd, a slice of nw*nh pixels at a time
+		if (nd != d) {
+			FilterTaps taps = ComputeTaps(d, nd, filter);
+			tmp0.resize((size_t)nw * nh * nd * layers * 4);
+			ParallelRows(threadPool, nd * layers, [&](uint32_t r) {
+				uint32_t z = r % nd, layer = r / nd;
+				FilterRows(level.data() + ((size_t)layer * d + taps.mStart[z]) * nw * nh * 4, (size_t)nw * nh * 4,
+					tmp0.data() + (size_t)r * nw * nh * 4, (size_t)nw * nh * 4, taps.mWeights.data() + z * taps.mTapCount, taps.mTapCount);
+			});
+			swap(level, tmp0);
+		}
+
+		w = nw; h = nh; d = nd;
+		ParallelRows(threadPool, h * d * layers, [&](uint32_t r) {
+			Encode(level.data() + (size_t)r * w * 4, pixelFormat, dest.data() + levelOffsets[i] + (size_t)r * w * pixelSize, w);
+		});
+	}
+}
\ No newline at end of file
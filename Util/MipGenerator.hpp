@@ -0,0 +1,23 @@
+#pragma once
+
+#include <Util/Util.hpp>
+
+class ThreadPool;
+
+enum MipFilter {
+	MIP_FILTER_BOX,
+	MIP_FILTER_KAISER,
+};
+
+/// Generates mip chains on the CPU, for formats that vkCmdBlitImage can't filter linearly and for 3D textures, which blits don't filter correctly.
+/// Pixels are converted to float4, filtered one axis at a time with SSE/AVX, and converted back. sRGB formats are filtered in linear space.
+class MipGenerator {
+public:
+	/// Returns true if pixels of the format can be converted to and from float4
+	ENGINE_EXPORT static bool Supported(VkFormat format);
+
+	/// Generates levels [1, mipLevels) from the layers of level 0 in pixels, on threadPool if it isn't null. dest receives every level including level 0,
+	/// with the layers of each level stored one after another as VkBufferImageCopy expects, and levelOffsets receives the offset of each level in dest.
+	ENGINE_EXPORT static void Generate(const void* pixels, VkFormat format, uint32_t width, uint32_t height, uint32_t depth, uint32_t layers, uint32_t mipLevels,
+		MipFilter filter, ThreadPool* threadPool, std::vector<uint8_t>& dest, std::vector<VkDeviceSize>& levelOffsets);
+};
\ No newline at end of file
@@ -0,0 +1,89 @@
+#include <Util/ThreadPool.hpp>
+
+#include <atomic>
+
+using namespace std;
+
+ThreadPool::ThreadPool(uint32_t threadCount) : mStop(false) {
+	if (threadCount == 0) threadCount = max(thread::hardware_concurrency(), 2u) - 1;
+	for (uint32_t i = 0; i < threadCount; i++)
+		mThreads.push_back(thread(&ThreadPool::WorkerThread, this));
+}
+ThreadPool::~ThreadPool() {
+	{
+		lock_guard lock(mMutex);
+		mStop = true;
+		mJobs.clear();
+	}
+	mCondition.notify_all();
+	for (thread& t : mThreads)
+		t.join();
+}
+
+void ThreadPool::ParallelFor(uint32_t count, const function<void(uint32_t)>& job) {
+	if (count == 0) return;
+	if (count == 1 || mThreads.empty()) {
+		for (uint32_t i = 0; i < count; i++) job(i);
+		return;
+	}
+
+	// helpers that start after the loop is done find no indices left, so they only touch the shared state
+	struct Loop {
+		function<void(uint32_t)> mJob;
+		uint32_t mCount;
+		atomic<uint32_t> mNext;
+		atomic<uint32_t> mDone;
+		mutex mMutex;
+		condition_variable mCondition;
+	};
+	auto loop = make_shared<Loop>();
+	loop->mJob = job;
+	loop->mCount = count;
+	loop->mNext = 0;
+	loop->mDone = 0;
+
+	auto run = [](Loop& l) {
+		uint32_t i;
+		while ((i = l.mNext++) < l.mCount) {
+			l.mJob(i);
+			if (++l.mDone == l.mCount) {
+				lock_guard lock(l.mMutex);
+				l.mCondition.notify_all();
+			}
+		}
+	};
+
+	uint32_t helpers = min(count - 1, (uint32_t)mThreads.size());
+	for (uint32_t i = 0; i < helpers; i++)
+		Push([loop, run]() { run(*loop); });
+	run(*loop);
+
+	unique_lock lock(loop->mMutex);
+	loop->mCondition.wait(lock, [&]() { return loop->mDone == loop->mCount; });
+}
+
+uint32_t ThreadPool::QueuedJobCount() {
+	lock_guard lock(mMutex);
+	return (uint32_t)mJobs.size();
+}
+
+void ThreadPool::Push(function<void()>&& job) {
+	{
+		lock_guard lock(mMutex);
+		mJobs.push_back(move(job));
+	}
+	mCondition.notify_one();
+}
+void ThreadPool::WorkerThread() {
+	while (true) {
+		function<void()> job;
+		{
+			unique_lock lock(mMutex);
+			mCondition.wait(lock, [&]() { return mStop || mJobs.size(); });
+			if (mStop) return;
+			job = move(mJobs.front());
+			mJobs.pop_front();
+		}
+		job();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+
+#include <Util/Util.hpp>
+
+/// A fixed set of worker threads that run queued jobs in the order they were queued.
+/// Owners of jobs must wait on their futures before destroying anything the jobs reference.
+class ThreadPool {
+public:
+	/// Creates threadCount worker threads, or one less than the number of hardware threads if threadCount is 0
+	ENGINE_EXPORT ThreadPool(uint32_t threadCount = 0);
+	/// Waits for running jobs to finish. Jobs that haven't started are discarded.
+	ENGINE_EXPORT ~ThreadPool();
+
+	/// Queues a job, the returned future holds its result
+	template<typename F>
+	inline std::future<std::invoke_result_t<F>> Enqueue(F&& job) {
+		auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::forward<F>(job));
+		std::future<std::invoke_result_t<F>> result = task->get_future();
+		Push([task]() { (*task)(); });
+		return result;
+	}
+
+	/// Calls job for every index in [0, count) on the worker threads and the calling thread, and returns when all calls are done.
+	/// The calling thread takes any indices the workers haven't started, so this is safe to call from a job.
+	ENGINE_EXPORT void ParallelFor(uint32_t count, const std::function<void(uint32_t)>& job);
+
+	inline uint32_t ThreadCount() const { return (uint32_t)mThreads.size(); }
+	/// Number of jobs that haven't started yet
+	ENGINE_EXPORT uint32_t QueuedJobCount();
+
+private:
+	std::vector<std::thread> mThreads;
+	std::deque<std::function<void()>> mJobs;
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	bool mStop;
+
+	ENGINE_EXPORT void Push(std::function<void()>&& job);
+	ENGINE_EXPORT void WorkerThread();
+};
\ No newline at end of file
@@ -318,6 +318,49 @@ inline bool IsPowerOfTwo(T value) {
 	return 0 == (value & (value - 1));
 }
 
+// Conversions between float and IEEE half precision floats, which are stored as uint16_t
+inline float HalfToFloat(uint16_t h) {
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	uint32_t exponent = (h >> 10) & 0x1F;
+	uint32_t mantissa = h & 0x3FF;
+	uint32_t bits;
+	if (exponent == 0) {
+		if (mantissa == 0) bits = sign;
+		else {
+			// denormal, normalize it
+			exponent = 127 - 15 + 1;
+			while ((mantissa & 0x400) == 0) {
+				mantissa <<= 1;
+				exponent--;
+			}
+			bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+		}
+	} else if (exponent == 0x1F)
+		bits = sign | 0x7F800000 | (mantissa << 13);
+	else
+		bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+	float f;
+	memcpy(&f, &bits, sizeof(float));
+	return f;
+}
+inline uint16_t FloatToHalf(float f) {
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(float));
+	uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+	uint32_t mantissa = bits & 0x7FFFFF;
+	int32_t exponent = (int32_t)((bits >> 23) & 0xFF);
+	if (exponent == 0xFF) return sign | 0x7C00 | (mantissa ? 0x200 : 0);
+	exponent += 15 - 127;
+	if (exponent >= 0x1F) return sign | 0x7C00;
+	if (exponent <= 0) {
+		if (exponent < -10) return sign;
+		mantissa |= 0x800000;
+		return sign | (uint16_t)(mantissa >> (14 - exponent));
+	}
+	// rounding may carry into the exponent, which is still correct
+	return sign | (uint16_t)(((uint32_t)exponent << 10) + (mantissa >> 13) + ((mantissa >> 12) & 1));
+}
+
 
 // Defines a vertex input. Hashes itself once at creation, then remains immutable.
 // Note: Meshes store a pointer to one of these, but do not handle creation/deletion.
@@ -409,6 +452,18 @@ inline bool ReadFile(const std::string& filename, std::vector<uint8_t>& dest) {
 
 	return true;
 }
+/// Directory of the running executable. Files the engine caches are kept next to it, so they don't depend on the working directory.
+inline fs::path ExecutableDirectory() {
+	#ifdef WINDOWS
+	char path[MAX_PATH];
+	if (GetModuleFileNameA(NULL, path, MAX_PATH)) return fs::path(path).parent_path();
+	#else
+	std::error_code err;
+	fs::path path = fs::read_symlink("/proc/self/exe", err);
+	if (!err) return path.parent_path();
+	#endif
+	return fs::current_path();
+}
 
 inline void ThrowIfFailed(VkResult result, const std::string& message){
 	if (result != VK_SUCCESS){